@@ -0,0 +1,51 @@
+#ifndef ATLAS_PACKER_H
+#define ATLAS_PACKER_H
+
+#include <cstddef>
+#include <vector>
+
+// Where an image landed: its pixels, without the gutter, in one layer
+struct AtlasRect {
+  int x, y;
+  int width, height;
+  int layer;
+};
+
+// Skyline bottom-left rectangle packer over a stack of equally sized layers,
+// for building texture arrays. Each image is surrounded by a gutter and its
+// cell is rounded up to a multiple of the gutter, so with a power of two
+// gutter every texel of mip levels up to log2(gutter) belongs to one image
+// and its edge-extended border.
+class AtlasPacker {
+public:
+  // width and height should be multiples of gutter
+  AtlasPacker(int width, int height, int gutter = 0, int maxLayers = 1);
+
+  // Place an image in the first layer with room, starting a new layer when
+  // none has any. False when it is larger than a layer or the layers ran out.
+  bool insert(int width, int height, AtlasRect &rect);
+
+  int layers() const { return (int)skylines.size(); }
+  // Image pixels over the pixels of every layer in use, 0 to 1
+  double efficiency() const;
+
+private:
+  // Top edge of the packed area over [x, x + width)
+  struct Segment {
+    int x, y, width;
+  };
+
+  int width, height;
+  int gutter, align;
+  int maxLayers;
+  std::vector<std::vector<Segment>> skylines;
+  double used = 0.0;
+
+  // Lowest y a cell can sit at starting on segment index, -1 when it does
+  // not fit there
+  int fit(const std::vector<Segment> &skyline, size_t index, int cellWidth,
+          int cellHeight) const;
+  bool place(int layer, int cellWidth, int cellHeight, AtlasRect &rect);
+};
+
+#endif
@@ -0,0 +1,39 @@
+#ifndef BLOCK_COMPRESS_H
+#define BLOCK_COMPRESS_H
+
+#include <cstddef>
+
+// BC1 and BC3 (DXT1 and DXT5) encoding of 8-bit images on the CPU, for
+// uploading with glCompressedTexImage2D. Every 4x4 pixel block becomes 8
+// (BC1) or 16 (BC3) bytes, edge blocks repeat the last row and column.
+enum BlockFormat {
+  BLOCK_BC1, // RGB, alpha ignored
+  BLOCK_BC3  // RGB plus a separately coded alpha
+};
+
+enum BlockQuality {
+  BLOCK_FAST, // Bounding box endpoints
+  BLOCK_HIGH  // Principal axis endpoints refined by least squares
+};
+
+// BC1 for 1 to 3 channels, BC3 when there is alpha
+BlockFormat blockFormatFor(int channels);
+size_t blockBytes(BlockFormat format); // Per 4x4 block
+size_t blockCompressedBytes(int width, int height, BlockFormat format);
+
+// Encode block rows [firstRow, lastRow) of an image with 1 to 4 channels.
+// out points at the whole compressed image; separate ranges can be encoded
+// on separate threads.
+void compressBlockRows(const unsigned char *pixels, int width, int height,
+                       int channels, BlockFormat format, BlockQuality quality,
+                       int firstRow, int lastRow, unsigned char *out);
+void compressBlocks(const unsigned char *pixels, int width, int height,
+                    int channels, BlockFormat format, BlockQuality quality,
+                    unsigned char *out);
+
+// Decode back to RGBA, for measuring quality and as a fallback on drivers
+// without S3TC
+void decompressBlocks(const unsigned char *blocks, int width, int height,
+                      BlockFormat format, unsigned char *rgba);
+
+#endif
@@ -0,0 +1,201 @@
+#ifndef GL_HANDLE_H
+#define GL_HANDLE_H
+
+#include "./glad/glad.h"
+
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+// Creation and deletion functions for each kind of GL object. Every traits
+// type works on arrays so handles can be generated and deleted in batches.
+struct GLBufferTraits {
+  static void create(GLsizei n, GLuint *ids) { glGenBuffers(n, ids); }
+  static void destroy(GLsizei n, const GLuint *ids) { glDeleteBuffers(n, ids); }
+};
+
+struct GLVertexArrayTraits {
+  static void create(GLsizei n, GLuint *ids) { glGenVertexArrays(n, ids); }
+  static void destroy(GLsizei n, const GLuint *ids) {
+    glDeleteVertexArrays(n, ids);
+  }
+};
+
+struct GLTextureTraits {
+  static void create(GLsizei n, GLuint *ids) { glGenTextures(n, ids); }
+  static void destroy(GLsizei n, const GLuint *ids) {
+    glDeleteTextures(n, ids);
+  }
+};
+
+struct GLFramebufferTraits {
+  static void create(GLsizei n, GLuint *ids) { glGenFramebuffers(n, ids); }
+  static void destroy(GLsizei n, const GLuint *ids) {
+    glDeleteFramebuffers(n, ids);
+  }
+};
+
+struct GLRenderbufferTraits {
+  static void create(GLsizei n, GLuint *ids) { glGenRenderbuffers(n, ids); }
+  static void destroy(GLsizei n, const GLuint *ids) {
+    glDeleteRenderbuffers(n, ids);
+  }
+};
+
+struct GLQueryTraits {
+  static void create(GLsizei n, GLuint *ids) { glGenQueries(n, ids); }
+  static void destroy(GLsizei n, const GLuint *ids) { glDeleteQueries(n, ids); }
+};
+
+// Programs have no batched entry points
+struct GLProgramTraits {
+  static void create(GLsizei n, GLuint *ids) {
+    for (GLsizei i = 0; i < n; i++)
+      ids[i] = glCreateProgram();
+  }
+  static void destroy(GLsizei n, const GLuint *ids) {
+    for (GLsizei i = 0; i < n; i++)
+      glDeleteProgram(ids[i]);
+  }
+};
+
+// Owns a single GL object name. Move-only and exactly the size of a GLuint,
+// it converts implicitly so it can be passed straight to GL calls.
+template <class Traits> class GLHandle {
+public:
+  GLHandle() noexcept : id(0) {}
+  // Take ownership of an existing object
+  explicit GLHandle(GLuint id) noexcept : id(id) {}
+  ~GLHandle() { reset(); }
+
+  GLHandle(const GLHandle &) = delete;
+  GLHandle &operator=(const GLHandle &) = delete;
+  GLHandle(GLHandle &&other) noexcept : id(other.release()) {}
+  GLHandle &operator=(GLHandle &&other) noexcept {
+    if (this != &other)
+      reset(other.release());
+    return *this;
+  }
+
+  static GLHandle create() {
+    GLuint id = 0;
+    Traits::create(1, &id);
+    return GLHandle(id);
+  }
+
+  GLuint get() const noexcept { return id; }
+  operator GLuint() const noexcept { return id; }
+  explicit operator bool() const noexcept { return id != 0; }
+
+  // Give up ownership without deleting the object
+  GLuint release() noexcept {
+    GLuint old = id;
+    id = 0;
+    return old;
+  }
+  // Delete the current object, optionally adopting another
+  void reset(GLuint newId = 0) noexcept {
+    if (id != 0)
+      Traits::destroy(1, &id);
+    id = newId;
+  }
+
+private:
+  GLuint id;
+};
+
+// A fixed number of objects created and deleted with one call each
+template <class Traits, size_t N> class GLHandleArray {
+public:
+  GLHandleArray() noexcept : ids() {}
+  ~GLHandleArray() { reset(); }
+
+  GLHandleArray(const GLHandleArray &) = delete;
+  GLHandleArray &operator=(const GLHandleArray &) = delete;
+  GLHandleArray(GLHandleArray &&other) noexcept : ids() { swap(other); }
+  GLHandleArray &operator=(GLHandleArray &&other) noexcept {
+    if (this != &other) {
+      reset();
+      swap(other);
+    }
+    return *this;
+  }
+
+  static GLHandleArray create() {
+    GLHandleArray handles;
+    Traits::create((GLsizei)N, handles.ids);
+    return handles;
+  }
+
+  GLuint operator[](size_t i) const noexcept { return ids[i]; }
+  const GLuint *data() const noexcept { return ids; }
+  static constexpr size_t size() noexcept { return N; }
+
+  void reset() noexcept {
+    if (ids[0] != 0)
+      Traits::destroy((GLsizei)N, ids);
+    for (size_t i = 0; i < N; i++)
+      ids[i] = 0;
+  }
+
+private:
+  GLuint ids[N];
+
+  void swap(GLHandleArray &other) noexcept {
+    for (size_t i = 0; i < N; i++) {
+      GLuint id = ids[i];
+      ids[i] = other.ids[i];
+      other.ids[i] = id;
+    }
+  }
+};
+
+// Same as GLHandleArray with the count chosen at runtime
+template <class Traits> class GLHandleList {
+public:
+  GLHandleList() = default;
+  explicit GLHandleList(size_t count) : ids(count, 0) {
+    if (count > 0)
+      Traits::create((GLsizei)count, ids.data());
+  }
+  ~GLHandleList() { reset(); }
+
+  GLHandleList(const GLHandleList &) = delete;
+  GLHandleList &operator=(const GLHandleList &) = delete;
+  GLHandleList(GLHandleList &&other) noexcept : ids(std::move(other.ids)) {
+    other.ids.clear();
+  }
+  GLHandleList &operator=(GLHandleList &&other) noexcept {
+    if (this != &other) {
+      reset();
+      ids.swap(other.ids);
+    }
+    return *this;
+  }
+
+  GLuint operator[](size_t i) const noexcept { return ids[i]; }
+  const GLuint *data() const noexcept { return ids.data(); }
+  size_t size() const noexcept { return ids.size(); }
+
+  void reset() noexcept {
+    if (!ids.empty())
+      Traits::destroy((GLsizei)ids.size(), ids.data());
+    ids.clear();
+  }
+
+private:
+  std::vector<GLuint> ids;
+};
+
+typedef GLHandle<GLBufferTraits> GLBuffer;
+typedef GLHandle<GLVertexArrayTraits> GLVertexArray;
+typedef GLHandle<GLTextureTraits> GLTexture;
+typedef GLHandle<GLFramebufferTraits> GLFramebuffer;
+typedef GLHandle<GLRenderbufferTraits> GLRenderbuffer;
+typedef GLHandle<GLQueryTraits> GLQuery;
+typedef GLHandle<GLProgramTraits> GLProgram;
+
+static_assert(sizeof(GLBuffer) == sizeof(GLuint),
+              "GL handles must stay a bare GLuint");
+
+#endif
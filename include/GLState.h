@@ -0,0 +1,99 @@
+#ifndef GL_STATE_H
+#define GL_STATE_H
+
+#include "./glad/glad.h"
+
+// Shadows the bits of GL state the renderer touches and drops calls that
+// would not change anything. Only correct while every change to that state
+// goes through the cache; call invalidate() after code that bypasses it.
+class GLStateCache {
+public:
+  // Number of texture units and uniform buffer binding points tracked
+  static const int MAX_TEXTURE_UNITS = 16;
+  static const int MAX_UNIFORM_BINDINGS = 16;
+
+  GLStateCache() { invalidate(); }
+
+  // Forget everything, the next call of each kind always reaches GL
+  void invalidate();
+
+  void useProgram(GLuint program);
+  void bindVertexArray(GLuint vao);
+  // Bind to GL_ARRAY_BUFFER, GL_UNIFORM_BUFFER, GL_PIXEL_UNPACK_BUFFER, ...
+  // The element array binding belongs to the VAO and is not cached.
+  void bindBuffer(GLenum target, GLuint buffer);
+  // Indexed binding, also moves the generic binding of target like GL does.
+  // Only GL_UNIFORM_BUFFER binding points are filtered.
+  void bindBufferRange(GLenum target, GLuint index, GLuint buffer,
+                       GLintptr offset, GLsizeiptr size);
+  // Selects the unit and binds in one go, both filtered separately
+  void bindTexture(int unit, GLenum target, GLuint texture);
+  void enable(GLenum capability, bool on);
+  void blendFunc(GLenum src, GLenum dst);
+  void depthFunc(GLenum func);
+  void polygonMode(GLenum mode);
+  void viewport(GLint x, GLint y, GLsizei width, GLsizei height);
+
+  // Call when an object is deleted so a recycled name is not filtered
+  void forgetProgram(GLuint program);
+  void forgetVertexArray(GLuint vao);
+  void forgetBuffer(GLuint buffer);
+  void forgetTexture(GLuint texture);
+
+  // Calls that reached GL and calls that were dropped
+  unsigned long issued = 0;
+  unsigned long filtered = 0;
+  void resetCounters() { issued = filtered = 0; }
+
+private:
+  enum BufferSlot {
+    ARRAY_BUFFER,
+    UNIFORM_BUFFER,
+    PIXEL_UNPACK_BUFFER,
+    PIXEL_PACK_BUFFER,
+    COPY_READ_BUFFER,
+    COPY_WRITE_BUFFER,
+    BUFFER_SLOTS
+  };
+  enum TextureSlot {
+    TEXTURE_2D,
+    TEXTURE_2D_ARRAY,
+    TEXTURE_CUBE_MAP,
+    TEXTURE_TARGETS
+  };
+  enum Capability { BLEND, DEPTH_TEST, CULL_FACE, SCISSOR_TEST, CAPABILITIES };
+
+  // Bound names use this value until first set, it never matches a real one
+  static const GLuint UNKNOWN = 0xFFFFFFFFu;
+
+  GLuint program;
+  GLuint vertexArray;
+  GLuint buffers[BUFFER_SLOTS];
+  struct BufferRange {
+    GLuint buffer;
+    GLintptr offset;
+    GLsizeiptr size;
+  };
+  BufferRange uniformRanges[MAX_UNIFORM_BINDINGS];
+  int activeUnit;
+  GLuint textures[MAX_TEXTURE_UNITS][TEXTURE_TARGETS];
+  int capabilities[CAPABILITIES];
+  GLenum blendSrc, blendDst;
+  GLenum depth;
+  GLenum polygon;
+  GLint view[4];
+
+  // Slots return -1 for values that are not tracked, those always reach GL
+  static int bufferSlot(GLenum target);
+  static int textureSlot(GLenum target);
+  static int capabilitySlot(GLenum capability);
+  bool changed(bool different) {
+    if (different)
+      issued++;
+    else
+      filtered++;
+    return different;
+  }
+};
+
+#endif
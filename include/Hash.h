@@ -0,0 +1,23 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include <cstddef>
+#include <cstdint>
+
+// FNV-1a hash of a null terminated string. constexpr so names like
+// uniform identifiers can be hashed at compile time.
+constexpr uint32_t fnv1a32(const char *str, uint32_t hash = 2166136261u) {
+  return *str ? fnv1a32(str + 1, (hash ^ (uint8_t)*str) * 16777619u) : hash;
+}
+
+// 64-bit FNV-1a over a block of bytes, chain calls by passing the previous
+// result as the seed.
+inline uint64_t fnv1a64(const void *data, size_t size,
+                        uint64_t hash = 14695981039346656037ull) {
+  const unsigned char *bytes = (const unsigned char *)data;
+  for (size_t i = 0; i < size; i++)
+    hash = (hash ^ bytes[i]) * 1099511628211ull;
+  return hash;
+}
+
+#endif
@@ -0,0 +1,58 @@
+#ifndef IMAGE_SCAN_H
+#define IMAGE_SCAN_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class ThreadPool;
+
+// Header only scan of image files, for sizing texture arrays and atlases
+// before anything is decoded. Each file costs one open and one read of its
+// first IMAGE_SCAN_PREFIX bytes; JPEG and PNG headers pushed further back by
+// metadata take one more read per window they are in. JPEG, PNG, GIF, HDR
+// and .htex headers are parsed here, the other formats stb_image reads go
+// through stbi_info on the prefix. What is reported matches stbi_info.
+
+const size_t IMAGE_SCAN_PREFIX = 4096;
+
+enum ImageScanFormat {
+  IMAGE_UNKNOWN = 0, // Not an image stb_image or TextureFile reads
+  IMAGE_JPEG = 1,
+  IMAGE_PNG = 2,
+  IMAGE_GIF = 3,
+  IMAGE_HDR = 4,
+  IMAGE_HTEX = 5,
+  IMAGE_OTHER = 6 // BMP, TGA, PSD, PIC or PNM
+};
+
+struct ImageHeader {
+  uint32_t width;
+  uint32_t height;
+  uint8_t channels; // As stbi_info reports them
+  uint8_t bits;     // Per channel in the file: 8, 16, or 32 for HDR floats
+  uint8_t format;   // ImageScanFormat
+  uint8_t padding;
+};
+
+static_assert(sizeof(ImageHeader) == 12, "headers are packed in manifests");
+
+// Every regular file under a directory, sorted by path, with the header of
+// each. Files that are not images keep a zeroed header.
+struct ImageManifest {
+  std::vector<std::string> paths;
+  std::vector<ImageHeader> headers;
+
+  size_t images() const;
+};
+
+// Fill header from the file at path, false if it is not an image
+bool scanImageHeader(const char *path, ImageHeader &header);
+
+// Scan every file under directory, recursing into subdirectories. Files are
+// read on pool in batches when one is given.
+ImageManifest scanImageDirectory(const char *directory,
+                                 ThreadPool *pool = nullptr);
+
+#endif
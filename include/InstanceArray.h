@@ -0,0 +1,31 @@
+#ifndef INSTANCE_ARRAY_H
+#define INSTANCE_ARRAY_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// CPU side state of many instanced quads, kept as a structure of arrays so
+// the per-frame update runs four instances per SIMD instruction.
+class InstanceArray {
+public:
+  // Floats written per instance: x, y, angle, scale
+  static const int STRIDE = 4;
+
+  // Reset to count instances scattered over clip space
+  void resize(size_t count, uint32_t seed = 1);
+  size_t size() const { return x.size(); }
+
+  // Advance every rotation by dt seconds and write STRIDE floats per instance
+  // to out, which is usually a mapped vertex buffer
+  void rebuild(float dt, float *out);
+
+private:
+  std::vector<float> x;
+  std::vector<float> y;
+  std::vector<float> angle;
+  std::vector<float> spin;
+  std::vector<float> scale;
+};
+
+#endif
@@ -0,0 +1,27 @@
+#ifndef MIP_CHAIN_H
+#define MIP_CHAIN_H
+
+#include <cstddef>
+
+// Mip chains of 8-bit images, built on the CPU so textures can be uploaded
+// complete instead of calling glGenerateMipmap. A chain is every level from
+// 0 down to 1x1, tightly packed one after the other with unpadded rows.
+
+// Levels in a full chain for a width x height base level
+int mipLevelCount(int width, int height);
+// Size of one level, levels halve and round down but never go below 1
+int mipWidth(int width, int level);
+// Bytes of the first levels of a chain
+size_t mipChainBytes(int width, int height, int channels, int levels);
+
+// 2x2 box filter of src into dst, which is mipWidth(width, 1) by
+// mipWidth(height, 1). The last row or column of an odd sized level is
+// dropped, as most drivers do.
+void downsampleBox(const unsigned char *src, int width, int height,
+                   int channels, unsigned char *dst);
+
+// Fill levels 1 to levels - 1 of a chain whose level 0 is already in place
+void buildMipChain(unsigned char *chain, int width, int height, int channels,
+                   int levels);
+
+#endif
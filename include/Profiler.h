@@ -0,0 +1,137 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include "./glad/glad.h"
+#include "./GLHandle.h"
+
+#include <cstdint>
+#include <map>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Frame profiler with nestable CPU scopes and GPU timestamp scopes.
+//
+// CPU scopes can be opened on any thread. Each thread writes finished scopes
+// into its own ring buffer with no locks; endFrame() drains the rings.
+// GPU scopes bracket GL work with glQueryCounter(GL_TIMESTAMP) and are read
+// back a few frames later, so reading results never stalls the pipeline.
+//
+//   { PROFILE_SCOPE("update"); ... }
+//   { GpuProfileScope gpu(profiler, "draw"); glDraw...; }
+//   profiler.endFrame();
+//
+// Scope names must be string literals, only the pointer is stored.
+class Profiler {
+public:
+  // Samples kept per scope for the rolling statistics
+  static const int WINDOW = 240;
+  // Frames a GPU query set waits before it is read back
+  static const int GPU_FRAMES = 4;
+  // GPU scopes per frame, later ones are dropped
+  static const int MAX_GPU_SCOPES = 64;
+
+  // CPU scopes are recorded on every thread while enabled
+  static void setEnabled(bool on);
+  static bool enabled();
+  static void beginCpu(const char *name);
+  static void endCpu();
+
+  // GPU scopes need a current GL context; call from the GL thread only.
+  // Without initGpu() they cost nothing.
+  void initGpu();
+  int beginGpu(const char *name);
+  void endGpu(int scope);
+
+  // Drain CPU rings and the oldest GPU query set, then start the next frame.
+  // A GPU set that is still not finished after GPU_FRAMES is dropped.
+  void endFrame();
+  // Wait for every outstanding GPU query, for the end of a run
+  void drain();
+  // Keep every event for writeTrace, off by default
+  void setTracing(bool on) { tracing = on; }
+
+  // min/avg/p99 per scope over the rolling window
+  void report(std::ostream &out) const;
+  // Chrome trace event JSON, load in chrome://tracing or Perfetto
+  bool writeTrace(const char *path) const;
+
+  // GPU query sets dropped because they were not finished in time
+  unsigned int gpuDropped = 0;
+
+private:
+  struct Window {
+    double samples[WINDOW];
+    int count = 0;
+    int next = 0;
+    void add(double ms);
+  };
+  struct TraceEvent {
+    const char *name;
+    int64_t start; // ns on the CPU clock
+    int64_t duration;
+    int thread; // -1 for the GPU
+  };
+  struct GpuFrame {
+    const char *names[MAX_GPU_SCOPES];
+    int count = 0;
+  };
+
+  std::map<std::string, Window> stats;
+  std::vector<TraceEvent> trace;
+  bool tracing = false;
+
+  GLHandleList<GLQueryTraits> queries;
+  GpuFrame gpuFrames[GPU_FRAMES];
+  int gpuFrame = 0;
+  bool gpuEnabled = false;
+  // GPU timestamp minus CPU clock, to place GPU events on the CPU timeline
+  int64_t gpuOffset = 0;
+
+  void collectCpu();
+  void collectGpu(int frame, bool wait);
+  GLuint query(int frame, int scope, int end) const {
+    return queries[(frame * MAX_GPU_SCOPES + scope) * 2 + end];
+  }
+  void record(const char *kind, const char *name, int64_t start,
+              int64_t duration, int thread);
+};
+
+// Times the enclosing block on the calling thread
+class ProfileScope {
+public:
+  explicit ProfileScope(const char *name) : active(Profiler::enabled()) {
+    if (active)
+      Profiler::beginCpu(name);
+  }
+  ~ProfileScope() {
+    if (active)
+      Profiler::endCpu();
+  }
+  ProfileScope(const ProfileScope &) = delete;
+  ProfileScope &operator=(const ProfileScope &) = delete;
+
+private:
+  bool active;
+};
+
+// Times the GL commands issued in the enclosing block
+class GpuProfileScope {
+public:
+  GpuProfileScope(Profiler &profiler, const char *name)
+      : profiler(profiler), scope(profiler.beginGpu(name)) {}
+  ~GpuProfileScope() { profiler.endGpu(scope); }
+  GpuProfileScope(const GpuProfileScope &) = delete;
+  GpuProfileScope &operator=(const GpuProfileScope &) = delete;
+
+private:
+  Profiler &profiler;
+  int scope;
+};
+
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+#define PROFILE_SCOPE(name)                                                    \
+  ProfileScope PROFILE_CONCAT(profileScope, __LINE__)(name)
+
+#endif
@@ -0,0 +1,40 @@
+#ifndef PROGRAM_CACHE_H
+#define PROGRAM_CACHE_H
+
+#include "./glad/glad.h"
+
+#include <cstdint>
+#include <string>
+
+// On-disk cache of linked program binaries (GL_ARB_get_program_binary).
+// Entries are keyed by the shader sources, the defines they were built with
+// and the driver vendor/renderer/version, so a driver update never picks up
+// a stale binary. Needs a current GL context to construct.
+class ProgramCache {
+public:
+  explicit ProgramCache(const std::string &directory);
+
+  // False when the driver exposes no binary formats; load/store are no-ops
+  bool enabled() const { return supported; }
+  uint64_t key(const std::string &vertexCode, const std::string &fragmentCode,
+               const std::string &defines) const;
+  // Load a cached binary into program. Returns false if there is no entry or
+  // the driver rejected it, in which case the caller compiles from source.
+  bool load(uint64_t key, unsigned int program);
+  // Save the binary of a successfully linked program
+  void store(uint64_t key, unsigned int program);
+
+  // Statistics since construction
+  unsigned int hits = 0;
+  unsigned int misses = 0;
+  unsigned int rejected = 0;
+
+private:
+  std::string directory;
+  uint64_t driverHash = 0;
+  bool supported = false;
+
+  std::string pathFor(uint64_t key) const;
+};
+
+#endif
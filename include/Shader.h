@@ -2,25 +2,84 @@
 #define SHADER_H
 
 #include "./glad/glad.h"
+#include "./GLHandle.h"
+#include "./Hash.h"
+#include "./glm/glm.hpp"
 
 #include <fstream>
 #include <iostream>
 #include <sstream>
 #include <string>
+#include <vector>
+
+class GLStateCache;
+class ProgramCache;
 
 class Shader {
 public:
-  // The program ID
-  unsigned int ID;
+  // The program ID, deleted with the Shader. Shaders can be moved but not
+  // copied.
+  GLProgram ID;
+  // A resolved uniform location, -1 if the uniform is not active
+  typedef int Uniform;
 
-  // Constructor reads and builds the shader
-  Shader(const char *vertexPath, const char *fragmentPath);
+  // Constructor reads and builds the shader. defines are inserted after the
+  // #version line of both stages; with a cache the linked binary is reused
+  // across runs instead of compiling from source.
+  Shader(const char *vertexPath, const char *fragmentPath,
+         const std::string &defines = "", ProgramCache *cache = nullptr);
+  // Adopt an already linked program, e.g. one built by a ShaderBatch
+  explicit Shader(unsigned int program);
   // use / activate the shader
   void use();
+  void use(GLStateCache &state);
+  // Resolve a uniform from the table built at link time. Never calls into GL,
+  // so it is safe to use on the hot path, but prefer resolving once up front.
+  // Names whose hashes collide are reported at link time; the hash overload
+  // returns the first of them, the name overload tells them apart.
+  Uniform uniform(uint32_t nameHash) const;
+  Uniform uniform(const std::string &name) const;
+  // Index of a named uniform block, GL_INVALID_INDEX if it is not active
+  GLuint uniformBlock(uint32_t nameHash) const;
+  GLuint uniformBlock(const std::string &name) const;
+  // Point a uniform block at a GL_UNIFORM_BUFFER binding point
+  void bindUniformBlock(uint32_t nameHash, GLuint binding) const;
+  void bindUniformBlock(const std::string &name, GLuint binding) const;
   // Utility uniform functions
   void setBool(const std::string &name, bool value) const;
   void setInt(const std::string &name, int value) const;
   void setFloat(const std::string &name, float value) const;
+  void setMat4(const std::string &name, const glm::mat4 &value) const;
+  void setBool(Uniform location, bool value) const;
+  void setInt(Uniform location, int value) const;
+  void setFloat(Uniform location, float value) const;
+  void setMat4(Uniform location, const glm::mat4 &value) const;
+
+  // Building blocks shared with ShaderBatch. compileStage only submits the
+  // compile, the status is not queried until checkStage.
+  static std::string readSource(const char *path, const std::string &defines);
+  static unsigned int compileStage(GLenum type, const std::string &source);
+  static bool checkStage(unsigned int shader, const char *stage);
+  static bool checkProgram(unsigned int program);
+
+private:
+  // Open addressed hash table of active uniforms, keyed by fnv1a32(name)
+  struct UniformSlot {
+    uint32_t hash;
+    Uniform location;
+    std::string name;
+  };
+  std::vector<UniformSlot> uniforms;
+  // Active uniform blocks, few enough to search linearly
+  struct BlockSlot {
+    uint32_t hash;
+    GLuint index;
+  };
+  std::vector<BlockSlot> blocks;
+
+  // Query every active uniform and uniform block once after linking
+  void reflectUniforms();
+  void addUniform(const std::string &name, Uniform location);
 };
 
 #endif
@@ -0,0 +1,65 @@
+#ifndef SHADER_BATCH_H
+#define SHADER_BATCH_H
+
+#include "./Shader.h"
+
+#include <string>
+#include <vector>
+
+class ProgramCache;
+class ShaderBatch;
+
+// Handle to a program that is still being built by a ShaderBatch
+class ShaderFuture {
+public:
+  // True once compiling and linking has finished. Never blocks when the
+  // driver supports GL_KHR_parallel_shader_compile, otherwise reports true.
+  bool ready() const;
+  // Wait for the program, report any errors and hand it over. Later calls
+  // report an error and return Shader(0).
+  Shader get();
+
+private:
+  friend class ShaderBatch;
+  ShaderFuture(ShaderBatch *batch, size_t index)
+      : batch(batch), index(index) {}
+
+  ShaderBatch *batch;
+  size_t index;
+};
+
+// Builds many programs at once. All compiles and links are issued up front
+// and statuses are only queried when a program is collected, so drivers with
+// threaded compilers can overlap the work. The batch must outlive its futures.
+class ShaderBatch {
+public:
+  explicit ShaderBatch(ProgramCache *cache = nullptr);
+  ~ShaderBatch();
+
+  // Queue a program, reading its sources right away
+  ShaderFuture add(const char *vertexPath, const char *fragmentPath,
+                   const std::string &defines = "");
+  // Issue every queued compile, then every link
+  void submit();
+
+private:
+  friend class ShaderFuture;
+
+  struct Pending {
+    std::string vertexCode;
+    std::string fragmentCode;
+    std::string defines;
+    uint64_t cacheKey;
+    unsigned int program;
+    unsigned int vertex;
+    unsigned int fragment;
+    bool fromCache;
+    bool taken;
+  };
+
+  ProgramCache *cache;
+  std::vector<Pending> pending;
+  size_t submitted = 0;
+};
+
+#endif
@@ -0,0 +1,65 @@
+#ifndef STAGING_RING_H
+#define STAGING_RING_H
+
+#include "./glad/glad.h"
+#include "./GLHandle.h"
+
+#include <mutex>
+#include <vector>
+
+class GLStateCache;
+
+// Fixed set of GL_PIXEL_UNPACK_BUFFER slots for texture uploads. Free slots
+// stay mapped, so any thread can fill one while the GL thread keeps drawing.
+// The GL thread then unmaps the slot and points glTexSubImage2D at it, which
+// lets the driver copy on its own time instead of inside the call. A fence
+// per slot holds it back until the GPU has read it.
+//
+//   worker:    int slot = ring.acquire(bytes); write to ring.data(slot)
+//   GL thread: ring.beginUpload(slot, bytes); glTexSubImage2D(..., 0);
+//              ring.endUpload(slot);
+//   per frame: ring.recycle();
+class StagingRing {
+public:
+  StagingRing(GLStateCache &state, GLsizeiptr slotSize, int slots = 4);
+  ~StagingRing();
+
+  StagingRing(const StagingRing &) = delete;
+  StagingRing &operator=(const StagingRing &) = delete;
+
+  // Any thread. A mapped slot of at least size bytes, or -1 when none is free
+  // or size does not fit; never waits.
+  int acquire(GLsizeiptr size);
+  // Write pointer of an acquired slot, valid until beginUpload()
+  void *data(int slot) const { return slots[slot].mapped; }
+  // Any thread. Hand back an acquired slot that will not be uploaded
+  void release(int slot);
+
+  // GL thread. Unmap the first bytes of slot and leave it bound to
+  // GL_PIXEL_UNPACK_BUFFER, so pixel pointers become offsets into it.
+  void beginUpload(int slot, GLsizeiptr bytes);
+  // GL thread. Fence the slot behind the uploads and unbind it
+  void endUpload(int slot);
+  // GL thread. Map slots whose uploads have finished and free them again
+  void recycle();
+
+  GLsizeiptr slotSize() const { return size; }
+
+private:
+  struct Slot {
+    void *mapped = nullptr;
+    GLsync fence = 0;
+  };
+
+  GLStateCache &state;
+  GLHandleList<GLBufferTraits> buffers;
+  GLsizeiptr size;
+  std::vector<Slot> slots;
+  // Mapped slots nobody has acquired; the only state workers touch
+  std::mutex freeMutex;
+  std::vector<int> freeSlots;
+
+  bool map(int slot);
+};
+
+#endif
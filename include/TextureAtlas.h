@@ -0,0 +1,71 @@
+#ifndef TEXTURE_ATLAS_H
+#define TEXTURE_ATLAS_H
+
+#include "./glad/glad.h"
+#include "./GLHandle.h"
+
+#include <vector>
+
+class GLStateCache;
+
+// Texture coordinates of one image in the atlas, u0, v0 is the first texel
+// of its first row
+struct AtlasRegion {
+  float u0, v0, u1, v1;
+  float layer;
+};
+
+// Packs many RGBA images into the layers of one GL_TEXTURE_2D_ARRAY, so
+// quads showing different images can be drawn together without a bind in
+// between. Images are added first and packed tallest first on build().
+// Gutters repeat each image's edge texels, and mips are only built down to
+// the level where a texel still covers a single image.
+//
+//   int face = atlas.add("../assets/awesomeface.png", true);
+//   atlas.build();
+//   sampler2DArray at vec3(mix(r.u0, r.u1, s), mix(r.v0, r.v1, t), r.layer)
+class TextureAtlas {
+public:
+  // Layers are size x size, gutter should be a power of two
+  TextureAtlas(GLStateCache &state, int size = 1024, int gutter = 8,
+               int maxLayers = 16);
+  ~TextureAtlas();
+
+  TextureAtlas(const TextureAtlas &) = delete;
+  TextureAtlas &operator=(const TextureAtlas &) = delete;
+
+  // Copy an 8-bit RGBA image, returns its index or -1 when width or height
+  // is not positive
+  int add(const unsigned char *rgba, int width, int height);
+  // Decode a file with stb_image, -1 when it cannot be read
+  int add(const char *path, bool flip = false);
+
+  // Pack, build the layers and their mips and upload them. Call once, the
+  // images are released; false when one of them did not fit.
+  bool build();
+
+  GLuint texture() const { return atlas; }
+  int images() const { return (int)regions.size(); }
+  const AtlasRegion &region(int image) const { return regions[image]; }
+  int layers() const { return layerCount; }
+  int levels() const { return levelCount; }
+  // Image texels over the texels of every layer, 0 to 1
+  double efficiency() const { return packed; }
+
+private:
+  struct Image {
+    std::vector<unsigned char> rgba;
+    int width, height;
+  };
+
+  GLStateCache &state;
+  int size, gutter, maxLayers;
+  std::vector<Image> pending;
+  std::vector<AtlasRegion> regions;
+  GLTexture atlas;
+  int layerCount = 0;
+  int levelCount = 0;
+  double packed = 0.0;
+};
+
+#endif
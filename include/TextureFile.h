@@ -0,0 +1,86 @@
+#ifndef TEXTURE_FILE_H
+#define TEXTURE_FILE_H
+
+#include <cstddef>
+#include <cstdint>
+
+// Pre-baked texture container (.htex). The file is a header, a table of mip
+// levels and the level payloads, each aligned to TEXTURE_FILE_ALIGNMENT, so a
+// mapped file can be handed to glTexImage2D or glCompressedTexImage2D as is.
+// texconv writes them from any image stb_image reads. All fields are little
+// endian.
+
+const uint32_t TEXTURE_FILE_VERSION = 1;
+const uint32_t TEXTURE_FILE_ALIGNMENT = 64;
+
+enum TextureFileFormat {
+  TEXTURE_FILE_RAW = 0, // 8 bits per channel, unpadded rows
+  TEXTURE_FILE_BC1 = 1,
+  TEXTURE_FILE_BC3 = 2
+};
+
+enum TextureFileFlags {
+  TEXTURE_FILE_FLIPPED = 1 // Bottom row first, as GL expects
+};
+
+struct TextureFileHeader {
+  char magic[4]; // "HTEX"
+  uint32_t version;
+  uint32_t width;
+  uint32_t height;
+  uint32_t channels; // Of the source image, BC1 holds 3 and BC3 holds 4
+  uint32_t format;   // TextureFileFormat
+  uint32_t levels;
+  uint32_t flags; // TextureFileFlags
+};
+
+struct TextureFileLevel {
+  uint32_t width;
+  uint32_t height;
+  uint64_t offset; // From the start of the file
+  uint64_t size;
+};
+
+static_assert(sizeof(TextureFileHeader) == 32, "header layout is on disk");
+static_assert(sizeof(TextureFileLevel) == 24, "level layout is on disk");
+
+// Write a container from levels stored one after the other in data
+bool writeTextureFile(const char *path, const TextureFileHeader &header,
+                      const TextureFileLevel *levels,
+                      const unsigned char *data);
+
+// A read-only mapping of a container. Pages are shared with every other
+// process mapping the same file and only read from disk on first touch.
+class TextureFile {
+public:
+  TextureFile() = default;
+  ~TextureFile() { close(); }
+
+  TextureFile(const TextureFile &) = delete;
+  TextureFile &operator=(const TextureFile &) = delete;
+
+  // Map and validate path, prints the reason and returns false on failure
+  bool open(const char *path);
+  void close();
+
+  const TextureFileHeader &header() const {
+    return *(const TextureFileHeader *)mapping;
+  }
+  const TextureFileLevel &level(int i) const {
+    return ((const TextureFileLevel *)(mapping + sizeof(TextureFileHeader)))[i];
+  }
+  const unsigned char *data(int i) const { return mapping + level(i).offset; }
+
+  // Ask the OS to start reading the payload in the background
+  void prefetch() const;
+
+private:
+  const unsigned char *mapping = nullptr;
+  size_t size = 0;
+#ifdef _WIN32
+  void *fileHandle = nullptr;
+  void *mappingHandle = nullptr;
+#endif
+};
+
+#endif
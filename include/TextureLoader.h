@@ -0,0 +1,132 @@
+#ifndef TEXTURE_LOADER_H
+#define TEXTURE_LOADER_H
+
+#include "./glad/glad.h"
+#include "./GLHandle.h"
+#include "./BlockCompress.h"
+
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+
+class GLStateCache;
+class StagingRing;
+class TextureFile;
+class ThreadPool;
+
+struct TextureParams {
+  GLenum wrap = GL_REPEAT;
+  GLenum minFilter = GL_LINEAR;
+  GLenum magFilter = GL_LINEAR;
+  bool flip = false; // First row at the bottom, as GL expects
+  // Color multiplied by alpha as stb writes the pixels, for blending with
+  // GL_ONE, GL_ONE_MINUS_SRC_ALPHA
+  bool premultiply = false;
+  bool mipmaps = true;
+  // Allocate with glTexStorage2D and upload a mip chain box filtered on the
+  // decode thread, instead of glTexImage2D and glGenerateMipmap. Without
+  // ARB_texture_storage the chain is still used, level by level.
+  bool immutable = false;
+  // Encode RGB and RGBA images to BC1 or BC3 on the decode thread when the
+  // driver has S3TC, the mip chain is then always built there too
+  bool compress = false;
+  BlockQuality compressQuality = BLOCK_FAST;
+};
+
+// Decodes image files on a thread pool and uploads them on the GL thread.
+// load() returns a texture straight away that shows a 1x1 placeholder; the
+// same name gets the real image once update() sees the decode has finished.
+// Workers hand results back through a lock-free list, so the GL thread never
+// waits on a decode. Each worker reads files and gives stb scratch from
+// buffers it keeps, so steady-state decodes make no allocations inside stb.
+// With a StagingRing, single level images are decoded straight into a mapped
+// unpack buffer and mip chains are copied into one; the upload reads from
+// there. Paths ending in .htex are pre-baked containers from texconv: they
+// are mapped instead of decoded, uploaded straight from the mapping and keep
+// the orientation they were baked with. Radiance .hdr images are decoded
+// to half floats and uploaded as GL_RGB16F, mipmapped by glGenerateMipmap.
+//
+//   GLuint wall = loader.load("../assets/container.jpg");
+//   every frame: loader.update();
+class TextureLoader {
+public:
+  TextureLoader(ThreadPool &pool, GLStateCache &state,
+                StagingRing *staging = nullptr);
+  // Waits for decodes in flight, the textures are deleted
+  ~TextureLoader();
+
+  TextureLoader(const TextureLoader &) = delete;
+  TextureLoader &operator=(const TextureLoader &) = delete;
+
+  GLuint load(const std::string &path,
+              const TextureParams &params = TextureParams());
+  // Decode on the calling GL thread and upload each band of rows as stb
+  // hands it over, so the image is never whole in client memory. Meant for
+  // panoramas too large to decode in one piece. Level 0 goes up band by
+  // band and glGenerateMipmap builds the rest; immutable storage and block
+  // compression need the whole image and are not used.
+  GLuint loadStreamed(const std::string &path,
+                      const TextureParams &params = TextureParams());
+  // Upload decoded images, at most maxUploads of them when it is above 0.
+  // Returns how many were uploaded. GL thread only.
+  int update(int maxUploads = 0);
+  // Block until everything queued so far is decoded and uploaded
+  void finish();
+  // Images queued but not uploaded yet
+  int pending() const { return waiting; }
+
+  unsigned int loaded = 0;
+  unsigned int failed = 0;
+  // Uploads that went through the staging ring
+  unsigned int staged = 0;
+  // Uploads in a block compressed format
+  unsigned int compressed = 0;
+
+private:
+  struct Decoded {
+    size_t index;
+    int width, height, channels;
+    int levels;
+    GLenum compressed; // Internal format of a block compressed chain, or 0
+    GLenum type;       // GL_UNSIGNED_BYTE, or GL_HALF_FLOAT for HDR images
+    std::vector<unsigned char> pixels; // Single level not in a staging slot
+    std::vector<unsigned char> chain; // Every level, when built here
+    int staging;                      // Staging slot holding the pixels, or -1
+    std::unique_ptr<TextureFile> file; // Mapped container holding the levels
+    const char *error;                // Set when the decode failed
+    Decoded *next;
+  };
+  struct Entry {
+    GLTexture texture;
+    std::string path;
+    TextureParams params;
+  };
+
+  ThreadPool &pool;
+  GLStateCache &state;
+  StagingRing *staging;
+  std::vector<Entry> entries;
+  // Pushed by workers, taken whole by the GL thread; newest first
+  std::atomic<Decoded *> completed{nullptr};
+  // Taken from completed but not uploaded yet, oldest first
+  std::deque<Decoded *> ready;
+  int waiting = 0;
+
+  // New entry showing the placeholder
+  GLuint create(const std::string &path, const TextureParams &params);
+  void decode(size_t index, const std::string &path,
+              const TextureParams &params);
+  void mapFile(Decoded *image, const std::string &path,
+               const TextureParams &params);
+  void decodeHdr(Decoded *image, const unsigned char *file, size_t size,
+                 const TextureParams &params);
+  void complete(Decoded *image);
+  void upload(Decoded *image);
+  static size_t levelBytes(const Decoded &image, int level);
+  static size_t chainBytes(const Decoded &image);
+  void collect();
+};
+
+#endif
@@ -0,0 +1,46 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads running jobs in submission order. Meant for
+// coarse jobs such as decoding a whole image; the queue takes a lock per job.
+class ThreadPool {
+public:
+  // 0 starts one worker per core, leaving one core for the GL thread
+  explicit ThreadPool(unsigned int threads = 0);
+  // Runs every queued job before joining the workers
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  void submit(std::function<void()> job);
+  // Block until the queue is empty and no job is running
+  void wait();
+
+  // Run task(0) .. task(count - 1) and return once all have finished. The
+  // calling thread runs tasks too and workers help when they are free, so
+  // it is safe to call from inside a job.
+  void parallelFor(int count, const std::function<void(int)> &task);
+
+  unsigned int size() const { return (unsigned int)workers.size(); }
+
+private:
+  std::vector<std::thread> workers;
+  std::deque<std::function<void()>> jobs;
+  std::mutex mutex;
+  std::condition_variable wake;
+  std::condition_variable idle;
+  unsigned int running = 0;
+  bool stopping = false;
+
+  void work();
+};
+
+#endif
@@ -0,0 +1,68 @@
+#ifndef UNIFORM_RING_H
+#define UNIFORM_RING_H
+
+#include "./glad/glad.h"
+#include "./GLHandle.h"
+
+#include <cstring>
+
+class GLStateCache;
+
+// Ring of uniform buffer memory for per-frame and per-draw constants. The
+// buffer is split into one segment per frame in flight. Each frame maps its
+// segment once, hands out blocks aligned to GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT
+// and unmaps before drawing; a fence keeps the CPU from overwriting a segment
+// the GPU is still reading.
+//
+//   ring.beginFrame();
+//   UniformRing::Allocation a = ring.push(objectConstants);
+//   ring.flush();
+//   ring.bind(0, a);  draw...
+//   ring.endFrame();
+class UniformRing {
+public:
+  struct Allocation {
+    void *data; // Write pointer, only valid until flush()
+    GLintptr offset;
+    GLsizeiptr size;
+  };
+
+  UniformRing(GLStateCache &state, GLsizeiptr frameSize, int frames = 3);
+  ~UniformRing();
+
+  UniformRing(const UniformRing &) = delete;
+  UniformRing &operator=(const UniformRing &) = delete;
+
+  // Wait until the GPU is done with this frame's segment and map it
+  void beginFrame();
+  // Reserve size bytes, data is nullptr when the segment is full
+  Allocation allocate(GLsizeiptr size);
+  template <class T> Allocation push(const T &value) {
+    Allocation allocation = allocate(sizeof(T));
+    if (allocation.data)
+      std::memcpy(allocation.data, &value, sizeof(T));
+    return allocation;
+  }
+  // Unmap, flushing only what was written. Must happen before any draw that
+  // reads from the ring.
+  void flush();
+  // glBindBufferRange an allocation to a uniform block binding point
+  void bind(GLuint binding, const Allocation &allocation);
+  // Fence the segment once every draw reading it has been issued
+  void endFrame();
+
+  GLint alignment() const { return offsetAlignment; }
+
+private:
+  GLStateCache &state;
+  GLBuffer buffer;
+  GLsizeiptr frameSize;
+  GLint offsetAlignment;
+  int frames;
+  int frame = 0;
+  GLsync fences[8] = {};
+  char *mapped = nullptr;
+  GLsizeiptr head = 0;
+};
+
+#endif
@@ -267,12 +267,103 @@ RECENT REVISION HISTORY:
 // (at least this is true for iOS and Android). Therefore, the NEON support is
 // toggled by a build flag: define STBI_NEON to get NEON loops.
 //
+// With GCC 5+, Clang or VC++ 2012+ on x86, AVX2 versions of the IDCT,
+// YCbCr conversion and chroma upsampling are compiled as well, for the AVX2
+// target only, and picked over SSE2 by a run-time test. Define STBI_NO_AVX2
+// to leave them out. stbi_set_jpeg_simd_level() caps the level used, which
+// is how the kernels are benchmarked and compared against each other.
+//
 // If for some reason you do not want to use any of SIMD code, or if
 // you have issues compiling it, you can disable it entirely by
 // defining STBI_NO_SIMD.
 //
 // ===========================================================================
 //
+// Multithreaded JPEG decoding
+//
+// stb_image starts no threads of its own. Give it a parallel-for with
+// stbi_set_parallel_for() and large JPEGs are split into tasks: baseline
+// scans with restart markers are entropy decoded one group of restart
+// intervals per task when loading from memory, progressive and other
+// baseline images run their IDCTs by block rows once entropy decoding is
+// done, and upsampling and color conversion run by bands of rows. The
+// output is identical to a single-threaded decode.
+//
+// ===========================================================================
+//
+// Decoding without allocating
+//
+// stbi_load_into_from_memory() decodes into an output buffer you own and
+// takes every buffer it needs along the way from a scratch block you also
+// own, so a texture path that keeps both around never touches the heap.
+// stbi_decode_sizes_from_memory() reads just the headers and reports the
+// output size and a scratch size that is enough for that image: exact
+// bounds for JPEG and PNG, generous ones for the other formats. Scratch
+// that runs out is topped up with STBI_MALLOC, so a short block costs
+// allocations but never fails the decode. JPEG and PNG write their final
+// rows straight into the output, already flipped; the other formats are
+// copied in at the end, in the same pass as the flip.
+//
+//    size_t out_bytes, scratch_bytes;
+//    stbi_decode_sizes_from_memory(file, len, 4, &x, &y, &n, &out_bytes, &scratch_bytes);
+//    (grow scratch to scratch_bytes, map out_bytes of a pixel buffer)
+//    stbi_load_into_from_memory(file, len, &x, &y, &n, 4, pixels, out_bytes, scratch, scratch_bytes);
+//
+// Like the flip flag, the scratch block is per thread when the compiler has
+// thread-locals; the parallel-for tasks of a JPEG decode allocate nothing.
+//
+// ===========================================================================
+//
+// Decoding by rows
+//
+// stbi_load_rows_from_memory() and stbi_load_rows() hand the image to a
+// callback in bands of rows as they are decoded, so a band can be uploaded
+// or downsampled while the rows below it are still being decoded:
+//
+//    int band(void *user, int y, int rows, stbi_uc const *pixels)
+//    {
+//       (rows rows of x*channels bytes each, starting at row y)
+//       return 1; // 0 stops the decode
+//    }
+//    stbi_load_rows(filename, &x, &y, &n, 4, band, user);
+//
+// x, y and channels_in_file are set before the first band. Baseline JPEGs
+// go out a row of MCUs at a time while only two rows of MCUs are held;
+// non-interlaced PNGs a few rows at a time as they inflate, holding the
+// compressed data and a 32K window. Progressive JPEGs and interlaced PNGs
+// need the whole image first, as does every other format; those come as
+// one band once decoded. Bands always go from the top row down and the
+// flip flag is ignored, y counts from the top; the red and blue swap and
+// premultiplied alpha still apply.
+//
+// ===========================================================================
+//
+// Decoding with a decoder
+//
+// The flag setters are per process, or per thread with the _thread
+// variants, and stbi_failure_reason() is per thread. A stbi_decoder holds
+// the same options, an allocator and the failure reason for the loads made
+// through it instead, so threads that decode with different options need
+// no locking and a pool can hand each job its own decoder:
+//
+//    stbi_decoder d;
+//    stbi_decoder_init(&d);
+//    d.flip_vertically = 1;
+//    pixels = stbi_decoder_load_from_memory(&d, file, len, &x, &y, &n, 4);
+//    if (!pixels) printf("%s\n", d.failure_reason);
+//    stbi_decoder_free(&d, pixels);
+//
+// A decoder is used by one load at a time. While a load runs it is
+// current on the calling thread, so the flags, the JPEG SIMD level, the
+// parallel-for and stbi_failure_reason() of that thread are neither read
+// nor written; rows callbacks run with it put aside. stbi_decoder_init()
+// copies the process-wide SIMD level and parallel-for, set the fields to
+// change them for one decoder. The parallel-for tasks of a JPEG decode
+// neither allocate nor read options. Without STBI_THREAD_LOCAL the current
+// decoder is per process, as the flags are.
+//
+// ===========================================================================
+//
 // HDR image support   (disable by defining STBI_NO_HDR)
 //
 // stb_image supports loading HDR images in general, and currently the Radiance
@@ -299,6 +390,11 @@ RECENT REVISION HISTORY:
 //     stbi_ldr_to_hdr_scale(1.0f);
 //     stbi_ldr_to_hdr_gamma(2.2f);
 //
+// stbi_loadh() and friends return the same values as IEEE half floats,
+// half the memory and ready for GL_RGB16F. Radiance files are converted
+// from RGBE straight to halves, with SSE2 when available, and are never
+// whole as floats.
+//
 // Finally, given a filename (or an open file or memory block--see header
 // file for details) containing image data, you can query for the "most
 // appropriate" interface to use (that is, whether the image is HDR or
@@ -426,6 +522,31 @@ STBIDEF stbi_uc *stbi_load_from_file  (FILE *f, int *x, int *y, int *channels_in
 // for stbi_load_from_file, file pointer is left pointing immediately after image
 #endif
 
+// decode at 1/2, 1/4 or 1/8 of the size for scale_log2 1, 2 or 3, rounding
+// the size up. JPEGs skip the high frequencies with smaller IDCTs, other
+// formats are decoded in full and box filtered.
+STBIDEF stbi_uc *stbi_load_from_memory_scaled(stbi_uc const *buffer, int len, int scale_log2, int *x, int *y, int *channels_in_file, int desired_channels);
+#ifndef STBI_NO_STDIO
+STBIDEF stbi_uc *stbi_load_scaled(char const *filename, int scale_log2, int *x, int *y, int *channels_in_file, int desired_channels);
+#endif
+
+// decode into output, 1 on success, with intermediate buffers taken from
+// scratch. output must hold x*y*channels bytes, see "Decoding without
+// allocating" above.
+STBIDEF int stbi_load_into_from_memory(stbi_uc const *buffer, int len, int *x, int *y, int *channels_in_file, int desired_channels, stbi_uc *output, size_t output_bytes, void *scratch, size_t scratch_bytes);
+// header pre-pass for stbi_load_into_from_memory: the output bytes and the
+// scratch bytes that decoding this image needs, 0 if it can't be read
+STBIDEF int stbi_decode_sizes_from_memory(stbi_uc const *buffer, int len, int desired_channels, int *x, int *y, int *channels_in_file, size_t *output_bytes, size_t *scratch_bytes);
+
+// gets rows [y, y+rows) of the image, packed, 0 to stop the decode
+typedef int (*stbi_rows_func)(void *user, int y, int rows, stbi_uc const *pixels);
+// decode handing bands of rows to func as they are done, 1 on success. see
+// "Decoding by rows" above
+STBIDEF int stbi_load_rows_from_memory(stbi_uc const *buffer, int len, int *x, int *y, int *channels_in_file, int desired_channels, stbi_rows_func func, void *user);
+#ifndef STBI_NO_STDIO
+STBIDEF int stbi_load_rows(char const *filename, int *x, int *y, int *channels_in_file, int desired_channels, stbi_rows_func func, void *user);
+#endif
+
 #ifndef STBI_NO_GIF
 STBIDEF stbi_uc *stbi_load_gif_from_memory(stbi_uc const *buffer, int len, int **delays, int *x, int *y, int *z, int *comp, int req_comp);
 #endif
@@ -459,6 +580,19 @@ STBIDEF stbi_us *stbi_load_from_file_16(FILE *f, int *x, int *y, int *channels_i
    STBIDEF float *stbi_loadf            (char const *filename, int *x, int *y, int *channels_in_file, int desired_channels);
    STBIDEF float *stbi_loadf_from_file  (FILE *f, int *x, int *y, int *channels_in_file, int desired_channels);
    #endif
+
+   // as stbi_loadf, in IEEE half floats for GL_HALF_FLOAT uploads. HDR files
+   // go from RGBE straight to halves, rounded as glm's packHalf rounds
+   STBIDEF stbi_us *stbi_loadh_from_memory   (stbi_uc const *buffer, int len, int *x, int *y, int *channels_in_file, int desired_channels);
+   STBIDEF stbi_us *stbi_loadh_from_callbacks(stbi_io_callbacks const *clbk, void *user, int *x, int *y,  int *channels_in_file, int desired_channels);
+   // into a buffer you own of x*y*channels halves, the image's own size from
+   // stbi_decode_sizes_from_memory(); 0 when it fails or output is too small
+   STBIDEF int      stbi_loadh_into_from_memory(stbi_uc const *buffer, int len, int *x, int *y, int *channels_in_file, int desired_channels, stbi_us *output, size_t output_bytes);
+
+   #ifndef STBI_NO_STDIO
+   STBIDEF stbi_us *stbi_loadh            (char const *filename, int *x, int *y, int *channels_in_file, int desired_channels);
+   STBIDEF stbi_us *stbi_loadh_from_file  (FILE *f, int *x, int *y, int *channels_in_file, int desired_channels);
+   #endif
 #endif
 
 #ifndef STBI_NO_HDR
@@ -514,12 +648,82 @@ STBIDEF void stbi_convert_iphone_png_to_rgb(int flag_true_if_should_convert);
 // flip the image vertically, so the first pixel in the output array is the bottom left
 STBIDEF void stbi_set_flip_vertically_on_load(int flag_true_if_should_flip);
 
+// swap the red and blue channels of 3 and 4 channel 8-bit output, giving BGR
+// and BGRA as some drivers prefer to upload
+STBIDEF void stbi_set_bgr_on_load(int flag_true_if_should_swap_red_and_blue);
+
+// multiply the color channels of 2 and 4 channel 8-bit output by alpha.
+// JPEG and PNG apply this, the swap above and the flip as they write their
+// final rows; the other formats do all three in one pass at the end
+STBIDEF void stbi_set_premultiply_on_load(int flag_true_if_should_premultiply);
+
 // as above, but only applies to images loaded on the thread that calls the function
 // this function is only available if your compiler supports thread-local variables;
 // calling it will fail to link if your compiler doesn't
 STBIDEF void stbi_set_unpremultiply_on_load_thread(int flag_true_if_should_unpremultiply);
 STBIDEF void stbi_convert_iphone_png_to_rgb_thread(int flag_true_if_should_convert);
 STBIDEF void stbi_set_flip_vertically_on_load_thread(int flag_true_if_should_flip);
+STBIDEF void stbi_set_bgr_on_load_thread(int flag_true_if_should_swap_red_and_blue);
+STBIDEF void stbi_set_premultiply_on_load_thread(int flag_true_if_should_premultiply);
+
+// run task(arg, 0) .. task(arg, count-1) in any order on any threads, and
+// return once all of them have finished. it may be called from several
+// decoding threads at once, and from inside its own tasks' threads, so the
+// calling thread should run tasks too rather than only wait for them
+typedef void stbi_parallel_for_func(void *user, int count, void (*task)(void *arg, int index), void *arg);
+
+// the options above and the failure reason for the loads made through one
+// decoder, see "Decoding with a decoder" above
+typedef struct
+{
+   int flip_vertically;
+   int bgr;
+   int premultiply;
+   int unpremultiply;
+   int convert_iphone_png;
+   // the JPEG SIMD level cap and parallel-for, as stbi_set_jpeg_simd_level()
+   // and stbi_set_parallel_for() set them for loads without a decoder
+   int simd_level;
+   stbi_parallel_for_func *parallel_for;
+   void *parallel_for_user;
+   // everything the decode allocates, or NULL for STBI_MALLOC and friends.
+   // realloc_fn may be NULL, blocks then move through malloc_fn and free_fn
+   void *(*malloc_fn)(void *user, size_t size);
+   void *(*realloc_fn)(void *user, void *p, size_t old_size, size_t new_size);
+   void  (*free_fn)(void *user, void *p);
+   void *alloc_user;
+   const char *failure_reason; // why the last load through it failed
+} stbi_decoder;
+
+// all options off and the default allocator, the SIMD level and parallel-for
+// copied from the process-wide ones as they are at the time of the call
+STBIDEF void     stbi_decoder_init(stbi_decoder *d);
+STBIDEF stbi_uc *stbi_decoder_load_from_memory(stbi_decoder *d, stbi_uc const *buffer, int len, int *x, int *y, int *channels_in_file, int desired_channels);
+STBIDEF int      stbi_decoder_load_into_from_memory(stbi_decoder *d, stbi_uc const *buffer, int len, int *x, int *y, int *channels_in_file, int desired_channels, stbi_uc *output, size_t output_bytes, void *scratch, size_t scratch_bytes);
+STBIDEF int      stbi_decoder_decode_sizes_from_memory(stbi_decoder *d, stbi_uc const *buffer, int len, int desired_channels, int *x, int *y, int *channels_in_file, size_t *output_bytes, size_t *scratch_bytes);
+STBIDEF int      stbi_decoder_load_rows_from_memory(stbi_decoder *d, stbi_uc const *buffer, int len, int *x, int *y, int *channels_in_file, int desired_channels, stbi_rows_func func, void *user);
+#ifndef STBI_NO_LINEAR
+STBIDEF stbi_us *stbi_decoder_loadh_from_memory(stbi_decoder *d, stbi_uc const *buffer, int len, int *x, int *y, int *channels_in_file, int desired_channels);
+STBIDEF int      stbi_decoder_loadh_into_from_memory(stbi_decoder *d, stbi_uc const *buffer, int len, int *x, int *y, int *channels_in_file, int desired_channels, stbi_us *output, size_t output_bytes);
+#endif
+#ifndef STBI_NO_STDIO
+STBIDEF stbi_uc *stbi_decoder_load(stbi_decoder *d, char const *filename, int *x, int *y, int *channels_in_file, int desired_channels);
+STBIDEF int      stbi_decoder_load_rows(stbi_decoder *d, char const *filename, int *x, int *y, int *channels_in_file, int desired_channels, stbi_rows_func func, void *user);
+#endif
+// frees what stbi_decoder_load* returned, with the decoder's allocator
+STBIDEF void     stbi_decoder_free(stbi_decoder *d, void *retval_from_stbi_decoder_load);
+
+// cap the SIMD kernels the JPEG decoder may use: 0 = generic C, 1 = SSE2 or
+// NEON, 2 = AVX2. the default is 2; levels the CPU lacks are never used.
+// per process and unsynchronized, so set it before other threads decode or
+// give each decoder its own simd_level
+STBIDEF void stbi_set_jpeg_simd_level(int max_level);
+
+// set the parallel-for large JPEGs are decoded with, NULL to decode on the
+// calling thread only (the default). each decode reads it once as it
+// starts; clear it before whatever user points to goes away. like the SIMD
+// level it is per process, a decoder carries its own
+STBIDEF void stbi_set_parallel_for(stbi_parallel_for_func *run, void *user);
 
 // ZLIB client - used by PNG, available for other purposes
 
@@ -747,7 +951,7 @@ static int stbi__cpuid3(void)
 
 #define STBI_SIMD_ALIGN(type, name) __declspec(align(16)) type name
 
-#if !defined(STBI_NO_JPEG) && defined(STBI_SSE2)
+#if (!defined(STBI_NO_JPEG) || !defined(STBI_NO_PNG) || !defined(STBI_NO_HDR)) && defined(STBI_SSE2)
 static int stbi__sse2_available(void)
 {
    int info3 = stbi__cpuid3();
@@ -758,7 +962,7 @@ static int stbi__sse2_available(void)
 #else // assume GCC-style if not VC++
 #define STBI_SIMD_ALIGN(type, name) type name __attribute__((aligned(16)))
 
-#if !defined(STBI_NO_JPEG) && defined(STBI_SSE2)
+#if (!defined(STBI_NO_JPEG) || !defined(STBI_NO_PNG) || !defined(STBI_NO_HDR)) && defined(STBI_SSE2)
 static int stbi__sse2_available(void)
 {
    // If we're even attempting to compile this on GCC/Clang, that means
@@ -768,6 +972,34 @@ static int stbi__sse2_available(void)
 }
 #endif
 
+#endif
+
+// AVX2 is opted into per function, so the rest of the file keeps working on
+// CPUs without it
+#if !defined(STBI_NO_JPEG) && !defined(STBI_NO_AVX2) && \
+    ((defined(_MSC_VER) && _MSC_VER >= 1700) || defined(__clang__) || (defined(__GNUC__) && __GNUC__ >= 5))
+#define STBI_AVX2
+#include <immintrin.h>
+
+#ifdef _MSC_VER
+#define STBI__AVX2_TARGET
+static int stbi__avx2_available(void)
+{
+   int info[4];
+   __cpuid(info,1);
+   // the OS must save the ymm registers (OSXSAVE, AVX, XCR0 bits 1 and 2)
+   if (((info[2] >> 27) & 3) != 3 || (_xgetbv(0) & 6) != 6)
+      return 0;
+   __cpuidex(info,7,0);
+   return ((info[1] >> 5) & 1) != 0;
+}
+#else
+#define STBI__AVX2_TARGET __attribute__((target("avx2")))
+static int stbi__avx2_available(void)
+{
+   return __builtin_cpu_supports("avx2") != 0;
+}
+#endif
 #endif
 #endif
 
@@ -814,6 +1046,9 @@ typedef struct
 
    stbi_uc *img_buffer, *img_buffer_end;
    stbi_uc *img_buffer_original, *img_buffer_original_end;
+
+   int scale_log2; // requested 1/2^n output size, cleared by loaders that apply it
+   struct stbi__finish *finish; // set for 8-bit loads, see stbi__load_and_finish_8bit
 } stbi__context;
 
 
@@ -827,6 +1062,8 @@ static void stbi__start_mem(stbi__context *s, stbi_uc const *buffer, int len)
    s->callback_already_read = 0;
    s->img_buffer = s->img_buffer_original = (stbi_uc *) buffer;
    s->img_buffer_end = s->img_buffer_original_end = (stbi_uc *) buffer+len;
+   s->scale_log2 = 0;
+   s->finish = NULL;
 }
 
 // initialize a callback-based context
@@ -840,6 +1077,8 @@ static void stbi__start_callbacks(stbi__context *s, stbi_io_callbacks *c, void *
    s->img_buffer = s->img_buffer_original = s->buffer_start;
    stbi__refill_buffer(s);
    s->img_buffer_original_end = s->img_buffer_end;
+   s->scale_log2 = 0;
+   s->finish = NULL;
 }
 
 #ifndef STBI_NO_STDIO
@@ -900,6 +1139,7 @@ typedef struct
    int bits_per_channel;
    int num_channels;
    int channel_order;
+   int finished; // written as s->finish asks, see stbi__load_and_finish_8bit
 } stbi__result_info;
 
 #ifndef STBI_NO_JPEG
@@ -937,6 +1177,7 @@ static int      stbi__psd_is16(stbi__context *s);
 #ifndef STBI_NO_HDR
 static int      stbi__hdr_test(stbi__context *s);
 static float   *stbi__hdr_load(stbi__context *s, int *x, int *y, int *comp, int req_comp, stbi__result_info *ri);
+static void    *stbi__hdr_load_main(stbi__context *s, int *x, int *y, int *comp, int req_comp, int half, struct stbi__finish *f);
 static int      stbi__hdr_info(stbi__context *s, int *x, int *y, int *comp);
 #endif
 
@@ -966,6 +1207,13 @@ STBI_THREAD_LOCAL
 #endif
 const char *stbi__g_failure_reason;
 
+// the decoder of the load running on this thread, see stbi__decoder_begin
+static
+#ifdef STBI_THREAD_LOCAL
+STBI_THREAD_LOCAL
+#endif
+stbi_decoder *stbi__g_decoder;
+
 STBIDEF const char *stbi_failure_reason(void)
 {
    return stbi__g_failure_reason;
@@ -974,14 +1222,139 @@ STBIDEF const char *stbi_failure_reason(void)
 #ifndef STBI_NO_FAILURE_STRINGS
 static int stbi__err(const char *str)
 {
-   stbi__g_failure_reason = str;
+   if (stbi__g_decoder)
+      stbi__g_decoder->failure_reason = str;
+   else
+      stbi__g_failure_reason = str;
    return 0;
 }
 #endif
 
+// scratch block of stbi_load_into_from_memory. blocks are stacked, each
+// after a header with the offset of the block below and its size; freeing
+// the top block pops it along with any freed ones under it, other frees wait
+// for the decode to end. what doesn't fit comes from STBI_MALLOC
+typedef struct
+{
+   stbi_uc *base;
+   size_t size, used;
+   size_t top; // offset of the newest block, 0 when empty
+} stbi__arena;
+
+typedef struct
+{
+   size_t below; // offset of the block below, +1 once this one is freed
+   size_t size;
+} stbi__arena_header;
+
+#define STBI__ARENA_HEADER 16 // keeps blocks 16-byte aligned
+
+static
+#ifdef STBI_THREAD_LOCAL
+STBI_THREAD_LOCAL
+#endif
+stbi__arena *stbi__g_arena;
+
+static void *stbi__arena_alloc(stbi__arena *a, size_t size)
+{
+   stbi__arena_header h;
+   size_t at = ((a->used + 15) & ~(size_t) 15) + STBI__ARENA_HEADER;
+   if (at > a->size || a->size - at < size) return NULL;
+   h.below = a->top;
+   h.size = size;
+   memcpy(a->base + at - STBI__ARENA_HEADER, &h, sizeof(h));
+   a->top = at;
+   a->used = at + size;
+   return a->base + at;
+}
+
+static int stbi__arena_owns(stbi__arena *a, void *p)
+{
+   return a && (stbi_uc *) p >= a->base && (stbi_uc *) p < a->base + a->size;
+}
+
+static void stbi__arena_free(stbi__arena *a, void *p)
+{
+   stbi__arena_header h;
+   size_t at = (size_t) ((stbi_uc *) p - a->base);
+   memcpy(&h, a->base + at - STBI__ARENA_HEADER, sizeof(h));
+   if (at != a->top) {
+      h.below |= 1;
+      memcpy(a->base + at - STBI__ARENA_HEADER, &h, sizeof(h));
+      return;
+   }
+   for (;;) {
+      a->used = at - STBI__ARENA_HEADER;
+      a->top = at = h.below & ~(size_t) 1;
+      if (!at) break;
+      memcpy(&h, a->base + at - STBI__ARENA_HEADER, sizeof(h));
+      if (!(h.below & 1)) break;
+   }
+}
+
 static void *stbi__malloc(size_t size)
 {
-    return STBI_MALLOC(size);
+   if (stbi__g_arena) {
+      void *p = stbi__arena_alloc(stbi__g_arena, size);
+      if (p) return p;
+   }
+   if (stbi__g_decoder && stbi__g_decoder->malloc_fn)
+      return stbi__g_decoder->malloc_fn(stbi__g_decoder->alloc_user, size);
+   return STBI_MALLOC(size);
+}
+
+static void stbi__free(void *p)
+{
+   if (stbi__arena_owns(stbi__g_arena, p))
+      stbi__arena_free(stbi__g_arena, p);
+   else if (stbi__g_decoder && stbi__g_decoder->malloc_fn) {
+      if (p) stbi__g_decoder->free_fn(stbi__g_decoder->alloc_user, p);
+   } else
+      STBI_FREE(p);
+}
+
+static void *stbi__realloc_sized(void *p, size_t oldsz, size_t newsz)
+{
+   stbi__arena *a = stbi__g_arena;
+   if (stbi__arena_owns(a, p)) {
+      stbi__arena_header h;
+      size_t at = (size_t) ((stbi_uc *) p - a->base);
+      void *q;
+      memcpy(&h, a->base + at - STBI__ARENA_HEADER, sizeof(h));
+      if (at == a->top && a->size - at >= newsz) {
+         // the newest block grows in place
+         h.size = newsz;
+         memcpy(a->base + at - STBI__ARENA_HEADER, &h, sizeof(h));
+         a->used = at + newsz;
+         return p;
+      }
+      q = stbi__malloc(newsz);
+      if (q) {
+         memcpy(q, p, h.size < newsz ? h.size : newsz);
+         stbi__arena_free(a, p);
+      }
+      return q;
+   }
+   if (a && !p) return stbi__malloc(newsz);
+   if (stbi__g_decoder && stbi__g_decoder->malloc_fn) {
+      stbi_decoder *d = stbi__g_decoder;
+      void *q;
+      if (d->realloc_fn) return d->realloc_fn(d->alloc_user, p, oldsz, newsz);
+      q = d->malloc_fn(d->alloc_user, newsz);
+      if (q && p) {
+         memcpy(q, p, oldsz < newsz ? oldsz : newsz);
+         d->free_fn(d->alloc_user, p);
+      }
+      return q;
+   }
+   STBI_NOTUSED(oldsz);
+   return STBI_REALLOC_SIZED(p, oldsz, newsz);
+}
+
+// scratch bytes a block of size takes, with its header and alignment
+static size_t stbi__arena_bytes(size_t size)
+{
+   return size + STBI__ARENA_HEADER + 15;
 }
 
 // stb_image uses ints pervasively, including for offset calculations.
@@ -1092,6 +1465,25 @@ static stbi_uc *stbi__hdr_to_ldr(float   *data, int x, int y, int comp);
 #endif
 
 static int stbi__vertically_flip_on_load_global = 0;
+static int stbi__jpeg_simd_level_global = 2;
+static stbi_parallel_for_func *stbi__parallel_for_run_global = NULL;
+static void *stbi__parallel_for_user_global = NULL;
+
+STBIDEF void stbi_set_jpeg_simd_level(int max_level)
+{
+   stbi__jpeg_simd_level_global = max_level;
+}
+
+STBIDEF void stbi_set_parallel_for(stbi_parallel_for_func *run, void *user)
+{
+   stbi__parallel_for_run_global = run;
+   stbi__parallel_for_user_global = user;
+}
+
+// a load through a decoder has its own, like the flags below
+#define stbi__jpeg_simd_level    (stbi__g_decoder ? stbi__g_decoder->simd_level : stbi__jpeg_simd_level_global)
+#define stbi__parallel_for_run   (stbi__g_decoder ? stbi__g_decoder->parallel_for : stbi__parallel_for_run_global)
+#define stbi__parallel_for_user  (stbi__g_decoder ? stbi__g_decoder->parallel_for_user : stbi__parallel_for_user_global)
 
 STBIDEF void stbi_set_flip_vertically_on_load(int flag_true_if_should_flip)
 {
@@ -1099,7 +1491,7 @@ STBIDEF void stbi_set_flip_vertically_on_load(int flag_true_if_should_flip)
 }
 
 #ifndef STBI_THREAD_LOCAL
-#define stbi__vertically_flip_on_load  stbi__vertically_flip_on_load_global
+#define stbi__vertically_flip_on_load_flag stbi__vertically_flip_on_load_global
 #else
 static STBI_THREAD_LOCAL int stbi__vertically_flip_on_load_local, stbi__vertically_flip_on_load_set;
 
@@ -1109,11 +1501,118 @@ STBIDEF void stbi_set_flip_vertically_on_load_thread(int flag_true_if_should_fli
    stbi__vertically_flip_on_load_set = 1;
 }
 
-#define stbi__vertically_flip_on_load  (stbi__vertically_flip_on_load_set       \
-                                         ? stbi__vertically_flip_on_load_local  \
-                                         : stbi__vertically_flip_on_load_global)
+#define stbi__vertically_flip_on_load_flag (stbi__vertically_flip_on_load_set  \
+                                              ? stbi__vertically_flip_on_load_local \
+                                              : stbi__vertically_flip_on_load_global)
+#endif // STBI_THREAD_LOCAL
+
+// a load through a decoder takes its options from there
+#define stbi__vertically_flip_on_load  (stbi__g_decoder ? stbi__g_decoder->flip_vertically : stbi__vertically_flip_on_load_flag)
+
+static int stbi__bgr_on_load_global = 0;
+static int stbi__premultiply_on_load_global = 0;
+
+STBIDEF void stbi_set_bgr_on_load(int flag_true_if_should_swap_red_and_blue)
+{
+   stbi__bgr_on_load_global = flag_true_if_should_swap_red_and_blue;
+}
+
+STBIDEF void stbi_set_premultiply_on_load(int flag_true_if_should_premultiply)
+{
+   stbi__premultiply_on_load_global = flag_true_if_should_premultiply;
+}
+
+#ifndef STBI_THREAD_LOCAL
+#define stbi__bgr_on_load_flag stbi__bgr_on_load_global
+#define stbi__premultiply_on_load_flag stbi__premultiply_on_load_global
+#else
+static STBI_THREAD_LOCAL int stbi__bgr_on_load_local, stbi__bgr_on_load_set;
+static STBI_THREAD_LOCAL int stbi__premultiply_on_load_local, stbi__premultiply_on_load_set;
+
+STBIDEF void stbi_set_bgr_on_load_thread(int flag_true_if_should_swap_red_and_blue)
+{
+   stbi__bgr_on_load_local = flag_true_if_should_swap_red_and_blue;
+   stbi__bgr_on_load_set = 1;
+}
+
+STBIDEF void stbi_set_premultiply_on_load_thread(int flag_true_if_should_premultiply)
+{
+   stbi__premultiply_on_load_local = flag_true_if_should_premultiply;
+   stbi__premultiply_on_load_set = 1;
+}
+
+#define stbi__bgr_on_load_flag (stbi__bgr_on_load_set                          \
+                                  ? stbi__bgr_on_load_local                     \
+                                  : stbi__bgr_on_load_global)
+#define stbi__premultiply_on_load_flag (stbi__premultiply_on_load_set          \
+                                          ? stbi__premultiply_on_load_local     \
+                                          : stbi__premultiply_on_load_global)
 #endif // STBI_THREAD_LOCAL
 
+// a load through a decoder takes its options from there
+#define stbi__bgr_on_load  (stbi__g_decoder ? stbi__g_decoder->bgr : stbi__bgr_on_load_flag)
+#define stbi__premultiply_on_load  (stbi__g_decoder ? stbi__g_decoder->premultiply : stbi__premultiply_on_load_flag)
+
+// how an 8-bit load wants its final pixels: rows flipped or not, red and blue
+// swapped, alpha premultiplied, into the caller's buffer when one is given
+// and big enough. JPEG and PNG write rows this way as they finish them and
+// set ri->finished, anything else is finished in one pass afterwards
+struct stbi__finish
+{
+   stbi_uc *dest;
+   size_t dest_bytes;
+   int flip, bgr, premultiply;
+};
+
+// x*y*n bytes to write the final image to: the caller's buffer, or allocated
+static stbi_uc *stbi__finish_buffer(struct stbi__finish *f, int x, int y, int n)
+{
+   stbi_uc *p;
+   if (f->dest && (size_t) x * y * n <= f->dest_bytes)
+      return f->dest;
+   if (!stbi__mad3sizes_valid(x, y, n, 0)) return stbi__errpuc("too large", "Image too large to decode");
+   p = (stbi_uc *) stbi__malloc_mad3(x, y, n, 0);
+   if (!p) return stbi__errpuc("outofmem", "Out of memory");
+   return p;
+}
+
+// copy an n-channel row of w pixels with red and blue swapped and/or alpha
+// premultiplied. dst may be src
+static void stbi__finish_row(stbi_uc *dst, stbi_uc const *src, int w, int n, int bgr, int premultiply)
+{
+   int i;
+   if (n < 3) bgr = 0;
+   if (n != 2 && n != 4) premultiply = 0;
+   if (!bgr && !premultiply) {
+      if (dst != src) memcpy(dst, src, (size_t) w * n);
+      return;
+   }
+   if (n == 2) {
+      for (i=0; i < w; ++i, dst += 2, src += 2) {
+         unsigned int t = src[0] * src[1] + 128;
+         dst[0] = (stbi_uc) ((t + (t >> 8)) >> 8);
+         dst[1] = src[1];
+      }
+      return;
+   }
+   for (i=0; i < w; ++i, dst += n, src += n) {
+      stbi_uc r = src[0], g = src[1], b = src[2];
+      if (n == 4) {
+         unsigned int a = src[3], t;
+         if (premultiply) {
+            // rounded c*a/255
+            t = r * a + 128; r = (stbi_uc) ((t + (t >> 8)) >> 8);
+            t = g * a + 128; g = (stbi_uc) ((t + (t >> 8)) >> 8);
+            t = b * a + 128; b = (stbi_uc) ((t + (t >> 8)) >> 8);
+         }
+         dst[3] = (stbi_uc) a;
+      }
+      dst[0] = bgr ? b : r;
+      dst[1] = g;
+      dst[2] = bgr ? r : b;
+   }
+}
+
 static void *stbi__load_main(stbi__context *s, int *x, int *y, int *comp, int req_comp, stbi__result_info *ri, int bpc)
 {
    memset(ri, 0, sizeof(*ri)); // make sure it's initialized if we add new fields
@@ -1179,7 +1678,7 @@ static stbi_uc *stbi__convert_16_to_8(stbi__uint16 *orig, int w, int h, int chan
    for (i = 0; i < img_len; ++i)
       reduced[i] = (stbi_uc)((orig[i] >> 8) & 0xFF); // top half of each byte is sufficient approx of 16->8 bit scaling
 
-   STBI_FREE(orig);
+   stbi__free(orig);
    return reduced;
 }
 
@@ -1195,7 +1694,7 @@ static stbi__uint16 *stbi__convert_8_to_16(stbi_uc *orig, int w, int h, int chan
    for (i = 0; i < img_len; ++i)
       enlarged[i] = (stbi__uint16)((orig[i] << 8) + orig[i]); // replicate to high and low byte, maps 0->0, 255->0xffff
 
-   STBI_FREE(orig);
+   stbi__free(orig);
    return enlarged;
 }
 
@@ -1237,13 +1736,87 @@ static void stbi__vertical_flip_slices(void *image, int w, int h, int z, int byt
 }
 #endif
 
-static unsigned char *stbi__load_and_postprocess_8bit(stbi__context *s, int *x, int *y, int *comp, int req_comp)
+// average 2^scale_log2 square boxes, partial boxes on the right and bottom
+// edges average the pixels they have; frees the input
+static stbi_uc *stbi__downsample_box(stbi_uc *data, int *x, int *y, int n, int scale_log2)
+{
+   int w = (*x + (1 << scale_log2) - 1) >> scale_log2;
+   int h = (*y + (1 << scale_log2) - 1) >> scale_log2;
+   int i,j,k,sx,sy;
+   stbi_uc *out = (stbi_uc *) stbi__malloc_mad3(w, h, n, 0);
+   if (!out) { stbi__free(data); return stbi__errpuc("outofmem", "Out of memory"); }
+   for (j=0; j < h; ++j) {
+      int y0 = j << scale_log2, y1 = y0 + (1 << scale_log2) < *y ? y0 + (1 << scale_log2) : *y;
+      for (i=0; i < w; ++i) {
+         int x0 = i << scale_log2, x1 = x0 + (1 << scale_log2) < *x ? x0 + (1 << scale_log2) : *x;
+         int count = (y1 - y0) * (x1 - x0);
+         for (k=0; k < n; ++k) {
+            int sum = 0;
+            for (sy=y0; sy < y1; ++sy)
+               for (sx=x0; sx < x1; ++sx)
+                  sum += data[((size_t) sy * *x + sx) * n + k];
+            out[((size_t) j * w + i) * n + k] = (stbi_uc) ((sum + count/2) / count);
+         }
+      }
+   }
+   stbi__free(data);
+   *x = w;
+   *y = h;
+   return out;
+}
+
+// finish an image its loader left as decoded, in one pass that flips, swaps
+// and premultiplies from in to out. out may be in
+static void stbi__finish_image(struct stbi__finish const *f, stbi_uc *out, stbi_uc *in, int w, int h, int n)
+{
+   size_t stride = (size_t) w * n;
+   int i, j;
+   if (!f->flip || out != in) {
+      for (j=0; j < h; ++j)
+         stbi__finish_row(out + stride * (f->flip ? h - 1 - j : j), in + stride * j, w, n, f->bgr, f->premultiply);
+   } else {
+      // in place, each pair of rows is swapped through temp a piece at a time
+      stbi_uc temp[2048];
+      int chunk = (int) sizeof(temp) / n;
+      for (j=0; j < (h>>1); ++j) {
+         stbi_uc *row0 = in + stride * j;
+         stbi_uc *row1 = in + stride * (h - 1 - j);
+         for (i=0; i < w; i += chunk) {
+            int count = w - i < chunk ? w - i : chunk;
+            memcpy(temp, row0 + (size_t) i * n, (size_t) count * n);
+            stbi__finish_row(row0 + (size_t) i * n, row1 + (size_t) i * n, count, n, f->bgr, f->premultiply);
+            stbi__finish_row(row1 + (size_t) i * n, temp, count, n, f->bgr, f->premultiply);
+         }
+      }
+      if (h & 1)
+         stbi__finish_row(in + stride * (h>>1), in + stride * (h>>1), w, n, f->bgr, f->premultiply);
+   }
+}
+
+// load 8-bit pixels swapped and premultiplied as the flags ask, flipped if
+// flip is set. they go into dest when it is given and big enough, the result
+// is then dest
+static unsigned char *stbi__load_and_finish_8bit(stbi__context *s, int *x, int *y, int *comp, int req_comp, int flip, stbi_uc *dest, size_t dest_bytes)
 {
    stbi__result_info ri;
-   void *result = stbi__load_main(s, x, y, comp, req_comp, &ri, 8);
+   struct stbi__finish f;
+   void *result;
+   stbi_uc *out;
+   int n;
+
+   f.dest = dest;
+   f.dest_bytes = dest_bytes;
+   f.flip = flip;
+   f.bgr = stbi__bgr_on_load;
+   f.premultiply = stbi__premultiply_on_load;
+   s->finish = &f;
+   result = stbi__load_main(s, x, y, comp, req_comp, &ri, 8);
+   s->finish = NULL;
 
    if (result == NULL)
       return NULL;
+   if (ri.finished)
+      return (unsigned char *) result;
 
    // it is the responsibility of the loaders to make sure we get either 8 or 16 bit.
    STBI_ASSERT(ri.bits_per_channel == 8 || ri.bits_per_channel == 16);
@@ -1255,12 +1828,26 @@ static unsigned char *stbi__load_and_postprocess_8bit(stbi__context *s, int *x,
 
    // @TODO: move stbi__convert_format to here
 
-   if (stbi__vertically_flip_on_load) {
-      int channels = req_comp ? req_comp : *comp;
-      stbi__vertical_flip(result, *x, *y, channels * sizeof(stbi_uc));
+   // loaders that cannot decode at a reduced size leave the request set
+   if (s->scale_log2) {
+      result = stbi__downsample_box((stbi_uc *) result, x, y, req_comp ? req_comp : *comp, s->scale_log2);
+      if (result == NULL)
+         return NULL;
    }
 
-   return (unsigned char *) result;
+   n = req_comp ? req_comp : *comp;
+   out = dest && (size_t) *x * *y * n <= dest_bytes ? dest : (stbi_uc *) result;
+   if (f.flip || f.bgr || f.premultiply || out != result)
+      stbi__finish_image(&f, out, (stbi_uc *) result, *x, *y, n);
+   if (out != result)
+      stbi__free(result);
+
+   return out;
+}
+
+static unsigned char *stbi__load_and_postprocess_8bit(stbi__context *s, int *x, int *y, int *comp, int req_comp)
+{
+   return stbi__load_and_finish_8bit(s, x, y, comp, req_comp, stbi__vertically_flip_on_load, NULL, 0);
 }
 
 static stbi__uint16 *stbi__load_and_postprocess_16bit(stbi__context *s, int *x, int *y, int *comp, int req_comp)
@@ -1420,6 +2007,32 @@ STBIDEF stbi_uc *stbi_load_from_callbacks(stbi_io_callbacks const *clbk, void *u
    return stbi__load_and_postprocess_8bit(&s,x,y,comp,req_comp);
 }
 
+STBIDEF stbi_uc *stbi_load_from_memory_scaled(stbi_uc const *buffer, int len, int scale_log2, int *x, int *y, int *comp, int req_comp)
+{
+   stbi__context s;
+   if (scale_log2 < 0 || scale_log2 > 3) return stbi__errpuc("bad scale", "Scale must be 0 to 3");
+   stbi__start_mem(&s,buffer,len);
+   s.scale_log2 = scale_log2;
+   return stbi__load_and_postprocess_8bit(&s,x,y,comp,req_comp);
+}
+
+#ifndef STBI_NO_STDIO
+STBIDEF stbi_uc *stbi_load_scaled(char const *filename, int scale_log2, int *x, int *y, int *comp, int req_comp)
+{
+   FILE *f;
+   stbi__context s;
+   unsigned char *result;
+   if (scale_log2 < 0 || scale_log2 > 3) return stbi__errpuc("bad scale", "Scale must be 0 to 3");
+   f = stbi__fopen(filename, "rb");
+   if (!f) return stbi__errpuc("can't fopen", "Unable to open file");
+   stbi__start_file(&s,f);
+   s.scale_log2 = scale_log2;
+   result = stbi__load_and_postprocess_8bit(&s,x,y,comp,req_comp);
+   fclose(f);
+   return result;
+}
+#endif
+
 #ifndef STBI_NO_GIF
 STBIDEF stbi_uc *stbi_load_gif_from_memory(stbi_uc const *buffer, int len, int **delays, int *x, int *y, int *z, int *comp, int req_comp)
 {
@@ -1436,6 +2049,96 @@ STBIDEF stbi_uc *stbi_load_gif_from_memory(stbi_uc const *buffer, int len, int *
 }
 #endif
 
+#if !defined(STBI_NO_LINEAR) || !defined(STBI_NO_HDR)
+// float to IEEE half as glm::packHalf1x16 rounds it: to nearest with ties
+// away from zero, denormal halves kept, anything too large to infinity
+static stbi__uint16 stbi__float_to_half(float f)
+{
+   stbi__uint32 i;
+   int s, e, m;
+   memcpy(&i, &f, sizeof(i));
+   s = (int) (i >> 16) & 0x8000;
+   e = (int) ((i >> 23) & 0xff) - (127 - 15);
+   m = (int) (i & 0x7fffff);
+   if (e <= 0) {
+      if (e < -10) return (stbi__uint16) s;
+      m = (m | 0x800000) >> (1 - e);
+      if (m & 0x1000) m += 0x2000;
+      return (stbi__uint16) (s | (m >> 13));
+   }
+   if (e == 0xff - (127 - 15)) {
+      if (m == 0) return (stbi__uint16) (s | 0x7c00);
+      m >>= 13; // NaN, keeping at least one significand bit
+      return (stbi__uint16) (s | 0x7c00 | m | (m == 0));
+   }
+   if (m & 0x1000) {
+      m += 0x2000;
+      if (m & 0x800000) { m = 0; e += 1; }
+   }
+   if (e > 30) return (stbi__uint16) (s | 0x7c00);
+   return (stbi__uint16) (s | (e << 10) | (m >> 13));
+}
+
+#ifdef STBI_SSE2
+stbi_inline static __m128i stbi__sse2_select(__m128i mask, __m128i a, __m128i b)
+{
+   return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+// four floats to halves as stbi__float_to_half, one per 32-bit lane and
+// sign extended, so _mm_packs_epi32 packs them
+static __m128i stbi__float_to_half_sse2(__m128 f)
+{
+   __m128i i = _mm_castps_si128(f);
+   __m128i a = _mm_and_si128(i, _mm_set1_epi32(0x7fffffff));
+   __m128i sign = _mm_and_si128(_mm_srli_epi32(i, 16), _mm_set1_epi32(0x8000));
+   __m128i inf = _mm_set1_epi32(0x7c00);
+   // normal: rebias and round on the whole bit pattern, so a significand
+   // that rounds up carries into the exponent
+   __m128i h = _mm_srli_epi32(_mm_add_epi32(a, _mm_set1_epi32(0x1000 - (112 << 23))), 13);
+   // denormal: |f| * 2^24 rounded half up, which floats hold exactly here
+   __m128i d = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(_mm_castsi128_ps(a), _mm_set1_ps(16777216.0f)), _mm_set1_ps(0.5f)));
+   __m128i nan = _mm_srli_epi32(_mm_and_si128(i, _mm_set1_epi32(0x7fffff)), 13);
+   nan = _mm_or_si128(_mm_or_si128(nan, inf), _mm_and_si128(_mm_cmpeq_epi32(nan, _mm_setzero_si128()), _mm_set1_epi32(1)));
+   h = stbi__sse2_select(_mm_cmpgt_epi32(h, _mm_set1_epi32(0x7bff)), inf, h);
+   h = stbi__sse2_select(_mm_cmplt_epi32(a, _mm_set1_epi32(113 << 23)), d, h);
+   h = _mm_andnot_si128(_mm_cmplt_epi32(a, _mm_set1_epi32(102 << 23)), h);
+   h = stbi__sse2_select(_mm_cmpgt_epi32(a, _mm_set1_epi32(0x7f800000)), nan, h);
+   h = _mm_or_si128(h, sign);
+   return _mm_srai_epi32(_mm_slli_epi32(h, 16), 16);
+}
+
+// the same for what RGBE pixels scale to: never negative or NaN, and with
+// at most 8 significant bits, so rounding below the denormals gives 0
+stbi_inline static __m128i stbi__rgbe_to_half_sse2(__m128 f)
+{
+   __m128i a = _mm_castps_si128(f);
+   __m128i h = _mm_srli_epi32(_mm_add_epi32(a, _mm_set1_epi32(0x1000 - (112 << 23))), 13);
+   __m128i d = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(f, _mm_set1_ps(16777216.0f)), _mm_set1_ps(0.5f)));
+   h = stbi__sse2_select(_mm_cmpgt_epi32(h, _mm_set1_epi32(0x7bff)), _mm_set1_epi32(0x7c00), h);
+   return stbi__sse2_select(_mm_cmplt_epi32(a, _mm_set1_epi32(113 << 23)), d, h);
+}
+#endif
+
+#ifndef STBI_NO_LINEAR
+static void stbi__float_to_half_row(stbi__uint16 *out, float const *in, size_t n)
+{
+   size_t i = 0;
+   #ifdef STBI_SSE2
+   if (stbi__sse2_available()) {
+      for (; i+8 <= n; i += 8) {
+         __m128i a = stbi__float_to_half_sse2(_mm_loadu_ps(in+i));
+         __m128i b = stbi__float_to_half_sse2(_mm_loadu_ps(in+i+4));
+         _mm_storeu_si128((__m128i *) (out+i), _mm_packs_epi32(a, b));
+      }
+   }
+   #endif
+   for (; i < n; ++i)
+      out[i] = stbi__float_to_half(in[i]);
+}
+#endif // !STBI_NO_LINEAR
+#endif
+
 #ifndef STBI_NO_LINEAR
 static float *stbi__loadf_main(stbi__context *s, int *x, int *y, int *comp, int req_comp)
 {
@@ -1488,6 +2191,84 @@ STBIDEF float *stbi_loadf_from_file(FILE *f, int *x, int *y, int *comp, int req_
 }
 #endif // !STBI_NO_STDIO
 
+// halves into dest when it is given and big enough, the result is then dest
+static stbi__uint16 *stbi__loadh_main(stbi__context *s, int *x, int *y, int *comp, int req_comp, stbi__uint16 *dest, size_t dest_bytes)
+{
+   float *data;
+   stbi__uint16 *half;
+   size_t n;
+   #ifndef STBI_NO_HDR
+   if (stbi__hdr_test(s)) {
+      // RGBE goes straight to halves, the floats are never stored
+      struct stbi__finish f;
+      f.dest = (stbi_uc *) dest;
+      f.dest_bytes = dest_bytes;
+      f.flip = stbi__vertically_flip_on_load;
+      f.bgr = 0;
+      f.premultiply = 0;
+      return (stbi__uint16 *) stbi__hdr_load_main(s,x,y,comp,req_comp,1,&f);
+   }
+   #endif
+   data = stbi__loadf_main(s,x,y,comp,req_comp);
+   if (!data) return NULL;
+   n = (size_t) *x * *y * (req_comp ? req_comp : *comp);
+   half = dest && n * sizeof(stbi__uint16) <= dest_bytes ? dest : (stbi__uint16 *) stbi__malloc(n * sizeof(stbi__uint16));
+   if (half) stbi__float_to_half_row(half, data, n);
+   stbi__free(data);
+   return half ? half : (stbi__uint16 *) stbi__errpuc("outofmem", "Out of memory");
+}
+
+STBIDEF stbi_us *stbi_loadh_from_memory(stbi_uc const *buffer, int len, int *x, int *y, int *comp, int req_comp)
+{
+   stbi__context s;
+   stbi__start_mem(&s,buffer,len);
+   return stbi__loadh_main(&s,x,y,comp,req_comp,NULL,0);
+}
+
+STBIDEF int stbi_loadh_into_from_memory(stbi_uc const *buffer, int len, int *x, int *y, int *comp, int req_comp, stbi_us *output, size_t output_bytes)
+{
+   stbi__context s;
+   stbi__uint16 *result;
+   int w, h, n;
+   stbi__start_mem(&s,buffer,len);
+   result = stbi__loadh_main(&s,&w,&h,&n,req_comp,output,output_bytes);
+   if (!result) return 0;
+   if (x) *x = w;
+   if (y) *y = h;
+   if (comp) *comp = n;
+   if (result != output) {
+      stbi__free(result);
+      return stbi__err("output too small", "Output buffer too small");
+   }
+   return 1;
+}
+
+STBIDEF stbi_us *stbi_loadh_from_callbacks(stbi_io_callbacks const *clbk, void *user, int *x, int *y, int *comp, int req_comp)
+{
+   stbi__context s;
+   stbi__start_callbacks(&s, (stbi_io_callbacks *) clbk, user);
+   return stbi__loadh_main(&s,x,y,comp,req_comp,NULL,0);
+}
+
+#ifndef STBI_NO_STDIO
+STBIDEF stbi_us *stbi_loadh(char const *filename, int *x, int *y, int *comp, int req_comp)
+{
+   stbi_us *result;
+   FILE *f = stbi__fopen(filename, "rb");
+   if (!f) return (stbi_us *) stbi__errpuc("can't fopen", "Unable to open file");
+   result = stbi_loadh_from_file(f,x,y,comp,req_comp);
+   fclose(f);
+   return result;
+}
+
+STBIDEF stbi_us *stbi_loadh_from_file(FILE *f, int *x, int *y, int *comp, int req_comp)
+{
+   stbi__context s;
+   stbi__start_file(&s,f);
+   return stbi__loadh_main(&s,x,y,comp,req_comp,NULL,0);
+}
+#endif // !STBI_NO_STDIO
+
 #endif // !STBI_NO_LINEAR
 
 // these is-hdr-or-not is defined independent of whether STBI_NO_LINEAR is
@@ -1732,23 +2513,13 @@ static stbi_uc stbi__compute_y(int r, int g, int b)
 #if defined(STBI_NO_PNG) && defined(STBI_NO_BMP) && defined(STBI_NO_PSD) && defined(STBI_NO_TGA) && defined(STBI_NO_GIF) && defined(STBI_NO_PIC) && defined(STBI_NO_PNM)
 // nothing
 #else
-static unsigned char *stbi__convert_format(unsigned char *data, int img_n, int req_comp, unsigned int x, unsigned int y)
+// convert y rows from data into good, which does not overlap it
+static int stbi__convert_format_rows(unsigned char *data, unsigned char *good, int img_n, int req_comp, unsigned int x, unsigned int y)
 {
    int i,j;
-   unsigned char *good;
-
-   if (req_comp == img_n) return data;
-   STBI_ASSERT(req_comp >= 1 && req_comp <= 4);
-
-   good = (unsigned char *) stbi__malloc_mad3(req_comp, x, y, 0);
-   if (good == NULL) {
-      STBI_FREE(data);
-      return stbi__errpuc("outofmem", "Out of memory");
-   }
-
-   for (j=0; j < (int) y; ++j) {
-      unsigned char *src  = data + j * x * img_n   ;
-      unsigned char *dest = good + j * x * req_comp;
+   for (j=0; j < (int) y; ++j) {
+      unsigned char *src  = data + j * x * img_n   ;
+      unsigned char *dest = good + j * x * req_comp;
 
       #define STBI__COMBO(a,b)  ((a)*8+(b))
       #define STBI__CASE(a,b)   case STBI__COMBO(a,b): for(i=x-1; i >= 0; --i, src += a, dest += b)
@@ -1767,12 +2538,31 @@ static unsigned char *stbi__convert_format(unsigned char *data, int img_n, int r
          STBI__CASE(4,1) { dest[0]=stbi__compute_y(src[0],src[1],src[2]);                   } break;
          STBI__CASE(4,2) { dest[0]=stbi__compute_y(src[0],src[1],src[2]); dest[1] = src[3]; } break;
          STBI__CASE(4,3) { dest[0]=src[0];dest[1]=src[1];dest[2]=src[2];                    } break;
-         default: STBI_ASSERT(0); STBI_FREE(data); STBI_FREE(good); return stbi__errpuc("unsupported", "Unsupported format conversion");
+         default: STBI_ASSERT(0); return stbi__err("unsupported", "Unsupported format conversion");
       }
       #undef STBI__CASE
    }
+   return 1;
+}
+
+static unsigned char *stbi__convert_format(unsigned char *data, int img_n, int req_comp, unsigned int x, unsigned int y)
+{
+   unsigned char *good;
+
+   if (req_comp == img_n) return data;
+   STBI_ASSERT(req_comp >= 1 && req_comp <= 4);
+
+   good = (unsigned char *) stbi__malloc_mad3(req_comp, x, y, 0);
+   if (good == NULL) {
+      stbi__free(data);
+      return stbi__errpuc("outofmem", "Out of memory");
+   }
 
-   STBI_FREE(data);
+   if (!stbi__convert_format_rows(data, good, img_n, req_comp, x, y)) {
+      stbi__free(good);
+      good = NULL;
+   }
+   stbi__free(data);
    return good;
 }
 #endif
@@ -1789,20 +2579,9 @@ static stbi__uint16 stbi__compute_y_16(int r, int g, int b)
 #if defined(STBI_NO_PNG) && defined(STBI_NO_PSD)
 // nothing
 #else
-static stbi__uint16 *stbi__convert_format16(stbi__uint16 *data, int img_n, int req_comp, unsigned int x, unsigned int y)
+static int stbi__convert_format16_rows(stbi__uint16 *data, stbi__uint16 *good, int img_n, int req_comp, unsigned int x, unsigned int y)
 {
    int i,j;
-   stbi__uint16 *good;
-
-   if (req_comp == img_n) return data;
-   STBI_ASSERT(req_comp >= 1 && req_comp <= 4);
-
-   good = (stbi__uint16 *) stbi__malloc(req_comp * x * y * 2);
-   if (good == NULL) {
-      STBI_FREE(data);
-      return (stbi__uint16 *) stbi__errpuc("outofmem", "Out of memory");
-   }
-
    for (j=0; j < (int) y; ++j) {
       stbi__uint16 *src  = data + j * x * img_n   ;
       stbi__uint16 *dest = good + j * x * req_comp;
@@ -1824,12 +2603,31 @@ static stbi__uint16 *stbi__convert_format16(stbi__uint16 *data, int img_n, int r
          STBI__CASE(4,1) { dest[0]=stbi__compute_y_16(src[0],src[1],src[2]);                   } break;
          STBI__CASE(4,2) { dest[0]=stbi__compute_y_16(src[0],src[1],src[2]); dest[1] = src[3]; } break;
          STBI__CASE(4,3) { dest[0]=src[0];dest[1]=src[1];dest[2]=src[2];                       } break;
-         default: STBI_ASSERT(0); STBI_FREE(data); STBI_FREE(good); return (stbi__uint16*) stbi__errpuc("unsupported", "Unsupported format conversion");
+         default: STBI_ASSERT(0); return stbi__err("unsupported", "Unsupported format conversion");
       }
       #undef STBI__CASE
    }
+   return 1;
+}
+
+static stbi__uint16 *stbi__convert_format16(stbi__uint16 *data, int img_n, int req_comp, unsigned int x, unsigned int y)
+{
+   stbi__uint16 *good;
+
+   if (req_comp == img_n) return data;
+   STBI_ASSERT(req_comp >= 1 && req_comp <= 4);
+
+   good = (stbi__uint16 *) stbi__malloc(req_comp * x * y * 2);
+   if (good == NULL) {
+      stbi__free(data);
+      return (stbi__uint16 *) stbi__errpuc("outofmem", "Out of memory");
+   }
 
-   STBI_FREE(data);
+   if (!stbi__convert_format16_rows(data, good, img_n, req_comp, x, y)) {
+      stbi__free(good);
+      good = NULL;
+   }
+   stbi__free(data);
    return good;
 }
 #endif
@@ -1841,7 +2639,7 @@ static float   *stbi__ldr_to_hdr(stbi_uc *data, int x, int y, int comp)
    float *output;
    if (!data) return NULL;
    output = (float *) stbi__malloc_mad4(x, y, comp, sizeof(float), 0);
-   if (output == NULL) { STBI_FREE(data); return stbi__errpf("outofmem", "Out of memory"); }
+   if (output == NULL) { stbi__free(data); return stbi__errpf("outofmem", "Out of memory"); }
    // compute number of non-alpha components
    if (comp & 1) n = comp; else n = comp-1;
    for (i=0; i < x*y; ++i) {
@@ -1854,7 +2652,7 @@ static float   *stbi__ldr_to_hdr(stbi_uc *data, int x, int y, int comp)
          output[i*comp + n] = data[i*comp + n]/255.0f;
       }
    }
-   STBI_FREE(data);
+   stbi__free(data);
    return output;
 }
 #endif
@@ -1867,7 +2665,7 @@ static stbi_uc *stbi__hdr_to_ldr(float   *data, int x, int y, int comp)
    stbi_uc *output;
    if (!data) return NULL;
    output = (stbi_uc *) stbi__malloc_mad3(x, y, comp, 0);
-   if (output == NULL) { STBI_FREE(data); return stbi__errpuc("outofmem", "Out of memory"); }
+   if (output == NULL) { stbi__free(data); return stbi__errpuc("outofmem", "Out of memory"); }
    // compute number of non-alpha components
    if (comp & 1) n = comp; else n = comp-1;
    for (i=0; i < x*y; ++i) {
@@ -1884,7 +2682,7 @@ static stbi_uc *stbi__hdr_to_ldr(float   *data, int x, int y, int comp)
          output[i*comp + k] = (stbi_uc) stbi__float2int(z);
       }
    }
-   STBI_FREE(data);
+   stbi__free(data);
    return output;
 }
 #endif
@@ -1951,9 +2749,10 @@ typedef struct
       int x,y,w2,h2;
       stbi_uc *data;
       void *raw_data, *raw_coeff;
-      stbi_uc *linebuf;
-      short   *coeff;   // progressive only
+      stbi_uc *linebuf; // component 0's holds the line buffers of all of them
+      short   *coeff;   // progressive, or baseline with parallel IDCTs
       int      coeff_w, coeff_h; // number of 8x8 coefficient blocks
+      int      ring;    // block rows in data when it is a ring decoded by rows, else 0
    } img_comp[4];
 
    stbi__uint32   code_buffer; // jpeg entropy-coded buffer
@@ -1973,13 +2772,66 @@ typedef struct
 
    int scan_n, order[4];
    int restart_interval, todo;
+   int scale; // output is 1/2^scale of the image size
+   struct stbi__jpeg_stream *stream; // set when decoding by rows
+   // the parallel-for hook, read once when the decode starts so clearing
+   // it mid decode can't pull it out from under the tasks
+   stbi_parallel_for_func *parallel_for;
+   void *parallel_for_user;
 
 // kernels
    void (*idct_block_kernel)(stbi_uc *out, int out_stride, short data[64]);
+   void (*idct_4x4_kernel)(stbi_uc *out, int out_stride, short data[64]);
    void (*YCbCr_to_RGB_kernel)(stbi_uc *out, const stbi_uc *y, const stbi_uc *pcb, const stbi_uc *pcr, int count, int step);
    stbi_uc *(*resample_row_hv_2_kernel)(stbi_uc *out, stbi_uc *in_near, stbi_uc *in_far, int w, int hs);
 } stbi__jpeg;
 
+// images smaller than this decode on the calling thread only
+#define STBI__PARALLEL_MIN_PIXELS  (1 << 18)
+// most pieces one step of a decode is split into
+#define STBI__PARALLEL_TASKS       64
+
+typedef void stbi__range_func(void *arg, int task, int first, int last);
+
+typedef struct
+{
+   stbi__range_func *range;
+   void *arg;
+   int count, tasks;
+} stbi__parallel_ranges;
+
+// how many tasks of at least min_size items count items make, 1 without a
+// parallel-for
+static int stbi__parallel_tasks(stbi__jpeg *z, int count, int min_size)
+{
+   int tasks = count / (min_size > 0 ? min_size : 1);
+   if (!z->parallel_for || tasks < 1) return 1;
+   return tasks < STBI__PARALLEL_TASKS ? tasks : STBI__PARALLEL_TASKS;
+}
+
+static void stbi__parallel_range_task(void *arg, int task)
+{
+   stbi__parallel_ranges *p = (stbi__parallel_ranges *) arg;
+   int size = p->count / p->tasks, extra = p->count % p->tasks;
+   int first = task * size + (task < extra ? task : extra);
+   p->range(p->arg, task, first, first + size + (task < extra));
+}
+
+// call range(arg, task, first, last) for tasks covering [0, count) evenly
+static void stbi__parallel_ranges_run(stbi__jpeg *z, stbi__range_func *range, void *arg, int count, int tasks)
+{
+   stbi__parallel_ranges p;
+   if (tasks <= 1) {
+      range(arg, 0, 0, count);
+      return;
+   }
+   p.range = range;
+   p.arg = arg;
+   p.count = count;
+   p.tasks = tasks;
+   z->parallel_for(z->parallel_for_user, tasks, stbi__parallel_range_task, &p);
+}
+
 static int stbi__build_huffman(stbi__huffman *h, int *count)
 {
    int i,j,k=0;
@@ -2489,6 +3341,61 @@ static void stbi__idct_block(stbi_uc *out, int out_stride, short data[64])
    }
 }
 
+// reduced-size IDCTs for scaled decoding: the low NxN coefficients through
+// an N-point inverse DCT, normalized like the 8-point one so a flat block
+// keeps its value. the columns keep 1<<1 of the 1<<12 constants, the rows
+// remove the rest along with the level shift
+#define STBI__IDCT4_1D(s0,s1,s2,s3) \
+   int e0,e1,o0,o1;                                 \
+   e0 = (s0+s2) * stbi__f2f(0.35355339f);           \
+   e1 = (s0-s2) * stbi__f2f(0.35355339f);           \
+   o0 = s1*stbi__f2f(0.46193977f) + s3*stbi__f2f(0.19134172f); \
+   o1 = s1*stbi__f2f(0.19134172f) - s3*stbi__f2f(0.46193977f);
+
+static void stbi__idct_4x4(stbi_uc *out, int out_stride, short data[64])
+{
+   int i,v[16],*t;
+   for (i=0; i < 4; ++i) {
+      STBI__IDCT4_1D(data[i], data[i+8], data[i+16], data[i+24])
+      e0 += 1 << 10; e1 += 1 << 10;
+      v[i   ] = (e0+o0) >> 11;
+      v[i+ 4] = (e1+o1) >> 11;
+      v[i+ 8] = (e1-o1) >> 11;
+      v[i+12] = (e0-o0) >> 11;
+   }
+   for (i=0, t=v; i < 4; ++i, t+=4, out+=out_stride) {
+      STBI__IDCT4_1D(t[0], t[1], t[2], t[3])
+      e0 += (128 << 13) + (1 << 12);
+      e1 += (128 << 13) + (1 << 12);
+      out[0] = stbi__clamp((e0+o0) >> 13);
+      out[1] = stbi__clamp((e1+o1) >> 13);
+      out[2] = stbi__clamp((e1-o1) >> 13);
+      out[3] = stbi__clamp((e0-o0) >> 13);
+   }
+}
+
+static void stbi__idct_2x2(stbi_uc *out, int out_stride, short data[64])
+{
+   int c = stbi__f2f(0.35355339f);
+   int v0 = ((data[0]+data[8]) * c + (1 << 10)) >> 11;
+   int v1 = ((data[1]+data[9]) * c + (1 << 10)) >> 11;
+   int v2 = ((data[0]-data[8]) * c + (1 << 10)) >> 11;
+   int v3 = ((data[1]-data[9]) * c + (1 << 10)) >> 11;
+   int r = (128 << 13) + (1 << 12);
+   out[0] = stbi__clamp(((v0+v1) * c + r) >> 13);
+   out[1] = stbi__clamp(((v0-v1) * c + r) >> 13);
+   out += out_stride;
+   out[0] = stbi__clamp(((v2+v3) * c + r) >> 13);
+   out[1] = stbi__clamp(((v2-v3) * c + r) >> 13);
+}
+
+static void stbi__idct_1x1(stbi_uc *out, int out_stride, short data[64])
+{
+   // the DC term alone is the block mean
+   STBI_NOTUSED(out_stride);
+   out[0] = stbi__clamp(((data[0] + 4) >> 3) + 128);
+}
+
 #ifdef STBI_SSE2
 // sse2 integer IDCT. not the fastest possible implementation but it
 // produces bit-identical results to the generic C version so it's
@@ -2668,8 +3575,233 @@ static void stbi__idct_simd(stbi_uc *out, int out_stride, short data[64])
 #undef dct_pass
 }
 
+// sse2 version of stbi__idct_4x4, bit-identical to it. the columns of both
+// passes are the lanes, with a 16-bit 4x4 transpose after each pass
+static void stbi__idct_4x4_simd(stbi_uc *out, int out_stride, short data[64])
+{
+   const short c = stbi__f2f(0.35355339f);
+   const short c1 = stbi__f2f(0.46193977f);
+   const short c3 = stbi__f2f(0.19134172f);
+   __m128i even_p = _mm_setr_epi16(c, c, c, c, c, c, c, c);
+   __m128i even_m = _mm_setr_epi16(c, -c, c, -c, c, -c, c, -c);
+   __m128i odd_0 = _mm_setr_epi16(c1, c3, c1, c3, c1, c3, c1, c3);
+   __m128i odd_1 = _mm_setr_epi16(c3, -c1, c3, -c1, c3, -c1, c3, -c1);
+   __m128i a0, a1, a2, a3, lo, hi, t0, t1;
+   int i;
+
+   // 4 lanes of one 4-point pass into lo (outputs 0, 1) and hi (2, 3)
+   #define dct4_pass(bias, shift) \
+   { \
+      __m128i p02 = _mm_unpacklo_epi16(a0, a2); \
+      __m128i p13 = _mm_unpacklo_epi16(a1, a3); \
+      __m128i e0 = _mm_add_epi32(_mm_madd_epi16(p02, even_p), bias); \
+      __m128i e1 = _mm_add_epi32(_mm_madd_epi16(p02, even_m), bias); \
+      __m128i o0 = _mm_madd_epi16(p13, odd_0); \
+      __m128i o1 = _mm_madd_epi16(p13, odd_1); \
+      lo = _mm_packs_epi32(_mm_srai_epi32(_mm_add_epi32(e0, o0), shift), \
+                           _mm_srai_epi32(_mm_add_epi32(e1, o1), shift)); \
+      hi = _mm_packs_epi32(_mm_srai_epi32(_mm_sub_epi32(e1, o1), shift), \
+                           _mm_srai_epi32(_mm_sub_epi32(e0, o0), shift)); \
+   }
+
+   // 4x4 transpose of the 16-bit rows in lo, hi into lo (rows 0, 1), hi (2, 3)
+   #define dct4_transpose() \
+   { \
+      t0 = _mm_unpacklo_epi16(lo, hi); \
+      t1 = _mm_unpackhi_epi16(lo, hi); \
+      lo = _mm_unpacklo_epi16(t0, t1); \
+      hi = _mm_unpackhi_epi16(t0, t1); \
+   }
+
+   a0 = _mm_loadl_epi64((const __m128i *) (data + 0*8));
+   a1 = _mm_loadl_epi64((const __m128i *) (data + 1*8));
+   a2 = _mm_loadl_epi64((const __m128i *) (data + 2*8));
+   a3 = _mm_loadl_epi64((const __m128i *) (data + 3*8));
+   dct4_pass(_mm_set1_epi32(1 << 10), 11);
+   dct4_transpose();
+
+   a0 = lo; a1 = _mm_srli_si128(lo, 8);
+   a2 = hi; a3 = _mm_srli_si128(hi, 8);
+   dct4_pass(_mm_set1_epi32((128 << 13) + (1 << 12)), 13);
+   dct4_transpose();
+
+   lo = _mm_packus_epi16(lo, hi);
+   for (i=0; i < 4; ++i, out += out_stride) {
+      int row = _mm_cvtsi128_si32(lo);
+      memcpy(out, &row, 4);
+      lo = _mm_srli_si128(lo, 4);
+   }
+
+#undef dct4_pass
+#undef dct4_transpose
+}
+
 #endif // STBI_SSE2
 
+#ifdef STBI_AVX2
+// avx2 integer IDCT. same passes and transposes as the sse2 version, but the
+// 32-bit intermediates of a row live in one register instead of two, which
+// halves the multiply-add and butterfly work. bit-identical to the generic C
+// version.
+STBI__AVX2_TARGET static void stbi__idct_avx2(stbi_uc *out, int out_stride, short data[64])
+{
+   __m128i row0, row1, row2, row3, row4, row5, row6, row7;
+   __m128i tmp;
+
+   // dot product constant: even elems=x, odd elems=y
+   #define dct_const(x,y)  _mm256_setr_epi16((x),(y),(x),(y),(x),(y),(x),(y),(x),(y),(x),(y),(x),(y),(x),(y))
+
+   // out(0) = c0[even]*x + c0[odd]*y   (c0, x, y 16-bit, out 32-bit)
+   // out(1) = c1[even]*x + c1[odd]*y
+   #define dct_rot(out0,out1, x,y,c0,c1) \
+      __m256i c0##xy = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_unpacklo_epi16((x),(y))), _mm_unpackhi_epi16((x),(y)), 1); \
+      __m256i out0 = _mm256_madd_epi16(c0##xy, c0); \
+      __m256i out1 = _mm256_madd_epi16(c0##xy, c1)
+
+   // out = in << 12  (in 16-bit, out 32-bit)
+   #define dct_widen(out, in) \
+      __m256i out = _mm256_slli_epi32(_mm256_cvtepi16_epi32(in), 12)
+
+   // butterfly a/b, add bias, then shift by "s" and pack
+   #define dct_bfly32o(out0, out1, a,b,bias,s) \
+      { \
+         __m256i abiased = _mm256_add_epi32(a, bias); \
+         __m256i sum = _mm256_srai_epi32(_mm256_add_epi32(abiased, b), s); \
+         __m256i dif = _mm256_srai_epi32(_mm256_sub_epi32(abiased, b), s); \
+         out0 = _mm_packs_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1)); \
+         out1 = _mm_packs_epi32(_mm256_castsi256_si128(dif), _mm256_extracti128_si256(dif, 1)); \
+      }
+
+   // 8-bit interleave step (for transposes)
+   #define dct_interleave8(a, b) \
+      tmp = a; \
+      a = _mm_unpacklo_epi8(a, b); \
+      b = _mm_unpackhi_epi8(tmp, b)
+
+   // 16-bit interleave step (for transposes)
+   #define dct_interleave16(a, b) \
+      tmp = a; \
+      a = _mm_unpacklo_epi16(a, b); \
+      b = _mm_unpackhi_epi16(tmp, b)
+
+   #define dct_pass(bias,shift) \
+      { \
+         /* even part */ \
+         dct_rot(t2e,t3e, row2,row6, rot0_0,rot0_1); \
+         __m128i sum04 = _mm_add_epi16(row0, row4); \
+         __m128i dif04 = _mm_sub_epi16(row0, row4); \
+         dct_widen(t0e, sum04); \
+         dct_widen(t1e, dif04); \
+         __m256i x0 = _mm256_add_epi32(t0e, t3e); \
+         __m256i x3 = _mm256_sub_epi32(t0e, t3e); \
+         __m256i x1 = _mm256_add_epi32(t1e, t2e); \
+         __m256i x2 = _mm256_sub_epi32(t1e, t2e); \
+         /* odd part */ \
+         dct_rot(y0o,y2o, row7,row3, rot2_0,rot2_1); \
+         dct_rot(y1o,y3o, row5,row1, rot3_0,rot3_1); \
+         __m128i sum17 = _mm_add_epi16(row1, row7); \
+         __m128i sum35 = _mm_add_epi16(row3, row5); \
+         dct_rot(y4o,y5o, sum17,sum35, rot1_0,rot1_1); \
+         __m256i x4 = _mm256_add_epi32(y0o, y4o); \
+         __m256i x5 = _mm256_add_epi32(y1o, y5o); \
+         __m256i x6 = _mm256_add_epi32(y2o, y5o); \
+         __m256i x7 = _mm256_add_epi32(y3o, y4o); \
+         dct_bfly32o(row0,row7, x0,x7,bias,shift); \
+         dct_bfly32o(row1,row6, x1,x6,bias,shift); \
+         dct_bfly32o(row2,row5, x2,x5,bias,shift); \
+         dct_bfly32o(row3,row4, x3,x4,bias,shift); \
+      }
+
+   __m256i rot0_0 = dct_const(stbi__f2f(0.5411961f), stbi__f2f(0.5411961f) + stbi__f2f(-1.847759065f));
+   __m256i rot0_1 = dct_const(stbi__f2f(0.5411961f) + stbi__f2f( 0.765366865f), stbi__f2f(0.5411961f));
+   __m256i rot1_0 = dct_const(stbi__f2f(1.175875602f) + stbi__f2f(-0.899976223f), stbi__f2f(1.175875602f));
+   __m256i rot1_1 = dct_const(stbi__f2f(1.175875602f), stbi__f2f(1.175875602f) + stbi__f2f(-2.562915447f));
+   __m256i rot2_0 = dct_const(stbi__f2f(-1.961570560f) + stbi__f2f( 0.298631336f), stbi__f2f(-1.961570560f));
+   __m256i rot2_1 = dct_const(stbi__f2f(-1.961570560f), stbi__f2f(-1.961570560f) + stbi__f2f( 3.072711026f));
+   __m256i rot3_0 = dct_const(stbi__f2f(-0.390180644f) + stbi__f2f( 2.053119869f), stbi__f2f(-0.390180644f));
+   __m256i rot3_1 = dct_const(stbi__f2f(-0.390180644f), stbi__f2f(-0.390180644f) + stbi__f2f( 1.501321110f));
+
+   // rounding biases in column/row passes, see stbi__idct_block for explanation.
+   __m256i bias_0 = _mm256_set1_epi32(512);
+   __m256i bias_1 = _mm256_set1_epi32(65536 + (128<<17));
+
+   // load
+   row0 = _mm_load_si128((const __m128i *) (data + 0*8));
+   row1 = _mm_load_si128((const __m128i *) (data + 1*8));
+   row2 = _mm_load_si128((const __m128i *) (data + 2*8));
+   row3 = _mm_load_si128((const __m128i *) (data + 3*8));
+   row4 = _mm_load_si128((const __m128i *) (data + 4*8));
+   row5 = _mm_load_si128((const __m128i *) (data + 5*8));
+   row6 = _mm_load_si128((const __m128i *) (data + 6*8));
+   row7 = _mm_load_si128((const __m128i *) (data + 7*8));
+
+   // column pass
+   dct_pass(bias_0, 10);
+
+   {
+      // 16bit 8x8 transpose pass 1
+      dct_interleave16(row0, row4);
+      dct_interleave16(row1, row5);
+      dct_interleave16(row2, row6);
+      dct_interleave16(row3, row7);
+
+      // transpose pass 2
+      dct_interleave16(row0, row2);
+      dct_interleave16(row1, row3);
+      dct_interleave16(row4, row6);
+      dct_interleave16(row5, row7);
+
+      // transpose pass 3
+      dct_interleave16(row0, row1);
+      dct_interleave16(row2, row3);
+      dct_interleave16(row4, row5);
+      dct_interleave16(row6, row7);
+   }
+
+   // row pass
+   dct_pass(bias_1, 17);
+
+   {
+      // pack
+      __m128i p0 = _mm_packus_epi16(row0, row1); // a0a1a2a3...a7b0b1b2b3...b7
+      __m128i p1 = _mm_packus_epi16(row2, row3);
+      __m128i p2 = _mm_packus_epi16(row4, row5);
+      __m128i p3 = _mm_packus_epi16(row6, row7);
+
+      // 8bit 8x8 transpose pass 1
+      dct_interleave8(p0, p2); // a0e0a1e1...
+      dct_interleave8(p1, p3); // c0g0c1g1...
+
+      // transpose pass 2
+      dct_interleave8(p0, p1); // a0c0e0g0...
+      dct_interleave8(p2, p3); // b0d0f0h0...
+
+      // transpose pass 3
+      dct_interleave8(p0, p2); // a0b0c0d0...
+      dct_interleave8(p1, p3); // a4b4c4d4...
+
+      // store
+      _mm_storel_epi64((__m128i *) out, p0); out += out_stride;
+      _mm_storel_epi64((__m128i *) out, _mm_shuffle_epi32(p0, 0x4e)); out += out_stride;
+      _mm_storel_epi64((__m128i *) out, p2); out += out_stride;
+      _mm_storel_epi64((__m128i *) out, _mm_shuffle_epi32(p2, 0x4e)); out += out_stride;
+      _mm_storel_epi64((__m128i *) out, p1); out += out_stride;
+      _mm_storel_epi64((__m128i *) out, _mm_shuffle_epi32(p1, 0x4e)); out += out_stride;
+      _mm_storel_epi64((__m128i *) out, p3); out += out_stride;
+      _mm_storel_epi64((__m128i *) out, _mm_shuffle_epi32(p3, 0x4e));
+   }
+
+#undef dct_const
+#undef dct_rot
+#undef dct_widen
+#undef dct_bfly32o
+#undef dct_interleave8
+#undef dct_interleave16
+#undef dct_pass
+}
+
+#endif // STBI_AVX2
+
 #ifdef STBI_NEON
 
 // NEON integer IDCT. should produce bit-identical
@@ -2912,34 +4044,211 @@ static void stbi__jpeg_reset(stbi__jpeg *j)
    // since we don't even allow 1<<30 pixels
 }
 
-static int stbi__parse_entropy_coded_data(stbi__jpeg *z)
+// inverse transform block bx, by of component n into its place in the
+// component buffer, which is 1/2^scale size when decoding scaled
+static void stbi__jpeg_idct(stbi__jpeg *z, int n, int bx, int by, short data[64])
 {
-   stbi__jpeg_reset(z);
-   if (!z->progressive) {
-      if (z->scan_n == 1) {
-         int i,j;
-         STBI_SIMD_ALIGN(short, data[64]);
-         int n = z->order[0];
-         // non-interleaved data, we just need to process one block at a time,
-         // in trivial scanline order
-         // number of blocks to do just depends on how many actual "pixels" this
-         // component has, independent of interleaved MCU blocking and such
-         int w = (z->img_comp[n].x+7) >> 3;
-         int h = (z->img_comp[n].y+7) >> 3;
-         for (j=0; j < h; ++j) {
-            for (i=0; i < w; ++i) {
-               int ha = z->img_comp[n].ha;
+   int size = 8 >> z->scale;
+   int stride = z->img_comp[n].w2 >> z->scale;
+   stbi_uc *out;
+   if (z->img_comp[n].ring) by %= z->img_comp[n].ring;
+   out = z->img_comp[n].data + stride*by*size + bx*size;
+   switch (z->scale) {
+      case 0: z->idct_block_kernel(out, stride, data); break;
+      case 1: z->idct_4x4_kernel(out, stride, data); break;
+      case 2: stbi__idct_2x2(out, stride, data); break;
+      default: stbi__idct_1x1(out, stride, data); break;
+   }
+}
+
+// a decoded baseline block: kept for stbi__jpeg_finish when the component
+// has coefficient storage, else transformed now
+static void stbi__jpeg_block_done(stbi__jpeg *z, int n, int bx, int by, short data[64])
+{
+   if (z->img_comp[n].coeff)
+      memcpy(z->img_comp[n].coeff + 64 * (bx + by * z->img_comp[n].coeff_w), data, 64 * sizeof(short));
+   else
+      stbi__jpeg_idct(z, n, bx, by, data);
+}
+
+// decode units [first, last) of a baseline scan without restarts in
+// between. a unit is an MCU, or a block for a single component scan
+static int stbi__jpeg_decode_units(stbi__jpeg *z, int first, int last)
+{
+   int u,k,x,y;
+   STBI_SIMD_ALIGN(short, data[64]);
+   if (z->scan_n == 1) {
+      int n = z->order[0], ha = z->img_comp[n].ha;
+      int w = (z->img_comp[n].x+7) >> 3;
+      for (u=first; u < last; ++u) {
+         if (!stbi__jpeg_decode_block(z, data, z->huff_dc+z->img_comp[n].hd, z->huff_ac+ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
+         stbi__jpeg_block_done(z, n, u % w, u / w, data);
+      }
+      return 1;
+   }
+   for (u=first; u < last; ++u) {
+      int i = u % z->img_mcu_x, j = u / z->img_mcu_x;
+      for (k=0; k < z->scan_n; ++k) {
+         int n = z->order[k], ha = z->img_comp[n].ha;
+         for (y=0; y < z->img_comp[n].v; ++y) {
+            for (x=0; x < z->img_comp[n].h; ++x) {
                if (!stbi__jpeg_decode_block(z, data, z->huff_dc+z->img_comp[n].hd, z->huff_ac+ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
-               z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*j*8+i*8, z->img_comp[n].w2, data);
-               // every data block is an MCU, so countdown the restart interval
-               if (--z->todo <= 0) {
-                  if (z->code_bits < 24) stbi__grow_buffer_unsafe(z);
-                  // if it's NOT a restart, then just bail, so we get corrupt data
-                  // rather than no data
+               stbi__jpeg_block_done(z, n, i*z->img_comp[n].h + x, j*z->img_comp[n].v + y, data);
+            }
+         }
+      }
+   }
+   return 1;
+}
+
+// find where each restart interval of the scan at the current position
+// starts, starts[intervals] being the marker after the scan. on success
+// that marker is consumed into z->marker
+static int stbi__jpeg_find_restarts(stbi__jpeg *z, stbi_uc **starts, int intervals)
+{
+   stbi_uc *p = z->s->img_buffer, *end = z->s->img_buffer_end;
+   int found = 0;
+   starts[0] = p;
+   for (;;) {
+      stbi_uc *ff = (stbi_uc *) memchr(p, 0xff, end - p);
+      if (!ff) return 0;
+      p = ff + 1;
+      while (p < end && *p == 0xff) ++p; // fill bytes
+      if (p == end) return 0;
+      if (*p == 0) { ++p; continue; } // stuffed 0xff data byte
+      if (STBI__RESTART(*p)) {
+         if (*p != 0xd0 + (found & 7) || ++found == intervals) return 0;
+         starts[found] = ++p;
+         continue;
+      }
+      if (found != intervals - 1) return 0;
+      starts[intervals] = ff;
+      z->marker = *p;
+      z->s->img_buffer = p + 1;
+      return 1;
+   }
+}
+
+typedef struct
+{
+   stbi__jpeg *z;
+   stbi_uc **starts;
+   stbi_uc *failed; // per interval
+   int units;
+} stbi__jpeg_intervals;
+
+static void stbi__jpeg_decode_intervals(void *arg, int task, int first, int last)
+{
+   stbi__jpeg_intervals *p = (stbi__jpeg_intervals *) arg;
+   stbi__jpeg z; // on the stack like stbi__zbuf, so tasks never allocate
+   stbi__context s;
+   int k, size = p->z->restart_interval;
+   STBI_NOTUSED(task);
+   // each task has its own bit reader and DC predictors
+   memcpy(&z, p->z, sizeof(z));
+   z.s = &s;
+   for (k=first; k < last; ++k) {
+      int u0 = k * size, u1 = u0 + size < p->units ? u0 + size : p->units;
+      stbi__start_mem(&s, p->starts[k], (int) (p->starts[k+1] - p->starts[k]));
+      stbi__jpeg_reset(&z);
+      if (!stbi__jpeg_decode_units(&z, u0, u1)) p->failed[k] = 1;
+   }
+}
+
+// entropy decode a baseline scan from memory one group of restart intervals
+// per task, returns 0 to leave it to the serial decoder with the position
+// unchanged
+static int stbi__jpeg_parallel_scan(stbi__jpeg *z)
+{
+   stbi__jpeg_intervals p;
+   stbi_uc *scan = z->s->img_buffer;
+   int k, intervals, tasks, ok;
+   if (!z->restart_interval || z->s->read_from_callbacks || z->img_comp[0].ring) return 0;
+   if ((stbi__uint32) z->s->img_x * z->s->img_y < STBI__PARALLEL_MIN_PIXELS) return 0;
+   if (z->scan_n == 1) {
+      int n = z->order[0];
+      p.units = ((z->img_comp[n].x+7) >> 3) * ((z->img_comp[n].y+7) >> 3);
+   } else {
+      p.units = z->img_mcu_x * z->img_mcu_y;
+   }
+   intervals = (p.units + z->restart_interval - 1) / z->restart_interval;
+   tasks = stbi__parallel_tasks(z, intervals, 1);
+   if (tasks < 2) return 0;
+
+   p.z = z;
+   p.starts = (stbi_uc **) stbi__malloc_mad2(intervals + 1, sizeof(stbi_uc *) + 1, 0);
+   if (!p.starts) return 0;
+   p.failed = (stbi_uc *) (p.starts + intervals + 1);
+   memset(p.failed, 0, intervals + 1);
+   ok = stbi__jpeg_find_restarts(z, p.starts, intervals);
+   if (ok) {
+      stbi__parallel_ranges_run(z, stbi__jpeg_decode_intervals, &p, intervals, tasks);
+      for (k=0; k < intervals; ++k)
+         if (p.failed[k]) ok = 0;
+   }
+   stbi__free(p.starts);
+   if (!ok) {
+      // corrupt or unusual restarts, the serial decoder knows how to cope
+      z->s->img_buffer = scan;
+      z->marker = STBI__MARKER_none;
+   }
+   return ok;
+}
+
+// give the components of a large baseline scan coefficient storage, so
+// their IDCTs run in parallel in stbi__jpeg_finish. on failure they are
+// transformed as they are decoded
+static void stbi__jpeg_defer_idct(stbi__jpeg *z)
+{
+   int k;
+   if ((stbi__uint32) z->s->img_x * z->s->img_y < STBI__PARALLEL_MIN_PIXELS) return;
+   if (stbi__parallel_tasks(z, z->img_mcu_y, 1) < 2 || z->img_comp[0].ring) return;
+   for (k=0; k < z->scan_n; ++k) {
+      int n = z->order[k];
+      if (z->img_comp[n].coeff) continue;
+      z->img_comp[n].coeff_w = z->img_comp[n].w2 / 8;
+      z->img_comp[n].coeff_h = z->img_comp[n].h2 / 8;
+      z->img_comp[n].raw_coeff = stbi__malloc_mad3(z->img_comp[n].w2, z->img_comp[n].h2, sizeof(short), 15);
+      if (z->img_comp[n].raw_coeff)
+         z->img_comp[n].coeff = (short*) (((size_t) z->img_comp[n].raw_coeff + 15) & ~15);
+   }
+}
+
+// hand the output rows that mcu_rows decoded rows of MCUs complete to the
+// row callback, all of them for -1
+static int stbi__jpeg_stream_rows(stbi__jpeg *z, int mcu_rows);
+
+static int stbi__parse_entropy_coded_data(stbi__jpeg *z)
+{
+   stbi__jpeg_reset(z);
+   if (!z->progressive) {
+      if (stbi__jpeg_parallel_scan(z)) return 1;
+      stbi__jpeg_defer_idct(z);
+      if (z->scan_n == 1) {
+         int i,j;
+         STBI_SIMD_ALIGN(short, data[64]);
+         int n = z->order[0];
+         // non-interleaved data, we just need to process one block at a time,
+         // in trivial scanline order
+         // number of blocks to do just depends on how many actual "pixels" this
+         // component has, independent of interleaved MCU blocking and such
+         int w = (z->img_comp[n].x+7) >> 3;
+         int h = (z->img_comp[n].y+7) >> 3;
+         for (j=0; j < h; ++j) {
+            for (i=0; i < w; ++i) {
+               int ha = z->img_comp[n].ha;
+               if (!stbi__jpeg_decode_block(z, data, z->huff_dc+z->img_comp[n].hd, z->huff_ac+ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
+               stbi__jpeg_block_done(z, n, i, j, data);
+               // every data block is an MCU, so countdown the restart interval
+               if (--z->todo <= 0) {
+                  if (z->code_bits < 24) stbi__grow_buffer_unsafe(z);
+                  // if it's NOT a restart, then just bail, so we get corrupt data
+                  // rather than no data
                   if (!STBI__RESTART(z->marker)) return 1;
                   stbi__jpeg_reset(z);
                }
             }
+            if (z->img_comp[n].ring && !stbi__jpeg_stream_rows(z, j+1)) return 0;
          }
          return 1;
       } else { // interleaved
@@ -2954,11 +4263,11 @@ static int stbi__parse_entropy_coded_data(stbi__jpeg *z)
                   // by the basic H and V specified for the component
                   for (y=0; y < z->img_comp[n].v; ++y) {
                      for (x=0; x < z->img_comp[n].h; ++x) {
-                        int x2 = (i*z->img_comp[n].h + x)*8;
-                        int y2 = (j*z->img_comp[n].v + y)*8;
+                        int x2 = i*z->img_comp[n].h + x;
+                        int y2 = j*z->img_comp[n].v + y;
                         int ha = z->img_comp[n].ha;
                         if (!stbi__jpeg_decode_block(z, data, z->huff_dc+z->img_comp[n].hd, z->huff_ac+ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
-                        z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*y2+x2, z->img_comp[n].w2, data);
+                        stbi__jpeg_block_done(z, n, x2, y2, data);
                      }
                   }
                }
@@ -2970,6 +4279,7 @@ static int stbi__parse_entropy_coded_data(stbi__jpeg *z)
                   stbi__jpeg_reset(z);
                }
             }
+            if (z->img_comp[0].ring && !stbi__jpeg_stream_rows(z, j+1)) return 0;
          }
          return 1;
       }
@@ -3043,25 +4353,44 @@ static void stbi__jpeg_dequantize(short *data, stbi__uint16 *dequant)
       data[i] *= dequant[i];
 }
 
-static void stbi__jpeg_finish(stbi__jpeg *z)
-{
-   if (z->progressive) {
-      // dequantize and idct the data
-      int i,j,n;
-      for (n=0; n < z->s->img_n; ++n) {
-         int w = (z->img_comp[n].x+7) >> 3;
-         int h = (z->img_comp[n].y+7) >> 3;
-         for (j=0; j < h; ++j) {
-            for (i=0; i < w; ++i) {
-               short *data = z->img_comp[n].coeff + 64 * (i + j * z->img_comp[n].coeff_w);
+// block rows [first, last) counting through the rows of every component
+static void stbi__jpeg_finish_rows(void *arg, int task, int first, int last)
+{
+   stbi__jpeg *z = (stbi__jpeg *) arg;
+   int i,j,n,row = 0;
+   STBI_NOTUSED(task);
+   for (n=0; n < z->s->img_n; ++n) {
+      int w = (z->img_comp[n].x+7) >> 3;
+      int h = (z->img_comp[n].y+7) >> 3;
+      if (!z->img_comp[n].coeff) { row += h; continue; }
+      for (j=0; j < h; ++j, ++row) {
+         if (row < first || row >= last) continue;
+         for (i=0; i < w; ++i) {
+            short *data = z->img_comp[n].coeff + 64 * (i + j * z->img_comp[n].coeff_w);
+            // baseline blocks were dequantized while decoding
+            if (z->progressive)
                stbi__jpeg_dequantize(data, z->dequant[z->img_comp[n].tq]);
-               z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*j*8+i*8, z->img_comp[n].w2, data);
-            }
+            stbi__jpeg_idct(z, n, i, j, data);
          }
       }
    }
 }
 
+static void stbi__jpeg_finish(stbi__jpeg *z)
+{
+   // dequantize and idct the blocks kept as coefficients
+   int n, tasks, rows = 0, blocks = 0;
+   for (n=0; n < z->s->img_n; ++n) {
+      if (!z->img_comp[n].coeff) continue;
+      rows += (z->img_comp[n].y+7) >> 3;
+      blocks += ((z->img_comp[n].x+7) >> 3) * ((z->img_comp[n].y+7) >> 3);
+   }
+   if (rows == 0) return;
+   // tasks of at least 4096 blocks
+   tasks = stbi__parallel_tasks(z, blocks, 4096);
+   stbi__parallel_ranges_run(z, stbi__jpeg_finish_rows, z, rows, tasks < rows ? tasks : rows);
+}
+
 static int stbi__process_marker(stbi__jpeg *z, int m)
 {
    int L;
@@ -3209,17 +4538,17 @@ static int stbi__free_jpeg_components(stbi__jpeg *z, int ncomp, int why)
    int i;
    for (i=0; i < ncomp; ++i) {
       if (z->img_comp[i].raw_data) {
-         STBI_FREE(z->img_comp[i].raw_data);
+         stbi__free(z->img_comp[i].raw_data);
          z->img_comp[i].raw_data = NULL;
          z->img_comp[i].data = NULL;
       }
       if (z->img_comp[i].raw_coeff) {
-         STBI_FREE(z->img_comp[i].raw_coeff);
+         stbi__free(z->img_comp[i].raw_coeff);
          z->img_comp[i].raw_coeff = 0;
          z->img_comp[i].coeff = 0;
       }
       if (z->img_comp[i].linebuf) {
-         STBI_FREE(z->img_comp[i].linebuf);
+         stbi__free(z->img_comp[i].linebuf);
          z->img_comp[i].linebuf = NULL;
       }
    }
@@ -3299,7 +4628,10 @@ static int stbi__process_frame_header(stbi__jpeg *z, int scan)
       z->img_comp[i].coeff = 0;
       z->img_comp[i].raw_coeff = 0;
       z->img_comp[i].linebuf = NULL;
-      z->img_comp[i].raw_data = stbi__malloc_mad2(z->img_comp[i].w2, z->img_comp[i].h2, 15);
+      // decoding a baseline image by rows keeps two MCU rows at a time
+      z->img_comp[i].ring = z->stream && !z->progressive && z->img_mcu_y > 2 ? 2 * z->img_comp[i].v : 0;
+      // a scaled decode only keeps the reduced blocks
+      z->img_comp[i].raw_data = stbi__malloc_mad2(z->img_comp[i].w2 >> z->scale, (z->img_comp[i].ring ? z->img_comp[i].ring * 8 : z->img_comp[i].h2) >> z->scale, 15);
       if (z->img_comp[i].raw_data == NULL)
          return stbi__free_jpeg_components(z, i+1, stbi__err("outofmem", "Out of memory"));
       // align blocks for idct using mmx/sse
@@ -3352,6 +4684,25 @@ static int stbi__decode_jpeg_header(stbi__jpeg *z, int scan)
 }
 
 // decode image to YCbCr format
+// step over a scan's entropy-coded data to the marker after it
+static void stbi__jpeg_skip_scan(stbi__jpeg *j)
+{
+   while (!stbi__at_eof(j->s)) {
+      int x = stbi__get8(j->s);
+      if (x != 255) continue;
+      do x = stbi__get8(j->s); while (x == 255);
+      // 0xff00 is a stuffed byte, restarts are part of the scan
+      if (x != 0 && !STBI__RESTART(x)) {
+         j->marker = (unsigned char) x;
+         return;
+      }
+   }
+}
+
+// set up decoding by rows at the start of a scan: 1 to skip the scan, -1
+// on error
+static int stbi__jpeg_stream_scan(stbi__jpeg *z);
+
 static int stbi__decode_jpeg_image(stbi__jpeg *j)
 {
    int m;
@@ -3364,8 +4715,17 @@ static int stbi__decode_jpeg_image(stbi__jpeg *j)
    m = stbi__get_marker(j);
    while (!stbi__EOI(m)) {
       if (stbi__SOS(m)) {
+         int skip = 0;
          if (!stbi__process_scan_header(j)) return 0;
-         if (!stbi__parse_entropy_coded_data(j)) return 0;
+         if (j->stream && (skip = stbi__jpeg_stream_scan(j)) < 0) return 0;
+         if (skip) {
+            stbi__jpeg_skip_scan(j);
+         } else if (j->progressive && j->scale == 3 && j->spec_start != 0) {
+            // a 1/8 decode only needs DC. smaller scales cannot skip the
+            // bands they drop, refinement scans usually span into them and
+            // need to know which of those coefficients are nonzero
+            stbi__jpeg_skip_scan(j);
+         } else if (!stbi__parse_entropy_coded_data(j)) return 0;
          if (j->marker == STBI__MARKER_none ) {
             // handle 0s at the end of image data from IP Kamera 9060
             while (!stbi__at_eof(j->s)) {
@@ -3387,8 +4747,7 @@ static int stbi__decode_jpeg_image(stbi__jpeg *j)
       }
       m = stbi__get_marker(j);
    }
-   if (j->progressive)
-      stbi__jpeg_finish(j);
+   stbi__jpeg_finish(j);
    return 1;
 }
 
@@ -3589,6 +4948,85 @@ static stbi_uc *stbi__resample_row_hv_2_simd(stbi_uc *out, stbi_uc *in_near, stb
 }
 #endif
 
+#ifdef STBI_AVX2
+// the sse2 filter above, 16 pixels at a time
+STBI__AVX2_TARGET static stbi_uc *stbi__resample_row_hv_2_avx2(stbi_uc *out, stbi_uc *in_near, stbi_uc *in_far, int w, int hs)
+{
+   // need to generate 2x2 samples for every one in input
+   int i=0,t0,t1;
+
+   if (w == 1) {
+      out[0] = out[1] = stbi__div4(3*in_near[0] + in_far[0] + 2);
+      return out;
+   }
+
+   t1 = 3*in_near[0] + in_far[0];
+   // process groups of 16 pixels for as long as we can.
+   // note we can't handle the last pixel in a row in this loop
+   // because we need to handle the filter boundary conditions.
+   for (; i < ((w-1) & ~15); i += 16) {
+      // load and perform the vertical filtering pass
+      // this uses 3*x + y = 4*x + (y - x)
+      __m256i farw  = _mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i *) (in_far + i)));
+      __m256i nearw = _mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i *) (in_near + i)));
+      __m256i diff  = _mm256_sub_epi16(farw, nearw);
+      __m256i nears = _mm256_slli_epi16(nearw, 2);
+      __m256i curr  = _mm256_add_epi16(nears, diff); // current row
+
+      // "prev" is current row shifted right by 1 pixel with the previous
+      // pixel value (from t1) inserted, "next" is shifted left by 1 pixel
+      // with the first pixel of the next block of 16 added in. the shifts
+      // cross the 128-bit lanes through a lane permute.
+      __m256i prv0 = _mm256_alignr_epi8(curr, _mm256_permute2x128_si256(curr, curr, 0x08), 14);
+      __m256i nxt0 = _mm256_alignr_epi8(_mm256_permute2x128_si256(curr, curr, 0x81), curr, 2);
+      __m256i prev = _mm256_insert_epi16(prv0, (short) t1, 0);
+      __m256i next = _mm256_insert_epi16(nxt0, (short) (3*in_near[i+16] + in_far[i+16]), 15);
+
+      // horizontal filter, polyphase implementation since it's convenient:
+      // even pixels = 3*cur + prev = cur*4 + (prev - cur)
+      // odd  pixels = 3*cur + next = cur*4 + (next - cur)
+      // note the shared term.
+      __m256i bias = _mm256_set1_epi16(8);
+      __m256i curs = _mm256_slli_epi16(curr, 2);
+      __m256i prvd = _mm256_sub_epi16(prev, curr);
+      __m256i nxtd = _mm256_sub_epi16(next, curr);
+      __m256i curb = _mm256_add_epi16(curs, bias);
+      __m256i even = _mm256_add_epi16(prvd, curb);
+      __m256i odd  = _mm256_add_epi16(nxtd, curb);
+
+      // interleave even and odd pixels, then undo scaling. the unpacks and
+      // the pack all work within lanes, so the bytes come out in order.
+      __m256i int0 = _mm256_unpacklo_epi16(even, odd);
+      __m256i int1 = _mm256_unpackhi_epi16(even, odd);
+      __m256i de0  = _mm256_srli_epi16(int0, 4);
+      __m256i de1  = _mm256_srli_epi16(int1, 4);
+
+      // pack and write output
+      __m256i outv = _mm256_packus_epi16(de0, de1);
+      _mm256_storeu_si256((__m256i *) (out + i*2), outv);
+
+      // "previous" value for next iter
+      t1 = 3*in_near[i+15] + in_far[i+15];
+   }
+
+   t0 = t1;
+   t1 = 3*in_near[i] + in_far[i];
+   out[i*2] = stbi__div16(3*t1 + t0 + 8);
+
+   for (++i; i < w; ++i) {
+      t0 = t1;
+      t1 = 3*in_near[i]+in_far[i];
+      out[i*2-1] = stbi__div16(3*t0 + t1 + 8);
+      out[i*2  ] = stbi__div16(3*t1 + t0 + 8);
+   }
+   out[w*2-1] = stbi__div4(t1+2);
+
+   STBI_NOTUSED(hs);
+
+   return out;
+}
+#endif
+
 static stbi_uc *stbi__resample_row_generic(stbi_uc *out, stbi_uc *in_near, stbi_uc *in_far, int w, int hs)
 {
    // resample with nearest-neighbor
@@ -3763,25 +5201,140 @@ static void stbi__YCbCr_to_RGB_simd(stbi_uc *out, stbi_uc const *y, stbi_uc cons
 }
 #endif
 
+#ifdef STBI_AVX2
+// the sse2 conversion above, 16 pixels at a time. step == 3 is handled as
+// well, by dropping the alpha bytes with a shuffle before storing.
+STBI__AVX2_TARGET static void stbi__YCbCr_to_RGB_avx2(stbi_uc *out, stbi_uc const *y, stbi_uc const *pcb, stbi_uc const *pcr, int count, int step)
+{
+   int i = 0;
+
+   if (step == 3 || step == 4) {
+      __m128i signflip  = _mm_set1_epi8(-0x80);
+      __m256i cr_const0 = _mm256_set1_epi16(   (short) ( 1.40200f*4096.0f+0.5f));
+      __m256i cr_const1 = _mm256_set1_epi16( - (short) ( 0.71414f*4096.0f+0.5f));
+      __m256i cb_const0 = _mm256_set1_epi16( - (short) ( 0.34414f*4096.0f+0.5f));
+      __m256i cb_const1 = _mm256_set1_epi16(   (short) ( 1.77200f*4096.0f+0.5f));
+      __m256i y_bias = _mm256_set1_epi16(128);
+      __m256i xw = _mm256_set1_epi16(255); // alpha channel
+      // rgbx rgbx rgbx rgbx -> rgb rgb rgb rgb, in each lane
+      __m256i drop_x = _mm256_setr_epi8(0,1,2,4,5,6,8,9,10,12,13,14,-1,-1,-1,-1,
+                                        0,1,2,4,5,6,8,9,10,12,13,14,-1,-1,-1,-1);
+
+      for (; i+15 < count; i += 16) {
+         // load and widen to short, cr and cb centered and left-shifted by 8
+         __m256i y_words = _mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i *) (y+i)));
+         __m128i cr_bytes = _mm_loadu_si128((__m128i *) (pcr+i));
+         __m128i cb_bytes = _mm_loadu_si128((__m128i *) (pcb+i));
+         __m256i crw = _mm256_slli_epi16(_mm256_cvtepi8_epi16(_mm_xor_si128(cr_bytes, signflip)), 8);
+         __m256i cbw = _mm256_slli_epi16(_mm256_cvtepi8_epi16(_mm_xor_si128(cb_bytes, signflip)), 8);
+         __m256i yw  = _mm256_or_si256(_mm256_slli_epi16(y_words, 8), y_bias);
+
+         // color transform
+         __m256i yws = _mm256_srli_epi16(yw, 4);
+         __m256i cr0 = _mm256_mulhi_epi16(cr_const0, crw);
+         __m256i cb0 = _mm256_mulhi_epi16(cb_const0, cbw);
+         __m256i cb1 = _mm256_mulhi_epi16(cbw, cb_const1);
+         __m256i cr1 = _mm256_mulhi_epi16(crw, cr_const1);
+         __m256i rws = _mm256_add_epi16(cr0, yws);
+         __m256i gwt = _mm256_add_epi16(cb0, yws);
+         __m256i bws = _mm256_add_epi16(yws, cb1);
+         __m256i gws = _mm256_add_epi16(gwt, cr1);
+
+         // descale
+         __m256i rw = _mm256_srai_epi16(rws, 4);
+         __m256i bw = _mm256_srai_epi16(bws, 4);
+         __m256i gw = _mm256_srai_epi16(gws, 4);
+
+         // back to byte, set up for transpose. everything works within
+         // lanes, so lane 0 holds pixels 0-7 and lane 1 pixels 8-15
+         __m256i brb = _mm256_packus_epi16(rw, bw);
+         __m256i gxb = _mm256_packus_epi16(gw, xw);
+
+         // transpose to interleave channels
+         __m256i t0 = _mm256_unpacklo_epi8(brb, gxb);
+         __m256i t1 = _mm256_unpackhi_epi8(brb, gxb);
+         __m256i o0 = _mm256_unpacklo_epi16(t0, t1); // pixels 0-3, 8-11
+         __m256i o1 = _mm256_unpackhi_epi16(t0, t1); // pixels 4-7, 12-15
+
+         if (step == 4) {
+            _mm256_storeu_si256((__m256i *) (out + 0), _mm256_permute2x128_si256(o0, o1, 0x20));
+            _mm256_storeu_si256((__m256i *) (out + 32), _mm256_permute2x128_si256(o0, o1, 0x31));
+            out += 64;
+         } else {
+            // 12 bytes per group of 4 pixels; later stores overwrite the
+            // 4 spare bytes of earlier ones and the last is stored exactly
+            __m256i c0 = _mm256_shuffle_epi8(o0, drop_x);
+            __m256i c1 = _mm256_shuffle_epi8(o1, drop_x);
+            __m128i c3 = _mm256_extracti128_si256(c1, 1);
+            stbi__uint32 last = (stbi__uint32) _mm_cvtsi128_si32(_mm_srli_si128(c3, 8));
+            _mm_storeu_si128((__m128i *) (out + 0), _mm256_castsi256_si128(c0));
+            _mm_storeu_si128((__m128i *) (out + 12), _mm256_castsi256_si128(c1));
+            _mm_storeu_si128((__m128i *) (out + 24), _mm256_extracti128_si256(c0, 1));
+            _mm_storel_epi64((__m128i *) (out + 36), c3);
+            memcpy(out + 44, &last, 4);
+            out += 48;
+         }
+      }
+   }
+
+   for (; i < count; ++i) {
+      int y_fixed = (y[i] << 20) + (1<<19); // rounding
+      int r,g,b;
+      int cr = pcr[i] - 128;
+      int cb = pcb[i] - 128;
+      r = y_fixed + cr* stbi__float2fixed(1.40200f);
+      g = y_fixed + cr*-stbi__float2fixed(0.71414f) + ((cb*-stbi__float2fixed(0.34414f)) & 0xffff0000);
+      b = y_fixed                                   +   cb* stbi__float2fixed(1.77200f);
+      r >>= 20;
+      g >>= 20;
+      b >>= 20;
+      if ((unsigned) r > 255) { if (r < 0) r = 0; else r = 255; }
+      if ((unsigned) g > 255) { if (g < 0) g = 0; else g = 255; }
+      if ((unsigned) b > 255) { if (b < 0) b = 0; else b = 255; }
+      out[0] = (stbi_uc)r;
+      out[1] = (stbi_uc)g;
+      out[2] = (stbi_uc)b;
+      out[3] = 255;
+      out += step;
+   }
+}
+#endif
+
 // set up the kernels
 static void stbi__setup_jpeg(stbi__jpeg *j)
 {
+   j->scale = 0;
+   j->stream = NULL;
+   j->parallel_for = stbi__parallel_for_run;
+   j->parallel_for_user = stbi__parallel_for_user;
    j->idct_block_kernel = stbi__idct_block;
+   j->idct_4x4_kernel = stbi__idct_4x4;
    j->YCbCr_to_RGB_kernel = stbi__YCbCr_to_RGB_row;
    j->resample_row_hv_2_kernel = stbi__resample_row_hv_2;
 
 #ifdef STBI_SSE2
-   if (stbi__sse2_available()) {
+   if (stbi__jpeg_simd_level >= 1 && stbi__sse2_available()) {
       j->idct_block_kernel = stbi__idct_simd;
+      j->idct_4x4_kernel = stbi__idct_4x4_simd;
       j->YCbCr_to_RGB_kernel = stbi__YCbCr_to_RGB_simd;
       j->resample_row_hv_2_kernel = stbi__resample_row_hv_2_simd;
    }
 #endif
 
+#ifdef STBI_AVX2
+   if (stbi__jpeg_simd_level >= 2 && stbi__avx2_available()) {
+      j->idct_block_kernel = stbi__idct_avx2;
+      j->YCbCr_to_RGB_kernel = stbi__YCbCr_to_RGB_avx2;
+      j->resample_row_hv_2_kernel = stbi__resample_row_hv_2_avx2;
+   }
+#endif
+
 #ifdef STBI_NEON
-   j->idct_block_kernel = stbi__idct_simd;
-   j->YCbCr_to_RGB_kernel = stbi__YCbCr_to_RGB_simd;
-   j->resample_row_hv_2_kernel = stbi__resample_row_hv_2_simd;
+   if (stbi__jpeg_simd_level >= 1) {
+      j->idct_block_kernel = stbi__idct_simd;
+      j->YCbCr_to_RGB_kernel = stbi__YCbCr_to_RGB_simd;
+      j->resample_row_hv_2_kernel = stbi__resample_row_hv_2_simd;
+   }
 #endif
 }
 
@@ -3801,6 +5354,21 @@ typedef struct
    int ypos;    // which pre-expansion row we're on
 } stbi__resample;
 
+// move component k's resampler down an output row
+static void stbi__resample_step(stbi__jpeg *z, stbi__resample *r, int k)
+{
+   if (++r->ystep >= r->vs) {
+      r->ystep = 0;
+      r->line0 = r->line1;
+      if (++r->ypos < z->img_comp[k].y) {
+         if (z->img_comp[k].ring && r->ypos % (z->img_comp[k].ring * 8) == 0)
+            r->line1 = z->img_comp[k].data; // wrap around the ring
+         else
+            r->line1 += z->img_comp[k].w2;
+      }
+   }
+}
+
 // fast 0..255 * 0..255 => 0..255 rounded multiplication
 static stbi_uc stbi__blinn_8x8(stbi_uc x, stbi_uc y)
 {
@@ -3808,9 +5376,186 @@ static stbi_uc stbi__blinn_8x8(stbi_uc x, stbi_uc y)
    return (stbi_uc) ((t + (t >>8)) >> 8);
 }
 
-static stbi_uc *load_jpeg_image(stbi__jpeg *z, int *out_x, int *out_y, int *comp, int req_comp)
+typedef struct
 {
+   stbi__jpeg *z;
+   stbi__resample res_comp[4]; // at row0
+   stbi_uc *output;            // row0 onwards
+   int row0;
+   int flip, bgr;              // row j lands at img_y-1-j; red and blue swapped
+   stbi_uc *linebufs; // per task, a line buffer per component and a row
+   size_t task_bytes;
    int n, decode_n, is_rgb;
+} stbi__jpeg_convert;
+
+// resample and color-convert output rows [first, last)
+static void stbi__jpeg_convert_rows(void *arg, int task, int first, int last)
+{
+   stbi__jpeg_convert *c = (stbi__jpeg_convert *) arg;
+   stbi__jpeg *z = c->z;
+   int k, n = c->n, decode_n = c->decode_n, is_rgb = c->is_rgb;
+   unsigned int i,j;
+   stbi_uc *coutput[4] = { NULL, NULL, NULL, NULL };
+   stbi_uc *linebuf[4], *last_row;
+   stbi__resample res_comp[4];
+
+   for (k=0; k < decode_n; ++k) {
+      res_comp[k] = c->res_comp[k];
+      linebuf[k] = c->linebufs + (size_t) task * c->task_bytes + (size_t) k * (z->s->img_x + 3);
+   }
+   last_row = c->linebufs + (size_t) task * c->task_bytes + (size_t) decode_n * (z->s->img_x + 3);
+   // step the resamplers to the first row of the band
+   for (j=c->row0; j < (unsigned int) first; ++j)
+      for (k=0; k < decode_n; ++k)
+         stbi__resample_step(z, &res_comp[k], k);
+
+   for (j=first; j < (unsigned int) last; ++j) {
+      stbi_uc *row = c->output + n * z->s->img_x * (c->flip ? z->s->img_y - 1 - j : j - c->row0);
+      // writing 3 channels can store a byte past the row. for the last row
+      // of a band that is the next band's or past the image, flipped it is
+      // the row above's, already written. those rows go via a copy
+      stbi_uc *out = (c->flip ? n == 3 : j+1 == (unsigned int) last) ? last_row : row;
+      stbi_uc *start = out;
+      for (k=0; k < decode_n; ++k) {
+         stbi__resample *r = &res_comp[k];
+         int y_bot = r->ystep >= (r->vs >> 1);
+         coutput[k] = r->resample(linebuf[k],
+                                  y_bot ? r->line1 : r->line0,
+                                  y_bot ? r->line0 : r->line1,
+                                  r->w_lores, r->hs);
+         stbi__resample_step(z, r, k);
+      }
+      if (n >= 3) {
+         stbi_uc *y = coutput[0];
+         if (z->s->img_n == 3) {
+            if (is_rgb) {
+               for (i=0; i < z->s->img_x; ++i) {
+                  out[0] = y[i];
+                  out[1] = coutput[1][i];
+                  out[2] = coutput[2][i];
+                  out[3] = 255;
+                  out += n;
+               }
+            } else {
+               z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
+            }
+         } else if (z->s->img_n == 4) {
+            if (z->app14_color_transform == 0) { // CMYK
+               for (i=0; i < z->s->img_x; ++i) {
+                  stbi_uc m = coutput[3][i];
+                  out[0] = stbi__blinn_8x8(coutput[0][i], m);
+                  out[1] = stbi__blinn_8x8(coutput[1][i], m);
+                  out[2] = stbi__blinn_8x8(coutput[2][i], m);
+                  out[3] = 255;
+                  out += n;
+               }
+            } else if (z->app14_color_transform == 2) { // YCCK
+               z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
+               for (i=0; i < z->s->img_x; ++i) {
+                  stbi_uc m = coutput[3][i];
+                  out[0] = stbi__blinn_8x8(255 - out[0], m);
+                  out[1] = stbi__blinn_8x8(255 - out[1], m);
+                  out[2] = stbi__blinn_8x8(255 - out[2], m);
+                  out += n;
+               }
+            } else { // YCbCr + alpha?  Ignore the fourth channel for now
+               z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
+            }
+         } else
+            for (i=0; i < z->s->img_x; ++i) {
+               out[0] = out[1] = out[2] = y[i];
+               out[3] = 255; // not used if n==3
+               out += n;
+            }
+      } else {
+         if (is_rgb) {
+            if (n == 1)
+               for (i=0; i < z->s->img_x; ++i)
+                  *out++ = stbi__compute_y(coutput[0][i], coutput[1][i], coutput[2][i]);
+            else {
+               for (i=0; i < z->s->img_x; ++i, out += 2) {
+                  out[0] = stbi__compute_y(coutput[0][i], coutput[1][i], coutput[2][i]);
+                  out[1] = 255;
+               }
+            }
+         } else if (z->s->img_n == 4 && z->app14_color_transform == 0) {
+            for (i=0; i < z->s->img_x; ++i) {
+               stbi_uc m = coutput[3][i];
+               stbi_uc r = stbi__blinn_8x8(coutput[0][i], m);
+               stbi_uc g = stbi__blinn_8x8(coutput[1][i], m);
+               stbi_uc b = stbi__blinn_8x8(coutput[2][i], m);
+               out[0] = stbi__compute_y(r, g, b);
+               out[1] = 255;
+               out += n;
+            }
+         } else if (z->s->img_n == 4 && z->app14_color_transform == 2) {
+            for (i=0; i < z->s->img_x; ++i) {
+               out[0] = stbi__blinn_8x8(255 - coutput[0][i], coutput[3][i]);
+               out[1] = 255;
+               out += n;
+            }
+         } else {
+            stbi_uc *y = coutput[0];
+            if (n == 1)
+               for (i=0; i < z->s->img_x; ++i) out[i] = y[i];
+            else
+               for (i=0; i < z->s->img_x; ++i) { *out++ = y[i]; *out++ = 255; }
+         }
+      }
+      if (c->bgr && n >= 3)
+         stbi__finish_row(row, start, z->s->img_x, n, 1, 0);
+      else if (start != row)
+         memcpy(row, start, n * z->s->img_x);
+   }
+}
+
+// pick the output channels and put the resamplers at row 0, for the image
+// as decoded. line buffers and output are left to the caller
+static void stbi__jpeg_convert_setup(stbi__jpeg *z, stbi__jpeg_convert *c, int req_comp)
+{
+   int k;
+   c->z = z;
+   c->row0 = 0;
+   c->flip = 0;
+   c->bgr = stbi__bgr_on_load;
+
+   // determine actual number of components to generate
+   c->n = req_comp ? req_comp : z->s->img_n >= 3 ? 3 : 1;
+
+   c->is_rgb = z->s->img_n == 3 && (z->rgb == 3 || (z->app14_color_transform == 0 && !z->jfif));
+
+   if (z->s->img_n == 3 && c->n < 3 && !c->is_rgb)
+      c->decode_n = 1;
+   else
+      c->decode_n = z->s->img_n;
+
+   for (k=0; k < c->decode_n; ++k) {
+      stbi__resample *r = &c->res_comp[k];
+
+      r->hs      = z->img_h_max / z->img_comp[k].h;
+      r->vs      = z->img_v_max / z->img_comp[k].v;
+      r->ystep   = r->vs >> 1;
+      r->w_lores = (z->s->img_x + r->hs-1) / r->hs;
+      r->ypos    = 0;
+      r->line0   = r->line1 = z->img_comp[k].data;
+
+      if      (r->hs == 1 && r->vs == 1) r->resample = resample_row_1;
+      else if (r->hs == 1 && r->vs == 2) r->resample = stbi__resample_row_v_2;
+      else if (r->hs == 2 && r->vs == 1) r->resample = stbi__resample_row_h_2;
+      else if (r->hs == 2 && r->vs == 2) r->resample = z->resample_row_hv_2_kernel;
+      else                               r->resample = stbi__resample_row_generic;
+   }
+
+   // for each band a line buffer per component, big enough for upsampling
+   // off the edges with upsample factor of 4, and an output row
+   c->task_bytes = (size_t) c->decode_n * (z->s->img_x + 3) + c->n * z->s->img_x + 1;
+}
+
+static stbi_uc *load_jpeg_image(stbi__jpeg *z, int *out_x, int *out_y, int *comp, int req_comp)
+{
+   int n;
+   stbi__jpeg_convert c;
+   struct stbi__finish *f = z->s->finish;
    z->s->img_n = 0; // make stbi__cleanup_jpeg safe
 
    // validate req_comp
@@ -3819,150 +5564,55 @@ static stbi_uc *load_jpeg_image(stbi__jpeg *z, int *out_x, int *out_y, int *comp
    // load a jpeg image from whichever source, but leave in YCbCr format
    if (!stbi__decode_jpeg_image(z)) { stbi__cleanup_jpeg(z); return NULL; }
 
-   // determine actual number of components to generate
-   n = req_comp ? req_comp : z->s->img_n >= 3 ? 3 : 1;
-
-   is_rgb = z->s->img_n == 3 && (z->rgb == 3 || (z->app14_color_transform == 0 && !z->jfif));
+   // the components were decoded at 1/2^scale, resample and convert as if
+   // that were the image
+   if (z->scale) {
+      int round = (1 << z->scale) - 1;
+      z->s->img_x = (z->s->img_x + round) >> z->scale;
+      z->s->img_y = (z->s->img_y + round) >> z->scale;
+      for (n=0; n < z->s->img_n; ++n) {
+         z->img_comp[n].x  = (z->img_comp[n].x + round) >> z->scale;
+         z->img_comp[n].y  = (z->img_comp[n].y + round) >> z->scale;
+         z->img_comp[n].w2 >>= z->scale;
+         z->img_comp[n].h2 >>= z->scale;
+      }
+   }
 
-   if (z->s->img_n == 3 && n < 3 && !is_rgb)
-      decode_n = 1;
-   else
-      decode_n = z->s->img_n;
+   stbi__jpeg_convert_setup(z, &c, req_comp);
 
    // nothing to do if no components requested; check this now to avoid
    // accessing uninitialized coutput[0] later
-   if (decode_n <= 0) { stbi__cleanup_jpeg(z); return NULL; }
+   if (c.decode_n <= 0) { stbi__cleanup_jpeg(z); return NULL; }
 
    // resample and color-convert
    {
-      int k;
-      unsigned int i,j;
+      int tasks;
       stbi_uc *output;
-      stbi_uc *coutput[4] = { NULL, NULL, NULL, NULL };
 
-      stbi__resample res_comp[4];
+      // bands of at least 64K pixels
+      tasks = 1;
+      if (z->s->img_x * z->s->img_y >= STBI__PARALLEL_MIN_PIXELS)
+         tasks = stbi__parallel_tasks(z, z->s->img_y, 65536 / z->s->img_x + 1);
 
-      for (k=0; k < decode_n; ++k) {
-         stbi__resample *r = &res_comp[k];
+      z->img_comp[0].linebuf = (stbi_uc *) stbi__malloc_mad2(tasks, (int) c.task_bytes, 0);
+      if (!z->img_comp[0].linebuf) { stbi__cleanup_jpeg(z); return stbi__errpuc("outofmem", "Out of memory"); }
 
-         // allocate line buffer big enough for upsampling off the edges
-         // with upsample factor of 4
-         z->img_comp[k].linebuf = (stbi_uc *) stbi__malloc(z->s->img_x + 3);
-         if (!z->img_comp[k].linebuf) { stbi__cleanup_jpeg(z); return stbi__errpuc("outofmem", "Out of memory"); }
-
-         r->hs      = z->img_h_max / z->img_comp[k].h;
-         r->vs      = z->img_v_max / z->img_comp[k].v;
-         r->ystep   = r->vs >> 1;
-         r->w_lores = (z->s->img_x + r->hs-1) / r->hs;
-         r->ypos    = 0;
-         r->line0   = r->line1 = z->img_comp[k].data;
-
-         if      (r->hs == 1 && r->vs == 1) r->resample = resample_row_1;
-         else if (r->hs == 1 && r->vs == 2) r->resample = stbi__resample_row_v_2;
-         else if (r->hs == 2 && r->vs == 1) r->resample = stbi__resample_row_h_2;
-         else if (r->hs == 2 && r->vs == 2) r->resample = z->resample_row_hv_2_kernel;
-         else                               r->resample = stbi__resample_row_generic;
+      // can't error after this so, this is safe. 8-bit loads get their
+      // final rows straight away, flipped and swapped as they are written
+      if (f) {
+         output = stbi__finish_buffer(f, z->s->img_x, z->s->img_y, c.n);
+         c.flip = f->flip;
+         c.bgr = f->bgr;
+      } else {
+         output = (stbi_uc *) stbi__malloc_mad3(c.n, z->s->img_x, z->s->img_y, 1);
+         c.bgr = 0;
       }
-
-      // can't error after this so, this is safe
-      output = (stbi_uc *) stbi__malloc_mad3(n, z->s->img_x, z->s->img_y, 1);
       if (!output) { stbi__cleanup_jpeg(z); return stbi__errpuc("outofmem", "Out of memory"); }
 
-      // now go ahead and resample
-      for (j=0; j < z->s->img_y; ++j) {
-         stbi_uc *out = output + n * z->s->img_x * j;
-         for (k=0; k < decode_n; ++k) {
-            stbi__resample *r = &res_comp[k];
-            int y_bot = r->ystep >= (r->vs >> 1);
-            coutput[k] = r->resample(z->img_comp[k].linebuf,
-                                     y_bot ? r->line1 : r->line0,
-                                     y_bot ? r->line0 : r->line1,
-                                     r->w_lores, r->hs);
-            if (++r->ystep >= r->vs) {
-               r->ystep = 0;
-               r->line0 = r->line1;
-               if (++r->ypos < z->img_comp[k].y)
-                  r->line1 += z->img_comp[k].w2;
-            }
-         }
-         if (n >= 3) {
-            stbi_uc *y = coutput[0];
-            if (z->s->img_n == 3) {
-               if (is_rgb) {
-                  for (i=0; i < z->s->img_x; ++i) {
-                     out[0] = y[i];
-                     out[1] = coutput[1][i];
-                     out[2] = coutput[2][i];
-                     out[3] = 255;
-                     out += n;
-                  }
-               } else {
-                  z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
-               }
-            } else if (z->s->img_n == 4) {
-               if (z->app14_color_transform == 0) { // CMYK
-                  for (i=0; i < z->s->img_x; ++i) {
-                     stbi_uc m = coutput[3][i];
-                     out[0] = stbi__blinn_8x8(coutput[0][i], m);
-                     out[1] = stbi__blinn_8x8(coutput[1][i], m);
-                     out[2] = stbi__blinn_8x8(coutput[2][i], m);
-                     out[3] = 255;
-                     out += n;
-                  }
-               } else if (z->app14_color_transform == 2) { // YCCK
-                  z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
-                  for (i=0; i < z->s->img_x; ++i) {
-                     stbi_uc m = coutput[3][i];
-                     out[0] = stbi__blinn_8x8(255 - out[0], m);
-                     out[1] = stbi__blinn_8x8(255 - out[1], m);
-                     out[2] = stbi__blinn_8x8(255 - out[2], m);
-                     out += n;
-                  }
-               } else { // YCbCr + alpha?  Ignore the fourth channel for now
-                  z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
-               }
-            } else
-               for (i=0; i < z->s->img_x; ++i) {
-                  out[0] = out[1] = out[2] = y[i];
-                  out[3] = 255; // not used if n==3
-                  out += n;
-               }
-         } else {
-            if (is_rgb) {
-               if (n == 1)
-                  for (i=0; i < z->s->img_x; ++i)
-                     *out++ = stbi__compute_y(coutput[0][i], coutput[1][i], coutput[2][i]);
-               else {
-                  for (i=0; i < z->s->img_x; ++i, out += 2) {
-                     out[0] = stbi__compute_y(coutput[0][i], coutput[1][i], coutput[2][i]);
-                     out[1] = 255;
-                  }
-               }
-            } else if (z->s->img_n == 4 && z->app14_color_transform == 0) {
-               for (i=0; i < z->s->img_x; ++i) {
-                  stbi_uc m = coutput[3][i];
-                  stbi_uc r = stbi__blinn_8x8(coutput[0][i], m);
-                  stbi_uc g = stbi__blinn_8x8(coutput[1][i], m);
-                  stbi_uc b = stbi__blinn_8x8(coutput[2][i], m);
-                  out[0] = stbi__compute_y(r, g, b);
-                  out[1] = 255;
-                  out += n;
-               }
-            } else if (z->s->img_n == 4 && z->app14_color_transform == 2) {
-               for (i=0; i < z->s->img_x; ++i) {
-                  out[0] = stbi__blinn_8x8(255 - coutput[0][i], coutput[3][i]);
-                  out[1] = 255;
-                  out += n;
-               }
-            } else {
-               stbi_uc *y = coutput[0];
-               if (n == 1)
-                  for (i=0; i < z->s->img_x; ++i) out[i] = y[i];
-               else
-                  for (i=0; i < z->s->img_x; ++i) { *out++ = y[i]; *out++ = 255; }
-            }
-         }
-      }
+      c.output = output;
+      c.linebufs = z->img_comp[0].linebuf;
+      stbi__parallel_ranges_run(z, stbi__jpeg_convert_rows, &c, z->s->img_y, tasks);
+
       stbi__cleanup_jpeg(z);
       *out_x = z->s->img_x;
       *out_y = z->s->img_y;
@@ -3976,14 +5626,118 @@ static void *stbi__jpeg_load(stbi__context *s, int *x, int *y, int *comp, int re
    unsigned char* result;
    stbi__jpeg* j = (stbi__jpeg*) stbi__malloc(sizeof(stbi__jpeg));
    if (!j) return stbi__errpuc("outofmem", "Out of memory");
-   STBI_NOTUSED(ri);
    j->s = s;
    stbi__setup_jpeg(j);
+   j->scale = s->scale_log2;
+   s->scale_log2 = 0;
    result = load_jpeg_image(j, x,y,comp,req_comp);
-   STBI_FREE(j);
+   stbi__free(j);
+   ri->finished = s->finish != NULL;
    return result;
 }
 
+struct stbi__jpeg_stream
+{
+   stbi_rows_func func;
+   void *user;
+   int *x, *y, *comp;
+   int req_comp;
+   int started;
+   stbi__jpeg_convert c; // at the first row not handed over yet
+   stbi_uc *band;
+   int band_rows;
+};
+
+static int stbi__jpeg_stream_scan(stbi__jpeg *z)
+{
+   struct stbi__jpeg_stream *st = z->stream;
+   int i;
+   if (st->started) {
+      // rows of the first scan are gone already, there is nothing to refine
+      return z->img_comp[0].ring != 0;
+   }
+   st->started = 1;
+
+   // only a baseline scan of every component goes out as it is decoded,
+   // anything else needs whole planes and goes out once the image is done
+   if (z->img_comp[0].ring && (z->progressive || z->scan_n != z->s->img_n)) {
+      for (i=0; i < z->s->img_n; ++i) {
+         stbi__free(z->img_comp[i].raw_data);
+         z->img_comp[i].ring = 0;
+         z->img_comp[i].data = NULL;
+         z->img_comp[i].raw_data = stbi__malloc_mad2(z->img_comp[i].w2, z->img_comp[i].h2, 15);
+         if (z->img_comp[i].raw_data == NULL) { stbi__err("outofmem", "Out of memory"); return -1; }
+         z->img_comp[i].data = (stbi_uc*) (((size_t) z->img_comp[i].raw_data + 15) & ~15);
+      }
+   }
+
+   stbi__jpeg_convert_setup(z, &st->c, st->req_comp);
+   st->band_rows = z->img_mcu_h;
+   z->img_comp[0].linebuf = (stbi_uc *) stbi__malloc(st->c.task_bytes);
+   st->band = (stbi_uc *) stbi__malloc_mad3(st->c.n, z->s->img_x, st->band_rows, 1);
+   if (!z->img_comp[0].linebuf || !st->band) { stbi__err("outofmem", "Out of memory"); return -1; }
+   st->c.linebufs = z->img_comp[0].linebuf;
+   st->c.output = st->band;
+   *st->x = z->s->img_x;
+   *st->y = z->s->img_y;
+   if (st->comp) *st->comp = z->s->img_n >= 3 ? 3 : 1;
+   return 0;
+}
+
+static int stbi__jpeg_stream_rows(stbi__jpeg *z, int mcu_rows)
+{
+   struct stbi__jpeg_stream *st = z->stream;
+   stbi__jpeg_convert *c = &st->c;
+   int j, k, rows, ready = z->s->img_y;
+
+   // an output row is ready once the rows its resamplers read are decoded
+   for (k=0; k < c->decode_n; ++k) {
+      int vs = c->res_comp[k].vs;
+      int have = mcu_rows * (z->scan_n == 1 ? 8 : z->img_comp[k].v * 8);
+      if (mcu_rows >= 0 && have < z->img_comp[k].y && have * vs - vs/2 < ready)
+         ready = have * vs - vs/2;
+   }
+
+   while (c->row0 < ready) {
+      rows = ready - c->row0 < st->band_rows ? ready - c->row0 : st->band_rows;
+      stbi__jpeg_convert_rows(c, 0, c->row0, c->row0 + rows);
+      if (!st->func(st->user, c->row0, rows, st->band))
+         return stbi__err("stopped", "Row callback stopped the decode");
+      for (j=0; j < rows; ++j)
+         for (k=0; k < c->decode_n; ++k)
+            stbi__resample_step(z, &c->res_comp[k], k);
+      c->row0 += rows;
+   }
+   return 1;
+}
+
+static int stbi__jpeg_load_rows(stbi__context *s, int *x, int *y, int *comp, int req_comp, stbi_rows_func func, void *user)
+{
+   struct stbi__jpeg_stream st;
+   int ok;
+   stbi__jpeg* j = (stbi__jpeg*) stbi__malloc(sizeof(stbi__jpeg));
+   if (!j) return stbi__err("outofmem", "Out of memory");
+   if (req_comp < 0 || req_comp > 4) { stbi__free(j); return stbi__err("bad req_comp", "Internal error"); }
+   memset(&st, 0, sizeof(st));
+   st.func = func;
+   st.user = user;
+   st.x = x;
+   st.y = y;
+   st.comp = comp;
+   st.req_comp = req_comp;
+   j->s = s;
+   stbi__setup_jpeg(j);
+   j->stream = &st;
+   s->img_n = 0; // make stbi__cleanup_jpeg safe
+   ok = stbi__decode_jpeg_image(j);
+   if (ok && !st.started) ok = stbi__err("no SOS", "Corrupt JPEG");
+   if (ok) ok = stbi__jpeg_stream_rows(j, -1);
+   stbi__free(st.band);
+   stbi__cleanup_jpeg(j);
+   stbi__free(j);
+   return ok;
+}
+
 static int stbi__jpeg_test(stbi__context *s)
 {
    int r;
@@ -3993,7 +5747,7 @@ static int stbi__jpeg_test(stbi__context *s)
    stbi__setup_jpeg(j);
    r = stbi__decode_jpeg_header(j, STBI__SCAN_type);
    stbi__rewind(s);
-   STBI_FREE(j);
+   stbi__free(j);
    return r;
 }
 
@@ -4016,9 +5770,54 @@ static int stbi__jpeg_info(stbi__context *s, int *x, int *y, int *comp)
    if (!j) return stbi__err("outofmem", "Out of memory");
    j->s = s;
    result = stbi__jpeg_info_raw(j, x, y, comp);
-   STBI_FREE(j);
+   stbi__free(j);
    return result;
 }
+
+// scratch a full size decode of this jpeg takes, mirroring the allocations
+// of stbi__process_frame_header, the parallel paths and load_jpeg_image
+static int stbi__jpeg_scratch(stbi__context *s, int req_comp, int *x, int *y, int *comp, size_t *scratch)
+{
+   stbi__jpeg j; // no allocating in the pre-pass either
+   size_t bytes, pixels;
+   int i, m, n, h_max=1, v_max=1, mcu_x, mcu_y, blocks=0, parallel, tasks;
+   j.s = s;
+   stbi__setup_jpeg(&j);
+   if (!stbi__decode_jpeg_header(&j, STBI__SCAN_header)) return 0;
+   // a DRI between the frame header and the first scan still counts
+   for (m = stbi__get_marker(&j); m != STBI__MARKER_none && !stbi__SOS(m) && !stbi__EOI(m); m = stbi__get_marker(&j))
+      if (!stbi__process_marker(&j, m)) break;
+
+   pixels = (size_t) s->img_x * s->img_y;
+   parallel = pixels >= STBI__PARALLEL_MIN_PIXELS;
+   for (i=0; i < s->img_n; ++i) {
+      if (j.img_comp[i].h > h_max) h_max = j.img_comp[i].h;
+      if (j.img_comp[i].v > v_max) v_max = j.img_comp[i].v;
+   }
+   mcu_x = (s->img_x + h_max*8-1) / (h_max*8);
+   mcu_y = (s->img_y + v_max*8-1) / (v_max*8);
+   bytes = stbi__arena_bytes(sizeof(stbi__jpeg));
+   for (i=0; i < s->img_n; ++i) {
+      size_t w2 = (size_t) mcu_x * j.img_comp[i].h * 8, h2 = (size_t) mcu_y * j.img_comp[i].v * 8;
+      bytes += stbi__arena_bytes(w2 * h2 + 15);
+      if (j.progressive || (parallel && stbi__parallel_tasks(&j, mcu_y, 1) > 1))
+         bytes += stbi__arena_bytes(w2 * h2 * 2 + 15);
+      if ((int) (w2 * h2 / 64) > blocks) blocks = (int) (w2 * h2 / 64);
+   }
+   // restart starts, a single component scan has the most units
+   if (parallel && j.restart_interval && stbi__parallel_tasks(&j, blocks, 1) > 1)
+      bytes += stbi__arena_bytes(((size_t) blocks / j.restart_interval + 2) * (sizeof(stbi_uc *) + 1));
+
+   n = req_comp ? req_comp : s->img_n >= 3 ? 3 : 1;
+   tasks = parallel ? stbi__parallel_tasks(&j, s->img_y, 65536 / s->img_x + 1) : 1;
+   bytes += stbi__arena_bytes((size_t) tasks * ((size_t) s->img_n * (s->img_x + 3) + n * s->img_x + 1));
+   bytes += stbi__arena_bytes(pixels * n);
+   *x = s->img_x;
+   *y = s->img_y;
+   *comp = s->img_n >= 3 ? 3 : 1;
+   *scratch = bytes;
+   return 1;
+}
 #endif
 
 // public domain zlib decode    v0.2  Sean Barrett 2006-11-18
@@ -4031,15 +5830,18 @@ static int stbi__jpeg_info(stbi__context *s, int *x, int *y, int *comp)
 #ifndef STBI_NO_ZLIB
 
 // fast-way is faster to check than jpeg huffman, but slow way is slower
-#define STBI__ZFAST_BITS  9 // accelerate all cases in default tables
+#define STBI__ZFAST_BITS  11 // accelerate all cases in default tables, and most literal pairs
 #define STBI__ZFAST_MASK  ((1 << STBI__ZFAST_BITS) - 1)
 #define STBI__ZNSYMS 288 // number of symbols in literal/length alphabet
 
 // zlib-style huffman encoding
 // (jpegs packs from left, zlib from right, so can't share code)
+// fast entries are (size << 9) | symbol in the low 16 bits; literal/length
+// tables may also resolve a second literal, in bits 16-23, with the combined
+// size of both codes in bits 24-28
 typedef struct
 {
-   stbi__uint16 fast[1 << STBI__ZFAST_BITS];
+   stbi__uint32 fast[1 << STBI__ZFAST_BITS];
    stbi__uint16 firstcode[16];
    int maxcode[17];
    stbi__uint16 firstsymbol[16];
@@ -4111,6 +5913,20 @@ static int stbi__zbuild_huffman(stbi__zhuffman *z, const stbi_uc *sizelist, int
    return 1;
 }
 
+// pair up literals whose codes fit in one fast lookup together
+static void stbi__zbuild_pairs(stbi__zhuffman *z)
+{
+   int i;
+   for (i=0; i < (1 << STBI__ZFAST_BITS); ++i) {
+      stbi__uint32 e = z->fast[i], e2;
+      int s = e >> 9;
+      if (!e || (e & 511) >= 256 || s >= STBI__ZFAST_BITS) continue;
+      e2 = z->fast[i >> s] & 0xffff; // only the low ZFAST_BITS-s bits are known, but the code fits in them
+      if (!e2 || (e2 & 511) >= 256 || s + (int) (e2 >> 9) > STBI__ZFAST_BITS) continue;
+      z->fast[i] = e | ((e2 & 255) << 16) | ((stbi__uint32) (s + (e2 >> 9)) << 24);
+   }
+}
+
 // zlib-from-memory implementation for PNG reading
 //    because PNG allows splitting the zlib stream arbitrarily,
 //    and it's annoying structurally to have PNG call ZLIB call PNG,
@@ -4120,14 +5936,19 @@ static int stbi__zbuild_huffman(stbi__zhuffman *z, const stbi_uc *sizelist, int
 typedef struct
 {
    stbi_uc *zbuffer, *zbuffer_end;
-   int num_bits;
-   stbi__uint32 code_buffer;
+   int num_bits; // goes negative once zero bits past the end have been used
+   unsigned long long code_buffer; // bits above num_bits repeat the next input bytes, or are 0
 
    char *zout;
    char *zout_start;
    char *zout_end;
    int   z_expandable;
 
+   // when set, called after every block with the output so far; it may
+   // discard output, but must keep the last 32K for back references
+   int (*flush)(void *user);
+   void *flush_user;
+
    stbi__zhuffman z_length, z_distance;
 } stbi__zbuf;
 
@@ -4143,21 +5964,30 @@ stbi_inline static stbi_uc stbi__zget8(stbi__zbuf *z)
 
 static void stbi__fill_bits(stbi__zbuf *z)
 {
-   do {
-      if (z->code_buffer >= (1U << z->num_bits)) {
-        z->zbuffer = z->zbuffer_end;  /* treat this as EOF so we fail. */
-        return;
+   if (z->zbuffer_end - z->zbuffer >= 8) {
+      // load 8 bytes and keep the whole ones that fit, 49-63 bits
+      stbi_uc *p = z->zbuffer;
+      unsigned long long v = (unsigned long long) p[0]       | (unsigned long long) p[1] <<  8 |
+                             (unsigned long long) p[2] << 16 | (unsigned long long) p[3] << 24 |
+                             (unsigned long long) p[4] << 32 | (unsigned long long) p[5] << 40 |
+                             (unsigned long long) p[6] << 48 | (unsigned long long) p[7] << 56;
+      z->code_buffer |= v << z->num_bits;
+      z->zbuffer += (63 - z->num_bits) >> 3;
+      z->num_bits |= 56;
+   } else {
+      // near the end; past it the buffer reads as zeros
+      while (z->num_bits <= 48 && !stbi__zeof(z)) {
+         z->code_buffer |= (unsigned long long) *z->zbuffer++ << z->num_bits;
+         z->num_bits += 8;
       }
-      z->code_buffer |= (unsigned int) stbi__zget8(z) << z->num_bits;
-      z->num_bits += 8;
-   } while (z->num_bits <= 24);
+   }
 }
 
 stbi_inline static unsigned int stbi__zreceive(stbi__zbuf *z, int n)
 {
    unsigned int k;
    if (z->num_bits < n) stbi__fill_bits(z);
-   k = z->code_buffer & ((1 << n) - 1);
+   k = (unsigned int) z->code_buffer & ((1 << n) - 1);
    z->code_buffer >>= n;
    z->num_bits -= n;
    return k;
@@ -4168,7 +5998,7 @@ static int stbi__zhuffman_decode_slowpath(stbi__zbuf *a, stbi__zhuffman *z)
    int b,s,k;
    // not resolved by fast table, so compute it the slow way
    // use jpeg approach, which requires MSbits at top
-   k = stbi__bit_reverse(a->code_buffer, 16);
+   k = stbi__bit_reverse((int) (a->code_buffer & 0xffff), 16);
    for (s=STBI__ZFAST_BITS+1; ; ++s)
       if (k < z->maxcode[s])
          break;
@@ -4186,12 +6016,11 @@ stbi_inline static int stbi__zhuffman_decode(stbi__zbuf *a, stbi__zhuffman *z)
 {
    int b,s;
    if (a->num_bits < 16) {
-      if (stbi__zeof(a)) {
-         return -1;   /* report error for unexpected end of data. */
-      }
       stbi__fill_bits(a);
+      if (a->num_bits <= 0)
+         return -1;   /* report error for unexpected end of data. */
    }
-   b = z->fast[a->code_buffer & STBI__ZFAST_MASK];
+   b = z->fast[a->code_buffer & STBI__ZFAST_MASK] & 0xffff;
    if (b) {
       s = b >> 9;
       a->code_buffer >>= s;
@@ -4207,6 +6036,12 @@ static int stbi__zexpand(stbi__zbuf *z, char *zout, int n)  // need to make room
    unsigned int cur, limit, old_limit;
    z->zout = zout;
    if (!z->z_expandable) return stbi__err("output buffer limit","Corrupt PNG");
+   // a streaming reader makes room by taking what is complete, in the middle
+   // of a block if need be; it keeps the 32K that back references reach
+   if (z->flush) {
+      if (!z->flush(z->flush_user)) return 0;
+      if (n <= z->zout_end - z->zout) return 1;
+   }
    cur   = (unsigned int) (z->zout - z->zout_start);
    limit = old_limit = (unsigned) (z->zout_end - z->zout_start);
    if (UINT_MAX - cur < (unsigned) n) return stbi__err("outofmem", "Out of memory");
@@ -4214,7 +6049,7 @@ static int stbi__zexpand(stbi__zbuf *z, char *zout, int n)  // need to make room
       if(limit > UINT_MAX / 2) return stbi__err("outofmem", "Out of memory");
       limit *= 2;
    }
-   q = (char *) STBI_REALLOC_SIZED(z->zout_start, old_limit, limit);
+   q = (char *) stbi__realloc_sized(z->zout_start, old_limit, limit);
    STBI_NOTUSED(old_limit);
    if (q == NULL) return stbi__err("outofmem", "Out of memory");
    z->zout_start = q;
@@ -4241,7 +6076,33 @@ static int stbi__parse_huffman_block(stbi__zbuf *a)
 {
    char *zout = a->zout;
    for(;;) {
-      int z = stbi__zhuffman_decode(a, &a->z_length);
+      stbi__uint32 e;
+      int z;
+      if (a->num_bits < 16) {
+         stbi__fill_bits(a);
+         if (a->num_bits <= 0) return stbi__err("bad huffman code","Corrupt PNG");
+      }
+      e = a->z_length.fast[a->code_buffer & STBI__ZFAST_MASK];
+      if (e >> 24) {
+         // two literals from one lookup
+         if (a->zout_end - zout < 2) {
+            if (!stbi__zexpand(a, zout, 2)) return 0;
+            zout = a->zout;
+         }
+         zout[0] = (char) (e & 255);
+         zout[1] = (char) ((e >> 16) & 255);
+         zout += 2;
+         a->code_buffer >>= e >> 24;
+         a->num_bits -= e >> 24;
+         continue;
+      }
+      if (e) {
+         a->code_buffer >>= e >> 9;
+         a->num_bits -= e >> 9;
+         z = e & 511;
+      } else {
+         z = stbi__zhuffman_decode_slowpath(a, &a->z_length);
+      }
       if (z < 256) {
          if (z < 0) return stbi__err("bad huffman code","Corrupt PNG"); // error in huffman codes
          if (zout >= a->zout_end) {
@@ -4270,8 +6131,17 @@ static int stbi__parse_huffman_block(stbi__zbuf *a)
          }
          p = (stbi_uc *) (zout - dist);
          if (dist == 1) { // run of one byte; common in images.
-            stbi_uc v = *p;
-            if (len) { do *zout++ = v; while (--len); }
+            memset(zout, *p, len);
+            zout += len;
+         } else if (dist >= 8 && a->zout_end - zout >= len + 8) {
+            // 8 bytes at a time, overshooting into space the next symbols overwrite
+            char *end = zout + len;
+            do {
+               memcpy(zout, p, 8);
+               zout += 8;
+               p += 8;
+            } while (zout < end);
+            zout = end;
          } else {
             if (len) { do *zout++ = *p++; while (--len); }
          }
@@ -4335,17 +6205,13 @@ static int stbi__parse_uncompressed_block(stbi__zbuf *a)
    int len,nlen,k;
    if (a->num_bits & 7)
       stbi__zreceive(a, a->num_bits & 7); // discard
-   // drain the bit-packed data into header
-   k = 0;
-   while (a->num_bits > 0) {
-      header[k++] = (stbi_uc) (a->code_buffer & 255); // suppress MSVC run-time check
-      a->code_buffer >>= 8;
-      a->num_bits -= 8;
-   }
    if (a->num_bits < 0) return stbi__err("zlib corrupt","Corrupt PNG");
-   // now fill header the normal way
-   while (k < 4)
-      header[k++] = stbi__zget8(a);
+   // the buffered whole bytes are the last ones read, give them back
+   a->zbuffer -= a->num_bits >> 3;
+   a->code_buffer = 0;
+   a->num_bits = 0;
+   for (k=0; k < 4; ++k)
+      header[k] = stbi__zget8(a);
    len  = header[1] * 256 + header[0];
    nlen = header[3] * 256 + header[2];
    if (nlen != (len ^ 0xffff)) return stbi__err("zlib corrupt","Corrupt PNG");
@@ -4423,8 +6289,10 @@ static int stbi__parse_zlib(stbi__zbuf *a, int parse_header)
          } else {
             if (!stbi__compute_huffman_codes(a)) return 0;
          }
+         stbi__zbuild_pairs(&a->z_length);
          if (!stbi__parse_huffman_block(a)) return 0;
       }
+      if (a->flush && !a->flush(a->flush_user)) return 0;
    } while (!final);
    return 1;
 }
@@ -4435,6 +6303,7 @@ static int stbi__do_zlib(stbi__zbuf *a, char *obuf, int olen, int exp, int parse
    a->zout       = obuf;
    a->zout_end   = obuf + olen;
    a->z_expandable = exp;
+   a->flush = NULL;
 
    return stbi__parse_zlib(a, parse_header);
 }
@@ -4450,7 +6319,7 @@ STBIDEF char *stbi_zlib_decode_malloc_guesssize(const char *buffer, int len, int
       if (outlen) *outlen = (int) (a.zout - a.zout_start);
       return a.zout_start;
    } else {
-      STBI_FREE(a.zout_start);
+      stbi__free(a.zout_start);
       return NULL;
    }
 }
@@ -4471,7 +6340,7 @@ STBIDEF char *stbi_zlib_decode_malloc_guesssize_headerflag(const char *buffer, i
       if (outlen) *outlen = (int) (a.zout - a.zout_start);
       return a.zout_start;
    } else {
-      STBI_FREE(a.zout_start);
+      stbi__free(a.zout_start);
       return NULL;
    }
 }
@@ -4498,7 +6367,7 @@ STBIDEF char *stbi_zlib_decode_noheader_malloc(char const *buffer, int len, int
       if (outlen) *outlen = (int) (a.zout - a.zout_start);
       return a.zout_start;
    } else {
-      STBI_FREE(a.zout_start);
+      stbi__free(a.zout_start);
       return NULL;
    }
 }
@@ -4554,6 +6423,7 @@ typedef struct
    stbi__context *s;
    stbi_uc *idata, *expanded, *out;
    int depth;
+   struct stbi__png_stream *stream; // set when decoding by rows
 } stbi__png;
 
 
@@ -4590,36 +6460,117 @@ static int stbi__paeth(int a, int b, int c)
 
 static const stbi_uc stbi__depth_scale_table[9] = { 0, 0xff, 0x55, 0, 0x11, 0,0,0, 0x01 };
 
-// create the png data from post-deflated data
-static int stbi__create_png_image_raw(stbi__png *a, stbi_uc *raw, stbi__uint32 raw_len, int out_n, stbi__uint32 x, stbi__uint32 y, int depth, int color)
+#ifdef STBI_SSE2
+// 3 or 4 bytes of one pixel; only the last pixel of a row can't read or
+// write a byte past a 3 byte pixel
+static __m128i stbi__png_load_pixel(stbi_uc const *p, int n, int last)
+{
+   int v = 0;
+   if (n == 4 || !last) memcpy(&v, p, 4);
+   else                 memcpy(&v, p, 3);
+   return _mm_cvtsi32_si128(v);
+}
+
+static void stbi__png_store_pixel(stbi_uc *p, __m128i v, int n, int last)
+{
+   int w = _mm_cvtsi128_si32(v);
+   if (n == 4 || !last) memcpy(p, &w, 4);
+   else                 memcpy(p, &w, 3);
+}
+
+// unfilter the pixels after the first one of an 8-bit row, 1 when handled.
+// sub, average and paeth depend on the pixel to the left, so these work one
+// pixel at a time with the channels in parallel
+static int stbi__png_unfilter_simd(int filter, stbi_uc *cur, stbi_uc const *prior, stbi_uc *raw, int pixels, int img_n, int out_n)
+{
+   __m128i zero = _mm_setzero_si128();
+   __m128i opaque = img_n == out_n ? zero : _mm_slli_si128(_mm_cvtsi32_si128(255), 3);
+   __m128i a, b, c, d;
+   int i, k;
+   if (!stbi__sse2_available()) return 0;
+
+   if (filter == STBI__F_up && img_n == out_n) {
+      int nk = pixels*img_n;
+      for (k=0; k+16 <= nk; k += 16) {
+         d = _mm_add_epi8(_mm_loadu_si128((__m128i const *) (raw+k)), _mm_loadu_si128((__m128i const *) (prior+k)));
+         _mm_storeu_si128((__m128i *) (cur+k), d);
+      }
+      for (; k < nk; ++k)
+         cur[k] = STBI__BYTECAST(raw[k] + prior[k]);
+      return 1;
+   }
+   if (img_n != 3 && img_n != 4) return 0;
+   if (filter != STBI__F_sub && filter != STBI__F_up && filter != STBI__F_avg && filter != STBI__F_paeth) return 0;
+
+   // a is the pixel to the left, b the one above and c above and to the left
+   a = stbi__png_load_pixel(cur-out_n, out_n, 1);
+   c = stbi__png_load_pixel(prior-out_n, out_n, 1);
+   for (i=0; i < pixels; ++i, raw += img_n, cur += out_n, prior += out_n) {
+      int last = (i == pixels-1);
+      d = stbi__png_load_pixel(raw, img_n, last);
+      switch (filter) {
+         case STBI__F_sub:
+            d = _mm_add_epi8(d, a);
+            break;
+         case STBI__F_up:
+            d = _mm_add_epi8(d, stbi__png_load_pixel(prior, out_n, last));
+            break;
+         case STBI__F_avg:
+            // avg_epu8 rounds up, take off the lost low bit
+            b = stbi__png_load_pixel(prior, out_n, last);
+            b = _mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(_mm_xor_si128(a, b), _mm_set1_epi8(1)));
+            d = _mm_add_epi8(d, b);
+            break;
+         default: {
+            // paeth in 16 bits, ties go to a, then b
+            __m128i a16, b16, c16, pa, pb, pc, m, sel;
+            b = stbi__png_load_pixel(prior, out_n, last);
+            a16 = _mm_unpacklo_epi8(a, zero);
+            b16 = _mm_unpacklo_epi8(b, zero);
+            c16 = _mm_unpacklo_epi8(c, zero);
+            pa = _mm_sub_epi16(b16, c16);
+            pb = _mm_sub_epi16(a16, c16);
+            pc = _mm_add_epi16(pa, pb);
+            pa = _mm_max_epi16(pa, _mm_sub_epi16(zero, pa));
+            pb = _mm_max_epi16(pb, _mm_sub_epi16(zero, pb));
+            pc = _mm_max_epi16(pc, _mm_sub_epi16(zero, pc));
+            m = _mm_min_epi16(pc, _mm_min_epi16(pa, pb));
+            sel = _mm_cmpeq_epi16(m, pb);
+            sel = _mm_or_si128(_mm_and_si128(sel, b16), _mm_andnot_si128(sel, c16));
+            m = _mm_cmpeq_epi16(m, pa);
+            sel = _mm_or_si128(_mm_and_si128(m, a16), _mm_andnot_si128(m, sel));
+            d = _mm_add_epi8(d, _mm_packus_epi16(sel, zero));
+            c = b;
+            break;
+         }
+      }
+      d = _mm_or_si128(d, opaque);
+      stbi__png_store_pixel(cur, d, out_n, last);
+      a = d;
+   }
+   return 1;
+}
+#endif
+
+// unfilter y rows of raw into out, rows of x*out_n*bytes. prior_row is the
+// unfiltered row above the first in the same layout, or NULL for the first
+// row of the image. rows stay as filtered: big endian, or packed at the
+// right end of each row below 8 bits, until stbi__png_expand_rows
+static int stbi__png_unfilter_rows(stbi__png *a, stbi_uc *out, stbi_uc const *prior_row, stbi_uc *raw, int out_n, stbi__uint32 x, stbi__uint32 y, int depth)
 {
    int bytes = (depth == 16? 2 : 1);
-   stbi__context *s = a->s;
    stbi__uint32 i,j,stride = x*out_n*bytes;
-   stbi__uint32 img_len, img_width_bytes;
+   stbi__uint32 img_width_bytes = (((a->s->img_n * x * depth) + 7) >> 3);
    int k;
-   int img_n = s->img_n; // copy it into a local for later
+   int img_n = a->s->img_n; // copy it into a local for later
 
    int output_bytes = out_n*bytes;
    int filter_bytes = img_n*bytes;
    int width = x;
 
-   STBI_ASSERT(out_n == s->img_n || out_n == s->img_n+1);
-   a->out = (stbi_uc *) stbi__malloc_mad3(x, y, output_bytes, 0); // extra bytes to write off the end into
-   if (!a->out) return stbi__err("outofmem", "Out of memory");
-
-   if (!stbi__mad3sizes_valid(img_n, x, depth, 7)) return stbi__err("too large", "Corrupt PNG");
-   img_width_bytes = (((img_n * x * depth) + 7) >> 3);
-   img_len = (img_width_bytes + 1) * y;
-
-   // we used to check for exact match between raw_len and img_len on non-interlaced PNGs,
-   // but issue #276 reported a PNG in the wild that had extra data at the end (all zeros),
-   // so just check for raw_len < img_len always.
-   if (raw_len < img_len) return stbi__err("not enough pixels","Corrupt PNG");
-
    for (j=0; j < y; ++j) {
-      stbi_uc *cur = a->out + stride*j;
-      stbi_uc *prior;
+      stbi_uc *cur = out + stride*j;
+      stbi_uc const *prior;
       int filter = *raw++;
 
       if (filter > 4)
@@ -4632,9 +6583,10 @@ static int stbi__create_png_image_raw(stbi__png *a, stbi_uc *raw, stbi__uint32 r
          width = img_width_bytes;
       }
       prior = cur - stride; // bugfix: need to compute this after 'cur +=' computation above
+      if (j == 0 && prior_row) prior = prior_row + (cur - out);
 
       // if first row, use special filter that doesn't sample previous row
-      if (j == 0) filter = first_row_filter[filter];
+      if (j == 0 && !prior_row) filter = first_row_filter[filter];
 
       // handle first byte explicitly
       for (k=0; k < filter_bytes; ++k) {
@@ -4669,6 +6621,13 @@ static int stbi__create_png_image_raw(stbi__png *a, stbi_uc *raw, stbi__uint32 r
          prior += 1;
       }
 
+      #ifdef STBI_SSE2
+      if (depth == 8 && (j > 0 || prior_row) && stbi__png_unfilter_simd(filter, cur, prior, raw, x-1, img_n, out_n)) {
+         raw += (x-1)*img_n;
+         continue;
+      }
+      #endif
+
       // this is a little gross, so that we don't switch per-pixel or per-component
       if (depth < 8 || img_n == out_n) {
          int nk = (width - 1)*filter_bytes;
@@ -4707,7 +6666,7 @@ static int stbi__create_png_image_raw(stbi__png *a, stbi_uc *raw, stbi__uint32 r
          // the loop above sets the high byte of the pixels' alpha, but for
          // 16 bit png files we also need the low byte set. we'll do that here.
          if (depth == 16) {
-            cur = a->out + stride*j; // start at the beginning of the row again
+            cur = out + stride*j; // start at the beginning of the row again
             for (i=0; i < x; ++i,cur+=output_bytes) {
                cur[filter_bytes+1] = 255;
             }
@@ -4715,13 +6674,24 @@ static int stbi__create_png_image_raw(stbi__png *a, stbi_uc *raw, stbi__uint32 r
       }
    }
 
+   return 1;
+}
+
+// turn y unfiltered rows into pixels: bits to bytes below 8 bits, big endian
+// to native at 16
+static void stbi__png_expand_rows(stbi_uc *out, int img_n, int out_n, stbi__uint32 x, stbi__uint32 y, int depth, int color)
+{
+   stbi__uint32 i,j,stride = x*out_n*(depth == 16 ? 2 : 1);
+   stbi__uint32 img_width_bytes = (((img_n * x * depth) + 7) >> 3);
+   int k;
+
    // we make a separate pass to expand bits to pixels; for performance,
    // this could run two scanlines behind the above code, so it won't
    // intefere with filtering but will still be in the cache.
    if (depth < 8) {
       for (j=0; j < y; ++j) {
-         stbi_uc *cur = a->out + stride*j;
-         stbi_uc *in  = a->out + stride*j + x*out_n - img_width_bytes;
+         stbi_uc *cur = out + stride*j;
+         stbi_uc *in  = out + stride*j + x*out_n - img_width_bytes;
          // unpack 1/2/4-bit into a 8-bit buffer. allows us to keep the common 8-bit path optimal at minimal cost for 1/2/4-bit
          // png guarante byte alignment, if width is not multiple of 8/4/2 we'll decode dummy trailing data that will be skipped in the later loop
          stbi_uc scale = (color == 0) ? stbi__depth_scale_table[depth] : 1; // scale grayscale values to 0..255 range
@@ -4770,7 +6740,7 @@ static int stbi__create_png_image_raw(stbi__png *a, stbi_uc *raw, stbi__uint32 r
          if (img_n != out_n) {
             int q;
             // insert alpha = 255
-            cur = a->out + stride*j;
+            cur = out + stride*j;
             if (img_n == 1) {
                for (q=x-1; q >= 0; --q) {
                   cur[q*2+1] = 255;
@@ -4792,14 +6762,37 @@ static int stbi__create_png_image_raw(stbi__png *a, stbi_uc *raw, stbi__uint32 r
       // this is done in a separate pass due to the decoding relying
       // on the data being untouched, but could probably be done
       // per-line during decode if care is taken.
-      stbi_uc *cur = a->out;
+      stbi_uc *cur = out;
       stbi__uint16 *cur16 = (stbi__uint16*)cur;
 
       for(i=0; i < x*y*out_n; ++i,cur16++,cur+=2) {
          *cur16 = (cur[0] << 8) | cur[1];
       }
    }
+}
+
+// create the png data from post-deflated data
+static int stbi__create_png_image_raw(stbi__png *a, stbi_uc *raw, stbi__uint32 raw_len, int out_n, stbi__uint32 x, stbi__uint32 y, int depth, int color)
+{
+   stbi__context *s = a->s;
+   stbi__uint32 img_len, img_width_bytes;
+   int img_n = s->img_n; // copy it into a local for later
+
+   STBI_ASSERT(out_n == s->img_n || out_n == s->img_n+1);
+   a->out = (stbi_uc *) stbi__malloc_mad3(x, y, out_n*(depth == 16 ? 2 : 1), 0); // extra bytes to write off the end into
+   if (!a->out) return stbi__err("outofmem", "Out of memory");
+
+   if (!stbi__mad3sizes_valid(img_n, x, depth, 7)) return stbi__err("too large", "Corrupt PNG");
+   img_width_bytes = (((img_n * x * depth) + 7) >> 3);
+   img_len = (img_width_bytes + 1) * y;
+
+   // we used to check for exact match between raw_len and img_len on non-interlaced PNGs,
+   // but issue #276 reported a PNG in the wild that had extra data at the end (all zeros),
+   // so just check for raw_len < img_len always.
+   if (raw_len < img_len) return stbi__err("not enough pixels","Corrupt PNG");
 
+   if (!stbi__png_unfilter_rows(a, a->out, NULL, raw, out_n, x, y, depth)) return 0;
+   stbi__png_expand_rows(a->out, img_n, out_n, x, y, depth, color);
    return 1;
 }
 
@@ -4827,7 +6820,7 @@ static int stbi__create_png_image(stbi__png *a, stbi_uc *image_data, stbi__uint3
       if (x && y) {
          stbi__uint32 img_len = ((((a->s->img_n * x * depth) + 7) >> 3) + 1) * y;
          if (!stbi__create_png_image_raw(a, image_data, image_data_len, out_n, x, y, depth, color)) {
-            STBI_FREE(final);
+            stbi__free(final);
             return 0;
          }
          for (j=0; j < y; ++j) {
@@ -4838,7 +6831,7 @@ static int stbi__create_png_image(stbi__png *a, stbi_uc *image_data, stbi__uint3
                       a->out + (j*x+i)*out_bytes, out_bytes);
             }
          }
-         STBI_FREE(a->out);
+         stbi__free(a->out);
          image_data += img_len;
          image_data_len -= img_len;
       }
@@ -4848,11 +6841,9 @@ static int stbi__create_png_image(stbi__png *a, stbi_uc *image_data, stbi__uint3
    return 1;
 }
 
-static int stbi__compute_transparency(stbi__png *z, stbi_uc tc[3], int out_n)
+static int stbi__compute_transparency(stbi_uc *p, stbi__uint32 pixel_count, stbi_uc tc[3], int out_n)
 {
-   stbi__context *s = z->s;
-   stbi__uint32 i, pixel_count = s->img_x * s->img_y;
-   stbi_uc *p = z->out;
+   stbi__uint32 i;
 
    // compute color-based transparency, assuming we've
    // already got 255 as the alpha value in the output
@@ -4873,11 +6864,10 @@ static int stbi__compute_transparency(stbi__png *z, stbi_uc tc[3], int out_n)
    return 1;
 }
 
-static int stbi__compute_transparency16(stbi__png *z, stbi__uint16 tc[3], int out_n)
+static int stbi__compute_transparency16(stbi_uc *out, stbi__uint32 pixel_count, stbi__uint16 tc[3], int out_n)
 {
-   stbi__context *s = z->s;
-   stbi__uint32 i, pixel_count = s->img_x * s->img_y;
-   stbi__uint16 *p = (stbi__uint16*) z->out;
+   stbi__uint32 i;
+   stbi__uint16 *p = (stbi__uint16*) out;
 
    // compute color-based transparency, assuming we've
    // already got 65535 as the alpha value in the output
@@ -4898,17 +6888,10 @@ static int stbi__compute_transparency16(stbi__png *z, stbi__uint16 tc[3], int ou
    return 1;
 }
 
-static int stbi__expand_png_palette(stbi__png *a, stbi_uc *palette, int len, int pal_img_n)
+// look up pixel_count palette indices from orig into p
+static void stbi__png_palette_rows(stbi_uc *p, stbi_uc const *orig, stbi__uint32 pixel_count, stbi_uc const *palette, int pal_img_n)
 {
-   stbi__uint32 i, pixel_count = a->s->img_x * a->s->img_y;
-   stbi_uc *p, *temp_out, *orig = a->out;
-
-   p = (stbi_uc *) stbi__malloc_mad2(pixel_count, pal_img_n, 0);
-   if (p == NULL) return stbi__err("outofmem", "Out of memory");
-
-   // between here and free(out) below, exitting would leak
-   temp_out = p;
-
+   stbi__uint32 i;
    if (pal_img_n == 3) {
       for (i=0; i < pixel_count; ++i) {
          int n = orig[i]*4;
@@ -4927,7 +6910,16 @@ static int stbi__expand_png_palette(stbi__png *a, stbi_uc *palette, int len, int
          p += 4;
       }
    }
-   STBI_FREE(a->out);
+}
+
+static int stbi__expand_png_palette(stbi__png *a, stbi_uc *palette, int len, int pal_img_n)
+{
+   stbi__uint32 pixel_count = a->s->img_x * a->s->img_y;
+   stbi_uc *temp_out = (stbi_uc *) stbi__malloc_mad2(pixel_count, pal_img_n, 0);
+   if (temp_out == NULL) return stbi__err("outofmem", "Out of memory");
+
+   stbi__png_palette_rows(temp_out, a->out, pixel_count, palette, pal_img_n);
+   stbi__free(a->out);
    a->out = temp_out;
 
    STBI_NOTUSED(len);
@@ -4949,13 +6941,13 @@ STBIDEF void stbi_convert_iphone_png_to_rgb(int flag_true_if_should_convert)
 }
 
 #ifndef STBI_THREAD_LOCAL
-#define stbi__unpremultiply_on_load  stbi__unpremultiply_on_load_global
-#define stbi__de_iphone_flag  stbi__de_iphone_flag_global
+#define stbi__unpremultiply_on_load_flag stbi__unpremultiply_on_load_global
+#define stbi__de_iphone_flag_flag stbi__de_iphone_flag_global
 #else
 static STBI_THREAD_LOCAL int stbi__unpremultiply_on_load_local, stbi__unpremultiply_on_load_set;
 static STBI_THREAD_LOCAL int stbi__de_iphone_flag_local, stbi__de_iphone_flag_set;
 
-STBIDEF void stbi__unpremultiply_on_load_thread(int flag_true_if_should_unpremultiply)
+STBIDEF void stbi_set_unpremultiply_on_load_thread(int flag_true_if_should_unpremultiply)
 {
    stbi__unpremultiply_on_load_local = flag_true_if_should_unpremultiply;
    stbi__unpremultiply_on_load_set = 1;
@@ -4967,14 +6959,18 @@ STBIDEF void stbi_convert_iphone_png_to_rgb_thread(int flag_true_if_should_conve
    stbi__de_iphone_flag_set = 1;
 }
 
-#define stbi__unpremultiply_on_load  (stbi__unpremultiply_on_load_set           \
-                                       ? stbi__unpremultiply_on_load_local      \
-                                       : stbi__unpremultiply_on_load_global)
-#define stbi__de_iphone_flag  (stbi__de_iphone_flag_set                         \
-                                ? stbi__de_iphone_flag_local                    \
-                                : stbi__de_iphone_flag_global)
+#define stbi__unpremultiply_on_load_flag (stbi__unpremultiply_on_load_set      \
+                                            ? stbi__unpremultiply_on_load_local \
+                                            : stbi__unpremultiply_on_load_global)
+#define stbi__de_iphone_flag_flag (stbi__de_iphone_flag_set                    \
+                                     ? stbi__de_iphone_flag_local               \
+                                     : stbi__de_iphone_flag_global)
 #endif // STBI_THREAD_LOCAL
 
+// a load through a decoder takes its options from there
+#define stbi__unpremultiply_on_load  (stbi__g_decoder ? stbi__g_decoder->unpremultiply : stbi__unpremultiply_on_load_flag)
+#define stbi__de_iphone_flag  (stbi__g_decoder ? stbi__g_decoder->convert_iphone_png : stbi__de_iphone_flag_flag)
+
 static void stbi__de_iphone(stbi__png *z)
 {
    stbi__context *s = z->s;
@@ -5020,6 +7016,171 @@ static void stbi__de_iphone(stbi__png *z)
 
 #define STBI__PNG_TYPE(a,b,c,d)  (((unsigned) (a) << 24) + ((unsigned) (b) << 16) + ((unsigned) (c) << 8) + (unsigned) (d))
 
+struct stbi__png_stream
+{
+   stbi_rows_func func;
+   void *user;
+   int *x, *y, *comp;
+   // the rest is set up at IEND
+   stbi__zbuf *zbuf;
+   size_t consumed;      // output of zbuf handed over as rows
+   stbi__uint32 row_bytes, rows_done, band_rows;
+   stbi_uc *prior, *band, *band2;
+   stbi_uc *palette, *tc;
+   stbi__uint16 *tc16;
+   int color, pal_img_n, pal_out_n, has_trans, req_comp;
+   int bgr, premultiply;
+   // whole 8-bit loads write the bands finished into out instead of calling func
+   struct stbi__finish *finish;
+   stbi_uc *out;
+};
+
+// finish rows of filtered data the way stbi__parse_png_file, stbi__do_png
+// and stbi__load_and_postprocess_8bit finish a whole image, and hand them on
+static int stbi__png_stream_band(stbi__png *z, stbi_uc *raw, stbi__uint32 rows)
+{
+   struct stbi__png_stream *st = z->stream;
+   stbi__context *s = z->s;
+   stbi__uint32 i, pixels = s->img_x * rows;
+   stbi__uint32 stride = s->img_x * s->img_out_n * (z->depth == 16 ? 2 : 1);
+   stbi_uc *cur = st->band, *other = st->band2, *t;
+   int n = s->img_out_n;
+
+   if (!stbi__png_unfilter_rows(z, cur, st->rows_done ? st->prior : NULL, raw, n, s->img_x, rows, z->depth)) return 0;
+   memcpy(st->prior, cur + (rows-1) * stride, stride);
+   stbi__png_expand_rows(cur, s->img_n, n, s->img_x, rows, z->depth, st->color);
+   if (st->has_trans) {
+      if (z->depth == 16) stbi__compute_transparency16(cur, pixels, st->tc16, n);
+      else                stbi__compute_transparency(cur, pixels, st->tc, n);
+   }
+   if (st->pal_img_n) {
+      stbi__png_palette_rows(other, cur, pixels, st->palette, st->pal_out_n);
+      t = cur; cur = other; other = t;
+      n = st->pal_out_n;
+   }
+   if (st->req_comp && st->req_comp != n) {
+      if (z->depth == 16) {
+         if (!stbi__convert_format16_rows((stbi__uint16 *) cur, (stbi__uint16 *) other, n, st->req_comp, s->img_x, rows)) return 0;
+      } else {
+         if (!stbi__convert_format_rows(cur, other, n, st->req_comp, s->img_x, rows)) return 0;
+      }
+      t = cur; cur = other; other = t;
+      n = st->req_comp;
+   }
+   if (z->depth == 16) {
+      // to 8 bits in place, each byte lands at or before the value it comes from
+      for (i=0; i < pixels * n; ++i)
+         cur[i] = (stbi_uc) (((stbi__uint16 *) cur)[i] >> 8);
+   }
+   if (st->out) {
+      // the band is still in cache, write its rows where they end up
+      size_t row_bytes = (size_t) s->img_x * n;
+      for (i=0; i < rows; ++i) {
+         stbi__uint32 j = st->rows_done + i;
+         if (st->finish->flip) j = s->img_y - 1 - j;
+         stbi__finish_row(st->out + row_bytes * j, cur + row_bytes * i, s->img_x, n, st->bgr, st->premultiply);
+      }
+   } else {
+      if (st->bgr || st->premultiply)
+         stbi__finish_row(cur, cur, pixels, n, st->bgr, st->premultiply);
+      if (!st->func(st->user, st->rows_done, rows, cur))
+         return stbi__err("stopped", "Row callback stopped the decode");
+   }
+   st->rows_done += rows;
+   return 1;
+}
+
+// zlib flush: hand over the complete rows inflated so far, then drop what
+// neither the rows nor back references need
+static int stbi__png_stream_flush(void *user)
+{
+   stbi__png *z = (stbi__png *) user;
+   struct stbi__png_stream *st = z->stream;
+   stbi__zbuf *a = st->zbuf;
+   size_t have = (size_t) (a->zout - a->zout_start), drop;
+   while (have - st->consumed >= st->row_bytes && st->rows_done < z->s->img_y) {
+      stbi__uint32 rows = (stbi__uint32) ((have - st->consumed) / st->row_bytes);
+      if (rows > st->band_rows) rows = st->band_rows;
+      if (rows > z->s->img_y - st->rows_done) rows = z->s->img_y - st->rows_done;
+      if (!stbi__png_stream_band(z, (stbi_uc *) a->zout_start + st->consumed, rows)) return 0;
+      st->consumed += (size_t) rows * st->row_bytes;
+   }
+   drop = have > 32768 ? have - 32768 : 0;
+   if (drop > st->consumed) drop = st->consumed;
+   // moving costs no more than what goes
+   if (drop && drop >= have - drop) {
+      memmove(a->zout_start, a->zout_start + drop, have - drop);
+      a->zout -= drop;
+      st->consumed -= drop;
+   }
+   return 1;
+}
+
+// inflate the image data a few blocks at a time, handing rows over as they
+// complete, so neither the filtered data nor the image is ever whole
+static int stbi__png_stream_image(stbi__png *z, stbi__uint32 ioff, int color, stbi_uc *palette, int pal_img_n, int has_trans, stbi_uc *tc, stbi__uint16 *tc16, int req_comp)
+{
+   struct stbi__png_stream *st = z->stream;
+   stbi__context *s = z->s;
+   stbi__zbuf a;
+   stbi__uint32 stride, band_bytes;
+   size_t zsize;
+   int ok;
+
+   if (!stbi__mad3sizes_valid(s->img_n, s->img_x, z->depth, 7)) return stbi__err("too large", "Corrupt PNG");
+   st->row_bytes = ((s->img_n * s->img_x * z->depth + 7) >> 3) + 1;
+   st->band_rows = 65536 / s->img_x + 1;
+   if (st->band_rows > s->img_y) st->band_rows = s->img_y;
+   stride = s->img_x * s->img_out_n * (z->depth == 16 ? 2 : 1);
+   // a band at its widest is 4 channels of 16 bits
+   band_bytes = st->band_rows * s->img_x * 8;
+   st->prior = (stbi_uc *) stbi__malloc_mad2(2, band_bytes, stride);
+   if (!st->prior) return stbi__err("outofmem", "Out of memory");
+   st->band = st->prior + stride;
+   st->band2 = st->band + band_bytes;
+   st->zbuf = &a;
+   st->consumed = 0;
+   st->rows_done = 0;
+   st->color = color;
+   st->palette = palette;
+   st->pal_img_n = pal_img_n;
+   st->pal_out_n = req_comp >= 3 ? req_comp : pal_img_n;
+   st->has_trans = has_trans;
+   st->tc = tc;
+   st->tc16 = tc16;
+   st->req_comp = req_comp;
+   *st->x = s->img_x;
+   *st->y = s->img_y;
+   if (st->comp) *st->comp = pal_img_n ? pal_img_n : has_trans ? s->img_n+1 : s->img_n;
+   if (st->finish) {
+      int n = req_comp ? req_comp : pal_img_n ? pal_img_n : has_trans ? s->img_n+1 : s->img_n;
+      st->out = stbi__finish_buffer(st->finish, s->img_x, s->img_y, n);
+      if (!st->out) { stbi__free(st->prior); return 0; }
+   }
+
+   a.zbuffer = z->idata;
+   a.zbuffer_end = z->idata + ioff;
+   // room for a whole band beside the window, so flushes hand over full bands
+   zsize = 65536;
+   while (zsize < (size_t) st->band_rows * st->row_bytes + 32768)
+      zsize *= 2;
+   a.zout_start = a.zout = (char *) stbi__malloc(zsize);
+   a.zout_end = a.zout_start + zsize;
+   a.z_expandable = 1;
+   a.flush = stbi__png_stream_flush;
+   a.flush_user = z;
+   ok = a.zout_start != NULL ? stbi__parse_zlib(&a, 1) : stbi__err("outofmem", "Out of memory");
+   if (ok && st->rows_done < s->img_y) ok = stbi__err("not enough pixels","Corrupt PNG");
+   if (!ok && st->out) {
+      if (st->out != st->finish->dest) stbi__free(st->out);
+      st->out = NULL;
+   }
+   stbi__free(a.zout_start);
+   stbi__free(st->prior);
+   stbi__free(z->idata); z->idata = NULL;
+   return ok;
+}
+
 static int stbi__parse_png_file(stbi__png *z, int scan, int req_comp)
 {
    stbi_uc palette[1024], pal_img_n=0;
@@ -5124,7 +7285,7 @@ static int stbi__parse_png_file(stbi__png *z, int scan, int req_comp)
                while (ioff + c.length > idata_limit)
                   idata_limit *= 2;
                STBI_NOTUSED(idata_limit_old);
-               p = (stbi_uc *) STBI_REALLOC_SIZED(z->idata, idata_limit_old, idata_limit); if (p == NULL) return stbi__err("outofmem", "Out of memory");
+               p = (stbi_uc *) stbi__realloc_sized(z->idata, idata_limit_old, idata_limit); if (p == NULL) return stbi__err("outofmem", "Out of memory");
                z->idata = p;
             }
             if (!stbi__getn(s, z->idata+ioff,c.length)) return stbi__err("outofdata","Corrupt PNG");
@@ -5137,22 +7298,27 @@ static int stbi__parse_png_file(stbi__png *z, int scan, int req_comp)
             if (first) return stbi__err("first not IHDR", "Corrupt PNG");
             if (scan != STBI__SCAN_load) return 1;
             if (z->idata == NULL) return stbi__err("no IDAT","Corrupt PNG");
+            if ((req_comp == s->img_n+1 && req_comp != 3 && !pal_img_n) || has_trans)
+               s->img_out_n = s->img_n+1;
+            else
+               s->img_out_n = s->img_n;
+            if (z->stream && !interlace && !is_iphone) {
+               if (!stbi__png_stream_image(z, ioff, color, palette, pal_img_n, has_trans, tc, tc16, req_comp)) return 0;
+               stbi__get32be(s);
+               return 1;
+            }
             // initial guess for decoded data size to avoid unnecessary reallocs
             bpl = (s->img_x * z->depth + 7) / 8; // bytes per line, per component
             raw_len = bpl * s->img_y * s->img_n /* pixels */ + s->img_y /* filter mode per row */;
             z->expanded = (stbi_uc *) stbi_zlib_decode_malloc_guesssize_headerflag((char *) z->idata, ioff, raw_len, (int *) &raw_len, !is_iphone);
             if (z->expanded == NULL) return 0; // zlib should set error
-            STBI_FREE(z->idata); z->idata = NULL;
-            if ((req_comp == s->img_n+1 && req_comp != 3 && !pal_img_n) || has_trans)
-               s->img_out_n = s->img_n+1;
-            else
-               s->img_out_n = s->img_n;
+            stbi__free(z->idata); z->idata = NULL;
             if (!stbi__create_png_image(z, z->expanded, raw_len, s->img_out_n, z->depth, color, interlace)) return 0;
             if (has_trans) {
                if (z->depth == 16) {
-                  if (!stbi__compute_transparency16(z, tc16, s->img_out_n)) return 0;
+                  if (!stbi__compute_transparency16(z->out, s->img_x * s->img_y, tc16, s->img_out_n)) return 0;
                } else {
-                  if (!stbi__compute_transparency(z, tc, s->img_out_n)) return 0;
+                  if (!stbi__compute_transparency(z->out, s->img_x * s->img_y, tc, s->img_out_n)) return 0;
                }
             }
             if (is_iphone && stbi__de_iphone_flag && s->img_out_n > 2)
@@ -5168,7 +7334,7 @@ static int stbi__parse_png_file(stbi__png *z, int scan, int req_comp)
                // non-paletted image with tRNS -> source image has (constant) alpha
                ++s->img_n;
             }
-            STBI_FREE(z->expanded); z->expanded = NULL;
+            stbi__free(z->expanded); z->expanded = NULL;
             // end of PNG chunk, read and skip CRC
             stbi__get32be(s);
             return 1;
@@ -5201,6 +7367,12 @@ static void *stbi__do_png(stbi__png *p, int *x, int *y, int *n, int req_comp, st
    void *result=NULL;
    if (req_comp < 0 || req_comp > 4) return stbi__errpuc("bad req_comp", "Internal error");
    if (stbi__parse_png_file(p, STBI__SCAN_load, req_comp)) {
+      if (p->stream && p->stream->out) {
+         // streamed, already finished and converted to 8 bits
+         ri->bits_per_channel = 8;
+         ri->finished = 1;
+         return p->stream->out;
+      }
       if (p->depth <= 8)
          ri->bits_per_channel = 8;
       else if (p->depth == 16)
@@ -5221,9 +7393,9 @@ static void *stbi__do_png(stbi__png *p, int *x, int *y, int *n, int req_comp, st
       *y = p->s->img_y;
       if (n) *n = p->s->img_n;
    }
-   STBI_FREE(p->out);      p->out      = NULL;
-   STBI_FREE(p->expanded); p->expanded = NULL;
-   STBI_FREE(p->idata);    p->idata    = NULL;
+   stbi__free(p->out);      p->out      = NULL;
+   stbi__free(p->expanded); p->expanded = NULL;
+   stbi__free(p->idata);    p->idata    = NULL;
 
    return result;
 }
@@ -5231,10 +7403,74 @@ static void *stbi__do_png(stbi__png *p, int *x, int *y, int *n, int req_comp, st
 static void *stbi__png_load(stbi__context *s, int *x, int *y, int *comp, int req_comp, stbi__result_info *ri)
 {
    stbi__png p;
+   struct stbi__png_stream st;
    p.s = s;
+   p.stream = NULL;
+   // 8-bit loads inflate and unfilter a band at a time like stbi_load_rows,
+   // each band written out finished while it is in cache. interlaced and
+   // iPhone images still come back whole
+   if (s->finish && !s->scale_log2) {
+      memset(&st, 0, sizeof(st));
+      st.x = x;
+      st.y = y;
+      st.comp = comp;
+      st.finish = s->finish;
+      st.bgr = s->finish->bgr;
+      st.premultiply = s->finish->premultiply;
+      p.stream = &st;
+   }
    return stbi__do_png(&p, x,y,comp,req_comp, ri);
 }
 
+static int stbi__png_load_rows(stbi__context *s, int *x, int *y, int *comp, int req_comp, stbi_rows_func func, void *user)
+{
+   stbi__png p;
+   struct stbi__png_stream st;
+   int ok;
+   if (req_comp < 0 || req_comp > 4) return stbi__err("bad req_comp", "Internal error");
+   st.func = func;
+   st.user = user;
+   st.x = x;
+   st.y = y;
+   st.comp = comp;
+   st.prior = NULL;
+   st.bgr = stbi__bgr_on_load;
+   st.premultiply = stbi__premultiply_on_load;
+   st.finish = NULL;
+   st.out = NULL;
+   p.s = s;
+   p.stream = &st;
+   ok = stbi__parse_png_file(&p, STBI__SCAN_load, req_comp);
+   if (ok && p.out) {
+      // interlaced and iPhone images come back whole, finish like stbi__do_png
+      int n = s->img_out_n;
+      void *result = p.out;
+      p.out = NULL;
+      if (req_comp && req_comp != n) {
+         if (p.depth == 16)
+            result = stbi__convert_format16((stbi__uint16 *) result, n, req_comp, s->img_x, s->img_y);
+         else
+            result = stbi__convert_format((stbi_uc *) result, n, req_comp, s->img_x, s->img_y);
+         n = req_comp;
+      }
+      if (result && p.depth == 16)
+         result = stbi__convert_16_to_8((stbi__uint16 *) result, s->img_x, s->img_y, n);
+      ok = result != NULL;
+      if (ok && (st.bgr || st.premultiply))
+         stbi__finish_row((stbi_uc *) result, (stbi_uc *) result, s->img_x * s->img_y, n, st.bgr, st.premultiply);
+      *x = s->img_x;
+      *y = s->img_y;
+      if (comp) *comp = s->img_n;
+      if (ok && !func(user, 0, s->img_y, (stbi_uc *) result))
+         ok = stbi__err("stopped", "Row callback stopped the decode");
+      stbi__free(result);
+   }
+   stbi__free(p.out);
+   stbi__free(p.expanded);
+   stbi__free(p.idata);
+   return ok;
+}
+
 static int stbi__png_test(stbi__context *s)
 {
    int r;
@@ -5274,6 +7510,102 @@ static int stbi__png_is16(stbi__context *s)
    }
    return 1;
 }
+
+// scratch a decode of this png takes, mirroring the allocations of
+// stbi__parse_png_file, stbi__do_png and the 16 to 8 bit conversion. the
+// chunks are walked for the IDAT sizes and tRNS, their data is skipped
+static int stbi__png_scratch(stbi__context *s, int req_comp, int *x, int *y, int *comp, size_t *scratch)
+{
+   stbi__uint32 ioff=0, idata_limit=0, raw_len;
+   size_t pixels, bytes;
+   int depth=0, color=0, interlace=0, has_trans=0, first=1, img_n, pal_img_n, out_n, final_n, b;
+   if (!stbi__check_png_header(s)) return 0;
+   for (;;) {
+      stbi__pngchunk c = stbi__get_chunk_header(s);
+      if (first != (c.type == STBI__PNG_TYPE('I','H','D','R'))) return stbi__err("first not IHDR","Corrupt PNG");
+      if (c.type == STBI__PNG_TYPE('I','E','N','D')) break;
+      if (stbi__at_eof(s)) return stbi__err("outofdata","Corrupt PNG");
+      switch (c.type) {
+         case STBI__PNG_TYPE('I','H','D','R'):
+            if (c.length != 13) return stbi__err("bad IHDR len","Corrupt PNG");
+            s->img_x = stbi__get32be(s);
+            s->img_y = stbi__get32be(s);
+            depth = stbi__get8(s);
+            color = stbi__get8(s);
+            stbi__get16be(s); // compression and filter method
+            interlace = stbi__get8(s);
+            if (!s->img_x || !s->img_y || s->img_x > STBI_MAX_DIMENSIONS || s->img_y > STBI_MAX_DIMENSIONS) return stbi__err("too large","Corrupt PNG");
+            if ((1 << 30) / s->img_x / 4 < s->img_y) return stbi__err("too large","Image too large to decode");
+            if (color > 6 || (color != 3 && (color & 1))) return stbi__err("bad ctype","Corrupt PNG");
+            first = 0;
+            break;
+         case STBI__PNG_TYPE('t','R','N','S'):
+            has_trans = 1;
+            stbi__skip(s, c.length);
+            break;
+         case STBI__PNG_TYPE('I','D','A','T'):
+            if ((int)(ioff + c.length) < (int)ioff) return 0;
+            if (ioff + c.length > idata_limit) {
+               if (idata_limit == 0) idata_limit = c.length > 4096 ? c.length : 4096;
+               while (ioff + c.length > idata_limit)
+                  idata_limit *= 2;
+            }
+            ioff += c.length;
+            stbi__skip(s, c.length);
+            break;
+         default:
+            stbi__skip(s, c.length);
+            break;
+      }
+      stbi__get32be(s); // CRC
+   }
+   if (!ioff) return stbi__err("no IDAT","Corrupt PNG");
+
+   img_n = color == 3 ? 1 : (color & 2 ? 3 : 1) + (color & 4 ? 1 : 0);
+   pal_img_n = color == 3 ? (has_trans ? 4 : 3) : 0;
+   b = depth == 16 ? 2 : 1;
+   pixels = (size_t) s->img_x * s->img_y;
+   raw_len = (s->img_x * depth + 7) / 8 * s->img_y * img_n + s->img_y;
+   if ((req_comp == img_n+1 && req_comp != 3 && !pal_img_n) || (has_trans && !pal_img_n))
+      out_n = img_n+1;
+   else
+      out_n = img_n;
+   *comp = pal_img_n ? pal_img_n : img_n + (has_trans ? 1 : 0);
+   *x = s->img_x;
+   *y = s->img_y;
+   if (!interlace) {
+      // 8-bit loads stream into the output, see stbi__png_stream_image: a
+      // row and two bands, then the zlib window on top. it starts with room
+      // for a band and the flush keeps it under two rows and 64K plus a
+      // stored block before it grows
+      size_t band_rows = 65536 / s->img_x + 1, row_bytes = (s->img_x * depth + 7) / 8 * img_n + 1, window = 65536;
+      if (band_rows > s->img_y) band_rows = s->img_y;
+      while (window < band_rows * row_bytes + 32768 || window < (2*row_bytes > 65536 ? 2*row_bytes : 65536) + 65536)
+         window *= 2;
+      *scratch = stbi__arena_bytes(idata_limit)
+               + stbi__arena_bytes((size_t) s->img_x * out_n * b + band_rows * s->img_x * 16)
+               + stbi__arena_bytes(window);
+      return 1;
+   }
+   // the zlib buffer may double once for the extra filter bytes of the passes
+   bytes = stbi__arena_bytes(idata_limit) + stbi__arena_bytes((size_t) raw_len << interlace);
+   // the passes are decoded one at a time beside the final image
+   bytes += stbi__arena_bytes(pixels * out_n * b) << interlace;
+   if (pal_img_n) {
+      final_n = req_comp >= 3 ? req_comp : pal_img_n;
+      bytes += stbi__arena_bytes(pixels * final_n);
+   } else {
+      final_n = out_n;
+   }
+   if (req_comp && req_comp != final_n) {
+      bytes += stbi__arena_bytes(pixels * req_comp * b);
+      final_n = req_comp;
+   }
+   if (b == 2)
+      bytes += stbi__arena_bytes(pixels * final_n);
+   *scratch = bytes;
+   return 1;
+}
 #endif
 
 // Microsoft/Windows BMP image
@@ -5520,7 +7852,7 @@ static void *stbi__bmp_load(stbi__context *s, int *x, int *y, int *comp, int req
    if (!out) return stbi__errpuc("outofmem", "Out of memory");
    if (info.bpp < 16) {
       int z=0;
-      if (psize == 0 || psize > 256) { STBI_FREE(out); return stbi__errpuc("invalid", "Corrupt BMP"); }
+      if (psize == 0 || psize > 256) { stbi__free(out); return stbi__errpuc("invalid", "Corrupt BMP"); }
       for (i=0; i < psize; ++i) {
          pal[i][2] = stbi__get8(s);
          pal[i][1] = stbi__get8(s);
@@ -5532,7 +7864,7 @@ static void *stbi__bmp_load(stbi__context *s, int *x, int *y, int *comp, int req
       if (info.bpp == 1) width = (s->img_x + 7) >> 3;
       else if (info.bpp == 4) width = (s->img_x + 1) >> 1;
       else if (info.bpp == 8) width = s->img_x;
-      else { STBI_FREE(out); return stbi__errpuc("bad bpp", "Corrupt BMP"); }
+      else { stbi__free(out); return stbi__errpuc("bad bpp", "Corrupt BMP"); }
       pad = (-width)&3;
       if (info.bpp == 1) {
          for (j=0; j < (int) s->img_y; ++j) {
@@ -5589,13 +7921,13 @@ static void *stbi__bmp_load(stbi__context *s, int *x, int *y, int *comp, int req
             easy = 2;
       }
       if (!easy) {
-         if (!mr || !mg || !mb) { STBI_FREE(out); return stbi__errpuc("bad masks", "Corrupt BMP"); }
+         if (!mr || !mg || !mb) { stbi__free(out); return stbi__errpuc("bad masks", "Corrupt BMP"); }
          // right shift amt to put high bit in position #7
          rshift = stbi__high_bit(mr)-7; rcount = stbi__bitcount(mr);
          gshift = stbi__high_bit(mg)-7; gcount = stbi__bitcount(mg);
          bshift = stbi__high_bit(mb)-7; bcount = stbi__bitcount(mb);
          ashift = stbi__high_bit(ma)-7; acount = stbi__bitcount(ma);
-         if (rcount > 8 || gcount > 8 || bcount > 8 || acount > 8) { STBI_FREE(out); return stbi__errpuc("bad masks", "Corrupt BMP"); }
+         if (rcount > 8 || gcount > 8 || bcount > 8 || acount > 8) { stbi__free(out); return stbi__errpuc("bad masks", "Corrupt BMP"); }
       }
       for (j=0; j < (int) s->img_y; ++j) {
          if (easy) {
@@ -5863,7 +8195,7 @@ static void *stbi__tga_load(stbi__context *s, int *x, int *y, int *comp, int req
       if ( tga_indexed)
       {
          if (tga_palette_len == 0) {  /* you have to have at least one entry! */
-            STBI_FREE(tga_data);
+            stbi__free(tga_data);
             return stbi__errpuc("bad palette", "Corrupt TGA");
          }
 
@@ -5872,7 +8204,7 @@ static void *stbi__tga_load(stbi__context *s, int *x, int *y, int *comp, int req
          //   load the palette
          tga_palette = (unsigned char*)stbi__malloc_mad2(tga_palette_len, tga_comp, 0);
          if (!tga_palette) {
-            STBI_FREE(tga_data);
+            stbi__free(tga_data);
             return stbi__errpuc("outofmem", "Out of memory");
          }
          if (tga_rgb16) {
@@ -5883,8 +8215,8 @@ static void *stbi__tga_load(stbi__context *s, int *x, int *y, int *comp, int req
                pal_entry += tga_comp;
             }
          } else if (!stbi__getn(s, tga_palette, tga_palette_len * tga_comp)) {
-               STBI_FREE(tga_data);
-               STBI_FREE(tga_palette);
+               stbi__free(tga_data);
+               stbi__free(tga_palette);
                return stbi__errpuc("bad palette", "Corrupt TGA");
          }
       }
@@ -5965,7 +8297,7 @@ static void *stbi__tga_load(stbi__context *s, int *x, int *y, int *comp, int req
       //   clear my palette, if I had one
       if ( tga_palette != NULL )
       {
-         STBI_FREE( tga_palette );
+         stbi__free( tga_palette );
       }
    }
 
@@ -6157,7 +8489,7 @@ static void *stbi__psd_load(stbi__context *s, int *x, int *y, int *comp, int req
          } else {
             // Read the RLE data.
             if (!stbi__psd_decode_rle(s, p, pixelCount)) {
-               STBI_FREE(out);
+               stbi__free(out);
                return stbi__errpuc("corrupt", "bad RLE data");
             }
          }
@@ -6449,7 +8781,7 @@ static void *stbi__pic_load(stbi__context *s,int *px,int *py,int *comp,int req_c
    memset(result, 0xff, x*y*4);
 
    if (!stbi__pic_load_core(s,x,y,comp, result)) {
-      STBI_FREE(result);
+      stbi__free(result);
       result=0;
    }
    *px = x;
@@ -6563,13 +8895,13 @@ static int stbi__gif_info_raw(stbi__context *s, int *x, int *y, int *comp)
    stbi__gif* g = (stbi__gif*) stbi__malloc(sizeof(stbi__gif));
    if (!g) return stbi__err("outofmem", "Out of memory");
    if (!stbi__gif_header(s, g, comp, 1)) {
-      STBI_FREE(g);
+      stbi__free(g);
       stbi__rewind( s );
       return 0;
    }
    if (x) *x = g->w;
    if (y) *y = g->h;
-   STBI_FREE(g);
+   stbi__free(g);
    return 1;
 }
 
@@ -6873,12 +9205,12 @@ static stbi_uc *stbi__gif_load_next(stbi__context *s, stbi__gif *g, int *comp, i
 
 static void *stbi__load_gif_main_outofmem(stbi__gif *g, stbi_uc *out, int **delays)
 {
-   STBI_FREE(g->out);
-   STBI_FREE(g->history);
-   STBI_FREE(g->background);
+   stbi__free(g->out);
+   stbi__free(g->history);
+   stbi__free(g->background);
 
-   if (out) STBI_FREE(out);
-   if (delays && *delays) STBI_FREE(*delays);
+   if (out) stbi__free(out);
+   if (delays && *delays) stbi__free(*delays);
    return stbi__errpuc("outofmem", "Out of memory");
 }
 
@@ -6913,7 +9245,7 @@ static void *stbi__load_gif_main(stbi__context *s, int **delays, int *x, int *y,
             stride = g.w * g.h * 4;
 
             if (out) {
-               void *tmp = (stbi_uc*) STBI_REALLOC_SIZED( out, out_size, layers * stride );
+               void *tmp = (stbi_uc*) stbi__realloc_sized( out, out_size, layers * stride );
                if (!tmp)
                   return stbi__load_gif_main_outofmem(&g, out, delays);
                else {
@@ -6922,7 +9254,7 @@ static void *stbi__load_gif_main(stbi__context *s, int **delays, int *x, int *y,
                }
 
                if (delays) {
-                  int *new_delays = (int*) STBI_REALLOC_SIZED( *delays, delays_size, sizeof(int) * layers );
+                  int *new_delays = (int*) stbi__realloc_sized( *delays, delays_size, sizeof(int) * layers );
                   if (!new_delays)
                      return stbi__load_gif_main_outofmem(&g, out, delays);
                   *delays = new_delays;
@@ -6952,9 +9284,9 @@ static void *stbi__load_gif_main(stbi__context *s, int **delays, int *x, int *y,
       } while (u != 0);
 
       // free temp buffer;
-      STBI_FREE(g.out);
-      STBI_FREE(g.history);
-      STBI_FREE(g.background);
+      stbi__free(g.out);
+      stbi__free(g.history);
+      stbi__free(g.background);
 
       // do the final conversion after loading everything;
       if (req_comp && req_comp != 4)
@@ -6986,12 +9318,12 @@ static void *stbi__gif_load(stbi__context *s, int *x, int *y, int *comp, int req
          u = stbi__convert_format(u, 4, req_comp, g.w, g.h);
    } else if (g.out) {
       // if there was an error and we allocated an image buffer, free it!
-      STBI_FREE(g.out);
+      stbi__free(g.out);
    }
 
    // free buffers needed for multiple frame loading;
-   STBI_FREE(g.history);
-   STBI_FREE(g.background);
+   stbi__free(g.history);
+   stbi__free(g.background);
 
    return u;
 }
@@ -7077,19 +9409,100 @@ static void stbi__hdr_convert(float *output, stbi_uc *input, int req_comp)
    }
 }
 
+// RGBE pixels to floats, or to halves when half is set
+static void stbi__hdr_convert_pixels(void *output, stbi_uc const *input, int n, int req_comp, int half)
+{
+   float *out = (float *) output;
+   stbi__uint16 *out16 = (stbi__uint16 *) output;
+   float f[4];
+   int i = 0, k;
+   #ifdef STBI_SSE2
+   if (req_comp >= 3 && stbi__sse2_available()) {
+      __m128i zero = _mm_setzero_si128();
+      __m128i rgb = _mm_set_epi32(0, -1, -1, -1);
+      __m128 alpha = _mm_set_ps(1.0f, 0.0f, 0.0f, 0.0f);
+      for (; i+4 <= n; i += 4) {
+         stbi_uc const *p = input + i*4;
+         __m128i x, lo, hi, v[4];
+         __m128 c[4], o0, o1, o2;
+         int j;
+         // exponents 1 to 9 scale into float denormals, the rare row with
+         // one is finished by the scalar code below
+         if ((stbi_uc) (p[3]-1) < 9 || (stbi_uc) (p[7]-1) < 9 || (stbi_uc) (p[11]-1) < 9 || (stbi_uc) (p[15]-1) < 9)
+            break;
+         x  = _mm_loadu_si128((__m128i const *) p);
+         lo = _mm_unpacklo_epi8(x, zero);
+         hi = _mm_unpackhi_epi8(x, zero);
+         v[0] = _mm_unpacklo_epi16(lo, zero);
+         v[1] = _mm_unpackhi_epi16(lo, zero);
+         v[2] = _mm_unpacklo_epi16(hi, zero);
+         v[3] = _mm_unpackhi_epi16(hi, zero);
+         for (j=0; j < 4; ++j) {
+            // 2^(e-136) put together in the exponent field, exact as the
+            // ldexp of stbi__hdr_convert; e of 0 gives black
+            __m128i e = _mm_shuffle_epi32(v[j], _MM_SHUFFLE(3,3,3,3));
+            __m128 scale = _mm_castsi128_ps(_mm_slli_epi32(_mm_sub_epi32(e, _mm_set1_epi32(9)), 23));
+            __m128i keep = _mm_and_si128(_mm_cmpgt_epi32(e, zero), rgb);
+            c[j] = _mm_or_ps(_mm_and_ps(_mm_mul_ps(_mm_cvtepi32_ps(v[j]), scale), _mm_castsi128_ps(keep)), alpha);
+         }
+         if (req_comp == 4) {
+            if (half) {
+               _mm_storeu_si128((__m128i *) (out16 + i*4    ), _mm_packs_epi32(stbi__rgbe_to_half_sse2(c[0]), stbi__rgbe_to_half_sse2(c[1])));
+               _mm_storeu_si128((__m128i *) (out16 + i*4 + 8), _mm_packs_epi32(stbi__rgbe_to_half_sse2(c[2]), stbi__rgbe_to_half_sse2(c[3])));
+            } else {
+               for (j=0; j < 4; ++j)
+                  _mm_storeu_ps(out + i*4 + j*4, c[j]);
+            }
+            continue;
+         }
+         // r0 g0 b0 r1 | g1 b1 r2 g2 | b2 r3 g3 b3
+         o0 = _mm_shuffle_ps(c[0], _mm_shuffle_ps(c[0], c[1], _MM_SHUFFLE(0,0,2,2)), _MM_SHUFFLE(2,0,1,0));
+         o1 = _mm_shuffle_ps(c[1], c[2], _MM_SHUFFLE(1,0,2,1));
+         o2 = _mm_shuffle_ps(_mm_shuffle_ps(c[2], c[3], _MM_SHUFFLE(0,0,2,2)), c[3], _MM_SHUFFLE(2,1,2,0));
+         if (half) {
+            __m128i h2 = stbi__rgbe_to_half_sse2(o2);
+            _mm_storeu_si128((__m128i *) (out16 + i*3), _mm_packs_epi32(stbi__rgbe_to_half_sse2(o0), stbi__rgbe_to_half_sse2(o1)));
+            _mm_storel_epi64((__m128i *) (out16 + i*3 + 8), _mm_packs_epi32(h2, h2));
+         } else {
+            _mm_storeu_ps(out + i*3    , o0);
+            _mm_storeu_ps(out + i*3 + 4, o1);
+            _mm_storeu_ps(out + i*3 + 8, o2);
+         }
+      }
+   }
+   #endif
+   for (; i < n; ++i) {
+      if (!half) {
+         stbi__hdr_convert(out + i*req_comp, (stbi_uc *) input + i*4, req_comp);
+         continue;
+      }
+      stbi__hdr_convert(f, (stbi_uc *) input + i*4, req_comp);
+      for (k=0; k < req_comp; ++k)
+         out16[i*req_comp + k] = stbi__float_to_half(f[k]);
+   }
+}
+
 static float *stbi__hdr_load(stbi__context *s, int *x, int *y, int *comp, int req_comp, stbi__result_info *ri)
+{
+   STBI_NOTUSED(ri);
+   return (float *) stbi__hdr_load_main(s, x, y, comp, req_comp, 0, NULL);
+}
+
+// floats, or IEEE halves when half is set. halves go where f says, flipped
+// as they are converted, when it is given
+static void *stbi__hdr_load_main(stbi__context *s, int *x, int *y, int *comp, int req_comp, int half, struct stbi__finish *f)
 {
    char buffer[STBI__HDR_BUFLEN];
    char *token;
    int valid = 0;
    int width, height;
    stbi_uc *scanline;
-   float *hdr_data;
-   int len;
+   stbi_uc *hdr_data, *owned;
+   size_t row_bytes;
+   int len, rle;
    unsigned char count, value;
    int i, j, k, c1,c2, z;
    const char *headerToken;
-   STBI_NOTUSED(ri);
 
    // Check identifier
    headerToken = stbi__hdr_gettoken(s,buffer);
@@ -7125,85 +9538,87 @@ static float *stbi__hdr_load(stbi__context *s, int *x, int *y, int *comp, int re
    if (comp) *comp = 3;
    if (req_comp == 0) req_comp = 3;
 
-   if (!stbi__mad4sizes_valid(width, height, req_comp, sizeof(float), 0))
+   if (!stbi__mad4sizes_valid(width, height, req_comp, half ? 2 : sizeof(float), 0))
       return stbi__errpf("too large", "HDR image is too large");
 
-   // Read data
-   hdr_data = (float *) stbi__malloc_mad4(width, height, req_comp, sizeof(float), 0);
-   if (!hdr_data)
+   // Read data, owned is what the error paths free
+   if (f && half) {
+      hdr_data = stbi__finish_buffer(f, width, height, req_comp * 2);
+      if (!hdr_data) return NULL;
+   } else {
+      f = NULL;
+      hdr_data = (stbi_uc *) stbi__malloc_mad4(width, height, req_comp, half ? 2 : sizeof(float), 0);
+      if (!hdr_data)
+         return stbi__errpf("outofmem", "Out of memory");
+   }
+   owned = f && hdr_data == f->dest ? NULL : hdr_data;
+   row_bytes = (size_t) width * req_comp * (half ? 2 : sizeof(float));
+   scanline = (stbi_uc *) stbi__malloc_mad2(width, 4, 0);
+   if (!scanline) {
+      stbi__free(owned);
       return stbi__errpf("outofmem", "Out of memory");
+   }
 
    // Load image data
-   // image data is stored as some number of sca
-   if ( width < 8 || width >= 32768) {
-      // Read flat data
-      for (j=0; j < height; ++j) {
-         for (i=0; i < width; ++i) {
-            stbi_uc rgbe[4];
-           main_decode_loop:
-            stbi__getn(s, rgbe, 4);
-            stbi__hdr_convert(hdr_data + j * width * req_comp + i * req_comp, rgbe, req_comp);
-         }
-      }
-   } else {
-      // Read RLE-encoded data
-      scanline = NULL;
-
-      for (j = 0; j < height; ++j) {
+   // image data is stored as some number of scanlines, each gathered into
+   // scanline as RGBE pixels and converted as a whole
+   rle = width >= 8 && width < 32768;
+   for (j = 0; j < height; ++j) {
+      i = 0;
+      if (rle) {
          c1 = stbi__get8(s);
          c2 = stbi__get8(s);
          len = stbi__get8(s);
          if (c1 != 2 || c2 != 2 || (len & 0x80)) {
             // not run-length encoded, so we have to actually use THIS data as a decoded
-            // pixel (note this can't be a valid pixel--one of RGB must be >= 128)
-            stbi_uc rgbe[4];
-            rgbe[0] = (stbi_uc) c1;
-            rgbe[1] = (stbi_uc) c2;
-            rgbe[2] = (stbi_uc) len;
-            rgbe[3] = (stbi_uc) stbi__get8(s);
-            stbi__hdr_convert(hdr_data, rgbe, req_comp);
+            // pixel (note this can't be a valid pixel--one of RGB must be >= 128),
+            // and the flat data it starts goes in from the top row
+            scanline[0] = (stbi_uc) c1;
+            scanline[1] = (stbi_uc) c2;
+            scanline[2] = (stbi_uc) len;
+            scanline[3] = (stbi_uc) stbi__get8(s);
             i = 1;
             j = 0;
-            STBI_FREE(scanline);
-            goto main_decode_loop; // yes, this makes no sense
-         }
-         len <<= 8;
-         len |= stbi__get8(s);
-         if (len != width) { STBI_FREE(hdr_data); STBI_FREE(scanline); return stbi__errpf("invalid decoded scanline length", "corrupt HDR"); }
-         if (scanline == NULL) {
-            scanline = (stbi_uc *) stbi__malloc_mad2(width, 4, 0);
-            if (!scanline) {
-               STBI_FREE(hdr_data);
-               return stbi__errpf("outofmem", "Out of memory");
-            }
-         }
-
-         for (k = 0; k < 4; ++k) {
-            int nleft;
-            i = 0;
-            while ((nleft = width - i) > 0) {
-               count = stbi__get8(s);
-               if (count > 128) {
-                  // Run
-                  value = stbi__get8(s);
-                  count -= 128;
-                  if (count > nleft) { STBI_FREE(hdr_data); STBI_FREE(scanline); return stbi__errpf("corrupt", "bad RLE data in HDR"); }
-                  for (z = 0; z < count; ++z)
-                     scanline[i++ * 4 + k] = value;
-               } else {
-                  // Dump
-                  if (count > nleft) { STBI_FREE(hdr_data); STBI_FREE(scanline); return stbi__errpf("corrupt", "bad RLE data in HDR"); }
-                  for (z = 0; z < count; ++z)
-                     scanline[i++ * 4 + k] = stbi__get8(s);
+            rle = 0;
+         } else {
+            len <<= 8;
+            len |= stbi__get8(s);
+            if (len != width) { stbi__free(owned); stbi__free(scanline); return stbi__errpf("invalid decoded scanline length", "corrupt HDR"); }
+
+            for (k = 0; k < 4; ++k) {
+               int nleft;
+               i = 0;
+               while ((nleft = width - i) > 0) {
+                  count = stbi__get8(s);
+                  if (count > 128) {
+                     // Run
+                     value = stbi__get8(s);
+                     count -= 128;
+                     if (count > nleft) { stbi__free(owned); stbi__free(scanline); return stbi__errpf("corrupt", "bad RLE data in HDR"); }
+                     for (z = 0; z < count; ++z)
+                        scanline[i++ * 4 + k] = value;
+                  } else {
+                     // Dump, straight from the buffer when it holds all of it
+                     if (count > nleft) { stbi__free(owned); stbi__free(scanline); return stbi__errpf("corrupt", "bad RLE data in HDR"); }
+                     if (s->img_buffer + count <= s->img_buffer_end) {
+                        for (z = 0; z < count; ++z)
+                           scanline[i++ * 4 + k] = s->img_buffer[z];
+                        s->img_buffer += count;
+                     } else {
+                        for (z = 0; z < count; ++z)
+                           scanline[i++ * 4 + k] = stbi__get8(s);
+                     }
+                  }
                }
             }
          }
-         for (i=0; i < width; ++i)
-            stbi__hdr_convert(hdr_data+(j*width + i)*req_comp, scanline + i*4, req_comp);
       }
-      if (scanline)
-         STBI_FREE(scanline);
+      // Read flat data
+      for (; i < width; ++i)
+         stbi__getn(s, scanline + i*4, 4);
+      stbi__hdr_convert_pixels(hdr_data + (f && f->flip ? height - 1 - j : j) * row_bytes, scanline, width, req_comp, half);
    }
+   stbi__free(scanline);
 
    return hdr_data;
 }
@@ -7654,6 +10069,243 @@ STBIDEF int stbi_info_from_callbacks(stbi_io_callbacks const *c, void *user, int
    return stbi__info_main(&s,x,y,comp);
 }
 
+STBIDEF int stbi_decode_sizes_from_memory(stbi_uc const *buffer, int len, int desired_channels, int *x, int *y, int *channels_in_file, size_t *output_bytes, size_t *scratch_bytes)
+{
+   stbi__context s;
+   size_t scratch = 0, tests = 0;
+   int w, h, n, found = 0;
+   if (desired_channels < 0 || desired_channels > 4) return stbi__err("bad req_comp", "Internal error");
+   #ifndef STBI_NO_PNG
+   stbi__start_mem(&s,buffer,len);
+   found = stbi__png_scratch(&s, desired_channels, &w, &h, &n, &scratch);
+   #endif
+   #ifndef STBI_NO_JPEG
+   if (!found) {
+      stbi__start_mem(&s,buffer,len);
+      found = stbi__jpeg_scratch(&s, desired_channels, &w, &h, &n, &scratch);
+   }
+   #endif
+   if (!found) {
+      // the other formats hold at most a few copies of the image, HDR
+      // as floats
+      stbi__start_mem(&s,buffer,len);
+      if (!stbi__info_main(&s, &w, &h, &n)) return 0;
+      scratch = stbi__arena_bytes((size_t) w * h * 32 + 65536);
+   }
+   // format tests run first, one struct at a time
+   #ifndef STBI_NO_GIF
+   tests = stbi__arena_bytes(sizeof(stbi__gif));
+   #endif
+   #ifndef STBI_NO_JPEG
+   if (tests < stbi__arena_bytes(sizeof(stbi__jpeg))) tests = stbi__arena_bytes(sizeof(stbi__jpeg));
+   #endif
+   if (x) *x = w;
+   if (y) *y = h;
+   if (channels_in_file) *channels_in_file = n;
+   if (output_bytes) *output_bytes = (size_t) w * h * (desired_channels ? desired_channels : n);
+   if (scratch_bytes) *scratch_bytes = scratch > tests ? scratch : tests;
+   return 1;
+}
+
+STBIDEF int stbi_load_into_from_memory(stbi_uc const *buffer, int len, int *x, int *y, int *channels_in_file, int desired_channels, stbi_uc *output, size_t output_bytes, void *scratch, size_t scratch_bytes)
+{
+   stbi__context s;
+   stbi__arena arena;
+   stbi_uc *result;
+   size_t align = (16 - (size_t) scratch % 16) % 16, bytes;
+   int w, h, n, ok = 1;
+   arena.base = (stbi_uc *) scratch + align;
+   arena.size = scratch && scratch_bytes > align ? scratch_bytes - align : 0;
+   arena.used = 0;
+   arena.top = 0;
+
+   stbi__start_mem(&s,buffer,len);
+   stbi__g_arena = &arena;
+   result = stbi__load_and_finish_8bit(&s,&w,&h,&n,desired_channels,stbi__vertically_flip_on_load,output,output_bytes);
+   stbi__g_arena = NULL;
+   if (!result) return 0;
+
+   // the final write lands in output unless it is too small
+   if (result != output) {
+      bytes = (size_t) w * h * (desired_channels ? desired_channels : n);
+      if (bytes > output_bytes)
+         ok = stbi__err("output too small", "Output buffer too small");
+      else
+         memcpy(output, result, bytes);
+      if (!stbi__arena_owns(&arena, result))
+         stbi__free(result);
+   }
+   if (x) *x = w;
+   if (y) *y = h;
+   if (channels_in_file) *channels_in_file = n;
+   return ok;
+}
+
+static int stbi__load_rows(stbi__context *s, int *x, int *y, int *comp, int req_comp, stbi_rows_func func, void *user)
+{
+   stbi_uc *result;
+   int n, ok;
+   #ifndef STBI_NO_JPEG
+   if (stbi__jpeg_test(s)) return stbi__jpeg_load_rows(s, x, y, comp, req_comp, func, user);
+   #endif
+   #ifndef STBI_NO_PNG
+   if (stbi__png_test(s)) return stbi__png_load_rows(s, x, y, comp, req_comp, func, user);
+   #endif
+
+   // everything else is decoded whole, top row first whatever the flip
+   // flag says, and goes out as one band
+   result = stbi__load_and_finish_8bit(s, x, y, &n, req_comp, 0, NULL, 0);
+   if (!result) return 0;
+   if (comp) *comp = n;
+   ok = func(user, 0, *y, result);
+   stbi__free(result);
+   return ok ? 1 : stbi__err("stopped", "Row callback stopped the decode");
+}
+
+STBIDEF int stbi_load_rows_from_memory(stbi_uc const *buffer, int len, int *x, int *y, int *channels_in_file, int desired_channels, stbi_rows_func func, void *user)
+{
+   stbi__context s;
+   stbi__start_mem(&s,buffer,len);
+   return stbi__load_rows(&s,x,y,channels_in_file,desired_channels,func,user);
+}
+
+#ifndef STBI_NO_STDIO
+STBIDEF int stbi_load_rows(char const *filename, int *x, int *y, int *channels_in_file, int desired_channels, stbi_rows_func func, void *user)
+{
+   FILE *f = stbi__fopen(filename, "rb");
+   stbi__context s;
+   int result;
+   if (!f) return stbi__err("can't fopen", "Unable to open file");
+   stbi__start_file(&s,f);
+   result = stbi__load_rows(&s,x,y,channels_in_file,desired_channels,func,user);
+   fclose(f);
+   return result;
+}
+#endif
+
+// a decoder is current on the calling thread for the length of one load,
+// the options, failure reason and allocator are looked up through it
+static stbi_decoder *stbi__decoder_begin(stbi_decoder *d)
+{
+   stbi_decoder *prev = stbi__g_decoder;
+   d->failure_reason = NULL;
+   stbi__g_decoder = d;
+   return prev;
+}
+
+STBIDEF void stbi_decoder_init(stbi_decoder *d)
+{
+   memset(d, 0, sizeof(*d));
+   d->simd_level = stbi__jpeg_simd_level_global;
+   d->parallel_for = stbi__parallel_for_run_global;
+   d->parallel_for_user = stbi__parallel_for_user_global;
+}
+
+STBIDEF void stbi_decoder_free(stbi_decoder *d, void *retval_from_stbi_decoder_load)
+{
+   if (d->malloc_fn) {
+      if (retval_from_stbi_decoder_load) d->free_fn(d->alloc_user, retval_from_stbi_decoder_load);
+   } else
+      STBI_FREE(retval_from_stbi_decoder_load);
+}
+
+STBIDEF stbi_uc *stbi_decoder_load_from_memory(stbi_decoder *d, stbi_uc const *buffer, int len, int *x, int *y, int *channels_in_file, int desired_channels)
+{
+   stbi_decoder *prev = stbi__decoder_begin(d);
+   stbi_uc *result = stbi_load_from_memory(buffer, len, x, y, channels_in_file, desired_channels);
+   stbi__g_decoder = prev;
+   return result;
+}
+
+STBIDEF int stbi_decoder_load_into_from_memory(stbi_decoder *d, stbi_uc const *buffer, int len, int *x, int *y, int *channels_in_file, int desired_channels, stbi_uc *output, size_t output_bytes, void *scratch, size_t scratch_bytes)
+{
+   stbi_decoder *prev = stbi__decoder_begin(d);
+   int result = stbi_load_into_from_memory(buffer, len, x, y, channels_in_file, desired_channels, output, output_bytes, scratch, scratch_bytes);
+   stbi__g_decoder = prev;
+   return result;
+}
+
+STBIDEF int stbi_decoder_decode_sizes_from_memory(stbi_decoder *d, stbi_uc const *buffer, int len, int desired_channels, int *x, int *y, int *channels_in_file, size_t *output_bytes, size_t *scratch_bytes)
+{
+   stbi_decoder *prev = stbi__decoder_begin(d);
+   int result = stbi_decode_sizes_from_memory(buffer, len, desired_channels, x, y, channels_in_file, output_bytes, scratch_bytes);
+   stbi__g_decoder = prev;
+   return result;
+}
+
+#ifndef STBI_NO_LINEAR
+STBIDEF stbi_us *stbi_decoder_loadh_from_memory(stbi_decoder *d, stbi_uc const *buffer, int len, int *x, int *y, int *channels_in_file, int desired_channels)
+{
+   stbi_decoder *prev = stbi__decoder_begin(d);
+   stbi_us *result = stbi_loadh_from_memory(buffer, len, x, y, channels_in_file, desired_channels);
+   stbi__g_decoder = prev;
+   return result;
+}
+
+STBIDEF int stbi_decoder_loadh_into_from_memory(stbi_decoder *d, stbi_uc const *buffer, int len, int *x, int *y, int *channels_in_file, int desired_channels, stbi_us *output, size_t output_bytes)
+{
+   stbi_decoder *prev = stbi__decoder_begin(d);
+   int result = stbi_loadh_into_from_memory(buffer, len, x, y, channels_in_file, desired_channels, output, output_bytes);
+   stbi__g_decoder = prev;
+   return result;
+}
+#endif
+
+// the rows callback runs with no decoder current, so that loads it makes
+// of its own don't pick up this decoder's options or allocator
+typedef struct
+{
+   stbi_rows_func func;
+   void *user;
+   stbi_decoder *d;
+} stbi__decoder_rows;
+
+static int stbi__decoder_rows_func(void *user, int y, int rows, stbi_uc const *pixels)
+{
+   stbi__decoder_rows *r = (stbi__decoder_rows *) user;
+   int ok;
+   stbi__g_decoder = NULL;
+   ok = r->func(r->user, y, rows, pixels);
+   stbi__g_decoder = r->d;
+   return ok;
+}
+
+STBIDEF int stbi_decoder_load_rows_from_memory(stbi_decoder *d, stbi_uc const *buffer, int len, int *x, int *y, int *channels_in_file, int desired_channels, stbi_rows_func func, void *user)
+{
+   stbi__decoder_rows r;
+   stbi_decoder *prev = stbi__decoder_begin(d);
+   int result;
+   r.func = func;
+   r.user = user;
+   r.d = d;
+   result = stbi_load_rows_from_memory(buffer, len, x, y, channels_in_file, desired_channels, stbi__decoder_rows_func, &r);
+   stbi__g_decoder = prev;
+   return result;
+}
+
+#ifndef STBI_NO_STDIO
+STBIDEF stbi_uc *stbi_decoder_load(stbi_decoder *d, char const *filename, int *x, int *y, int *channels_in_file, int desired_channels)
+{
+   stbi_decoder *prev = stbi__decoder_begin(d);
+   stbi_uc *result = stbi_load(filename, x, y, channels_in_file, desired_channels);
+   stbi__g_decoder = prev;
+   return result;
+}
+
+STBIDEF int stbi_decoder_load_rows(stbi_decoder *d, char const *filename, int *x, int *y, int *channels_in_file, int desired_channels, stbi_rows_func func, void *user)
+{
+   stbi__decoder_rows r;
+   stbi_decoder *prev = stbi__decoder_begin(d);
+   int result;
+   r.func = func;
+   r.user = user;
+   r.d = d;
+   result = stbi_load_rows(filename, x, y, channels_in_file, desired_channels, stbi__decoder_rows_func, &r);
+   stbi__g_decoder = prev;
+   return result;
+}
+#endif
+
 STBIDEF int stbi_is_16_bit_from_memory(stbi_uc const *buffer, int len)
 {
    stbi__context s;
@@ -7,7 +7,11 @@ layout (location = 2) in vec2 aTexCoord;
 out vec3 ourColor;
 out vec2 TexCoord;
 
-uniform mat4 transform;
+// Per-object constants, sub-allocated from a ring of uniform buffer memory
+layout (std140) uniform Object
+{
+  mat4 transform;
+};
 
 void main()
 {
@@ -0,0 +1,12 @@
+#version 330 core
+
+out vec4 FragColor;
+
+in vec3 TexCoord;
+
+uniform sampler2DArray atlas;
+
+void main()
+{
+  FragColor = texture(atlas, TexCoord);
+}
@@ -0,0 +1,21 @@
+#version 330 core
+
+layout (location = 0) in vec3 aPos;
+layout (location = 1) in vec3 aColor;
+layout (location = 2) in vec2 aTexCoord;
+// Per-instance: x, y, rotation angle, scale
+layout (location = 3) in vec4 aInstance;
+// Per-instance: the sprite's atlas region, u0, v0, u1, v1 and its layer
+layout (location = 4) in vec4 aRegion;
+layout (location = 5) in float aLayer;
+
+out vec3 TexCoord;
+
+void main()
+{
+  float s = sin(aInstance.z);
+  float c = cos(aInstance.z);
+  vec2 p = mat2(c, s, -s, c) * aPos.xy * aInstance.w;
+  gl_Position = vec4(p + aInstance.xy, aPos.z, 1.0);
+  TexCoord = vec3(mix(aRegion.xy, aRegion.zw, aTexCoord), aLayer);
+}
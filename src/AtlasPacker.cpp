@@ -0,0 +1,106 @@
+#include "../include/AtlasPacker.h"
+
+#include <algorithm>
+#include <climits>
+
+AtlasPacker::AtlasPacker(int width, int height, int gutter, int maxLayers)
+    : width(width), height(height), gutter(gutter),
+      align(std::max(gutter, 1)), maxLayers(maxLayers) {}
+
+double AtlasPacker::efficiency() const {
+  if (skylines.empty())
+    return 0.0;
+  return used / ((double)width * height * skylines.size());
+}
+
+bool AtlasPacker::insert(int imageWidth, int imageHeight, AtlasRect &rect) {
+  int cellWidth = (imageWidth + 2 * gutter + align - 1) / align * align;
+  int cellHeight = (imageHeight + 2 * gutter + align - 1) / align * align;
+  if (imageWidth <= 0 || imageHeight <= 0 || cellWidth > width ||
+      cellHeight > height)
+    return false;
+
+  bool placed = false;
+  for (int layer = 0; !placed && layer < layers(); layer++)
+    placed = place(layer, cellWidth, cellHeight, rect);
+  if (!placed) {
+    if (layers() >= maxLayers)
+      return false;
+    skylines.push_back({Segment{0, 0, width}});
+    // An empty layer always has room for a cell no larger than it
+    place(layers() - 1, cellWidth, cellHeight, rect);
+  }
+  rect.x += gutter;
+  rect.y += gutter;
+  rect.width = imageWidth;
+  rect.height = imageHeight;
+  used += (double)imageWidth * imageHeight;
+  return true;
+}
+
+int AtlasPacker::fit(const std::vector<Segment> &skyline, size_t index,
+                     int cellWidth, int cellHeight) const {
+  if (skyline[index].x + cellWidth > width)
+    return -1;
+  int y = 0;
+  int left = cellWidth;
+  for (size_t i = index; left > 0; i++) {
+    y = std::max(y, skyline[i].y);
+    if (y + cellHeight > height)
+      return -1;
+    left -= skyline[i].width;
+  }
+  return y;
+}
+
+bool AtlasPacker::place(int layer, int cellWidth, int cellHeight,
+                        AtlasRect &rect) {
+  std::vector<Segment> &skyline = skylines[layer];
+
+  // Lowest top edge wins, then the narrowest segment to waste less
+  int bestTop = INT_MAX, bestWidth = INT_MAX;
+  size_t best = skyline.size();
+  for (size_t i = 0; i < skyline.size(); i++) {
+    int y = fit(skyline, i, cellWidth, cellHeight);
+    if (y < 0)
+      continue;
+    int top = y + cellHeight;
+    if (top < bestTop || (top == bestTop && skyline[i].width < bestWidth)) {
+      bestTop = top;
+      bestWidth = skyline[i].width;
+      best = i;
+    }
+  }
+  if (best == skyline.size())
+    return false;
+
+  int x = skyline[best].x;
+  rect.x = x;
+  rect.y = bestTop - cellHeight;
+  rect.layer = layer;
+
+  // The cell's top replaces the segments it covers, the last one may only
+  // be covered in part
+  skyline.insert(skyline.begin() + best, Segment{x, bestTop, cellWidth});
+  size_t next = best + 1;
+  while (next < skyline.size() && skyline[next].x < x + cellWidth) {
+    int overlap = x + cellWidth - skyline[next].x;
+    if (overlap < skyline[next].width) {
+      skyline[next].x += overlap;
+      skyline[next].width -= overlap;
+      break;
+    }
+    skyline.erase(skyline.begin() + next);
+  }
+
+  // Neighbours at the same height are one segment
+  for (size_t i = 0; i + 1 < skyline.size();) {
+    if (skyline[i].y == skyline[i + 1].y) {
+      skyline[i].width += skyline[i + 1].width;
+      skyline.erase(skyline.begin() + i + 1);
+    } else {
+      i++;
+    }
+  }
+  return true;
+}
@@ -0,0 +1,443 @@
+#include "../include/BlockCompress.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) ||                                    \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define BLOCK_COMPRESS_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+// One 4x4 block as floats, one array per channel so four pixels fit a
+// register
+struct Block {
+  float r[16], g[16], b[16], a[16];
+};
+
+void gatherBlock(const unsigned char *pixels, int width, int height,
+                 int channels, int bx, int by, Block &block) {
+  for (int py = 0; py < 4; py++) {
+    int y = std::min(by * 4 + py, height - 1);
+    for (int px = 0; px < 4; px++) {
+      int x = std::min(bx * 4 + px, width - 1);
+      const unsigned char *p = pixels + ((size_t)y * width + x) * channels;
+      int i = py * 4 + px;
+      if (channels >= 3) {
+        block.r[i] = p[0];
+        block.g[i] = p[1];
+        block.b[i] = p[2];
+      } else {
+        block.r[i] = block.g[i] = block.b[i] = p[0]; // Grey
+      }
+      block.a[i] = channels == 4 ? p[3] : channels == 2 ? p[1] : 255.0f;
+    }
+  }
+}
+
+uint16_t packColor(const float c[3]) {
+  int r = (int)(std::min(std::max(c[0], 0.0f), 255.0f) * 31.0f / 255.0f + 0.5f);
+  int g = (int)(std::min(std::max(c[1], 0.0f), 255.0f) * 63.0f / 255.0f + 0.5f);
+  int b = (int)(std::min(std::max(c[2], 0.0f), 255.0f) * 31.0f / 255.0f + 0.5f);
+  return (uint16_t)((r << 11) | (g << 5) | b);
+}
+
+void unpackColor(uint16_t c, int rgb[3]) {
+  int r = (c >> 11) & 31, g = (c >> 5) & 63, b = c & 31;
+  rgb[0] = (r << 3) | (r >> 2);
+  rgb[1] = (g << 2) | (g >> 4);
+  rgb[2] = (b << 3) | (b >> 2);
+}
+
+// Four colour palette in index order: c0, c1, 2/3 c0 + 1/3 c1, the reverse
+void colorPalette(uint16_t c0, uint16_t c1, int palette[4][3]) {
+  unpackColor(c0, palette[0]);
+  unpackColor(c1, palette[1]);
+  for (int k = 0; k < 3; k++) {
+    palette[2][k] = (2 * palette[0][k] + palette[1][k]) / 3;
+    palette[3][k] = (palette[0][k] + 2 * palette[1][k]) / 3;
+  }
+}
+
+// Nearest palette entry for every pixel, returns the summed squared error
+float fitIndices(const Block &block, const int palette[4][3],
+                 uint8_t indices[16]) {
+  float error = 0.0f;
+#ifdef BLOCK_COMPRESS_SSE2
+  for (int i = 0; i < 16; i += 4) {
+    __m128 r = _mm_loadu_ps(block.r + i);
+    __m128 g = _mm_loadu_ps(block.g + i);
+    __m128 b = _mm_loadu_ps(block.b + i);
+    __m128 best = _mm_set1_ps(1e30f);
+    __m128i bestIndex = _mm_setzero_si128();
+    for (int k = 0; k < 4; k++) {
+      __m128 dr = _mm_sub_ps(r, _mm_set1_ps((float)palette[k][0]));
+      __m128 dg = _mm_sub_ps(g, _mm_set1_ps((float)palette[k][1]));
+      __m128 db = _mm_sub_ps(b, _mm_set1_ps((float)palette[k][2]));
+      __m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dr, dr), _mm_mul_ps(dg, dg)),
+                            _mm_mul_ps(db, db));
+      __m128i closer = _mm_castps_si128(_mm_cmplt_ps(d, best));
+      best = _mm_min_ps(d, best);
+      bestIndex = _mm_or_si128(_mm_and_si128(closer, _mm_set1_epi32(k)),
+                               _mm_andnot_si128(closer, bestIndex));
+    }
+    int32_t lanes[4];
+    float errors[4];
+    _mm_storeu_si128((__m128i *)lanes, bestIndex);
+    _mm_storeu_ps(errors, best);
+    for (int j = 0; j < 4; j++) {
+      indices[i + j] = (uint8_t)lanes[j];
+      error += errors[j];
+    }
+  }
+#else
+  for (int i = 0; i < 16; i++) {
+    float best = 1e30f;
+    for (int k = 0; k < 4; k++) {
+      float dr = block.r[i] - palette[k][0];
+      float dg = block.g[i] - palette[k][1];
+      float db = block.b[i] - palette[k][2];
+      float d = dr * dr + dg * dg + db * db;
+      if (d < best) {
+        best = d;
+        indices[i] = (uint8_t)k;
+      }
+    }
+    error += best;
+  }
+#endif
+  return error;
+}
+
+struct ColorBlock {
+  uint16_t c0, c1;
+  uint8_t indices[16];
+  float error;
+};
+
+// Quantize a pair of endpoints and choose indices for them
+ColorBlock tryEndpoints(const Block &block, const float e0[3],
+                        const float e1[3]) {
+  ColorBlock result;
+  result.c0 = packColor(e0);
+  result.c1 = packColor(e1);
+  // c0 > c1 selects four colour mode, which is all BC3 can decode anyway
+  if (result.c0 < result.c1)
+    std::swap(result.c0, result.c1);
+  int palette[4][3];
+  colorPalette(result.c0, result.c1, palette);
+  result.error = fitIndices(block, palette, result.indices);
+  return result;
+}
+
+// Best endpoints for fixed indices, by least squares
+bool refineEndpoints(const Block &block, const uint8_t indices[16],
+                     float e0[3], float e1[3]) {
+  static const float weights[4] = {1.0f, 0.0f, 2.0f / 3.0f, 1.0f / 3.0f};
+  float aa = 0, bb = 0, ab = 0;
+  float x[3] = {0, 0, 0}, y[3] = {0, 0, 0};
+  for (int i = 0; i < 16; i++) {
+    float w = weights[indices[i]];
+    float v = 1.0f - w;
+    aa += w * w;
+    bb += v * v;
+    ab += w * v;
+    const float p[3] = {block.r[i], block.g[i], block.b[i]};
+    for (int k = 0; k < 3; k++) {
+      x[k] += w * p[k];
+      y[k] += v * p[k];
+    }
+  }
+  float det = aa * bb - ab * ab;
+  if (std::fabs(det) < 1e-6f)
+    return false;
+  for (int k = 0; k < 3; k++) {
+    e0[k] = (bb * x[k] - ab * y[k]) / det;
+    e1[k] = (aa * y[k] - ab * x[k]) / det;
+  }
+  return true;
+}
+
+void boundingBoxEndpoints(const Block &block, float e0[3], float e1[3]) {
+  const float *channels[3] = {block.r, block.g, block.b};
+  float lo[3], hi[3], mean[3];
+  for (int k = 0; k < 3; k++) {
+    lo[k] = hi[k] = channels[k][0];
+    mean[k] = 0;
+    for (int i = 0; i < 16; i++) {
+      lo[k] = std::min(lo[k], channels[k][i]);
+      hi[k] = std::max(hi[k], channels[k][i]);
+      mean[k] += channels[k][i] / 16.0f;
+    }
+    // Inset so the endpoints are not spent on outliers
+    float inset = (hi[k] - lo[k]) / 16.0f;
+    lo[k] += inset;
+    hi[k] -= inset;
+  }
+  // Flip red and blue against green when they are anticorrelated, so the
+  // diagonal follows the colours
+  float covRG = 0, covBG = 0;
+  for (int i = 0; i < 16; i++) {
+    float dg = block.g[i] - mean[1];
+    covRG += (block.r[i] - mean[0]) * dg;
+    covBG += (block.b[i] - mean[2]) * dg;
+  }
+  if (covRG < 0)
+    std::swap(lo[0], hi[0]);
+  if (covBG < 0)
+    std::swap(lo[2], hi[2]);
+  for (int k = 0; k < 3; k++) {
+    e0[k] = hi[k];
+    e1[k] = lo[k];
+  }
+}
+
+void principalAxisEndpoints(const Block &block, float e0[3], float e1[3]) {
+  float mean[3] = {0, 0, 0};
+  for (int i = 0; i < 16; i++) {
+    mean[0] += block.r[i] / 16.0f;
+    mean[1] += block.g[i] / 16.0f;
+    mean[2] += block.b[i] / 16.0f;
+  }
+  float cov[6] = {0, 0, 0, 0, 0, 0}; // rr rg rb gg gb bb
+  for (int i = 0; i < 16; i++) {
+    float r = block.r[i] - mean[0];
+    float g = block.g[i] - mean[1];
+    float b = block.b[i] - mean[2];
+    cov[0] += r * r;
+    cov[1] += r * g;
+    cov[2] += r * b;
+    cov[3] += g * g;
+    cov[4] += g * b;
+    cov[5] += b * b;
+  }
+  // Power iteration converges on the axis of greatest variance
+  float axis[3] = {1.0f, 1.0f, 1.0f};
+  for (int iteration = 0; iteration < 8; iteration++) {
+    float next[3] = {cov[0] * axis[0] + cov[1] * axis[1] + cov[2] * axis[2],
+                     cov[1] * axis[0] + cov[3] * axis[1] + cov[4] * axis[2],
+                     cov[2] * axis[0] + cov[4] * axis[1] + cov[5] * axis[2]};
+    float length = std::sqrt(next[0] * next[0] + next[1] * next[1] +
+                             next[2] * next[2]);
+    if (length < 1e-6f)
+      break;
+    for (int k = 0; k < 3; k++)
+      axis[k] = next[k] / length;
+  }
+
+  float lo = 0, hi = 0;
+  for (int i = 0; i < 16; i++) {
+    float t = (block.r[i] - mean[0]) * axis[0] +
+              (block.g[i] - mean[1]) * axis[1] +
+              (block.b[i] - mean[2]) * axis[2];
+    lo = std::min(lo, t);
+    hi = std::max(hi, t);
+  }
+  for (int k = 0; k < 3; k++) {
+    e0[k] = mean[k] + axis[k] * hi;
+    e1[k] = mean[k] + axis[k] * lo;
+  }
+}
+
+void encodeColor(const Block &block, BlockQuality quality, unsigned char *out) {
+  float e0[3], e1[3];
+  ColorBlock best;
+  if (quality == BLOCK_FAST) {
+    boundingBoxEndpoints(block, e0, e1);
+    best = tryEndpoints(block, e0, e1);
+  } else {
+    principalAxisEndpoints(block, e0, e1);
+    best = tryEndpoints(block, e0, e1);
+    for (int iteration = 0; iteration < 2; iteration++) {
+      if (!refineEndpoints(block, best.indices, e0, e1))
+        break;
+      ColorBlock refined = tryEndpoints(block, e0, e1);
+      if (refined.error >= best.error)
+        break;
+      best = refined;
+    }
+  }
+
+  uint32_t bits = 0;
+  if (best.c0 != best.c1) {
+    for (int i = 0; i < 16; i++)
+      bits |= (uint32_t)best.indices[i] << (2 * i);
+  }
+  out[0] = (unsigned char)(best.c0 & 0xFF);
+  out[1] = (unsigned char)(best.c0 >> 8);
+  out[2] = (unsigned char)(best.c1 & 0xFF);
+  out[3] = (unsigned char)(best.c1 >> 8);
+  for (int i = 0; i < 4; i++)
+    out[4 + i] = (unsigned char)(bits >> (8 * i));
+}
+
+// Eight entry alpha palette. a0 > a1 interpolates six values between them,
+// otherwise four are interpolated and 0 and 255 come last.
+void alphaPalette(int a0, int a1, int palette[8]) {
+  palette[0] = a0;
+  palette[1] = a1;
+  if (a0 > a1) {
+    for (int i = 1; i < 7; i++)
+      palette[i + 1] = ((7 - i) * a0 + i * a1) / 7;
+  } else {
+    for (int i = 1; i < 5; i++)
+      palette[i + 1] = ((5 - i) * a0 + i * a1) / 5;
+    palette[6] = 0;
+    palette[7] = 255;
+  }
+}
+
+int fitAlpha(const int alpha[16], int a0, int a1, uint8_t indices[16]) {
+  int palette[8];
+  alphaPalette(a0, a1, palette);
+  int error = 0;
+  for (int i = 0; i < 16; i++) {
+    int best = 1 << 30;
+    for (int k = 0; k < 8; k++) {
+      int d = (alpha[i] - palette[k]) * (alpha[i] - palette[k]);
+      if (d < best) {
+        best = d;
+        indices[i] = (uint8_t)k;
+      }
+    }
+    error += best;
+  }
+  return error;
+}
+
+void encodeAlpha(const Block &block, BlockQuality quality, unsigned char *out) {
+  int alpha[16];
+  int lo = 255, hi = 0;
+  for (int i = 0; i < 16; i++) {
+    alpha[i] = (int)block.a[i];
+    lo = std::min(lo, alpha[i]);
+    hi = std::max(hi, alpha[i]);
+  }
+
+  int a0 = hi, a1 = lo;
+  uint8_t indices[16] = {};
+  if (hi != lo) {
+    int error = fitAlpha(alpha, a0, a1, indices);
+    if (quality == BLOCK_HIGH) {
+      // Six value mode spends no entries on fully clear or opaque texels
+      int innerLo = 255, innerHi = 0;
+      for (int i = 0; i < 16; i++) {
+        if (alpha[i] != 0 && alpha[i] != 255) {
+          innerLo = std::min(innerLo, alpha[i]);
+          innerHi = std::max(innerHi, alpha[i]);
+        }
+      }
+      if (innerLo > innerHi)
+        innerLo = innerHi = 0;
+      uint8_t inner[16];
+      if (fitAlpha(alpha, innerLo, innerHi, inner) < error) {
+        a0 = innerLo;
+        a1 = innerHi;
+        memcpy(indices, inner, sizeof(inner));
+      }
+    }
+  }
+
+  uint64_t bits = 0;
+  for (int i = 0; i < 16; i++)
+    bits |= (uint64_t)indices[i] << (3 * i);
+  out[0] = (unsigned char)a0;
+  out[1] = (unsigned char)a1;
+  for (int i = 0; i < 6; i++)
+    out[2 + i] = (unsigned char)(bits >> (8 * i));
+}
+
+} // namespace
+
+BlockFormat blockFormatFor(int channels) {
+  return channels == 2 || channels == 4 ? BLOCK_BC3 : BLOCK_BC1;
+}
+
+size_t blockBytes(BlockFormat format) { return format == BLOCK_BC1 ? 8 : 16; }
+
+size_t blockCompressedBytes(int width, int height, BlockFormat format) {
+  return (size_t)((width + 3) / 4) * ((height + 3) / 4) * blockBytes(format);
+}
+
+void compressBlockRows(const unsigned char *pixels, int width, int height,
+                       int channels, BlockFormat format, BlockQuality quality,
+                       int firstRow, int lastRow, unsigned char *out) {
+  int blocksWide = (width + 3) / 4;
+  size_t bytes = blockBytes(format);
+  Block block;
+  for (int by = firstRow; by < lastRow; by++) {
+    for (int bx = 0; bx < blocksWide; bx++) {
+      unsigned char *dst = out + ((size_t)by * blocksWide + bx) * bytes;
+      gatherBlock(pixels, width, height, channels, bx, by, block);
+      if (format == BLOCK_BC3) {
+        encodeAlpha(block, quality, dst);
+        dst += 8;
+      }
+      encodeColor(block, quality, dst);
+    }
+  }
+}
+
+void compressBlocks(const unsigned char *pixels, int width, int height,
+                    int channels, BlockFormat format, BlockQuality quality,
+                    unsigned char *out) {
+  compressBlockRows(pixels, width, height, channels, format, quality, 0,
+                    (height + 3) / 4, out);
+}
+
+void decompressBlocks(const unsigned char *blocks, int width, int height,
+                      BlockFormat format, unsigned char *rgba) {
+  int blocksWide = (width + 3) / 4;
+  int blocksHigh = (height + 3) / 4;
+  for (int by = 0; by < blocksHigh; by++) {
+    for (int bx = 0; bx < blocksWide; bx++) {
+      const unsigned char *src =
+          blocks + ((size_t)by * blocksWide + bx) * blockBytes(format);
+      int alpha[16];
+      if (format == BLOCK_BC3) {
+        int palette[8];
+        alphaPalette(src[0], src[1], palette);
+        uint64_t bits = 0;
+        for (int i = 0; i < 6; i++)
+          bits |= (uint64_t)src[2 + i] << (8 * i);
+        for (int i = 0; i < 16; i++)
+          alpha[i] = palette[(bits >> (3 * i)) & 7];
+        src += 8;
+      } else {
+        for (int i = 0; i < 16; i++)
+          alpha[i] = 255;
+      }
+
+      uint16_t c0 = (uint16_t)(src[0] | (src[1] << 8));
+      uint16_t c1 = (uint16_t)(src[2] | (src[3] << 8));
+      int palette[4][3];
+      colorPalette(c0, c1, palette);
+      if (c0 <= c1 && format == BLOCK_BC1) {
+        // Three colour mode, the last entry is black
+        for (int k = 0; k < 3; k++) {
+          palette[2][k] = (palette[0][k] + palette[1][k]) / 2;
+          palette[3][k] = 0;
+        }
+      }
+      uint32_t bits = src[4] | (src[5] << 8) | (src[6] << 16) |
+                      ((uint32_t)src[7] << 24);
+
+      for (int i = 0; i < 16; i++) {
+        int x = bx * 4 + i % 4;
+        int y = by * 4 + i / 4;
+        if (x >= width || y >= height)
+          continue;
+        const int *color = palette[(bits >> (2 * i)) & 3];
+        unsigned char *dst = rgba + ((size_t)y * width + x) * 4;
+        dst[0] = (unsigned char)color[0];
+        dst[1] = (unsigned char)color[1];
+        dst[2] = (unsigned char)color[2];
+        dst[3] = (unsigned char)alpha[i];
+      }
+    }
+  }
+}
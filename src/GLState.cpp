@@ -0,0 +1,210 @@
+#include "../include/GLState.h"
+
+void GLStateCache::invalidate() {
+  program = UNKNOWN;
+  vertexArray = UNKNOWN;
+  for (int i = 0; i < BUFFER_SLOTS; i++)
+    buffers[i] = UNKNOWN;
+  for (int i = 0; i < MAX_UNIFORM_BINDINGS; i++)
+    uniformRanges[i].buffer = UNKNOWN;
+  activeUnit = -1;
+  for (int unit = 0; unit < MAX_TEXTURE_UNITS; unit++) {
+    for (int i = 0; i < TEXTURE_TARGETS; i++)
+      textures[unit][i] = UNKNOWN;
+  }
+  for (int i = 0; i < CAPABILITIES; i++)
+    capabilities[i] = -1;
+  blendSrc = blendDst = UNKNOWN;
+  depth = UNKNOWN;
+  polygon = UNKNOWN;
+  view[0] = view[1] = view[2] = view[3] = -1;
+}
+
+int GLStateCache::bufferSlot(GLenum target) {
+  switch (target) {
+  case GL_ARRAY_BUFFER:
+    return ARRAY_BUFFER;
+  case GL_UNIFORM_BUFFER:
+    return UNIFORM_BUFFER;
+  case GL_PIXEL_UNPACK_BUFFER:
+    return PIXEL_UNPACK_BUFFER;
+  case GL_PIXEL_PACK_BUFFER:
+    return PIXEL_PACK_BUFFER;
+  case GL_COPY_READ_BUFFER:
+    return COPY_READ_BUFFER;
+  case GL_COPY_WRITE_BUFFER:
+    return COPY_WRITE_BUFFER;
+  default:
+    return -1;
+  }
+}
+
+int GLStateCache::textureSlot(GLenum target) {
+  switch (target) {
+  case GL_TEXTURE_2D:
+    return TEXTURE_2D;
+  case GL_TEXTURE_2D_ARRAY:
+    return TEXTURE_2D_ARRAY;
+  case GL_TEXTURE_CUBE_MAP:
+    return TEXTURE_CUBE_MAP;
+  default:
+    return -1;
+  }
+}
+
+int GLStateCache::capabilitySlot(GLenum capability) {
+  switch (capability) {
+  case GL_BLEND:
+    return BLEND;
+  case GL_DEPTH_TEST:
+    return DEPTH_TEST;
+  case GL_CULL_FACE:
+    return CULL_FACE;
+  case GL_SCISSOR_TEST:
+    return SCISSOR_TEST;
+  default:
+    return -1;
+  }
+}
+
+void GLStateCache::useProgram(GLuint newProgram) {
+  if (changed(program != newProgram)) {
+    program = newProgram;
+    glUseProgram(newProgram);
+  }
+}
+
+void GLStateCache::bindVertexArray(GLuint vao) {
+  if (changed(vertexArray != vao)) {
+    vertexArray = vao;
+    glBindVertexArray(vao);
+  }
+}
+
+void GLStateCache::bindBuffer(GLenum target, GLuint buffer) {
+  int slot = bufferSlot(target);
+  if (slot < 0) {
+    issued++;
+    glBindBuffer(target, buffer);
+    return;
+  }
+  if (changed(buffers[slot] != buffer)) {
+    buffers[slot] = buffer;
+    glBindBuffer(target, buffer);
+  }
+}
+
+void GLStateCache::bindBufferRange(GLenum target, GLuint index, GLuint buffer,
+                                   GLintptr offset, GLsizeiptr size) {
+  if (target == GL_UNIFORM_BUFFER && index < (GLuint)MAX_UNIFORM_BINDINGS) {
+    BufferRange &range = uniformRanges[index];
+    if (!changed(range.buffer != buffer || range.offset != offset ||
+                 range.size != size))
+      return;
+    range.buffer = buffer;
+    range.offset = offset;
+    range.size = size;
+  } else {
+    issued++;
+  }
+  glBindBufferRange(target, index, buffer, offset, size);
+  int slot = bufferSlot(target);
+  if (slot >= 0)
+    buffers[slot] = buffer;
+}
+
+void GLStateCache::bindTexture(int unit, GLenum target, GLuint texture) {
+  // The unit is selected even when the binding is filtered, callers may go
+  // on to glTexImage2D and friends
+  if (changed(activeUnit != unit)) {
+    activeUnit = unit;
+    glActiveTexture(GL_TEXTURE0 + unit);
+  }
+
+  int slot = textureSlot(target);
+  if (slot >= 0 && unit < MAX_TEXTURE_UNITS &&
+      !changed(textures[unit][slot] != texture))
+    return;
+  if (slot >= 0 && unit < MAX_TEXTURE_UNITS)
+    textures[unit][slot] = texture;
+  else
+    issued++;
+  glBindTexture(target, texture);
+}
+
+void GLStateCache::enable(GLenum capability, bool on) {
+  int slot = capabilitySlot(capability);
+  if (slot >= 0 && !changed(capabilities[slot] != (int)on))
+    return;
+  if (slot >= 0)
+    capabilities[slot] = on;
+  else
+    issued++;
+  if (on)
+    glEnable(capability);
+  else
+    glDisable(capability);
+}
+
+void GLStateCache::blendFunc(GLenum src, GLenum dst) {
+  if (changed(blendSrc != src || blendDst != dst)) {
+    blendSrc = src;
+    blendDst = dst;
+    glBlendFunc(src, dst);
+  }
+}
+
+void GLStateCache::depthFunc(GLenum func) {
+  if (changed(depth != func)) {
+    depth = func;
+    glDepthFunc(func);
+  }
+}
+
+void GLStateCache::polygonMode(GLenum mode) {
+  if (changed(polygon != mode)) {
+    polygon = mode;
+    glPolygonMode(GL_FRONT_AND_BACK, mode);
+  }
+}
+
+void GLStateCache::viewport(GLint x, GLint y, GLsizei width, GLsizei height) {
+  if (changed(view[0] != x || view[1] != y || view[2] != width ||
+              view[3] != height)) {
+    view[0] = x;
+    view[1] = y;
+    view[2] = width;
+    view[3] = height;
+    glViewport(x, y, width, height);
+  }
+}
+
+void GLStateCache::forgetProgram(GLuint deleted) {
+  if (program == deleted)
+    program = UNKNOWN;
+}
+
+void GLStateCache::forgetVertexArray(GLuint deleted) {
+  if (vertexArray == deleted)
+    vertexArray = UNKNOWN;
+}
+
+void GLStateCache::forgetBuffer(GLuint deleted) {
+  for (int i = 0; i < BUFFER_SLOTS; i++) {
+    if (buffers[i] == deleted)
+      buffers[i] = UNKNOWN;
+  }
+  for (int i = 0; i < MAX_UNIFORM_BINDINGS; i++) {
+    if (uniformRanges[i].buffer == deleted)
+      uniformRanges[i].buffer = UNKNOWN;
+  }
+}
+
+void GLStateCache::forgetTexture(GLuint deleted) {
+  for (int unit = 0; unit < MAX_TEXTURE_UNITS; unit++) {
+    for (int i = 0; i < TEXTURE_TARGETS; i++) {
+      if (textures[unit][i] == deleted)
+        textures[unit][i] = UNKNOWN;
+    }
+  }
+}
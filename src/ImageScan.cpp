@@ -0,0 +1,371 @@
+#include "../include/ImageScan.h"
+#include "../include/TextureFile.h"
+#include "../include/ThreadPool.h"
+#include "../include/stb_image.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+// Largest side stb_image accepts
+const uint32_t MAX_DIMENSION = 1 << 24;
+
+// Windows of a file read with one positioned read each. The first holds
+// the prefix; at() moves the window when asked for bytes outside it.
+class HeaderReader {
+public:
+  explicit HeaderReader(const char *path) {
+#ifdef _WIN32
+    handle = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL,
+                         OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (handle == INVALID_HANDLE_VALUE)
+      handle = nullptr;
+#else
+    fd = ::open(path, O_RDONLY);
+#endif
+  }
+  ~HeaderReader() {
+#ifdef _WIN32
+    if (handle)
+      CloseHandle(handle);
+#else
+    if (fd >= 0)
+      ::close(fd);
+#endif
+  }
+
+  HeaderReader(const HeaderReader &) = delete;
+  HeaderReader &operator=(const HeaderReader &) = delete;
+
+  // The n bytes at offset, nullptr when the file ends before them
+  const unsigned char *at(uint64_t offset, size_t n) {
+    if (n > sizeof(window))
+      return nullptr;
+    if (offset < start || offset + n > start + length) {
+      start = offset;
+      length = read(offset);
+    }
+    return offset + n <= start + length ? window + (offset - start) : nullptr;
+  }
+
+  size_t prefixLength() { return at(0, 1) ? length : 0; }
+  const unsigned char *prefix() const { return window; }
+
+private:
+  unsigned char window[IMAGE_SCAN_PREFIX];
+  uint64_t start = 0;
+  size_t length = 0;
+#ifdef _WIN32
+  HANDLE handle = nullptr;
+#else
+  int fd = -1;
+#endif
+
+  size_t read(uint64_t offset) {
+#ifdef _WIN32
+    if (!handle)
+      return 0;
+    OVERLAPPED position = {};
+    position.Offset = (DWORD)offset;
+    position.OffsetHigh = (DWORD)(offset >> 32);
+    DWORD got = 0;
+    if (!ReadFile(handle, window, sizeof(window), &got, &position))
+      return 0;
+    return got;
+#else
+    if (fd < 0)
+      return 0;
+    ssize_t got = pread(fd, window, sizeof(window), (off_t)offset);
+    return got > 0 ? (size_t)got : 0;
+#endif
+  }
+};
+
+uint32_t be16(const unsigned char *p) { return (uint32_t)p[0] << 8 | p[1]; }
+uint32_t be32(const unsigned char *p) { return be16(p) << 16 | be16(p + 2); }
+uint32_t le16(const unsigned char *p) { return (uint32_t)p[1] << 8 | p[0]; }
+
+bool setHeader(ImageHeader &header, uint32_t width, uint32_t height,
+               int channels, int bits, ImageScanFormat format) {
+  if (width == 0 || height == 0 || width > MAX_DIMENSION ||
+      height > MAX_DIMENSION)
+    return false;
+  header.width = width;
+  header.height = height;
+  header.channels = (uint8_t)channels;
+  header.bits = (uint8_t)bits;
+  header.format = (uint8_t)format;
+  return true;
+}
+
+// Markers up to the first baseline, extended or progressive SOF, taking
+// the segments stb_image takes before it
+bool scanJpeg(HeaderReader &reader, ImageHeader &header) {
+  uint64_t at = 2;
+  for (;;) {
+    // Bytes other than 0xff between segments are padding, then fill bytes
+    const unsigned char *p = reader.at(at, 1);
+    while (p && *p != 0xff)
+      p = reader.at(++at, 1);
+    while (p && *p == 0xff)
+      p = reader.at(++at, 1);
+    if (!p)
+      return false;
+    unsigned char marker = *p;
+    at++;
+    if (marker >= 0xc0 && marker <= 0xc2) {
+      const unsigned char *sof = reader.at(at, 8);
+      if (!sof)
+        return false;
+      uint32_t length = be16(sof), components = sof[7];
+      if (sof[2] != 8 ||
+          (components != 1 && components != 3 && components != 4) ||
+          length != 8 + 3 * components)
+        return false;
+      const unsigned char *c = reader.at(at + 8, 3 * components);
+      if (!c)
+        return false;
+      for (uint32_t i = 0; i < components; i++, c += 3) {
+        int h = c[1] >> 4, v = c[1] & 15;
+        if (h == 0 || h > 4 || v == 0 || v > 4 || c[2] > 3)
+          return false;
+      }
+      return setHeader(header, be16(sof + 5), be16(sof + 3),
+                       components >= 3 ? 3 : 1, 8, IMAGE_JPEG);
+    }
+    bool segment = marker == 0xc4 || marker == 0xdb || marker == 0xdd ||
+                   marker == 0xfe || (marker >= 0xe0 && marker <= 0xef);
+    if (!segment)
+      return false;
+    const unsigned char *length = reader.at(at, 2);
+    if (!length || be16(length) < 2 ||
+        (marker == 0xdd && be16(length) != 4))
+      return false;
+    at += be16(length);
+  }
+}
+
+// IHDR, then for palettes the chunks up to tRNS or the first IDAT, which
+// decide between 3 and 4 channels
+bool scanPng(HeaderReader &reader, ImageHeader &header) {
+  uint64_t at = 8;
+  uint32_t width = 0, height = 0;
+  bool first = true, palette = false, hasPalette = false;
+  int bits = 8;
+  for (;;) {
+    const unsigned char *chunk = reader.at(at, 8);
+    if (!chunk)
+      return false;
+    uint32_t length = be32(chunk);
+    uint32_t type = be32(chunk + 4);
+    if (type == be32((const unsigned char *)"IHDR")) {
+      const unsigned char *ihdr = reader.at(at + 8, 13);
+      if (!first || length != 13 || !ihdr)
+        return false;
+      first = false;
+      width = be32(ihdr);
+      height = be32(ihdr + 4);
+      int depth = ihdr[8], color = ihdr[9];
+      if ((depth != 1 && depth != 2 && depth != 4 && depth != 8 &&
+           depth != 16) ||
+          color > 6 || (color == 3 && depth == 16) ||
+          (color != 3 && (color & 1)) || ihdr[10] || ihdr[11] ||
+          ihdr[12] > 1)
+        return false;
+      bits = depth == 16 ? 16 : 8;
+      if (color != 3) {
+        int channels = (color & 2 ? 3 : 1) + (color & 4 ? 1 : 0);
+        if (width && (1u << 30) / width / channels < height)
+          return false;
+        return setHeader(header, width, height, channels, bits, IMAGE_PNG);
+      }
+      if (width && (1u << 30) / width / 4 < height)
+        return false;
+      palette = true;
+    } else if (type == be32((const unsigned char *)"CgBI")) {
+      // iPhone PNGs lead with it, before IHDR
+    } else if (first) {
+      return false;
+    } else if (type == be32((const unsigned char *)"PLTE")) {
+      if (length > 256 * 3 || length % 3)
+        return false;
+      hasPalette = true;
+    } else if (type == be32((const unsigned char *)"tRNS")) {
+      return palette && setHeader(header, width, height, 4, bits, IMAGE_PNG);
+    } else if (type == be32((const unsigned char *)"IDAT")) {
+      return palette && hasPalette &&
+             setHeader(header, width, height, 3, bits, IMAGE_PNG);
+    } else if (!(type & (1 << 29))) {
+      return false; // Unknown critical chunk, IEND included
+    }
+    at += 12 + (uint64_t)length;
+  }
+}
+
+bool scanGif(const unsigned char *p, size_t n, ImageHeader &header) {
+  if (n < 10 || (p[4] != '7' && p[4] != '9') || p[5] != 'a')
+    return false;
+  return setHeader(header, le16(p + 6), le16(p + 8), 4, 8, IMAGE_GIF);
+}
+
+// Header lines up to a blank one, then "-Y height +X width"
+bool scanHdr(const unsigned char *p, size_t n, ImageHeader &header) {
+  const char *text = (const char *)p, *end = text + n;
+  const char *line = (const char *)memchr(text, '\n', n);
+  bool valid = false;
+  while (line && ++line < end && *line != '\n') {
+    const char *next = (const char *)memchr(line, '\n', end - line);
+    if (next && next - line == 22 &&
+        memcmp(line, "FORMAT=32-bit_rle_rgbe", 22) == 0)
+      valid = true;
+    line = next;
+  }
+  if (!valid || !line || ++line + 3 > end || memcmp(line, "-Y ", 3) != 0)
+    return false;
+  // The line is within the prefix and a newline ends it, strtol stops there
+  const char *newline = (const char *)memchr(line, '\n', end - line);
+  if (!newline)
+    return false;
+  char *rest;
+  long height = strtol(line + 3, &rest, 10);
+  while (*rest == ' ')
+    rest++;
+  if (strncmp(rest, "+X ", 3) != 0)
+    return false;
+  long width = strtol(rest + 3, nullptr, 10);
+  return height > 0 && width > 0 &&
+         setHeader(header, (uint32_t)width, (uint32_t)height, 3, 32,
+                   IMAGE_HDR);
+}
+
+bool scanHtex(const unsigned char *p, size_t n, ImageHeader &header) {
+  TextureFileHeader file;
+  if (n < sizeof(file))
+    return false;
+  memcpy(&file, p, sizeof(file));
+  if (file.version != TEXTURE_FILE_VERSION || file.channels == 0 ||
+      file.channels > 4)
+    return false;
+  return setHeader(header, file.width, file.height, (int)file.channels, 8,
+                   IMAGE_HTEX);
+}
+
+// The formats without a parser of their own, stb_image works on the prefix
+bool scanOther(const unsigned char *p, size_t n, ImageHeader &header) {
+  int width, height, channels;
+  if (!stbi_info_from_memory(p, (int)n, &width, &height, &channels))
+    return false;
+  int bits = stbi_is_16_bit_from_memory(p, (int)n) ? 16 : 8;
+  return setHeader(header, (uint32_t)width, (uint32_t)height, channels, bits,
+                   IMAGE_OTHER);
+}
+
+#ifdef _WIN32
+void listFiles(const std::string &directory, std::vector<std::string> &paths) {
+  WIN32_FIND_DATAA entry;
+  HANDLE find = FindFirstFileA((directory + "\\*").c_str(), &entry);
+  if (find == INVALID_HANDLE_VALUE)
+    return;
+  do {
+    if (strcmp(entry.cFileName, ".") == 0 || strcmp(entry.cFileName, "..") == 0)
+      continue;
+    std::string path = directory + "/" + entry.cFileName;
+    if (entry.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+      listFiles(path, paths);
+    else
+      paths.push_back(path);
+  } while (FindNextFileA(find, &entry));
+  FindClose(find);
+}
+#else
+void listFiles(const std::string &directory, std::vector<std::string> &paths) {
+  DIR *dir = opendir(directory.c_str());
+  if (!dir)
+    return;
+  while (dirent *entry = readdir(dir)) {
+    if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+      continue;
+    std::string path = directory + "/" + entry->d_name;
+    bool isDir = entry->d_type == DT_DIR, isFile = entry->d_type == DT_REG;
+    if (entry->d_type == DT_UNKNOWN || entry->d_type == DT_LNK) {
+      struct stat info;
+      if (stat(path.c_str(), &info) != 0)
+        continue;
+      isDir = S_ISDIR(info.st_mode);
+      isFile = S_ISREG(info.st_mode);
+    }
+    if (isDir)
+      listFiles(path, paths);
+    else if (isFile)
+      paths.push_back(path);
+  }
+  closedir(dir);
+}
+#endif
+
+} // namespace
+
+size_t ImageManifest::images() const {
+  return (size_t)std::count_if(
+      headers.begin(), headers.end(),
+      [](const ImageHeader &h) { return h.format != IMAGE_UNKNOWN; });
+}
+
+bool scanImageHeader(const char *path, ImageHeader &header) {
+  memset(&header, 0, sizeof(header));
+  HeaderReader reader(path);
+  size_t n = reader.prefixLength();
+  const unsigned char *p = reader.prefix();
+  bool ok;
+  if (n >= 3 && p[0] == 0xff && p[1] == 0xd8 && p[2] == 0xff)
+    ok = scanJpeg(reader, header);
+  else if (n >= 8 && memcmp(p, "\x89PNG\r\n\x1a\n", 8) == 0)
+    ok = scanPng(reader, header);
+  else if (n >= 4 && memcmp(p, "GIF8", 4) == 0)
+    ok = scanGif(p, n, header);
+  else if ((n >= 11 && memcmp(p, "#?RADIANCE\n", 11) == 0) ||
+           (n >= 7 && memcmp(p, "#?RGBE\n", 7) == 0))
+    ok = scanHdr(p, n, header);
+  else if (n >= 4 && memcmp(p, "HTEX", 4) == 0)
+    ok = scanHtex(p, n, header);
+  else
+    ok = n > 0 && scanOther(p, n, header);
+  if (!ok)
+    memset(&header, 0, sizeof(header));
+  return ok;
+}
+
+ImageManifest scanImageDirectory(const char *directory, ThreadPool *pool) {
+  ImageManifest manifest;
+  listFiles(directory, manifest.paths);
+  std::sort(manifest.paths.begin(), manifest.paths.end());
+  manifest.headers.resize(manifest.paths.size());
+
+  // A file costs a few microseconds, batches keep the pool's per task
+  // overhead below that
+  const int batch = 64;
+  int batches = (int)((manifest.paths.size() + batch - 1) / batch);
+  auto scanBatch = [&manifest](int index) {
+    size_t end = std::min(manifest.paths.size(), (size_t)(index + 1) * batch);
+    for (size_t i = (size_t)index * batch; i < end; i++)
+      scanImageHeader(manifest.paths[i].c_str(), manifest.headers[i]);
+  };
+  if (pool) {
+    pool->parallelFor(batches, scanBatch);
+  } else {
+    for (int i = 0; i < batches; i++)
+      scanBatch(i);
+  }
+  return manifest;
+}
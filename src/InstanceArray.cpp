@@ -0,0 +1,83 @@
+#include "../include/InstanceArray.h"
+
+#if defined(__SSE2__) || defined(_M_X64) ||                                    \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define INSTANCE_ARRAY_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+const float PI = 3.14159265358979f;
+const float TWO_PI = 6.28318530717959f;
+
+// Small deterministic generator so runs are comparable
+float nextFloat(uint32_t &state, float low, float high) {
+  state = state * 1664525u + 1013904223u;
+  return low + (high - low) * (float)(state >> 8) / 16777216.0f;
+}
+
+} // namespace
+
+void InstanceArray::resize(size_t count, uint32_t seed) {
+  x.resize(count);
+  y.resize(count);
+  angle.resize(count);
+  spin.resize(count);
+  scale.resize(count);
+
+  uint32_t state = seed;
+  for (size_t i = 0; i < count; i++) {
+    x[i] = nextFloat(state, -0.95f, 0.95f);
+    y[i] = nextFloat(state, -0.95f, 0.95f);
+    angle[i] = nextFloat(state, -PI, PI);
+    spin[i] = nextFloat(state, -2.0f, 2.0f);
+    scale[i] = nextFloat(state, 0.02f, 0.08f);
+  }
+}
+
+void InstanceArray::rebuild(float dt, float *out) {
+  size_t count = x.size();
+  size_t i = 0;
+
+#ifdef INSTANCE_ARRAY_SSE2
+  const __m128 step = _mm_set1_ps(dt);
+  const __m128 pi = _mm_set1_ps(PI);
+  const __m128 negPi = _mm_set1_ps(-PI);
+  const __m128 twoPi = _mm_set1_ps(TWO_PI);
+  for (; i + 4 <= count; i += 4) {
+    __m128 a = _mm_add_ps(_mm_loadu_ps(&angle[i]),
+                          _mm_mul_ps(_mm_loadu_ps(&spin[i]), step));
+    // Keep angles in [-pi, pi] so precision does not drift over long runs
+    a = _mm_sub_ps(a, _mm_and_ps(_mm_cmpgt_ps(a, pi), twoPi));
+    a = _mm_add_ps(a, _mm_and_ps(_mm_cmplt_ps(a, negPi), twoPi));
+    _mm_storeu_ps(&angle[i], a);
+
+    // Four SoA rows become four AoS vec4s
+    __m128 r0 = _mm_loadu_ps(&x[i]);
+    __m128 r1 = _mm_loadu_ps(&y[i]);
+    __m128 r2 = a;
+    __m128 r3 = _mm_loadu_ps(&scale[i]);
+    _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+    float *dst = out + i * STRIDE;
+    _mm_storeu_ps(dst, r0);
+    _mm_storeu_ps(dst + 4, r1);
+    _mm_storeu_ps(dst + 8, r2);
+    _mm_storeu_ps(dst + 12, r3);
+  }
+#endif
+
+  for (; i < count; i++) {
+    float a = angle[i] + spin[i] * dt;
+    if (a > PI)
+      a -= TWO_PI;
+    if (a < -PI)
+      a += TWO_PI;
+    angle[i] = a;
+    float *dst = out + i * STRIDE;
+    dst[0] = x[i];
+    dst[1] = y[i];
+    dst[2] = a;
+    dst[3] = scale[i];
+  }
+}
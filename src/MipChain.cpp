@@ -0,0 +1,97 @@
+#include "../include/MipChain.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) ||                                    \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MIP_CHAIN_SSE2
+#include <emmintrin.h>
+#endif
+
+int mipLevelCount(int width, int height) {
+  int levels = 1;
+  for (int size = std::max(width, height); size > 1; size >>= 1)
+    levels++;
+  return levels;
+}
+
+int mipWidth(int width, int level) { return std::max(1, width >> level); }
+
+size_t mipChainBytes(int width, int height, int channels, int levels) {
+  size_t bytes = 0;
+  for (int level = 0; level < levels; level++)
+    bytes += (size_t)mipWidth(width, level) * mipWidth(height, level) * channels;
+  return bytes;
+}
+
+void downsampleBox(const unsigned char *src, int width, int height,
+                   int channels, unsigned char *dst) {
+  int dstWidth = mipWidth(width, 1);
+  int dstHeight = mipWidth(height, 1);
+  size_t srcRow = (size_t)width * channels;
+  size_t dstRow = (size_t)dstWidth * channels;
+  // Vertical sums of one row pair, the horizontal pass reads these
+  std::vector<uint16_t> sums(srcRow);
+
+  for (int y = 0; y < dstHeight; y++) {
+    // A level one pixel high averages its only row with itself
+    const unsigned char *a = src + srcRow * std::min(2 * y, height - 1);
+    const unsigned char *b = src + srcRow * std::min(2 * y + 1, height - 1);
+    unsigned char *out = dst + dstRow * y;
+
+    size_t i = 0;
+#ifdef MIP_CHAIN_SSE2
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 16 <= srcRow; i += 16) {
+      __m128i ra = _mm_loadu_si128((const __m128i *)(a + i));
+      __m128i rb = _mm_loadu_si128((const __m128i *)(b + i));
+      __m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(ra, zero),
+                                 _mm_unpacklo_epi8(rb, zero));
+      __m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(ra, zero),
+                                 _mm_unpackhi_epi8(rb, zero));
+      _mm_storeu_si128((__m128i *)&sums[i], lo);
+      _mm_storeu_si128((__m128i *)&sums[i + 8], hi);
+    }
+#endif
+    for (; i < srcRow; i++)
+      sums[i] = (uint16_t)(a[i] + b[i]);
+
+    int x = 0;
+#ifdef MIP_CHAIN_SSE2
+    if (channels == 4) {
+      // Four source pixels of sums make two output pixels
+      const __m128i round = _mm_set1_epi16(2);
+      for (; 2 * x + 4 <= width; x += 2) {
+        __m128i p01 = _mm_loadu_si128((const __m128i *)&sums[8 * x]);
+        __m128i p23 = _mm_loadu_si128((const __m128i *)&sums[8 * x + 8]);
+        __m128i s0 = _mm_add_epi16(p01, _mm_srli_si128(p01, 8));
+        __m128i s1 = _mm_add_epi16(p23, _mm_srli_si128(p23, 8));
+        __m128i r = _mm_unpacklo_epi64(s0, s1);
+        r = _mm_srli_epi16(_mm_add_epi16(r, round), 2);
+        _mm_storel_epi64((__m128i *)(out + 4 * x), _mm_packus_epi16(r, r));
+      }
+    }
+#endif
+    for (; x < dstWidth; x++) {
+      const uint16_t *p0 = &sums[(size_t)channels * 2 * x];
+      const uint16_t *p1 =
+          &sums[(size_t)channels * std::min(2 * x + 1, width - 1)];
+      for (int c = 0; c < channels; c++)
+        out[channels * x + c] = (unsigned char)((p0[c] + p1[c] + 2) >> 2);
+    }
+  }
+}
+
+void buildMipChain(unsigned char *chain, int width, int height, int channels,
+                   int levels) {
+  unsigned char *level = chain;
+  for (int i = 1; i < levels; i++) {
+    int w = mipWidth(width, i - 1);
+    int h = mipWidth(height, i - 1);
+    unsigned char *next = level + (size_t)w * h * channels;
+    downsampleBox(level, w, h, channels, next);
+    level = next;
+  }
+}
@@ -0,0 +1,245 @@
+#include "../include/Profiler.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+
+namespace {
+
+int64_t nowNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+struct CpuEvent {
+  const char *name;
+  int64_t start;
+  int64_t end;
+};
+
+// Single producer, single consumer. The owning thread fills a slot and then
+// publishes it by bumping written; endFrame() reads up to written. A thread
+// that records more than SIZE scopes between two drains loses the oldest.
+struct ThreadRing {
+  static const uint64_t SIZE = 16384;
+  static const int MAX_DEPTH = 64;
+
+  CpuEvent events[SIZE];
+  std::atomic<uint64_t> written{0};
+  uint64_t read = 0; // Consumer side only
+  int id = 0;
+
+  // Open scopes, producer side only
+  const char *openNames[MAX_DEPTH];
+  int64_t openStarts[MAX_DEPTH];
+  int depth = 0;
+};
+
+std::atomic<bool> cpuEnabled{false};
+// Registration is the only locked path, once per thread. Rings outlive their
+// threads so late events can still be drained.
+std::mutex ringsMutex;
+std::vector<std::unique_ptr<ThreadRing>> rings;
+thread_local ThreadRing *localRing = nullptr;
+
+ThreadRing &threadRing() {
+  if (!localRing) {
+    std::unique_ptr<ThreadRing> ring(new ThreadRing());
+    std::lock_guard<std::mutex> lock(ringsMutex);
+    ring->id = (int)rings.size();
+    localRing = ring.get();
+    rings.push_back(std::move(ring));
+  }
+  return *localRing;
+}
+
+const int GPU_THREAD = -1;
+
+} // namespace
+
+void Profiler::Window::add(double ms) {
+  samples[next] = ms;
+  next = (next + 1) % WINDOW;
+  if (count < WINDOW)
+    count++;
+}
+
+void Profiler::setEnabled(bool on) {
+  cpuEnabled.store(on, std::memory_order_relaxed);
+}
+
+bool Profiler::enabled() { return cpuEnabled.load(std::memory_order_relaxed); }
+
+void Profiler::beginCpu(const char *name) {
+  ThreadRing &ring = threadRing();
+  if (ring.depth < ThreadRing::MAX_DEPTH) {
+    ring.openNames[ring.depth] = name;
+    ring.openStarts[ring.depth] = nowNs();
+  }
+  ring.depth++;
+}
+
+void Profiler::endCpu() {
+  ThreadRing &ring = threadRing();
+  if (ring.depth == 0)
+    return;
+  ring.depth--;
+  if (ring.depth >= ThreadRing::MAX_DEPTH)
+    return;
+  uint64_t index = ring.written.load(std::memory_order_relaxed);
+  CpuEvent &event = ring.events[index % ThreadRing::SIZE];
+  event.name = ring.openNames[ring.depth];
+  event.start = ring.openStarts[ring.depth];
+  event.end = nowNs();
+  ring.written.store(index + 1, std::memory_order_release);
+}
+
+void Profiler::initGpu() {
+  queries = GLHandleList<GLQueryTraits>(GPU_FRAMES * MAX_GPU_SCOPES * 2);
+  for (GpuFrame &frame : gpuFrames)
+    frame.count = 0;
+  gpuFrame = 0;
+
+  GLint64 gpuNow = 0;
+  glGetInteger64v(GL_TIMESTAMP, &gpuNow);
+  gpuOffset = gpuNow - nowNs();
+  gpuEnabled = true;
+}
+
+int Profiler::beginGpu(const char *name) {
+  if (!gpuEnabled)
+    return -1;
+  GpuFrame &frame = gpuFrames[gpuFrame];
+  if (frame.count >= MAX_GPU_SCOPES)
+    return -1;
+  int scope = frame.count++;
+  frame.names[scope] = name;
+  glQueryCounter(query(gpuFrame, scope, 0), GL_TIMESTAMP);
+  return scope;
+}
+
+void Profiler::endGpu(int scope) {
+  if (scope < 0)
+    return;
+  glQueryCounter(query(gpuFrame, scope, 1), GL_TIMESTAMP);
+}
+
+void Profiler::endFrame() {
+  collectCpu();
+  if (!gpuEnabled)
+    return;
+  // The next set was last written GPU_FRAMES - 1 frames ago
+  gpuFrame = (gpuFrame + 1) % GPU_FRAMES;
+  collectGpu(gpuFrame, false);
+}
+
+void Profiler::drain() {
+  collectCpu();
+  if (!gpuEnabled)
+    return;
+  // Oldest first, so the trace stays in order
+  for (int i = 1; i <= GPU_FRAMES; i++)
+    collectGpu((gpuFrame + i) % GPU_FRAMES, true);
+}
+
+void Profiler::collectCpu() {
+  std::lock_guard<std::mutex> lock(ringsMutex);
+  for (const std::unique_ptr<ThreadRing> &ring : rings) {
+    uint64_t written = ring->written.load(std::memory_order_acquire);
+    if (written - ring->read > ThreadRing::SIZE)
+      ring->read = written - ThreadRing::SIZE;
+    for (; ring->read < written; ring->read++) {
+      const CpuEvent &event = ring->events[ring->read % ThreadRing::SIZE];
+      record("cpu", event.name, event.start, event.end - event.start,
+             ring->id);
+    }
+  }
+}
+
+void Profiler::collectGpu(int frame, bool wait) {
+  GpuFrame &set = gpuFrames[frame];
+  if (set.count == 0)
+    return;
+
+  // Timestamps land in submission order, so the last one covers the rest
+  GLuint last = query(frame, set.count - 1, 1);
+  GLint available = 0;
+  glGetQueryObjectiv(last, GL_QUERY_RESULT_AVAILABLE, &available);
+  if (!available && !wait) {
+    gpuDropped++;
+    set.count = 0;
+    return;
+  }
+
+  for (int scope = 0; scope < set.count; scope++) {
+    GLuint64 start = 0, end = 0;
+    glGetQueryObjectui64v(query(frame, scope, 0), GL_QUERY_RESULT, &start);
+    glGetQueryObjectui64v(query(frame, scope, 1), GL_QUERY_RESULT, &end);
+    record("gpu", set.names[scope], (int64_t)start - gpuOffset,
+           (int64_t)(end - start), GPU_THREAD);
+  }
+  set.count = 0;
+}
+
+void Profiler::record(const char *kind, const char *name, int64_t start,
+                      int64_t duration, int thread) {
+  stats[std::string(kind) + " " + name].add(duration / 1e6);
+  if (tracing)
+    trace.push_back(TraceEvent{name, start, duration, thread});
+}
+
+void Profiler::report(std::ostream &out) const {
+  char line[160];
+  snprintf(line, sizeof(line), "%-32s %10s %10s %10s %8s", "scope", "min ms",
+           "avg ms", "p99 ms", "samples");
+  out << line << "\n";
+  for (const auto &entry : stats) {
+    const Window &window = entry.second;
+    std::vector<double> sorted(window.samples, window.samples + window.count);
+    std::sort(sorted.begin(), sorted.end());
+    double total = 0.0;
+    for (double ms : sorted)
+      total += ms;
+    size_t p99 = std::min(sorted.size() - 1, (size_t)(0.99 * sorted.size()));
+    snprintf(line, sizeof(line), "%-32s %10.3f %10.3f %10.3f %8d",
+             entry.first.c_str(), sorted.front(), total / sorted.size(),
+             sorted[p99], window.count);
+    out << line << "\n";
+  }
+  if (gpuDropped > 0)
+    out << "gpu frames dropped: " << gpuDropped << "\n";
+  out.flush();
+}
+
+bool Profiler::writeTrace(const char *path) const {
+  FILE *file = fopen(path, "w");
+  if (!file)
+    return false;
+
+  int64_t origin = 0;
+  if (!trace.empty()) {
+    origin = trace.front().start;
+    for (const TraceEvent &event : trace)
+      origin = std::min(origin, event.start);
+  }
+
+  fprintf(file, "{\"traceEvents\":[\n");
+  fprintf(file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,"
+                "\"args\":{\"name\":\"GPU\"}}",
+          GPU_THREAD);
+  for (const TraceEvent &event : trace) {
+    // Names are literals from our own code, quotes and control characters
+    // are not expected
+    fprintf(file,
+            ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,"
+            "\"ts\":%.3f,\"dur\":%.3f}",
+            event.name, event.thread, (event.start - origin) / 1000.0,
+            event.duration / 1000.0);
+  }
+  fprintf(file, "\n]}\n");
+  return fclose(file) == 0;
+}
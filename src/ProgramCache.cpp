@@ -0,0 +1,155 @@
+#include "../include/ProgramCache.h"
+#include "../include/Hash.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+#ifdef _WIN32
+#include <direct.h>
+#include <process.h>
+#define getpid _getpid
+#else
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+// Bump whenever the file layout changes
+const uint32_t CACHE_VERSION = 1;
+
+struct CacheHeader {
+  char magic[4];
+  uint32_t version;
+  uint64_t key;
+  uint32_t format;
+  uint32_t length;
+};
+
+uint64_t hashString(const char *str, uint64_t hash) {
+  if (str == nullptr)
+    return hash;
+  // Include the terminator so "ab"+"c" and "a"+"bc" hash differently
+  return fnv1a64(str, std::strlen(str) + 1, hash);
+}
+
+} // namespace
+
+ProgramCache::ProgramCache(const std::string &directory)
+    : directory(directory) {
+  int formats = 0;
+  if (GLAD_GL_ARB_get_program_binary)
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+  supported = formats > 0;
+
+  driverHash = hashString((const char *)glGetString(GL_VENDOR), driverHash);
+  driverHash = hashString((const char *)glGetString(GL_RENDERER), driverHash);
+  driverHash = hashString((const char *)glGetString(GL_VERSION), driverHash);
+  driverHash = hashString(
+      (const char *)glGetString(GL_SHADING_LANGUAGE_VERSION), driverHash);
+
+  if (supported) {
+#ifdef _WIN32
+    _mkdir(directory.c_str());
+#else
+    mkdir(directory.c_str(), 0755);
+#endif
+  }
+}
+
+uint64_t ProgramCache::key(const std::string &vertexCode,
+                           const std::string &fragmentCode,
+                           const std::string &defines) const {
+  uint64_t hash = driverHash;
+  hash = hashString(vertexCode.c_str(), hash);
+  hash = hashString(fragmentCode.c_str(), hash);
+  hash = hashString(defines.c_str(), hash);
+  return hash;
+}
+
+std::string ProgramCache::pathFor(uint64_t key) const {
+  char name[32];
+  std::snprintf(name, sizeof(name), "%016llx.bin", (unsigned long long)key);
+  return directory + "/" + name;
+}
+
+bool ProgramCache::load(uint64_t key, unsigned int program) {
+  if (!supported)
+    return false;
+
+  // The binary fills the rest of the file, a length that disagrees means the
+  // entry is corrupt and must not size the allocation
+  std::ifstream file(pathFor(key), std::ios::binary | std::ios::ate);
+  std::streamoff size = file ? (std::streamoff)file.tellg() : 0;
+  file.seekg(0);
+  CacheHeader header;
+  if (!file.read((char *)&header, sizeof(header)) ||
+      std::memcmp(header.magic, "PBIN", 4) != 0 ||
+      header.version != CACHE_VERSION || header.key != key ||
+      header.length == 0 ||
+      (std::streamoff)header.length != size - (std::streamoff)sizeof(header)) {
+    misses++;
+    return false;
+  }
+  std::vector<char> binary(header.length);
+  if (!file.read(binary.data(), binary.size())) {
+    misses++;
+    return false;
+  }
+
+  glProgramBinary(program, header.format, binary.data(), header.length);
+  int success;
+  glGetProgramiv(program, GL_LINK_STATUS, &success);
+  if (!success) {
+    // The driver changed underneath us, drop the entry so it gets rebuilt
+    rejected++;
+    std::remove(pathFor(key).c_str());
+    return false;
+  }
+  hits++;
+  return true;
+}
+
+void ProgramCache::store(uint64_t key, unsigned int program) {
+  if (!supported)
+    return;
+
+  int length = 0;
+  glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+  if (length <= 0)
+    return;
+
+  CacheHeader header;
+  std::memcpy(header.magic, "PBIN", 4);
+  header.version = CACHE_VERSION;
+  header.key = key;
+  std::vector<char> binary(length);
+  GLsizei written = 0;
+  GLenum format = 0;
+  glGetProgramBinary(program, length, &written, &format, binary.data());
+  if (written <= 0)
+    return;
+  header.format = format;
+  header.length = written;
+
+  // Write to a private file and rename so concurrent instances never see a
+  // partially written entry
+  std::string path = pathFor(key);
+  std::string temp = path + "." + std::to_string(getpid()) + ".tmp";
+  {
+    std::ofstream file(temp, std::ios::binary | std::ios::trunc);
+    file.write((const char *)&header, sizeof(header));
+    file.write(binary.data(), written);
+    if (!file) {
+      std::cout << "ERROR::PROGRAM_CACHE::WRITE_FAILED " << temp << std::endl;
+      file.close();
+      std::remove(temp.c_str());
+      return;
+    }
+  }
+  if (std::rename(temp.c_str(), path.c_str()) != 0)
+    std::remove(temp.c_str());
+}
@@ -1,95 +1,278 @@
 #include "../include/Shader.h"
+#include "../include/GLState.h"
+#include "../include/ProgramCache.h"
 #include <fstream>
 
+namespace {
+
+// Splice defines in right after the #version line, which has to stay first
+std::string addDefines(const std::string &source, const std::string &defines) {
+  if (defines.empty())
+    return source;
+  size_t version = source.find("#version");
+  if (version == std::string::npos)
+    return defines + "\n" + source;
+  size_t lineEnd = source.find('\n', version);
+  if (lineEnd == std::string::npos)
+    return source + "\n" + defines + "\n";
+  return source.substr(0, lineEnd + 1) + defines + "\n" +
+         source.substr(lineEnd + 1);
+}
+
+} // namespace
+
 // Constructor
-Shader::Shader(const char *vertexPath, const char *fragmentPath) {
+Shader::Shader(const char *vertexPath, const char *fragmentPath,
+               const std::string &defines, ProgramCache *cache) {
   // 1. Retrieve the vertex/fragment source code from filepath
-  std::string vertexCode;
-  std::string fragmentCode;
-  std::ifstream vShaderFile;
-  std::ifstream fShaderFile;
+  std::string vertexCode = readSource(vertexPath, defines);
+  std::string fragmentCode = readSource(fragmentPath, defines);
+
+  ID = GLProgram::create();
+
+  // 2. Reuse a binary from a previous run if the driver still accepts it
+  uint64_t cacheKey = 0;
+  if (cache && cache->enabled()) {
+    cacheKey = cache->key(vertexCode, fragmentCode, defines);
+    if (cache->load(cacheKey, ID)) {
+      reflectUniforms();
+      return;
+    }
+    // A rejected binary may leave the program in a failed state, start over
+    ID = GLProgram::create();
+    glProgramParameteri(ID, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+  }
+
+  // 3. compile both stages before asking for any status, so a driver with a
+  // threaded compiler can work on them at the same time
+  unsigned int vertex = compileStage(GL_VERTEX_SHADER, vertexCode);
+  unsigned int fragment = compileStage(GL_FRAGMENT_SHADER, fragmentCode);
+  checkStage(vertex, "VERTEX");
+  checkStage(fragment, "FRAGMENT");
+
+  // Shader program
+  glAttachShader(ID, vertex);
+  glAttachShader(ID, fragment);
+  glLinkProgram(ID);
+  if (checkProgram(ID) && cache && cache->enabled())
+    cache->store(cacheKey, ID);
+
+  // delete shaders; they're linked into our program and no longer neccessary
+  glDeleteShader(vertex);
+  glDeleteShader(fragment);
+
+  reflectUniforms();
+}
 
+Shader::Shader(unsigned int program) : ID(program) { reflectUniforms(); }
+
+std::string Shader::readSource(const char *path, const std::string &defines) {
+  std::ifstream shaderFile;
   // ensure ifstream objects can throw exceptions:
-  vShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-  fShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
+  shaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
   try {
-    // open files
-    vShaderFile.open(vertexPath);
-    fShaderFile.open(fragmentPath);
-    std::stringstream vShaderStream, fShaderStream;
+    shaderFile.open(path);
+    std::stringstream shaderStream;
     // read file's buffer contents into streams
-    vShaderStream << vShaderFile.rdbuf();
-    fShaderStream << fShaderFile.rdbuf();
-    // Close the handlers
-    vShaderFile.close();
-    fShaderFile.close();
+    shaderStream << shaderFile.rdbuf();
+    shaderFile.close();
     // convert the stream into string
-    vertexCode = vShaderStream.str();
-    fragmentCode = fShaderStream.str();
-  } catch (std::ifstream::failure e) {
-    std::cout << "ERROR::SHADER::FILE_NOT_SUCCESSFULLY_READ" << std::endl;
+    return addDefines(shaderStream.str(), defines);
+  } catch (const std::ifstream::failure &e) {
+    std::cout << "ERROR::SHADER::FILE_NOT_SUCCESSFULLY_READ " << path
+              << std::endl;
   }
+  return std::string();
+}
 
-  const char *vShaderCode = vertexCode.c_str();
-  const char *fShaderCode = fragmentCode.c_str();
+unsigned int Shader::compileStage(GLenum type, const std::string &source) {
+  const char *code = source.c_str();
+  unsigned int shader = glCreateShader(type);
+  glShaderSource(shader, 1, &code, NULL);
+  glCompileShader(shader);
+  return shader;
+}
 
-  // 2. compile shaders
-  unsigned int vertex, fragment;
+bool Shader::checkStage(unsigned int shader, const char *stage) {
   int success;
-  char infoLog[51];
-
-  // vertex shader
-  vertex = glCreateShader(GL_VERTEX_SHADER);
-  glShaderSource(vertex, 1, &vShaderCode, NULL);
-  glCompileShader(vertex);
-  // print compile errors if any
-  glGetShaderiv(vertex, GL_COMPILE_STATUS, &success);
-  if (!success) {
-    glGetShaderInfoLog(vertex, 512, NULL, infoLog);
-    std::cout << "ERROR::SHADER::VERTEX::COMPILATION_FAILED\n"
-              << infoLog << std::endl;
-  };
-
-  // Similar for fragment shader
-  fragment = glCreateShader(GL_FRAGMENT_SHADER);
-  glShaderSource(fragment, 1, &fShaderCode, NULL);
-  glCompileShader(fragment);
+  char infoLog[512];
   // print compile errors if any
-  glGetShaderiv(fragment, GL_COMPILE_STATUS, &success);
+  glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
   if (!success) {
-    glGetShaderInfoLog(fragment, 512, NULL, infoLog);
-    std::cout << "ERROR::SHADER::FRAGMENT::COMPILATION_FAILED\n"
+    glGetShaderInfoLog(shader, 512, NULL, infoLog);
+    std::cout << "ERROR::SHADER::" << stage << "::COMPILATION_FAILED\n"
               << infoLog << std::endl;
-  };
+  }
+  return success;
+}
 
-  // Shader program
-  ID = glCreateProgram();
-  glAttachShader(ID, vertex);
-  glAttachShader(ID, fragment);
-  glLinkProgram(ID);
+bool Shader::checkProgram(unsigned int program) {
+  int success;
+  char infoLog[512];
   // print linking errors if any
-  glGetProgramiv(ID, GL_LINK_STATUS, &success);
+  glGetProgramiv(program, GL_LINK_STATUS, &success);
   if (!success) {
-    glGetProgramInfoLog(ID, 512, NULL, infoLog);
+    glGetProgramInfoLog(program, 512, NULL, infoLog);
     std::cout << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n"
               << infoLog << std::endl;
   }
-
-  // delete shaders; they're linked into our program and no longer neccessary
-  glDeleteShader(vertex);
-  glDeleteShader(fragment);
+  return success;
 }
 
 void Shader::use() { glUseProgram(ID); }
 
+void Shader::use(GLStateCache &state) { state.useProgram(ID); }
+
+void Shader::reflectUniforms() {
+  int count = 0;
+  int maxLength = 0;
+  glGetProgramiv(ID, GL_ACTIVE_UNIFORMS, &count);
+  glGetProgramiv(ID, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+
+  // Collect every addressable name first so the table can be sized up front
+  std::vector<std::pair<std::string, Uniform>> found;
+  std::vector<char> name(maxLength > 0 ? maxLength : 1);
+  for (int i = 0; i < count; i++) {
+    GLsizei length = 0;
+    GLint size = 0;
+    GLenum type;
+    glGetActiveUniform(ID, i, maxLength, &length, &size, &type, name.data());
+    std::string uniformName(name.data(), length);
+    Uniform location = glGetUniformLocation(ID, uniformName.c_str());
+    // Members of uniform blocks have no location
+    if (location < 0)
+      continue;
+    found.emplace_back(uniformName, location);
+
+    // Arrays are reported as "name[0]", also register "name" and every element
+    size_t bracket = uniformName.rfind("[0]");
+    if (bracket == std::string::npos || bracket + 3 != uniformName.size())
+      continue;
+    std::string base = uniformName.substr(0, bracket);
+    found.emplace_back(base, location);
+    for (int j = 1; j < size; j++) {
+      std::string element = base + "[" + std::to_string(j) + "]";
+      found.emplace_back(element, glGetUniformLocation(ID, element.c_str()));
+    }
+  }
+
+  int blockCount = 0;
+  glGetProgramiv(ID, GL_ACTIVE_UNIFORM_BLOCKS, &blockCount);
+  glGetProgramiv(ID, GL_ACTIVE_UNIFORM_BLOCK_MAX_NAME_LENGTH, &maxLength);
+  name.resize(maxLength > 0 ? maxLength : 1);
+  blocks.clear();
+  for (int i = 0; i < blockCount; i++) {
+    GLsizei length = 0;
+    glGetActiveUniformBlockName(ID, i, maxLength, &length, name.data());
+    blocks.push_back(
+        BlockSlot{fnv1a32(std::string(name.data(), length).c_str()), (GLuint)i});
+  }
+
+  // Keep the table at most half full so probes stay short
+  size_t capacity = 8;
+  while (capacity < found.size() * 2)
+    capacity *= 2;
+  uniforms.assign(capacity, UniformSlot{0, -1, std::string()});
+  for (const auto &entry : found) {
+    if (entry.second >= 0)
+      addUniform(entry.first, entry.second);
+  }
+}
+
+// Colliding names each get a slot, the later one further along the probe
+void Shader::addUniform(const std::string &name, Uniform location) {
+  uint32_t nameHash = fnv1a32(name.c_str());
+  size_t mask = uniforms.size() - 1;
+  for (size_t i = nameHash & mask;; i = (i + 1) & mask) {
+    UniformSlot &slot = uniforms[i];
+    if (slot.location < 0) {
+      slot.hash = nameHash;
+      slot.location = location;
+      slot.name = name;
+      return;
+    }
+    if (slot.hash == nameHash) {
+      if (slot.name == name)
+        return;
+      std::cout << "ERROR::SHADER::UNIFORM_HASH_COLLISION " << slot.name
+                << " " << name << std::endl;
+    }
+  }
+}
+
+Shader::Uniform Shader::uniform(uint32_t nameHash) const {
+  if (uniforms.empty())
+    return -1;
+  size_t mask = uniforms.size() - 1;
+  for (size_t i = nameHash & mask;; i = (i + 1) & mask) {
+    const UniformSlot &slot = uniforms[i];
+    if (slot.location < 0 || slot.hash == nameHash)
+      return slot.location;
+  }
+}
+
+Shader::Uniform Shader::uniform(const std::string &name) const {
+  if (uniforms.empty())
+    return -1;
+  uint32_t nameHash = fnv1a32(name.c_str());
+  size_t mask = uniforms.size() - 1;
+  for (size_t i = nameHash & mask;; i = (i + 1) & mask) {
+    const UniformSlot &slot = uniforms[i];
+    if (slot.location < 0 || (slot.hash == nameHash && slot.name == name))
+      return slot.location;
+  }
+}
+
+GLuint Shader::uniformBlock(uint32_t nameHash) const {
+  for (const BlockSlot &block : blocks) {
+    if (block.hash == nameHash)
+      return block.index;
+  }
+  return GL_INVALID_INDEX;
+}
+
+GLuint Shader::uniformBlock(const std::string &name) const {
+  return uniformBlock(fnv1a32(name.c_str()));
+}
+
+void Shader::bindUniformBlock(uint32_t nameHash, GLuint binding) const {
+  GLuint index = uniformBlock(nameHash);
+  if (index != GL_INVALID_INDEX)
+    glUniformBlockBinding(ID, index, binding);
+}
+
+void Shader::bindUniformBlock(const std::string &name, GLuint binding) const {
+  bindUniformBlock(fnv1a32(name.c_str()), binding);
+}
+
 void Shader::setBool(const std::string &name, bool value) const {
-  glUniform1i(glGetUniformLocation(ID, name.c_str()), (int)value);
+  setBool(uniform(name), value);
 }
 
 void Shader::setInt(const std::string &name, int value) const {
-  glUniform1i(glGetUniformLocation(ID, name.c_str()), value);
+  setInt(uniform(name), value);
 }
 
 void Shader::setFloat(const std::string &name, float value) const {
-  glUniform1f(glad_glGetUniformLocation(ID, name.c_str()), value);
+  setFloat(uniform(name), value);
+}
+
+void Shader::setMat4(const std::string &name, const glm::mat4 &value) const {
+  setMat4(uniform(name), value);
+}
+
+void Shader::setBool(Uniform location, bool value) const {
+  glUniform1i(location, (int)value);
+}
+
+void Shader::setInt(Uniform location, int value) const {
+  glUniform1i(location, value);
+}
+
+void Shader::setFloat(Uniform location, float value) const {
+  glUniform1f(location, value);
+}
+
+void Shader::setMat4(Uniform location, const glm::mat4 &value) const {
+  glUniformMatrix4fv(location, 1, GL_FALSE, &value[0][0]);
 }
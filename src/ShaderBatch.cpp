@@ -0,0 +1,132 @@
+#include "../include/ShaderBatch.h"
+#include "../include/ProgramCache.h"
+
+#include <iostream>
+
+namespace {
+
+bool parallelCompile() {
+  return GLAD_GL_KHR_parallel_shader_compile ||
+         GLAD_GL_ARB_parallel_shader_compile;
+}
+
+} // namespace
+
+ShaderBatch::ShaderBatch(ProgramCache *cache) : cache(cache) {
+  // Let the driver pick how many compiler threads to use
+  if (GLAD_GL_KHR_parallel_shader_compile)
+    glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+  else if (GLAD_GL_ARB_parallel_shader_compile)
+    glMaxShaderCompilerThreadsARB(0xFFFFFFFF);
+}
+
+ShaderBatch::~ShaderBatch() {
+  for (Pending &p : pending) {
+    if (p.taken)
+      continue;
+    if (p.vertex)
+      glDeleteShader(p.vertex);
+    if (p.fragment)
+      glDeleteShader(p.fragment);
+    if (p.program)
+      glDeleteProgram(p.program);
+  }
+}
+
+ShaderFuture ShaderBatch::add(const char *vertexPath, const char *fragmentPath,
+                              const std::string &defines) {
+  Pending p;
+  p.vertexCode = Shader::readSource(vertexPath, defines);
+  p.fragmentCode = Shader::readSource(fragmentPath, defines);
+  p.defines = defines;
+  p.cacheKey = 0;
+  p.program = 0;
+  p.vertex = 0;
+  p.fragment = 0;
+  p.fromCache = false;
+  p.taken = false;
+  pending.push_back(p);
+  return ShaderFuture(this, pending.size() - 1);
+}
+
+void ShaderBatch::submit() {
+  bool useCache = cache && cache->enabled();
+
+  // Cached binaries first, anything missing goes through the compiler
+  for (size_t i = submitted; i < pending.size(); i++) {
+    Pending &p = pending[i];
+    p.program = glCreateProgram();
+    if (!useCache)
+      continue;
+    p.cacheKey = cache->key(p.vertexCode, p.fragmentCode, p.defines);
+    p.fromCache = cache->load(p.cacheKey, p.program);
+    if (!p.fromCache) {
+      glDeleteProgram(p.program);
+      p.program = glCreateProgram();
+      glProgramParameteri(p.program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT,
+                          GL_TRUE);
+    }
+  }
+
+  for (size_t i = submitted; i < pending.size(); i++) {
+    Pending &p = pending[i];
+    if (p.fromCache)
+      continue;
+    p.vertex = Shader::compileStage(GL_VERTEX_SHADER, p.vertexCode);
+    p.fragment = Shader::compileStage(GL_FRAGMENT_SHADER, p.fragmentCode);
+  }
+
+  // Linking waits on the stages inside the driver, not on this thread
+  for (size_t i = submitted; i < pending.size(); i++) {
+    Pending &p = pending[i];
+    if (p.fromCache)
+      continue;
+    glAttachShader(p.program, p.vertex);
+    glAttachShader(p.program, p.fragment);
+    glLinkProgram(p.program);
+  }
+
+  submitted = pending.size();
+}
+
+bool ShaderFuture::ready() const {
+  if (index >= batch->submitted)
+    return false;
+  const ShaderBatch::Pending &p = batch->pending[index];
+  if (p.fromCache || !parallelCompile())
+    return true;
+  int done = GL_FALSE;
+  glGetProgramiv(p.program, GL_COMPLETION_STATUS_KHR, &done);
+  return done == GL_TRUE;
+}
+
+Shader ShaderFuture::get() {
+  if (index >= batch->submitted)
+    batch->submit();
+
+  ShaderBatch::Pending &p = batch->pending[index];
+  // The program has one owner, a second Shader would delete it again
+  if (p.taken) {
+    std::cout << "ERROR::SHADER_BATCH::PROGRAM_ALREADY_TAKEN" << std::endl;
+    return Shader(0);
+  }
+  p.taken = true;
+  if (!p.fromCache) {
+    // Only print stage logs when linking fails, they explain why
+    if (!Shader::checkProgram(p.program)) {
+      Shader::checkStage(p.vertex, "VERTEX");
+      Shader::checkStage(p.fragment, "FRAGMENT");
+    } else if (batch->cache && batch->cache->enabled()) {
+      batch->cache->store(p.cacheKey, p.program);
+    }
+    glDeleteShader(p.vertex);
+    glDeleteShader(p.fragment);
+    p.vertex = 0;
+    p.fragment = 0;
+  }
+
+  // Sources are no longer needed
+  std::string().swap(p.vertexCode);
+  std::string().swap(p.fragmentCode);
+  return Shader(p.program);
+}
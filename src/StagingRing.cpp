@@ -0,0 +1,90 @@
+#include "../include/StagingRing.h"
+#include "../include/GLState.h"
+
+#include <iostream>
+
+StagingRing::StagingRing(GLStateCache &state, GLsizeiptr slotSize, int count)
+    : state(state), buffers(count > 0 ? count : 1), size(slotSize),
+      slots(buffers.size()) {
+  for (int i = 0; i < (int)slots.size(); i++) {
+    state.bindBuffer(GL_PIXEL_UNPACK_BUFFER, buffers[i]);
+    glBufferData(GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW);
+    if (map(i))
+      freeSlots.push_back(i);
+  }
+  state.bindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+StagingRing::~StagingRing() {
+  for (int i = 0; i < (int)slots.size(); i++) {
+    if (slots[i].mapped) {
+      state.bindBuffer(GL_PIXEL_UNPACK_BUFFER, buffers[i]);
+      glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+    }
+    if (slots[i].fence)
+      glDeleteSync(slots[i].fence);
+    state.forgetBuffer(buffers[i]);
+  }
+}
+
+bool StagingRing::map(int slot) {
+  // Only mapped once the fence has passed, so the driver need not sync
+  state.bindBuffer(GL_PIXEL_UNPACK_BUFFER, buffers[slot]);
+  slots[slot].mapped = glMapBufferRange(
+      GL_PIXEL_UNPACK_BUFFER, 0, size,
+      GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT |
+          GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_FLUSH_EXPLICIT_BIT);
+  if (!slots[slot].mapped)
+    std::cout << "ERROR::STAGING_RING::MAP_FAILED" << std::endl;
+  return slots[slot].mapped != nullptr;
+}
+
+int StagingRing::acquire(GLsizeiptr bytes) {
+  if (bytes > size)
+    return -1;
+  std::lock_guard<std::mutex> lock(freeMutex);
+  if (freeSlots.empty())
+    return -1;
+  int slot = freeSlots.back();
+  freeSlots.pop_back();
+  return slot;
+}
+
+void StagingRing::release(int slot) {
+  std::lock_guard<std::mutex> lock(freeMutex);
+  freeSlots.push_back(slot);
+}
+
+void StagingRing::beginUpload(int slot, GLsizeiptr bytes) {
+  state.bindBuffer(GL_PIXEL_UNPACK_BUFFER, buffers[slot]);
+  if (bytes > 0)
+    glFlushMappedBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, bytes);
+  glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+  slots[slot].mapped = nullptr;
+}
+
+void StagingRing::endUpload(int slot) {
+  slots[slot].fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  state.bindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+void StagingRing::recycle() {
+  bool bound = false;
+  for (int i = 0; i < (int)slots.size(); i++) {
+    GLsync &fence = slots[i].fence;
+    if (!fence)
+      continue;
+    GLenum status = glClientWaitSync(fence, 0, 0);
+    if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+      continue;
+    glDeleteSync(fence);
+    fence = 0;
+    bound = true;
+    if (map(i)) {
+      std::lock_guard<std::mutex> lock(freeMutex);
+      freeSlots.push_back(i);
+    }
+  }
+  if (bound)
+    state.bindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
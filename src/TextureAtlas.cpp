@@ -0,0 +1,147 @@
+#include "../include/TextureAtlas.h"
+#include "../include/AtlasPacker.h"
+#include "../include/GLState.h"
+#include "../include/MipChain.h"
+#include "../include/Profiler.h"
+#include "../include/stb_image.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <utility>
+
+TextureAtlas::TextureAtlas(GLStateCache &state, int size, int gutter,
+                           int maxLayers)
+    : state(state), size(size), gutter(gutter), maxLayers(maxLayers) {}
+
+TextureAtlas::~TextureAtlas() {
+  if (atlas)
+    state.forgetTexture(atlas);
+}
+
+int TextureAtlas::add(const unsigned char *rgba, int width, int height) {
+  if (width <= 0 || height <= 0)
+    return -1;
+  Image image;
+  image.rgba.assign(rgba, rgba + (size_t)width * height * 4);
+  image.width = width;
+  image.height = height;
+  pending.push_back(std::move(image));
+  regions.push_back(AtlasRegion());
+  return (int)regions.size() - 1;
+}
+
+int TextureAtlas::add(const char *path, bool flip) {
+  int width, height, channels;
+  stbi_decoder decoder;
+  stbi_decoder_init(&decoder);
+  decoder.flip_vertically = flip;
+  unsigned char *pixels =
+      stbi_decoder_load(&decoder, path, &width, &height, &channels, 4);
+  if (!pixels) {
+    std::cout << "ERROR::TEXTURE_ATLAS::LOAD_FAILED " << path << ": "
+              << decoder.failure_reason << std::endl;
+    return -1;
+  }
+  int index = add(pixels, width, height);
+  stbi_decoder_free(&decoder, pixels);
+  return index;
+}
+
+bool TextureAtlas::build() {
+  PROFILE_SCOPE("build atlas");
+  // Tallest first keeps the skyline flat
+  std::vector<int> order(pending.size());
+  for (size_t i = 0; i < order.size(); i++)
+    order[i] = (int)i;
+  std::stable_sort(order.begin(), order.end(), [this](int a, int b) {
+    if (pending[a].height != pending[b].height)
+      return pending[a].height > pending[b].height;
+    return pending[a].width > pending[b].width;
+  });
+
+  AtlasPacker packer(size, size, gutter, maxLayers);
+  std::vector<AtlasRect> rects(pending.size());
+  for (int i : order) {
+    if (!packer.insert(pending[i].width, pending[i].height, rects[i])) {
+      std::cout << "ERROR::TEXTURE_ATLAS::FULL " << pending[i].width << "x"
+                << pending[i].height << std::endl;
+      return false;
+    }
+  }
+  layerCount = packer.layers();
+  packed = packer.efficiency();
+
+  // A level k texel spans 2^k texels of level 0, which stay inside one
+  // gutter aligned cell while 2^k <= gutter
+  levelCount = 1;
+  for (int span = 2; span <= gutter; span *= 2)
+    levelCount++;
+  levelCount = std::min(levelCount, mipLevelCount(size, size));
+
+  if (!atlas)
+    atlas = GLTexture::create();
+  state.bindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+  state.bindTexture(0, GL_TEXTURE_2D_ARRAY, atlas);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER,
+                  levelCount > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, levelCount - 1);
+  bool immutable = GLAD_GL_ARB_texture_storage;
+  if (immutable)
+    glTexStorage3D(GL_TEXTURE_2D_ARRAY, levelCount, GL_RGBA8, size, size,
+                   layerCount);
+
+  // One layer at a time, the chain buffer is reused for each
+  std::vector<unsigned char> chain(mipChainBytes(size, size, 4, levelCount));
+  size_t row = (size_t)size * 4;
+  for (int layer = 0; layer < layerCount; layer++) {
+    memset(chain.data(), 0, row * size);
+    for (size_t i = 0; i < pending.size(); i++) {
+      const AtlasRect &rect = rects[i];
+      if (rect.layer != layer)
+        continue;
+      // The gutter repeats the nearest edge texel
+      const Image &image = pending[i];
+      int top = std::max(0, rect.y - gutter);
+      int bottom = std::min(size, rect.y + rect.height + gutter);
+      int left = std::max(0, rect.x - gutter);
+      int right = std::min(size, rect.x + rect.width + gutter);
+      for (int y = top; y < bottom; y++) {
+        int sy = std::min(std::max(y - rect.y, 0), rect.height - 1);
+        const unsigned char *src =
+            image.rgba.data() + (size_t)sy * image.width * 4;
+        unsigned char *dst = chain.data() + row * y;
+        for (int x = left; x < rect.x; x++)
+          memcpy(dst + 4 * x, src, 4);
+        memcpy(dst + 4 * rect.x, src, (size_t)rect.width * 4);
+        for (int x = rect.x + rect.width; x < right; x++)
+          memcpy(dst + 4 * x, src + 4 * (rect.width - 1), 4);
+      }
+    }
+    buildMipChain(chain.data(), size, size, 4, levelCount);
+
+    size_t offset = 0;
+    for (int level = 0; level < levelCount; level++) {
+      int w = mipWidth(size, level);
+      if (!immutable && layer == 0)
+        glTexImage3D(GL_TEXTURE_2D_ARRAY, level, GL_RGBA8, w, w, layerCount,
+                     0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+      glTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, layer, w, w, 1,
+                      GL_RGBA, GL_UNSIGNED_BYTE, chain.data() + offset);
+      offset += (size_t)w * w * 4;
+    }
+  }
+
+  for (size_t i = 0; i < pending.size(); i++) {
+    const AtlasRect &rect = rects[i];
+    regions[i] = AtlasRegion{(float)rect.x / size, (float)rect.y / size,
+                             (float)(rect.x + rect.width) / size,
+                             (float)(rect.y + rect.height) / size,
+                             (float)rect.layer};
+  }
+  std::vector<Image>().swap(pending);
+  return true;
+}
@@ -0,0 +1,140 @@
+#include "../include/TextureFile.h"
+
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+bool writeTextureFile(const char *path, const TextureFileHeader &header,
+                      const TextureFileLevel *levels,
+                      const unsigned char *data) {
+  // Written beside the target and renamed, so a reader mapping the old file
+  // never sees a half written one
+  std::string temp = std::string(path) + ".tmp";
+  FILE *file = fopen(temp.c_str(), "wb");
+  if (!file)
+    return false;
+
+  bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+            fwrite(levels, sizeof(TextureFileLevel), header.levels, file) ==
+                header.levels;
+  uint64_t position =
+      sizeof(header) + sizeof(TextureFileLevel) * header.levels;
+  static const unsigned char zeros[TEXTURE_FILE_ALIGNMENT] = {};
+  for (uint32_t i = 0; ok && i < header.levels; i++) {
+    ok = fwrite(zeros, 1, levels[i].offset - position, file) ==
+             levels[i].offset - position &&
+         fwrite(data, 1, levels[i].size, file) == levels[i].size;
+    data += levels[i].size;
+    position = levels[i].offset + levels[i].size;
+  }
+  ok = fclose(file) == 0 && ok;
+
+  if (ok) {
+    std::remove(path); // rename() does not replace on Windows
+    ok = std::rename(temp.c_str(), path) == 0;
+  }
+  if (!ok)
+    std::remove(temp.c_str());
+  return ok;
+}
+
+bool TextureFile::open(const char *path) {
+  close();
+#ifdef _WIN32
+  HANDLE handle = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL,
+                              OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (handle == INVALID_HANDLE_VALUE) {
+    std::cout << "ERROR::TEXTURE_FILE::OPEN_FAILED " << path << std::endl;
+    return false;
+  }
+  LARGE_INTEGER fileSize;
+  GetFileSizeEx(handle, &fileSize);
+  size = (size_t)fileSize.QuadPart;
+  HANDLE fileMapping =
+      size > 0 ? CreateFileMappingA(handle, NULL, PAGE_READONLY, 0, 0, NULL)
+               : NULL;
+  void *view =
+      fileMapping ? MapViewOfFile(fileMapping, FILE_MAP_READ, 0, 0, 0) : NULL;
+  fileHandle = handle;
+  mappingHandle = fileMapping;
+  if (!view) {
+    std::cout << "ERROR::TEXTURE_FILE::MAP_FAILED " << path << std::endl;
+    close();
+    return false;
+  }
+  mapping = (const unsigned char *)view;
+#else
+  int fd = ::open(path, O_RDONLY);
+  if (fd < 0) {
+    std::cout << "ERROR::TEXTURE_FILE::OPEN_FAILED " << path << std::endl;
+    return false;
+  }
+  struct stat info;
+  void *view = MAP_FAILED;
+  if (fstat(fd, &info) == 0 && info.st_size > 0) {
+    size = (size_t)info.st_size;
+    view = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+  }
+  // The mapping keeps the file alive
+  ::close(fd);
+  if (view == MAP_FAILED) {
+    std::cout << "ERROR::TEXTURE_FILE::MAP_FAILED " << path << std::endl;
+    size = 0;
+    return false;
+  }
+  mapping = (const unsigned char *)view;
+#endif
+
+  // Everything the accessors touch must lie inside the file
+  const TextureFileHeader &head = header();
+  bool valid = size >= sizeof(TextureFileHeader) &&
+               memcmp(head.magic, "HTEX", 4) == 0 &&
+               head.version == TEXTURE_FILE_VERSION && head.levels > 0 &&
+               head.levels <= 32 &&
+               size >= sizeof(TextureFileHeader) +
+                           sizeof(TextureFileLevel) * head.levels;
+  for (uint32_t i = 0; valid && i < head.levels; i++) {
+    const TextureFileLevel &entry = level(i);
+    valid = entry.offset <= size && entry.size <= size - entry.offset;
+  }
+  if (!valid) {
+    std::cout << "ERROR::TEXTURE_FILE::INVALID " << path << std::endl;
+    close();
+    return false;
+  }
+  return true;
+}
+
+void TextureFile::close() {
+#ifdef _WIN32
+  if (mapping)
+    UnmapViewOfFile((void *)mapping);
+  if (mappingHandle)
+    CloseHandle(mappingHandle);
+  if (fileHandle)
+    CloseHandle(fileHandle);
+  fileHandle = mappingHandle = nullptr;
+#else
+  if (mapping)
+    munmap((void *)mapping, size);
+#endif
+  mapping = nullptr;
+  size = 0;
+}
+
+void TextureFile::prefetch() const {
+#ifndef _WIN32
+  // Windows reads ahead on its own for sequential access
+  madvise((void *)mapping, size, MADV_WILLNEED);
+#endif
+}
@@ -0,0 +1,523 @@
+#include "../include/TextureLoader.h"
+#include "../include/GLState.h"
+#include "../include/MipChain.h"
+#include "../include/Profiler.h"
+#include "../include/StagingRing.h"
+#include "../include/TextureFile.h"
+#include "../include/ThreadPool.h"
+#include "../include/stb_image.h"
+
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <utility>
+
+namespace {
+
+GLenum formatFor(int channels) {
+  switch (channels) {
+  case 1:
+    return GL_RED;
+  case 2:
+    return GL_RG;
+  case 3:
+    return GL_RGB;
+  default:
+    return GL_RGBA;
+  }
+}
+
+// Whole file into bytes, which keep their capacity between files
+bool readFile(const std::string &path, std::vector<unsigned char> &bytes) {
+  FILE *file = fopen(path.c_str(), "rb");
+  if (!file)
+    return false;
+  bool ok = fseek(file, 0, SEEK_END) == 0;
+  long size = ok ? ftell(file) : -1;
+  ok = size >= 0 && fseek(file, 0, SEEK_SET) == 0;
+  if (ok) {
+    bytes.resize((size_t)size);
+    ok = fread(bytes.data(), 1, bytes.size(), file) == bytes.size();
+  }
+  fclose(file);
+  return ok;
+}
+
+GLenum sizedFormatFor(int channels, GLenum type) {
+  bool half = type == GL_HALF_FLOAT;
+  switch (channels) {
+  case 1:
+    return half ? GL_R16F : GL_R8;
+  case 2:
+    return half ? GL_RG16F : GL_RG8;
+  case 3:
+    return half ? GL_RGB16F : GL_RGB8;
+  default:
+    return half ? GL_RGBA16F : GL_RGBA8;
+  }
+}
+
+} // namespace
+
+TextureLoader::TextureLoader(ThreadPool &pool, GLStateCache &state,
+                             StagingRing *staging)
+    : pool(pool), state(state), staging(staging) {}
+
+TextureLoader::~TextureLoader() {
+  // Jobs still queued write into this object
+  pool.wait();
+  collect();
+  for (Decoded *image : ready) {
+    if (image->staging >= 0)
+      staging->release(image->staging);
+    delete image;
+  }
+  for (Entry &entry : entries)
+    state.forgetTexture(entry.texture);
+}
+
+GLuint TextureLoader::create(const std::string &path,
+                             const TextureParams &params) {
+  entries.push_back(Entry{GLTexture::create(), path, params});
+  GLuint texture = entries.back().texture;
+
+  // Mid grey until the image arrives. Level 0 is the only level for now so a
+  // mipmapped filter still samples it.
+  static const unsigned char placeholder[4] = {128, 128, 128, 255};
+  state.bindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+  state.bindTexture(0, GL_TEXTURE_2D, texture);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, params.wrap);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, params.wrap);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, params.minFilter);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, params.magFilter);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE,
+               placeholder);
+  return texture;
+}
+
+GLuint TextureLoader::load(const std::string &path,
+                           const TextureParams &params) {
+  size_t index = entries.size();
+  GLuint texture = create(path, params);
+
+  // Raw upload on drivers that cannot take the compressed blocks
+  TextureParams decodeParams = params;
+  decodeParams.compress =
+      params.compress && GLAD_GL_EXT_texture_compression_s3tc;
+
+  waiting++;
+  pool.submit([this, index, path, decodeParams] {
+    decode(index, path, decodeParams);
+  });
+  return texture;
+}
+
+GLuint TextureLoader::loadStreamed(const std::string &path,
+                                   const TextureParams &params) {
+  PROFILE_SCOPE("stream image");
+  GLuint texture = create(path, params);
+
+  // stb sets the size before the first band, level 0 is allocated then
+  struct Bands {
+    int width = 0, height = 0, channels = 0;
+    bool flip;
+    bool allocated = false;
+    std::vector<unsigned char> flipped;
+  } bands;
+  bands.flip = params.flip;
+  auto upload = [](void *user, int y, int rows, const unsigned char *pixels) {
+    Bands &bands = *(Bands *)user;
+    GLenum format = formatFor(bands.channels);
+    size_t stride = (size_t)bands.width * bands.channels;
+    if (!bands.allocated) {
+      glTexImage2D(GL_TEXTURE_2D, 0,
+                   sizedFormatFor(bands.channels, GL_UNSIGNED_BYTE),
+                   bands.width, bands.height, 0, format, GL_UNSIGNED_BYTE,
+                   nullptr);
+      bands.allocated = true;
+    }
+    // Flipped bands land mirrored from the bottom, rows reversed
+    if (bands.flip) {
+      bands.flipped.resize(stride * rows);
+      for (int row = 0; row < rows; row++)
+        memcpy(bands.flipped.data() + stride * (rows - 1 - row),
+               pixels + stride * row, stride);
+      pixels = bands.flipped.data();
+      y = bands.height - y - rows;
+    }
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, y, bands.width, rows, format,
+                    GL_UNSIGNED_BYTE, pixels);
+    return 1;
+  };
+
+  stbi_decoder decoder;
+  stbi_decoder_init(&decoder);
+  decoder.premultiply = params.premultiply;
+  // Rows of 1 and 3 channel images are not padded to 4 bytes
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  int ok = stbi_decoder_load_rows(&decoder, path.c_str(), &bands.width,
+                                  &bands.height, &bands.channels, 0, upload,
+                                  &bands);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+  if (!ok) {
+    std::cout << "Failed to load texture " << path << ": "
+              << decoder.failure_reason << std::endl;
+    failed++;
+    return texture;
+  }
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 1000);
+  if (params.mipmaps)
+    glGenerateMipmap(GL_TEXTURE_2D);
+  loaded++;
+  return texture;
+}
+
+void TextureLoader::decode(size_t index, const std::string &path,
+                           const TextureParams &params) {
+  PROFILE_SCOPE("decode image");
+  Decoded *image = new Decoded();
+  image->index = index;
+  image->levels = 1;
+  image->compressed = 0;
+  image->type = GL_UNSIGNED_BYTE;
+  image->staging = -1;
+  if (path.size() > 5 && path.compare(path.size() - 5, 5, ".htex") == 0) {
+    mapFile(image, path, params);
+    complete(image);
+    return;
+  }
+
+  // The file and stb's scratch go through per worker buffers that only grow,
+  // so once they fit the largest image stb decodes without allocating
+  thread_local std::vector<unsigned char> file, scratch;
+  // Options and the failure reason live in the decoder, workers share
+  // nothing with stb
+  stbi_decoder decoder;
+  stbi_decoder_init(&decoder);
+  decoder.flip_vertically = params.flip;
+  decoder.premultiply = params.premultiply;
+  size_t pixelBytes = 0, scratchBytes = 0;
+  if (!readFile(path, file)) {
+    image->error = "cannot read file";
+  } else if (stbi_is_hdr_from_memory(file.data(), (int)file.size())) {
+    decodeHdr(image, file.data(), file.size(), params);
+    complete(image);
+    return;
+  } else if (!stbi_decoder_decode_sizes_from_memory(
+                 &decoder, file.data(), (int)file.size(), 0, &image->width,
+                 &image->height, &image->channels, &pixelBytes,
+                 &scratchBytes)) {
+    image->error = decoder.failure_reason;
+  }
+  if (image->error) {
+    complete(image);
+    return;
+  }
+  if (scratch.size() < scratchBytes)
+    scratch.resize(scratchBytes);
+
+  int width = image->width, height = image->height;
+  bool compress =
+      params.compress && (image->channels == 3 || image->channels == 4);
+  // Compressed textures cannot use glGenerateMipmap, their chain is
+  // always built here
+  bool buildChain = params.mipmaps && (params.immutable || compress);
+
+  // Level 0 of a chain is decoded in place, a single level straight into a
+  // staging slot when one is free
+  unsigned char *pixels;
+  if (buildChain || compress) {
+    image->levels = buildChain ? mipLevelCount(width, height) : 1;
+    image->chain.resize(
+        mipChainBytes(width, height, image->channels, image->levels));
+    pixels = image->chain.data();
+  } else {
+    image->staging = staging ? staging->acquire(pixelBytes) : -1;
+    if (image->staging < 0)
+      image->pixels.resize(pixelBytes);
+    pixels = image->staging >= 0
+                 ? (unsigned char *)staging->data(image->staging)
+                 : image->pixels.data();
+  }
+
+  // stb flips and premultiplies as it writes the final rows
+  if (!stbi_decoder_load_into_from_memory(
+          &decoder, file.data(), (int)file.size(), &width, &height,
+          &image->channels, 0, pixels, pixelBytes, scratch.data(),
+          scratch.size())) {
+    image->error = decoder.failure_reason;
+    if (image->staging >= 0)
+      staging->release(image->staging);
+    image->staging = -1;
+    complete(image);
+    return;
+  }
+  if (!buildChain && !compress) {
+    complete(image);
+    return;
+  }
+
+  if (buildChain) {
+    PROFILE_SCOPE("build mips");
+    buildMipChain(image->chain.data(), width, height, image->channels,
+                  image->levels);
+  }
+
+  if (compress) {
+    PROFILE_SCOPE("compress blocks");
+    BlockFormat format = blockFormatFor(image->channels);
+    image->compressed = format == BLOCK_BC1 ? GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+                                            : GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+    std::vector<unsigned char> blocks(chainBytes(*image));
+    size_t from = 0, to = 0;
+    for (int level = 0; level < image->levels; level++) {
+      int w = mipWidth(width, level), h = mipWidth(height, level);
+      compressBlocks(image->chain.data() + from, w, h, image->channels,
+                     format, params.compressQuality, blocks.data() + to);
+      from += (size_t)w * h * image->channels;
+      to += levelBytes(*image, level);
+    }
+    image->chain.swap(blocks);
+  }
+
+  // Without a free slot the chain uploads from client memory
+  size_t bytes = chainBytes(*image);
+  int slot = staging ? staging->acquire(bytes) : -1;
+  if (slot >= 0) {
+    memcpy(staging->data(slot), image->chain.data(), bytes);
+    std::vector<unsigned char>().swap(image->chain);
+    image->staging = slot;
+  }
+  complete(image);
+}
+
+// Radiance images keep their range as half floats, half the memory of the
+// floats stb decodes them to otherwise. Their mipmaps come from the driver.
+void TextureLoader::decodeHdr(Decoded *image, const unsigned char *file,
+                              size_t size, const TextureParams &params) {
+  PROFILE_SCOPE("decode hdr");
+  stbi_decoder decoder;
+  stbi_decoder_init(&decoder);
+  decoder.flip_vertically = params.flip;
+  size_t pixelBytes, scratchBytes;
+  if (!stbi_decoder_decode_sizes_from_memory(
+          &decoder, file, (int)size, 0, &image->width, &image->height,
+          &image->channels, &pixelBytes, &scratchBytes)) {
+    image->error = decoder.failure_reason;
+    return;
+  }
+  // The halves go straight into a staging slot when one is free
+  image->type = GL_HALF_FLOAT;
+  size_t bytes = levelBytes(*image, 0);
+  image->staging = staging ? staging->acquire(bytes) : -1;
+  if (image->staging < 0)
+    image->pixels.resize(bytes);
+  stbi_us *halves = image->staging >= 0
+                        ? (stbi_us *)staging->data(image->staging)
+                        : (stbi_us *)image->pixels.data();
+  if (!stbi_decoder_loadh_into_from_memory(
+          &decoder, file, (int)size, &image->width, &image->height,
+          &image->channels, 0, halves, bytes)) {
+    image->error = decoder.failure_reason;
+    if (image->staging >= 0)
+      staging->release(image->staging);
+    image->staging = -1;
+    std::vector<unsigned char>().swap(image->pixels);
+  }
+}
+
+void TextureLoader::mapFile(Decoded *image, const std::string &path,
+                            const TextureParams &params) {
+  PROFILE_SCOPE("map texture file");
+  std::unique_ptr<TextureFile> file(new TextureFile());
+  if (!file->open(path.c_str())) {
+    image->error = "cannot map texture file";
+    return;
+  }
+  const TextureFileHeader &header = file->header();
+  image->width = (int)header.width;
+  image->height = (int)header.height;
+  image->channels = (int)header.channels;
+  image->levels = params.mipmaps ? (int)header.levels : 1;
+  bool blocks = header.format != TEXTURE_FILE_RAW;
+  BlockFormat format = header.format == TEXTURE_FILE_BC1 ? BLOCK_BC1 : BLOCK_BC3;
+  if (blocks)
+    image->compressed = format == BLOCK_BC1 ? GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+                                            : GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+
+  // The table was checked against the file size, check it against the image
+  bool valid = image->width > 0 && image->height > 0 &&
+               image->channels >= 1 && image->channels <= 4 &&
+               header.format <= TEXTURE_FILE_BC3 &&
+               (!blocks || blockFormatFor(image->channels) == format) &&
+               image->levels <= mipLevelCount(image->width, image->height);
+  for (int level = 0; valid && level < image->levels; level++) {
+    const TextureFileLevel &entry = file->level(level);
+    valid = entry.width == (uint32_t)mipWidth(image->width, level) &&
+            entry.height == (uint32_t)mipWidth(image->height, level) &&
+            entry.size == levelBytes(*image, level);
+  }
+  if (!valid) {
+    image->error = "texture file does not match its header";
+    return;
+  }
+
+  if (blocks && !GLAD_GL_EXT_texture_compression_s3tc) {
+    // Expand to RGBA here, the mapping is dropped with this function
+    PROFILE_SCOPE("decompress blocks");
+    image->compressed = 0;
+    image->channels = 4;
+    image->chain.resize(chainBytes(*image));
+    size_t offset = 0;
+    for (int level = 0; level < image->levels; level++) {
+      decompressBlocks(file->data(level), mipWidth(image->width, level),
+                       mipWidth(image->height, level), format,
+                       image->chain.data() + offset);
+      offset += levelBytes(*image, level);
+    }
+    return;
+  }
+  // Start paging the payload in now, the upload touches it next
+  file->prefetch();
+  image->file = std::move(file);
+}
+
+void TextureLoader::complete(Decoded *image) {
+  // Lock-free push, the GL thread only ever takes the whole list
+  image->next = completed.load(std::memory_order_relaxed);
+  while (!completed.compare_exchange_weak(image->next, image,
+                                          std::memory_order_release,
+                                          std::memory_order_relaxed)) {
+  }
+}
+
+void TextureLoader::collect() {
+  Decoded *list = completed.exchange(nullptr, std::memory_order_acquire);
+  // The list is newest first, reverse it so uploads follow completion order
+  Decoded *oldest = nullptr;
+  while (list) {
+    Decoded *next = list->next;
+    list->next = oldest;
+    oldest = list;
+    list = next;
+  }
+  for (; oldest; oldest = oldest->next)
+    ready.push_back(oldest);
+}
+
+int TextureLoader::update(int maxUploads) {
+  if (staging)
+    staging->recycle();
+  if (waiting == 0)
+    return 0;
+  PROFILE_SCOPE("upload textures");
+  collect();
+  int uploaded = 0;
+  while (!ready.empty() && (maxUploads <= 0 || uploaded < maxUploads)) {
+    Decoded *image = ready.front();
+    ready.pop_front();
+    upload(image);
+    delete image;
+    waiting--;
+    uploaded++;
+  }
+  return uploaded;
+}
+
+void TextureLoader::finish() {
+  pool.wait();
+  update();
+}
+
+size_t TextureLoader::levelBytes(const Decoded &image, int level) {
+  int width = mipWidth(image.width, level);
+  int height = mipWidth(image.height, level);
+  if (image.compressed)
+    return blockCompressedBytes(width, height,
+                                blockFormatFor(image.channels));
+  size_t bytes = (size_t)width * height * image.channels;
+  return image.type == GL_HALF_FLOAT ? bytes * 2 : bytes;
+}
+
+size_t TextureLoader::chainBytes(const Decoded &image) {
+  size_t bytes = 0;
+  for (int level = 0; level < image.levels; level++)
+    bytes += levelBytes(image, level);
+  return bytes;
+}
+
+void TextureLoader::upload(Decoded *image) {
+  const Entry &entry = entries[image->index];
+  if (image->error) {
+    std::cout << "Failed to load texture " << entry.path << ": "
+              << image->error << std::endl;
+    failed++;
+    return;
+  }
+
+  GLenum format = formatFor(image->channels);
+  GLenum internalFormat = image->compressed
+                              ? image->compressed
+                              : sizedFormatFor(image->channels, image->type);
+  bool immutable = entry.params.immutable && GLAD_GL_ARB_texture_storage;
+  bool half = image->type == GL_HALF_FLOAT;
+  state.bindTexture(0, GL_TEXTURE_2D, entry.texture);
+  // HDR images bring one level and leave room for glGenerateMipmap
+  int storageLevels = half && entry.params.mipmaps
+                          ? mipLevelCount(image->width, image->height)
+                          : image->levels;
+  if (immutable)
+    glTexStorage2D(GL_TEXTURE_2D, storageLevels, internalFormat, image->width,
+                   image->height);
+
+  // Staged levels are offsets into the slot, the driver copies from there
+  // asynchronously. Mapped levels are read straight from the page cache.
+  const unsigned char *source =
+      image->chain.empty() ? image->pixels.data() : image->chain.data();
+  if (image->staging >= 0)
+    staging->beginUpload(image->staging, chainBytes(*image));
+  else
+    state.bindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+  // Rows of 1 and 3 channel images are not padded to 4 bytes
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  size_t offset = 0;
+  for (int level = 0; level < image->levels; level++) {
+    int width = mipWidth(image->width, level);
+    int height = mipWidth(image->height, level);
+    GLsizei size = (GLsizei)levelBytes(*image, level);
+    const void *pixels = image->staging >= 0 ? (const void *)offset
+                         : image->file    ? image->file->data(level)
+                                          : source + offset;
+    if (image->compressed && immutable)
+      glCompressedTexSubImage2D(GL_TEXTURE_2D, level, 0, 0, width, height,
+                                internalFormat, size, pixels);
+    else if (image->compressed)
+      glCompressedTexImage2D(GL_TEXTURE_2D, level, internalFormat, width,
+                             height, 0, size, pixels);
+    else if (immutable)
+      glTexSubImage2D(GL_TEXTURE_2D, level, 0, 0, width, height, format,
+                      image->type, pixels);
+    else
+      glTexImage2D(GL_TEXTURE_2D, level, half ? internalFormat : format, width,
+                   height, 0, format, image->type, pixels);
+    offset += size;
+  }
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+  if (image->staging >= 0) {
+    staging->endUpload(image->staging);
+    staged++;
+  }
+  if (image->compressed)
+    compressed++;
+
+  if (image->levels > 1) {
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, image->levels - 1);
+  } else {
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 1000);
+    if (entry.params.mipmaps && !image->compressed)
+      glGenerateMipmap(GL_TEXTURE_2D);
+  }
+  loaded++;
+}
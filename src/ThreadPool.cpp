@@ -0,0 +1,97 @@
+#include "../include/ThreadPool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+
+ThreadPool::ThreadPool(unsigned int threads) {
+  if (threads == 0) {
+    unsigned int cores = std::thread::hardware_concurrency();
+    threads = cores > 1 ? cores - 1 : 1;
+  }
+  workers.reserve(threads);
+  for (unsigned int i = 0; i < threads; i++)
+    workers.emplace_back(&ThreadPool::work, this);
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  wake.notify_all();
+  for (std::thread &worker : workers)
+    worker.join();
+}
+
+void ThreadPool::submit(std::function<void()> job) {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    jobs.push_back(std::move(job));
+  }
+  wake.notify_one();
+}
+
+void ThreadPool::wait() {
+  std::unique_lock<std::mutex> lock(mutex);
+  idle.wait(lock, [this] { return jobs.empty() && running == 0; });
+}
+
+void ThreadPool::parallelFor(int count, const std::function<void(int)> &task) {
+  if (count <= 1 || workers.empty()) {
+    for (int i = 0; i < count; i++)
+      task(i);
+    return;
+  }
+
+  // Helpers can start after every task is done, so what they touch is
+  // shared, and they only use task after claiming an index
+  struct Shared {
+    std::function<void(int)> task;
+    int count;
+    std::atomic<int> next{0};
+    std::atomic<int> done{0};
+    std::mutex mutex;
+    std::condition_variable finished;
+  };
+  auto shared = std::make_shared<Shared>();
+  shared->task = task;
+  shared->count = count;
+  auto run = [](Shared &s) {
+    for (int i; (i = s.next.fetch_add(1)) < s.count;) {
+      s.task(i);
+      if (s.done.fetch_add(1) + 1 == s.count) {
+        std::lock_guard<std::mutex> lock(s.mutex);
+        s.finished.notify_all();
+      }
+    }
+  };
+
+  unsigned int helpers = std::min(size(), (unsigned int)count - 1);
+  for (unsigned int i = 0; i < helpers; i++)
+    submit([shared, run] { run(*shared); });
+  run(*shared);
+
+  std::unique_lock<std::mutex> lock(shared->mutex);
+  shared->finished.wait(lock,
+                        [&shared] { return shared->done == shared->count; });
+}
+
+void ThreadPool::work() {
+  std::unique_lock<std::mutex> lock(mutex);
+  for (;;) {
+    wake.wait(lock, [this] { return stopping || !jobs.empty(); });
+    if (jobs.empty())
+      return; // Stopping with nothing left to run
+
+    std::function<void()> job = std::move(jobs.front());
+    jobs.pop_front();
+    running++;
+    lock.unlock();
+    job();
+    lock.lock();
+    running--;
+    if (jobs.empty() && running == 0)
+      idle.notify_all();
+  }
+}
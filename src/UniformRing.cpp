@@ -0,0 +1,89 @@
+#include "../include/UniformRing.h"
+#include "../include/GLState.h"
+
+#include <iostream>
+
+UniformRing::UniformRing(GLStateCache &state, GLsizeiptr frameSize, int frames)
+    : state(state), buffer(GLBuffer::create()), frameSize(frameSize),
+      frames(frames) {
+  const int maxFrames = sizeof(fences) / sizeof(fences[0]);
+  if (this->frames < 1)
+    this->frames = 1;
+  if (this->frames > maxFrames)
+    this->frames = maxFrames;
+
+  offsetAlignment = 256;
+  glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &offsetAlignment);
+  // Keep every segment start aligned as well
+  this->frameSize = (frameSize + offsetAlignment - 1) / offsetAlignment *
+                    offsetAlignment;
+
+  state.bindBuffer(GL_UNIFORM_BUFFER, buffer);
+  glBufferData(GL_UNIFORM_BUFFER, this->frameSize * this->frames, NULL,
+               GL_STREAM_DRAW);
+}
+
+UniformRing::~UniformRing() {
+  if (mapped) {
+    state.bindBuffer(GL_UNIFORM_BUFFER, buffer);
+    glUnmapBuffer(GL_UNIFORM_BUFFER);
+  }
+  for (GLsync fence : fences) {
+    if (fence)
+      glDeleteSync(fence);
+  }
+  state.forgetBuffer(buffer);
+}
+
+void UniformRing::beginFrame() {
+  GLsync &fence = fences[frame];
+  if (fence) {
+    // Normally already signalled, only stalls if the GPU is frames behind
+    GLenum status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+    while (status == GL_TIMEOUT_EXPIRED)
+      status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+    glDeleteSync(fence);
+    fence = 0;
+  }
+
+  // The fence already ordered us against the GPU, so skip the driver's sync
+  state.bindBuffer(GL_UNIFORM_BUFFER, buffer);
+  mapped = (char *)glMapBufferRange(
+      GL_UNIFORM_BUFFER, frame * frameSize, frameSize,
+      GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT |
+          GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_FLUSH_EXPLICIT_BIT);
+  head = 0;
+  if (!mapped)
+    std::cout << "ERROR::UNIFORM_RING::MAP_FAILED" << std::endl;
+}
+
+UniformRing::Allocation UniformRing::allocate(GLsizeiptr size) {
+  GLsizeiptr start =
+      (head + offsetAlignment - 1) / offsetAlignment * offsetAlignment;
+  if (!mapped || start + size > frameSize) {
+    std::cout << "ERROR::UNIFORM_RING::OUT_OF_SPACE" << std::endl;
+    return Allocation{nullptr, 0, 0};
+  }
+  head = start + size;
+  return Allocation{mapped + start, frame * frameSize + start, size};
+}
+
+void UniformRing::flush() {
+  if (!mapped)
+    return;
+  state.bindBuffer(GL_UNIFORM_BUFFER, buffer);
+  if (head > 0)
+    glFlushMappedBufferRange(GL_UNIFORM_BUFFER, 0, head);
+  glUnmapBuffer(GL_UNIFORM_BUFFER);
+  mapped = nullptr;
+}
+
+void UniformRing::bind(GLuint binding, const Allocation &allocation) {
+  state.bindBufferRange(GL_UNIFORM_BUFFER, binding, buffer, allocation.offset,
+                        allocation.size);
+}
+
+void UniformRing::endFrame() {
+  fences[frame] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  frame = (frame + 1) % frames;
+}
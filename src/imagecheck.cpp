@@ -0,0 +1,797 @@
+// Checks the decoders in include/stb_image.h against references and exits
+// non-zero on the first kernel or image that disagrees. Built with its own
+// copy of the implementation so it can reach the internal kernels.
+//
+//   imagecheck --jpeg-kernels [FILE...]
+//   imagecheck --png [FILE...]
+//   imagecheck --alloc [FILE...]
+//
+// --jpeg-kernels: the IDCT, YCbCr to RGB and chroma upsampling kernels of
+// every SIMD level against the generic ones on random input, then whole
+// JPEG decodes at every level and scale against the generic decode, over
+// generated images and the files given. Also prints each kernel's MB/s.
+//
+// --png: inflate and unfiltering against libpng, over PNGs generated with
+// every colour type and bit depth, tRNS, interlacing, each filter type and
+// zlib strategy, and the files given. Files libpng rejects are skipped.
+//
+// --alloc: stbi_load_into_from_memory given exactly the sizes
+// stbi_decode_sizes_from_memory reports, over generated JPEGs and PNGs and
+// the files given, must decode without a single STBI_MALLOC or STBI_REALLOC.
+#include <cstdlib>
+
+// Every heap allocation stb_image makes in this program. The check decodes
+// on one thread, so a plain counter will do.
+static unsigned long heapAllocations = 0;
+
+static void *countedMalloc(size_t size) {
+  heapAllocations++;
+  return malloc(size);
+}
+
+static void *countedRealloc(void *p, size_t size) {
+  heapAllocations++;
+  return realloc(p, size);
+}
+
+#define STBI_MALLOC(size) countedMalloc(size)
+#define STBI_REALLOC(p, size) countedRealloc(p, size)
+#define STBI_FREE(p) free(p)
+#define STB_IMAGE_IMPLEMENTATION
+#include "../include/stb_image.h"
+
+#include <jpeglib.h>
+#include <png.h>
+#include <zlib.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+namespace {
+
+const char *levelNames[] = {"generic", "simd", "avx2"};
+const int LEVELS = 3;
+
+// Deterministic noise, so a failure reproduces
+struct Random {
+  uint32_t state = 12345;
+  uint32_t next() {
+    state = state * 1664525u + 1013904223u;
+    return state >> 8;
+  }
+  int range(int low, int high) {
+    return low + (int)(next() % (high - low + 1));
+  }
+};
+
+bool readFile(const char *path, std::vector<unsigned char> &bytes) {
+  FILE *file = fopen(path, "rb");
+  if (!file)
+    return false;
+  unsigned char chunk[65536];
+  size_t read;
+  while ((read = fread(chunk, 1, sizeof(chunk), file)) > 0)
+    bytes.insert(bytes.end(), chunk, chunk + read);
+  fclose(file);
+  return true;
+}
+
+// The kernels stb picks at a SIMD level, through the same setup a decode uses
+void kernelsAt(int level, stbi__jpeg &kernels) {
+  stbi_set_jpeg_simd_level(level);
+  stbi__setup_jpeg(&kernels);
+  stbi_set_jpeg_simd_level(2);
+}
+
+double seconds(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                       start)
+      .count();
+}
+
+// Every level against generic on random input. Coefficients past +-256 can
+// overflow the 16-bit lanes of the SIMD IDCTs, which wrap where the generic
+// one does not; real JPEGs stay inside it, wider ranges only compare the
+// SIMD levels with each other.
+bool checkKernels(stbi__jpeg *kernels) {
+  Random random;
+  const int ranges[] = {16, 256, 2048, 32767};
+  for (int t = 0; t < 200000; t++) {
+    int range = ranges[t % 4];
+    STBI_SIMD_ALIGN(short, coefficients[64]);
+    for (int i = 0; i < 64; i++)
+      coefficients[i] = (short)random.range(-range, range);
+    stbi_uc out[LEVELS][64];
+    for (int level = 0; level < LEVELS; level++) {
+      STBI_SIMD_ALIGN(short, data[64]);
+      memcpy(data, coefficients, sizeof(data));
+      kernels[level].idct_block_kernel(out[level], 8, data);
+    }
+    int first = range <= 256 ? 0 : 1;
+    for (int level = first + 1; level < LEVELS; level++) {
+      if (memcmp(out[first], out[level], 64) != 0) {
+        printf("MISMATCH idct %s against %s, case %d\n", levelNames[level],
+               levelNames[first], t);
+        return false;
+      }
+    }
+  }
+
+  // Rows get guard bytes after count pixels, a kernel must not write there
+  const int GUARD = 64;
+  for (int t = 0; t < 40000; t++) {
+    int count = random.range(1, 300);
+    int step = t & 1 ? 3 : 4;
+    std::vector<stbi_uc> y(count + GUARD), cb(count + GUARD),
+        cr(count + GUARD);
+    for (int i = 0; i < count + GUARD; i++) {
+      y[i] = (stbi_uc)random.next();
+      cb[i] = (stbi_uc)random.next();
+      cr[i] = (stbi_uc)random.next();
+    }
+    // The generic kernel stores alpha with every pixel, so 3 byte rows get
+    // one byte of 255 after the last pixel; nothing may write past that
+    std::vector<stbi_uc> out[LEVELS];
+    size_t bytes = (size_t)count * step;
+    for (int level = 0; level < LEVELS; level++) {
+      out[level].assign(count * 4 + GUARD, 7);
+      kernels[level].YCbCr_to_RGB_kernel(out[level].data(), y.data(),
+                                         cb.data(), cr.data(), count, step);
+      bool guarded = true;
+      for (size_t i = bytes + 1; i < out[level].size(); i++)
+        guarded = guarded && out[level][i] == 7;
+      if (!guarded ||
+          memcmp(out[level].data(), out[0].data(), bytes) != 0) {
+        printf("MISMATCH YCbCr %s, %d pixels of %d bytes\n",
+               levelNames[level], count, step);
+        return false;
+      }
+    }
+
+    int width = random.range(1, 300);
+    std::vector<stbi_uc> near(width + GUARD), far(width + GUARD);
+    for (int i = 0; i < width + GUARD; i++) {
+      near[i] = (stbi_uc)random.next();
+      far[i] = (stbi_uc)random.next();
+    }
+    for (int level = 0; level < LEVELS; level++) {
+      out[level].assign(width * 2 + GUARD, 7);
+      kernels[level].resample_row_hv_2_kernel(out[level].data(), near.data(),
+                                              far.data(), width, 2);
+      if (out[level] != out[0]) {
+        printf("MISMATCH resample hv 2 %s, width %d\n", levelNames[level],
+               width);
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+// Keeps the timed kernels' output alive
+volatile unsigned sink;
+
+// Output MB/s of each kernel at each level, best of 5
+void timeKernels(stbi__jpeg *kernels) {
+  Random random;
+  const int BLOCKS = 1 << 14, WIDTH = 1024, ROWS = 256;
+  std::vector<short> coefficients(64 * BLOCKS);
+  for (short &c : coefficients)
+    c = (short)random.range(-64, 64);
+  std::vector<stbi_uc> y(WIDTH + 64), cb(WIDTH + 64), cr(WIDTH + 64);
+  for (int i = 0; i < WIDTH + 64; i++) {
+    y[i] = (stbi_uc)random.next();
+    cb[i] = (stbi_uc)random.next();
+    cr[i] = (stbi_uc)random.next();
+  }
+  std::vector<stbi_uc> out(WIDTH * 4 + 64);
+  unsigned sum = 0;
+
+  printf("kernel     %-9s %-9s %-9s MB/s out\n", levelNames[0],
+         levelNames[1], levelNames[2]);
+  for (int kernel = 0; kernel < 3; kernel++) {
+    const char *names[] = {"idct", "YCbCr", "hv 2"};
+    printf("%-10s", names[kernel]);
+    for (int level = 0; level < LEVELS; level++) {
+      stbi__jpeg &k = kernels[level];
+      double best = 1e30, bytes = 0.0;
+      for (int run = 0; run < 5; run++) {
+        auto start = std::chrono::steady_clock::now();
+        if (kernel == 0) {
+          STBI_SIMD_ALIGN(short, data[64]);
+          for (int b = 0; b < BLOCKS; b++) {
+            memcpy(data, &coefficients[64 * b], sizeof(data));
+            k.idct_block_kernel(out.data(), 8, data);
+            sum += out[b & 63];
+          }
+          bytes = 64.0 * BLOCKS;
+        } else {
+          for (int row = 0; row < ROWS; row++) {
+            if (kernel == 1)
+              k.YCbCr_to_RGB_kernel(out.data(), y.data(), cb.data(),
+                                    cr.data(), WIDTH, 4);
+            else
+              k.resample_row_hv_2_kernel(out.data(), y.data(), cb.data(),
+                                         WIDTH / 2, 2);
+            sum += out[row];
+          }
+          bytes = (kernel == 1 ? 4.0 : 1.0) * WIDTH * ROWS;
+        }
+        best = std::min(best, seconds(start));
+      }
+      printf(" %-9.0f", bytes / best / 1e6);
+    }
+    printf("\n");
+  }
+  sink = sum;
+}
+
+// A JPEG of gradients under noise, so decodes see flat and busy blocks.
+// hSamp and vSamp are the luma sampling factors, chroma is always 1x1.
+std::vector<unsigned char> writeJpeg(int width, int height, int components,
+                                     int hSamp, int vSamp, bool progressive,
+                                     int quality, int restart) {
+  jpeg_compress_struct info;
+  jpeg_error_mgr errors;
+  info.err = jpeg_std_error(&errors);
+  jpeg_create_compress(&info);
+  unsigned char *buffer = NULL;
+  unsigned long size = 0;
+  jpeg_mem_dest(&info, &buffer, &size);
+  info.image_width = width;
+  info.image_height = height;
+  info.input_components = components;
+  info.in_color_space = components == 1 ? JCS_GRAYSCALE : JCS_RGB;
+  jpeg_set_defaults(&info);
+  jpeg_set_quality(&info, quality, TRUE);
+  if (components == 3) {
+    info.comp_info[0].h_samp_factor = hSamp;
+    info.comp_info[0].v_samp_factor = vSamp;
+  }
+  if (progressive)
+    jpeg_simple_progression(&info);
+  info.restart_interval = restart;
+  jpeg_start_compress(&info, TRUE);
+
+  Random random;
+  std::vector<unsigned char> row((size_t)width * components);
+  while (info.next_scanline < info.image_height) {
+    int y = info.next_scanline;
+    for (int x = 0; x < width; x++) {
+      for (int c = 0; c < components; c++)
+        row[x * components + c] = (unsigned char)(
+            x * 255 / width + y * (c + 1) + (random.next() & 31) + c * 80);
+    }
+    JSAMPROW rows[1] = {row.data()};
+    jpeg_write_scanlines(&info, rows, 1);
+  }
+  jpeg_finish_compress(&info);
+  std::vector<unsigned char> file(buffer, buffer + size);
+  free(buffer);
+  jpeg_destroy_compress(&info);
+  return file;
+}
+
+// Decodes of file at every level, scale and channel count against generic
+bool checkDecodes(const std::vector<unsigned char> &file, const char *name) {
+  for (int scaleLog2 = 0; scaleLog2 <= 3; scaleLog2++) {
+    for (int channels = 0; channels <= 4; channels++) {
+      if (channels == 1 || channels == 2)
+        continue;
+      std::vector<unsigned char> reference;
+      int refWidth = 0, refHeight = 0;
+      for (int level = 0; level < LEVELS; level++) {
+        int width, height, inFile;
+        stbi_set_jpeg_simd_level(level);
+        stbi_uc *pixels = stbi_load_from_memory_scaled(
+            file.data(), (int)file.size(), scaleLog2, &width, &height,
+            &inFile, channels);
+        stbi_set_jpeg_simd_level(2);
+        if (!pixels) {
+          printf("FAILED %s: %s\n", name, stbi_failure_reason());
+          return false;
+        }
+        size_t bytes =
+            (size_t)width * height * (channels ? channels : inFile);
+        if (level == 0) {
+          reference.assign(pixels, pixels + bytes);
+          refWidth = width;
+          refHeight = height;
+        } else if (width != refWidth || height != refHeight ||
+                   memcmp(pixels, reference.data(), bytes) != 0) {
+          printf("MISMATCH %s at %s, 1/%d scale, %d channels\n", name,
+                 levelNames[level], 1 << scaleLog2, channels);
+          stbi_image_free(pixels);
+          return false;
+        }
+        stbi_image_free(pixels);
+      }
+    }
+  }
+  return true;
+}
+
+int checkJpegKernels(const std::vector<const char *> &paths) {
+  stbi__jpeg *kernels = new stbi__jpeg[LEVELS];
+  for (int level = 0; level < LEVELS; level++)
+    kernelsAt(level, kernels[level]);
+  bool ok = checkKernels(kernels);
+  if (ok)
+    timeKernels(kernels);
+  delete[] kernels;
+  if (!ok)
+    return 1;
+
+  // Greyscale, 4:4:4, 4:2:2, 4:4:0 and 4:2:0, baseline and progressive, at
+  // sizes that leave partial blocks and MCUs
+  const int sizes[][2] = {{1, 1}, {7, 5}, {16, 16}, {33, 17}, {250, 131}};
+  const int sampling[][3] = {{1, 1, 1}, {3, 1, 1}, {3, 2, 1}, {3, 1, 2},
+                             {3, 2, 2}};
+  int images = 0;
+  for (const auto &size : sizes) {
+    for (const auto &s : sampling) {
+      for (int progressive = 0; progressive < 2; progressive++) {
+        for (int quality : {50, 95, 100}) {
+          int restart = quality == 95 ? 2 : 0;
+          std::vector<unsigned char> file =
+              writeJpeg(size[0], size[1], s[0], s[1], s[2], progressive != 0,
+                        quality, restart);
+          char name[96];
+          snprintf(name, sizeof(name), "%dx%d %dc %dx%d%s q%d", size[0],
+                   size[1], s[0], s[1], s[2], progressive ? " progressive" : "",
+                   quality);
+          if (!checkDecodes(file, name))
+            return 1;
+          images++;
+        }
+      }
+    }
+  }
+  for (const char *path : paths) {
+    std::vector<unsigned char> file;
+    if (!readFile(path, file)) {
+      printf("FAILED %s: cannot read file\n", path);
+      return 1;
+    }
+    if (!checkDecodes(file, path))
+      return 1;
+    images++;
+  }
+  printf("jpeg kernels: %d images identical at every level\n", images);
+  return 0;
+}
+
+// PNGs go through memory both ways
+struct PngBuffer {
+  std::vector<unsigned char> *bytes;
+  size_t at;
+};
+
+void writePngBytes(png_structp png, png_bytep data, png_size_t size) {
+  PngBuffer *buffer = (PngBuffer *)png_get_io_ptr(png);
+  buffer->bytes->insert(buffer->bytes->end(), data, data + size);
+}
+
+void flushPng(png_structp) {}
+
+void readPngBytes(png_structp png, png_bytep data, png_size_t size) {
+  PngBuffer *buffer = (PngBuffer *)png_get_io_ptr(png);
+  if (buffer->bytes->size() - buffer->at < size)
+    png_error(png, "truncated");
+  memcpy(data, buffer->bytes->data() + buffer->at, size);
+  buffer->at += size;
+}
+
+// How a generated PNG is laid out and compressed
+struct PngLayout {
+  int width, height;
+  int colorType, depth;
+  bool transparent; // tRNS chunk, on grey, RGB and palette images
+  bool interlaced;
+  int filters;     // PNG_FILTER_* mask
+  int compression; // index into the zlib settings below
+};
+
+int samplesPerPixel(int colorType) {
+  switch (colorType) {
+  case PNG_COLOR_TYPE_GRAY_ALPHA:
+    return 2;
+  case PNG_COLOR_TYPE_RGB:
+    return 3;
+  case PNG_COLOR_TYPE_RGB_ALPHA:
+    return 4;
+  default:
+    return 1;
+  }
+}
+
+// Runs of repeated samples between rows of noise, so inflate sees long and
+// short matches as well as literals, and each filter sees both
+std::vector<unsigned char> writePng(const PngLayout &layout) {
+  // Stored, default, filtered, Huffman only, RLE and fixed codes, the odd
+  // ones with IDATs split every 100 bytes
+  const int levels[] = {0, 6, 9, 1, 9, 6};
+  const int strategies[] = {Z_DEFAULT_STRATEGY, Z_DEFAULT_STRATEGY,
+                            Z_FILTERED,         Z_HUFFMAN_ONLY,
+                            Z_RLE,              Z_FIXED};
+  std::vector<unsigned char> file;
+  PngBuffer buffer = {&file, 0};
+  png_structp png =
+      png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+  png_infop info = png_create_info_struct(png);
+  if (setjmp(png_jmpbuf(png))) {
+    png_destroy_write_struct(&png, &info);
+    file.clear();
+    return file;
+  }
+  png_set_write_fn(png, &buffer, writePngBytes, flushPng);
+  png_set_IHDR(png, info, layout.width, layout.height, layout.depth,
+               layout.colorType,
+               layout.interlaced ? PNG_INTERLACE_ADAM7 : PNG_INTERLACE_NONE,
+               PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+  png_set_filter(png, PNG_FILTER_TYPE_BASE, layout.filters);
+  png_set_compression_level(png, levels[layout.compression]);
+  png_set_compression_strategy(png, strategies[layout.compression]);
+  if (layout.compression & 1)
+    png_set_compression_buffer_size(png, 100);
+
+  int samples = samplesPerPixel(layout.colorType);
+  int maxSample = (1 << layout.depth) - 1;
+  Random random;
+  std::vector<int> values((size_t)layout.width * layout.height * samples);
+  for (int y = 0; y < layout.height; y++) {
+    for (int x = 0; x < layout.width * samples; x++) {
+      int value = (y >> 2) & 1 ? (int)random.next()
+                               : (x / (5 * samples) + y / 2 + x % samples) * 7;
+      values[(size_t)y * layout.width * samples + x] = value & maxSample;
+    }
+  }
+
+  png_color palette[256];
+  png_byte alphas[256];
+  png_color_16 key = {};
+  if (layout.colorType == PNG_COLOR_TYPE_PALETTE) {
+    for (int i = 0; i <= maxSample; i++) {
+      palette[i].red = (png_byte)(i * 3);
+      palette[i].green = (png_byte)(255 - i);
+      palette[i].blue = (png_byte)(i * 7);
+      alphas[i] = (png_byte)(i * 17);
+    }
+    png_set_PLTE(png, info, palette, maxSample + 1);
+    if (layout.transparent)
+      png_set_tRNS(png, info, alphas, std::min(maxSample + 1, 16), NULL);
+  } else if (layout.transparent) {
+    // The first pixel's colour, which the runs repeat
+    key.gray = (png_uint_16)values[0];
+    key.red = (png_uint_16)values[0];
+    key.green = (png_uint_16)values[std::min(1, (int)values.size() - 1)];
+    key.blue = (png_uint_16)values[std::min(2, (int)values.size() - 1)];
+    png_set_tRNS(png, info, NULL, 0, &key);
+  }
+  png_write_info(png, info);
+
+  // Pack samples into rows, most significant bits first
+  size_t rowBytes = ((size_t)layout.width * samples * layout.depth + 7) / 8;
+  std::vector<unsigned char> rows(rowBytes * layout.height);
+  std::vector<png_bytep> rowPointers(layout.height);
+  for (int y = 0; y < layout.height; y++) {
+    unsigned char *row = &rows[rowBytes * y];
+    rowPointers[y] = row;
+    for (int x = 0; x < layout.width * samples; x++) {
+      int value = values[(size_t)y * layout.width * samples + x];
+      if (layout.depth == 16) {
+        row[x * 2] = (unsigned char)(value >> 8);
+        row[x * 2 + 1] = (unsigned char)value;
+      } else {
+        int bit = x * layout.depth;
+        row[bit / 8] |= (unsigned char)(value << (8 - layout.depth - bit % 8));
+      }
+    }
+  }
+  png_write_image(png, rowPointers.data());
+  png_write_end(png, info);
+  png_destroy_write_struct(&png, &info);
+  return file;
+}
+
+// libpng's decode of file, expanded the way stb expands it: palettes and
+// tRNS to RGB(A), low bit depths to 8 and 16 bit samples cut to their high
+// byte unless sixteen asks for them in host order
+bool referencePng(std::vector<unsigned char> &file, bool sixteen,
+                  std::vector<unsigned char> &pixels, int &width,
+                  int &height, int &channels, int &depth) {
+  PngBuffer buffer = {&file, 0};
+  png_structp png =
+      png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+  png_infop info = png_create_info_struct(png);
+  if (setjmp(png_jmpbuf(png))) {
+    png_destroy_read_struct(&png, &info, NULL);
+    return false;
+  }
+  png_set_read_fn(png, &buffer, readPngBytes);
+  png_read_info(png, info);
+  depth = png_get_bit_depth(png, info);
+  png_set_expand(png);
+  if (depth == 16 && !sixteen)
+    png_set_strip_16(png);
+  uint16_t one = 1;
+  if (depth == 16 && sixteen && *(unsigned char *)&one)
+    png_set_swap(png);
+  png_set_interlace_handling(png);
+  png_read_update_info(png, info);
+  width = (int)png_get_image_width(png, info);
+  height = (int)png_get_image_height(png, info);
+  channels = png_get_channels(png, info);
+  size_t rowBytes = png_get_rowbytes(png, info);
+  pixels.assign(rowBytes * height, 0);
+  std::vector<png_bytep> rows(height);
+  for (int y = 0; y < height; y++)
+    rows[y] = &pixels[rowBytes * y];
+  png_read_image(png, rows.data());
+  png_read_end(png, NULL);
+  png_destroy_read_struct(&png, &info, NULL);
+  return true;
+}
+
+// stb's 8-bit decode, 16-bit decode of 16-bit files, and the decodes that
+// add an opaque alpha channel while unfiltering, against libpng. Files
+// libpng rejects are skipped, true if they were.
+bool checkPng(std::vector<unsigned char> &file, const char *name,
+              bool &skipped) {
+  skipped = false;
+  for (int sixteen = 0; sixteen < 2; sixteen++) {
+    std::vector<unsigned char> reference;
+    int refWidth, refHeight, refChannels, depth;
+    if (!referencePng(file, sixteen != 0, reference, refWidth, refHeight,
+                      refChannels, depth)) {
+      skipped = true;
+      return true;
+    }
+    if (sixteen && depth != 16)
+      return true;
+    int bytesPerSample = sixteen ? 2 : 1;
+
+    // Without tRNS the grey and RGB images also load with alpha added
+    bool addAlpha = refChannels == 1 || refChannels == 3;
+    for (int extra = 0; extra <= (addAlpha ? 1 : 0); extra++) {
+      int wanted = extra ? refChannels + 1 : 0;
+      int width, height, channels;
+      void *pixels =
+          sixteen ? (void *)stbi_load_16_from_memory(
+                        file.data(), (int)file.size(), &width, &height,
+                        &channels, wanted)
+                  : (void *)stbi_load_from_memory(file.data(),
+                                                  (int)file.size(), &width,
+                                                  &height, &channels, wanted);
+      if (!pixels) {
+        printf("FAILED %s: %s\n", name, stbi_failure_reason());
+        return false;
+      }
+      int outChannels = wanted ? wanted : channels;
+      std::vector<unsigned char> expected = reference;
+      if (extra) {
+        // libpng's pixels with an opaque sample after each one
+        size_t pixelBytes = (size_t)refChannels * bytesPerSample;
+        expected.clear();
+        for (size_t at = 0; at < reference.size(); at += pixelBytes) {
+          expected.insert(expected.end(), &reference[at],
+                          &reference[at] + pixelBytes);
+          expected.insert(expected.end(), bytesPerSample, 0xff);
+        }
+      }
+      bool same = width == refWidth && height == refHeight &&
+                  outChannels == refChannels + extra &&
+                  memcmp(pixels, expected.data(), expected.size()) == 0;
+      stbi_image_free(pixels);
+      if (!same) {
+        printf("MISMATCH %s, %s bit output, %d channels\n", name,
+               sixteen ? "16" : "8", outChannels);
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+int checkPngs(const std::vector<const char *> &paths) {
+  // Every colour type at every bit depth it allows, with and without tRNS
+  // where it can have one
+  const int formats[][2] = {
+      {PNG_COLOR_TYPE_GRAY, 1},       {PNG_COLOR_TYPE_GRAY, 2},
+      {PNG_COLOR_TYPE_GRAY, 4},       {PNG_COLOR_TYPE_GRAY, 8},
+      {PNG_COLOR_TYPE_GRAY, 16},      {PNG_COLOR_TYPE_RGB, 8},
+      {PNG_COLOR_TYPE_RGB, 16},       {PNG_COLOR_TYPE_PALETTE, 1},
+      {PNG_COLOR_TYPE_PALETTE, 2},    {PNG_COLOR_TYPE_PALETTE, 4},
+      {PNG_COLOR_TYPE_PALETTE, 8},    {PNG_COLOR_TYPE_GRAY_ALPHA, 8},
+      {PNG_COLOR_TYPE_GRAY_ALPHA, 16}, {PNG_COLOR_TYPE_RGB_ALPHA, 8},
+      {PNG_COLOR_TYPE_RGB_ALPHA, 16}};
+  const int filters[] = {PNG_FILTER_NONE, PNG_FILTER_SUB, PNG_FILTER_UP,
+                         PNG_FILTER_AVG,  PNG_FILTER_PAETH, PNG_ALL_FILTERS};
+  const int sizes[][2] = {{1, 1}, {5, 3}, {33, 17}, {257, 40}};
+  int images = 0, variant = 0;
+  for (const auto &format : formats) {
+    bool keyed = (format[0] & PNG_COLOR_MASK_ALPHA) == 0;
+    for (int transparent = 0; transparent <= (keyed ? 1 : 0); transparent++) {
+      for (int interlaced = 0; interlaced < 2; interlaced++) {
+        for (int filter : filters) {
+          for (const auto &size : sizes) {
+            PngLayout layout = {size[0],        size[1],
+                                format[0],      format[1],
+                                transparent != 0, interlaced != 0,
+                                filter,         variant++ % 6};
+            std::vector<unsigned char> file = writePng(layout);
+            char name[96];
+            snprintf(name, sizeof(name),
+                     "%dx%d type %d depth %d%s%s filters %x zlib %d",
+                     size[0], size[1], format[0], format[1],
+                     transparent ? " tRNS" : "",
+                     interlaced ? " interlaced" : "", filter,
+                     layout.compression);
+            bool skipped;
+            if (file.empty() || !checkPng(file, name, skipped) || skipped) {
+              printf("FAILED %s\n", name);
+              return 1;
+            }
+            images++;
+          }
+        }
+      }
+    }
+  }
+  int skippedFiles = 0;
+  for (const char *path : paths) {
+    std::vector<unsigned char> file;
+    if (!readFile(path, file)) {
+      printf("FAILED %s: cannot read file\n", path);
+      return 1;
+    }
+    bool skipped;
+    if (!checkPng(file, path, skipped))
+      return 1;
+    if (skipped)
+      skippedFiles++;
+    else
+      images++;
+  }
+  printf("png: %d images identical to libpng", images);
+  if (skippedFiles)
+    printf(", %d files libpng rejects skipped", skippedFiles);
+  printf("\n");
+  return 0;
+}
+
+// stbi_load_into_from_memory with exactly the output and scratch that
+// stbi_decode_sizes_from_memory asks for, which must not touch the heap
+// and must decode what stbi_load_from_memory does
+bool checkIntoAllocs(std::vector<unsigned char> &file, const char *name,
+                     bool &skipped) {
+  skipped = false;
+  for (int flip = 0; flip < 2; flip++) {
+    for (int wanted : {0, 3, 4}) {
+      int width, height, channels;
+      size_t outputBytes, scratchBytes;
+      if (!stbi_decode_sizes_from_memory(file.data(), (int)file.size(),
+                                         wanted, &width, &height, &channels,
+                                         &outputBytes, &scratchBytes)) {
+        skipped = true;
+        return true;
+      }
+      stbi_set_flip_vertically_on_load(flip);
+      std::vector<unsigned char> output(outputBytes), scratch(scratchBytes);
+      unsigned long before = heapAllocations;
+      int loaded = stbi_load_into_from_memory(
+          file.data(), (int)file.size(), &width, &height, &channels, wanted,
+          output.data(), output.size(), scratch.data(), scratch.size());
+      unsigned long allocations = heapAllocations - before;
+      int refWidth, refHeight, refChannels;
+      stbi_uc *reference =
+          stbi_load_from_memory(file.data(), (int)file.size(), &refWidth,
+                                &refHeight, &refChannels, wanted);
+      stbi_set_flip_vertically_on_load(0);
+      bool same = loaded && reference && width == refWidth &&
+                  height == refHeight &&
+                  memcmp(output.data(), reference, outputBytes) == 0;
+      stbi_image_free(reference);
+      if (!same || allocations) {
+        printf("%s %s, %d channels%s: %lu allocations with %zu bytes of "
+               "scratch\n",
+               same ? "ALLOCATED" : "MISMATCH", name, wanted,
+               flip ? " flipped" : "", allocations, scratchBytes);
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+int checkAllocs(const std::vector<const char *> &paths) {
+  int images = 0;
+  const int sampling[][3] = {{1, 1, 1}, {3, 1, 1}, {3, 2, 1}, {3, 1, 2},
+                             {3, 2, 2}};
+  for (const auto &s : sampling) {
+    for (int progressive = 0; progressive < 2; progressive++) {
+      for (int restart : {0, 2}) {
+        std::vector<unsigned char> file =
+            writeJpeg(250, 131, s[0], s[1], s[2], progressive != 0, 90,
+                      restart);
+        char name[96];
+        snprintf(name, sizeof(name), "jpeg %dc %dx%d%s restart %d", s[0],
+                 s[1], s[2], progressive ? " progressive" : "", restart);
+        bool skipped;
+        if (!checkIntoAllocs(file, name, skipped) || skipped) {
+          printf("FAILED %s\n", name);
+          return 1;
+        }
+        images++;
+      }
+    }
+  }
+  const int formats[][2] = {
+      {PNG_COLOR_TYPE_GRAY, 1},       {PNG_COLOR_TYPE_GRAY, 8},
+      {PNG_COLOR_TYPE_GRAY, 16},      {PNG_COLOR_TYPE_RGB, 8},
+      {PNG_COLOR_TYPE_RGB, 16},       {PNG_COLOR_TYPE_PALETTE, 2},
+      {PNG_COLOR_TYPE_PALETTE, 8},    {PNG_COLOR_TYPE_GRAY_ALPHA, 8},
+      {PNG_COLOR_TYPE_GRAY_ALPHA, 16}, {PNG_COLOR_TYPE_RGB_ALPHA, 8},
+      {PNG_COLOR_TYPE_RGB_ALPHA, 16}};
+  int variant = 0;
+  for (const auto &format : formats) {
+    for (int interlaced = 0; interlaced < 2; interlaced++) {
+      bool keyed = (format[0] & PNG_COLOR_MASK_ALPHA) == 0;
+      PngLayout layout = {257,       40,     format[0],       format[1],
+                          keyed,     interlaced != 0, PNG_ALL_FILTERS,
+                          variant++ % 6};
+      std::vector<unsigned char> file = writePng(layout);
+      char name[96];
+      snprintf(name, sizeof(name), "png type %d depth %d%s", format[0],
+               format[1], interlaced ? " interlaced" : "");
+      bool skipped;
+      if (file.empty() || !checkIntoAllocs(file, name, skipped) || skipped) {
+        printf("FAILED %s\n", name);
+        return 1;
+      }
+      images++;
+    }
+  }
+  int skippedFiles = 0;
+  for (const char *path : paths) {
+    std::vector<unsigned char> file;
+    if (!readFile(path, file)) {
+      printf("FAILED %s: cannot read file\n", path);
+      return 1;
+    }
+    bool skipped;
+    if (!checkIntoAllocs(file, path, skipped))
+      return 1;
+    if (skipped)
+      skippedFiles++;
+    else
+      images++;
+  }
+  printf("alloc: %d images decoded into their reported sizes without "
+         "allocating",
+         images);
+  if (skippedFiles)
+    printf(", %d files stb cannot size skipped", skippedFiles);
+  printf("\n");
+  return 0;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  if (argc >= 2 && strcmp(argv[1], "--jpeg-kernels") == 0)
+    return checkJpegKernels(std::vector<const char *>(argv + 2, argv + argc));
+  if (argc >= 2 && strcmp(argv[1], "--png") == 0)
+    return checkPngs(std::vector<const char *>(argv + 2, argv + argc));
+  if (argc >= 2 && strcmp(argv[1], "--alloc") == 0)
+    return checkAllocs(std::vector<const char *>(argv + 2, argv + argc));
+  std::cout << "Usage: " << argv[0]
+            << " --jpeg-kernels [FILE...] | --png [FILE...] | --alloc [FILE...]"
+            << std::endl;
+  return 1;
+}
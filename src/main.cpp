@@ -1,5 +1,19 @@
 #include "../include/glad/glad.h"
 #include "../include/Shader.h"
+#include "../include/ProgramCache.h"
+#include "../include/ShaderBatch.h"
+#include "../include/GLHandle.h"
+#include "../include/GLState.h"
+#include "../include/UniformRing.h"
+#include "../include/InstanceArray.h"
+#include "../include/Profiler.h"
+#include "../include/ThreadPool.h"
+#include "../include/StagingRing.h"
+#include "../include/TextureLoader.h"
+#include "../include/TextureAtlas.h"
+#include "../include/ImageScan.h"
+#include "../include/MipChain.h"
+#include "../include/BlockCompress.h"
 #include "../include/stb_image.h"
 #include "../include/glm/glm.hpp"
 #include "../include/glm/gtc/matrix_transform.hpp"
@@ -7,6 +21,13 @@
 #include <GLFW/glfw3.h>
 #include <iostream>
 #include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <vector>
 
 // Callback function to adjust the viewport if the GLFW window is resized
 void framebuffer_size_callback(GLFWwindow* window, int width, int height);
@@ -14,9 +35,61 @@ void framebuffer_size_callback(GLFWwindow* window, int width, int height);
 // Process input in the window 
 void processInput(GLFWwindow* window);
 
+// Command line options
+struct Options
+{
+  int instances = 0;         // --instances N: draw N instanced quads instead of one
+  bool benchmark = false;    // --bench: scale the instance count and report frame times
+  int benchFrames = 200;     // --bench-frames N: frames timed per instance count
+  int maxInstances = 65536;  // --max-instances N: largest count the benchmark tries
+  bool headless = false;     // --headless: invisible window, render into an FBO
+  int width = 800;           // --width N
+  int height = 600;          // --height N
+  int frames = 0;            // --frames N: exit after N frames, 0 runs until closed
+  bool profile = false;      // --profile: print per-scope CPU and GPU timings on exit
+  const char* trace = NULL;  // --trace FILE: write a Chrome trace of every scope
+  bool staging = true;       // --no-pbo: upload textures straight from client memory
+  bool driverMips = false;   // --driver-mips: glGenerateMipmap instead of mips built on the decode threads
+  bool compress = false;     // --compress fast|high: BC1/BC3 encode textures when S3TC is available
+  BlockQuality compressQuality = BLOCK_FAST;
+  const char* bcBench = NULL; // --bc-bench FILE: time the block encoder on an image and exit
+  bool baked = false;        // --baked: map the .htex containers from `make baked` instead of decoding images
+  bool stream = false;       // --stream: decode the quad's images on the GL thread and upload them band by band
+  int sprites = 0;           // --sprites N: draw N quads showing different images from one texture atlas
+  std::vector<const char*> decodeBench; // --decode-bench FILE: time decoding with each level of SIMD kernels, on a thread pool, at reduced sizes and into reused buffers and exit, repeatable
+  const char* scan = NULL;   // --scan DIR: read the header of every image under DIR, time it against stbi_info and exit
+};
+
+bool parseOptions(int argc, char** argv, Options& options);
+
+// Create the scene and run the render loop. Every GL object is owned by a
+// handle local to this function, so all of them are deleted before
+// glfwTerminate destroys the context.
+int runScene(GLFWwindow* window, const Options& options);
+
+// Print min/avg/percentile frame times for a run
+void printFrameStats(std::vector<double> frameMs);
+
+// Rebuild the per-instance stream into a freshly orphaned buffer and draw
+// every instance with one call
+void drawInstances(GLStateCache& state, GLuint instanceVBO, InstanceArray& instances, float dt);
+
+// Encode an image with each block compression preset, single threaded and
+// on a thread pool, and print the throughput and PSNR of each
+int runCompressionBenchmark(const char* path);
+
+// Print the profiler's scope table and write its trace, as the options ask
+void reportProfile(Profiler& profiler, const Options& options);
+
 void framebuffer_size_callback(GLFWwindow* window, int width, int height)
 {
-  glViewport(0, 0, width, height);
+  // While a scene runs its state cache has to see the new viewport, or a
+  // later viewport call back to the old size would be filtered out
+  GLStateCache* state = (GLStateCache*)glfwGetWindowUserPointer(window);
+  if (state)
+    state->viewport(0, 0, width, height);
+  else
+    glViewport(0, 0, width, height);
 }
 
 void processInput(GLFWwindow* window)
@@ -27,17 +100,458 @@ void processInput(GLFWwindow* window)
   }
 }
 
-int main()
+// The largest framebuffer GL 3.3 drivers commonly allow
+const int MAX_WINDOW_SIZE = 16384;
+
+// Counts size buffers and divide frame times, so anything but a whole
+// number from min to max falls through to the usage message
+bool parseCount(const char* text, int& value, int min = 1, int max = 1 << 24)
+{
+  char* end;
+  long count = strtol(text, &end, 10);
+  if (end == text || *end != '\0' || count < min || count > max)
+    return false;
+  value = (int)count;
+  return true;
+}
+
+// Only the two names the usage message lists
+bool parseQuality(const char* text, BlockQuality& quality)
+{
+  if (strcmp(text, "fast") == 0)
+    quality = BLOCK_FAST;
+  else if (strcmp(text, "high") == 0)
+    quality = BLOCK_HIGH;
+  else
+    return false;
+  return true;
+}
+
+bool parseOptions(int argc, char** argv, Options& options)
+{
+  for (int i = 1; i < argc; i++)
+  {
+    bool hasValue = i + 1 < argc;
+    if (strcmp(argv[i], "--bench") == 0)
+      options.benchmark = true;
+    else if (strcmp(argv[i], "--instances") == 0 && hasValue && parseCount(argv[i + 1], options.instances))
+      i++;
+    else if (strcmp(argv[i], "--bench-frames") == 0 && hasValue && parseCount(argv[i + 1], options.benchFrames))
+      i++;
+    else if (strcmp(argv[i], "--max-instances") == 0 && hasValue && parseCount(argv[i + 1], options.maxInstances))
+      i++;
+    else if (strcmp(argv[i], "--headless") == 0)
+      options.headless = true;
+    else if (strcmp(argv[i], "--width") == 0 && hasValue && parseCount(argv[i + 1], options.width, 1, MAX_WINDOW_SIZE))
+      i++;
+    else if (strcmp(argv[i], "--height") == 0 && hasValue && parseCount(argv[i + 1], options.height, 1, MAX_WINDOW_SIZE))
+      i++;
+    else if (strcmp(argv[i], "--frames") == 0 && hasValue && parseCount(argv[i + 1], options.frames, 0))
+      i++;
+    else if (strcmp(argv[i], "--profile") == 0)
+      options.profile = true;
+    else if (strcmp(argv[i], "--trace") == 0 && hasValue)
+      options.trace = argv[++i];
+    else if (strcmp(argv[i], "--no-pbo") == 0)
+      options.staging = false;
+    else if (strcmp(argv[i], "--driver-mips") == 0)
+      options.driverMips = true;
+    else if (strcmp(argv[i], "--compress") == 0 && hasValue && parseQuality(argv[i + 1], options.compressQuality))
+    {
+      options.compress = true;
+      i++;
+    }
+    else if (strcmp(argv[i], "--bc-bench") == 0 && hasValue)
+      options.bcBench = argv[++i];
+    else if (strcmp(argv[i], "--baked") == 0)
+      options.baked = true;
+    else if (strcmp(argv[i], "--stream") == 0)
+      options.stream = true;
+    else if (strcmp(argv[i], "--sprites") == 0 && hasValue && parseCount(argv[i + 1], options.sprites))
+      i++;
+    else if (strcmp(argv[i], "--decode-bench") == 0 && hasValue)
+      options.decodeBench.push_back(argv[++i]);
+    else if (strcmp(argv[i], "--scan") == 0 && hasValue)
+      options.scan = argv[++i];
+    else
+    {
+      std::cout << "Usage: " << argv[0] << " [--instances N] [--bench] [--bench-frames N] [--max-instances N]"
+                << " [--headless] [--width N] [--height N] [--frames N] [--profile] [--trace FILE] [--no-pbo] [--driver-mips]"
+                << " [--compress fast|high] [--bc-bench FILE] [--baked] [--stream] [--sprites N] [--decode-bench FILE] [--scan DIR]" << std::endl;
+      return false;
+    }
+  }
+  if (options.width <= 0 || options.height <= 0)
+  {
+    std::cout << "Width and height must be positive" << std::endl;
+    return false;
+  }
+  // A headless run that never ends is not useful on a build machine
+  if (options.headless && options.frames <= 0)
+    options.frames = 300;
+  return true;
+}
+
+void printFrameStats(std::vector<double> frameMs)
+{
+  if (frameMs.empty())
+    return;
+  std::sort(frameMs.begin(), frameMs.end());
+  double total = 0.0;
+  for (double ms : frameMs)
+    total += ms;
+  size_t n = frameMs.size();
+  auto percentile = [&](double p) { return frameMs[std::min(n - 1, (size_t)(p * n))]; };
+  printf("frames %zu  total %.1f ms  avg %.3f ms  min %.3f  p50 %.3f  p99 %.3f  max %.3f ms  (%.1f fps)\n",
+         n, total, total / n, frameMs.front(), percentile(0.50), percentile(0.99), frameMs.back(), n * 1000.0 / total);
+}
+
+void drawInstances(GLStateCache& state, GLuint instanceVBO, InstanceArray& instances, float dt)
+{
+  GLsizeiptr bytes = instances.size() * InstanceArray::STRIDE * sizeof(float);
+  state.bindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+  // Orphan last frame's storage so mapping never waits on the GPU
+  glBufferData(GL_ARRAY_BUFFER, bytes, NULL, GL_STREAM_DRAW);
+  float* stream = (float*)glMapBufferRange(GL_ARRAY_BUFFER, 0, bytes, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+  if (stream == NULL)
+    return;
+  {
+    PROFILE_SCOPE("rebuild instances");
+    instances.rebuild(dt, stream);
+  }
+  glUnmapBuffer(GL_ARRAY_BUFFER);
+  glDrawElementsInstanced(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0, (GLsizei)instances.size());
+}
+
+// The sprite atlas holds both textures at several smaller sizes and cut into
+// 128x128 tiles, standing in for a set of distinct small images. Returns how
+// many were added.
+int addSpriteImages(TextureAtlas& atlas)
+{
+  const char* paths[] = { "../assets/container.jpg", "../assets/awesomeface.png" };
+  const bool flips[] = { false, true };
+  int added = 0;
+  for (int i = 0; i < 2; i++)
+  {
+    int width, height, channels;
+    stbi_decoder decoder;
+    stbi_decoder_init(&decoder);
+    decoder.flip_vertically = flips[i];
+    unsigned char* pixels = stbi_decoder_load(&decoder, paths[i], &width, &height, &channels, 4);
+    if (pixels == NULL)
+    {
+      std::cout << "Failed to load " << paths[i] << ": " << decoder.failure_reason << std::endl;
+      continue;
+    }
+    int levels = std::min(6, mipLevelCount(width, height));
+    std::vector<unsigned char> chain(mipChainBytes(width, height, 4, levels));
+    memcpy(chain.data(), pixels, (size_t)width * height * 4);
+    stbi_decoder_free(&decoder, pixels);
+    buildMipChain(chain.data(), width, height, 4, levels);
+    const int TILE = 128;
+    for (int y = 0; y + TILE <= height; y += TILE)
+    {
+      for (int x = 0; x + TILE <= width; x += TILE)
+      {
+        std::vector<unsigned char> tile((size_t)TILE * TILE * 4);
+        for (int row = 0; row < TILE; row++)
+          memcpy(&tile[(size_t)row * TILE * 4], &chain[((size_t)(y + row) * width + x) * 4], TILE * 4);
+        if (atlas.add(tile.data(), TILE, TILE) >= 0)
+          added++;
+      }
+    }
+    size_t offset = (size_t)width * height * 4;
+    for (int level = 1; level < levels; level++)
+    {
+      int w = mipWidth(width, level), h = mipWidth(height, level);
+      if (atlas.add(chain.data() + offset, w, h) >= 0)
+        added++;
+      offset += (size_t)w * h * 4;
+    }
+  }
+  return added;
+}
+
+int runCompressionBenchmark(const char* path)
+{
+  int width, height, channels;
+  unsigned char* pixels = stbi_load(path, &width, &height, &channels, 0);
+  if (pixels == NULL)
+  {
+    std::cout << "Failed to load " << path << ": " << stbi_failure_reason() << std::endl;
+    return -1;
+  }
+
+  BlockFormat format = blockFormatFor(channels);
+  // PSNR over the channels the format keeps
+  int compared = format == BLOCK_BC3 ? 4 : std::min(channels, 3);
+  std::vector<unsigned char> blocks(blockCompressedBytes(width, height, format));
+  std::vector<unsigned char> decoded((size_t)width * height * 4);
+  int blockRows = (height + 3) / 4;
+  ThreadPool pool;
+
+  printf("%s: %dx%d, %d channels, %s\n", path, width, height, channels, format == BLOCK_BC1 ? "BC1" : "BC3");
+  printf("quality  threads  ms        MPixels/s  PSNR dB\n");
+  std::vector<unsigned int> threadCounts = { 1 };
+  if (pool.size() > 1)
+    threadCounts.push_back(pool.size());
+  const BlockQuality qualities[] = { BLOCK_FAST, BLOCK_HIGH };
+  for (BlockQuality quality : qualities)
+  {
+    for (unsigned int threads : threadCounts)
+    {
+      // Best of a few runs, bands of block rows spread over the pool
+      double best = 1e30;
+      for (int run = 0; run < 3; run++)
+      {
+        // GLFW is not initialised here, so no glfwGetTime
+        auto start = std::chrono::steady_clock::now();
+        int band = std::max(1, blockRows / (int)(threads * 4));
+        for (int row = 0; row < blockRows; row += band)
+        {
+          int last = std::min(blockRows, row + band);
+          auto job = [&, row, last]() {
+            compressBlockRows(pixels, width, height, channels, format, quality, row, last, blocks.data());
+          };
+          if (threads == 1)
+            job();
+          else
+            pool.submit(job);
+        }
+        pool.wait();
+        best = std::min(best, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+      }
+
+      decompressBlocks(blocks.data(), width, height, format, decoded.data());
+      double squared = 0.0;
+      for (size_t i = 0; i < (size_t)width * height; i++)
+      {
+        for (int c = 0; c < compared; c++)
+        {
+          double d = (double)pixels[i * channels + c] - decoded[i * 4 + c];
+          squared += d * d;
+        }
+      }
+      double mse = squared / ((double)width * height * compared);
+      double psnr = mse > 0.0 ? 10.0 * std::log10(255.0 * 255.0 / mse) : 99.0;
+      printf("%-7s  %7u  %8.2f  %9.2f  %7.2f\n", quality == BLOCK_FAST ? "fast" : "high", threads,
+             best * 1000.0, width * height / best / 1e6, psnr);
+    }
+  }
+  stbi_image_free(pixels);
+  return 0;
+}
+
+// stb_image's parallel-for, on the ThreadPool passed as user
+void stbiParallelFor(void* user, int count, void (*task)(void* arg, int index), void* arg)
+{
+  static_cast<ThreadPool*>(user)->parallelFor(count, [task, arg](int index) { task(arg, index); });
+}
+
+// Points stb_image's parallel-for at a pool and clears it again on the way
+// out of the scope, which has to end before the pool's does
+struct StbiParallelForScope
+{
+  explicit StbiParallelForScope(ThreadPool& pool) { stbi_set_parallel_for(stbiParallelFor, &pool); }
+  ~StbiParallelForScope() { stbi_set_parallel_for(NULL, NULL); }
+};
+
+int runDecodeBenchmark(const std::vector<const char*>& paths)
+{
+  // Files are read once, decoding from memory keeps the disk out of it
+  std::vector<std::vector<unsigned char>> files;
+  for (const char* path : paths)
+  {
+    FILE* file = fopen(path, "rb");
+    if (file == NULL)
+    {
+      std::cout << "Failed to open " << path << std::endl;
+      return -1;
+    }
+    std::vector<unsigned char> bytes;
+    unsigned char chunk[65536];
+    size_t read;
+    while ((read = fread(chunk, 1, sizeof(chunk), file)) > 0)
+      bytes.insert(bytes.end(), chunk, chunk + read);
+    fclose(file);
+    files.push_back(bytes);
+  }
+
+  // Best of 5 runs over every file, pixels and bytes are of the output
+  auto timeDecodes = [&files](int scaleLog2, double& pixels, double& bytes)
+  {
+    double best = 1e30;
+    for (int run = 0; run < 5; run++)
+    {
+      pixels = bytes = 0.0;
+      auto start = std::chrono::steady_clock::now();
+      for (const std::vector<unsigned char>& file : files)
+      {
+        int width, height, channels;
+        unsigned char* image = stbi_load_from_memory_scaled(file.data(), (int)file.size(), scaleLog2, &width, &height, &channels, 0);
+        if (image == NULL)
+          continue;
+        pixels += (double)width * height;
+        bytes += (double)width * height * channels;
+        stbi_image_free(image);
+      }
+      best = std::min(best, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    }
+    return best;
+  };
+
+  // Only JPEG decoding has SIMD kernels, other formats time the same at
+  // every level. Levels the CPU lacks fall back to the one below. `make
+  // check` prints the MB/s of each kernel on its own.
+  const char* levels[] = { "generic", "sse2", "avx2" };
+  printf("%zu files\n", files.size());
+  printf("kernels  ms        MPixels/s  MB/s out\n");
+  double pixels, bytes;
+  for (int level = 0; level < 3; level++)
+  {
+    stbi_set_jpeg_simd_level(level);
+    double best = timeDecodes(0, pixels, bytes);
+    printf("%-7s  %8.2f  %9.2f  %8.1f\n", levels[level], best * 1000.0, pixels / best / 1e6, bytes / best / 1e6);
+  }
+
+  // Large JPEGs split into tasks, the calling thread is one of the threads
+  {
+    ThreadPool pool;
+    double best;
+    {
+      StbiParallelForScope parallelFor(pool);
+      best = timeDecodes(0, pixels, bytes);
+    }
+    char label[16];
+    snprintf(label, sizeof(label), "%u thr", pool.size() + 1);
+    printf("%-7s  %8.2f  %9.2f  %8.1f\n", label, best * 1000.0, pixels / best / 1e6, bytes / best / 1e6);
+  }
+
+  // Reduced size decodes for previews and low mips, JPEGs skip the high
+  // frequencies and other formats are box filtered after a full decode
+  printf("scale    ms        MPixels/s  speedup\n");
+  double full = timeDecodes(0, pixels, bytes);
+  const char* scales[] = { "1/2", "1/4", "1/8" };
+  for (int scaleLog2 = 1; scaleLog2 <= 3; scaleLog2++)
+  {
+    double best = timeDecodes(scaleLog2, pixels, bytes);
+    printf("%-7s  %8.2f  %9.2f  %7.2fx\n", scales[scaleLog2 - 1], best * 1000.0, pixels / best / 1e6, full / best);
+  }
+
+  // Decoding into reused buffers, scratch and output only ever grow so
+  // after the first run no decode touches the heap; `make check` counts
+  // the allocations
+  printf("alloc    ms        MPixels/s\n");
+  full = timeDecodes(0, pixels, bytes);
+  printf("%-7s  %8.2f  %9.2f\n", "malloc", full * 1000.0, pixels / full / 1e6);
+  {
+    std::vector<unsigned char> output, scratch;
+    double best = 1e30;
+    for (int run = 0; run < 5; run++)
+    {
+      pixels = 0.0;
+      auto start = std::chrono::steady_clock::now();
+      for (const std::vector<unsigned char>& file : files)
+      {
+        int width, height, channels;
+        size_t outputBytes, scratchBytes;
+        if (!stbi_decode_sizes_from_memory(file.data(), (int)file.size(), 0, &width, &height, &channels, &outputBytes, &scratchBytes))
+          continue;
+        if (output.size() < outputBytes)
+          output.resize(outputBytes);
+        if (scratch.size() < scratchBytes)
+          scratch.resize(scratchBytes);
+        if (stbi_load_into_from_memory(file.data(), (int)file.size(), &width, &height, &channels, 0, output.data(), output.size(), scratch.data(), scratch.size()))
+          pixels += (double)width * height;
+      }
+      best = std::min(best, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    }
+    printf("%-7s  %8.2f  %9.2f\n", "arena", best * 1000.0, pixels / best / 1e6);
+  }
+  stbi_set_jpeg_simd_level(2);
+  return 0;
+}
+
+// Scan a directory into a manifest on a thread pool, then read the same
+// files one by one with stbi_info, and print both times and what texture
+// storage the manifest asks for
+int runScanBenchmark(const char* directory)
 {
+  ThreadPool pool;
+  auto start = std::chrono::steady_clock::now();
+  ImageManifest manifest = scanImageDirectory(directory, &pool);
+  double scanMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+  start = std::chrono::steady_clock::now();
+  size_t disagree = 0;
+  for (size_t i = 0; i < manifest.paths.size(); i++)
+  {
+    const ImageHeader& header = manifest.headers[i];
+    if (header.format == IMAGE_HTEX)
+      continue; // TextureFile's own container, stb_image cannot read it
+    int width, height, channels;
+    bool ok = stbi_info(manifest.paths[i].c_str(), &width, &height, &channels) && width > 0 && height > 0;
+    if (ok != (header.format != IMAGE_UNKNOWN) ||
+        (ok && ((uint32_t)width != header.width || (uint32_t)height != header.height || channels != header.channels)))
+    {
+      std::cout << "Header differs from stbi_info: " << manifest.paths[i] << std::endl;
+      disagree++;
+    }
+  }
+  double infoMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+  const char* formats[] = { "unknown", "jpeg", "png", "gif", "hdr", "htex", "other" };
+  size_t counts[7] = {};
+  double bytes = 0.0;
+  for (const ImageHeader& header : manifest.headers)
+  {
+    counts[header.format]++;
+    bytes += (double)header.width * header.height * header.channels * (header.bits / 8);
+  }
+  printf("%zu files, %zu images:", manifest.paths.size(), manifest.images());
+  for (int i = 1; i < 7; i++)
+    if (counts[i])
+      printf(" %zu %s", counts[i], formats[i]);
+  printf("\nmanifest %.2f ms on %u threads, stbi_info %.2f ms, %zu disagree\n", scanMs, pool.size() + 1, infoMs, disagree);
+  printf("%.1f MB of level 0 storage\n", bytes / 1e6);
+  return disagree == 0 ? 0 : -1;
+}
+
+int main(int argc, char** argv)
+{
+  Options options;
+  if (!parseOptions(argc, argv, options))
+    return -1;
+  if (options.bcBench)
+    return runCompressionBenchmark(options.bcBench);
+  if (!options.decodeBench.empty())
+    return runDecodeBenchmark(options.decodeBench);
+  if (options.scan)
+    return runScanBenchmark(options.scan);
+
   // Initialize GLFW 
+#ifdef GLFW_PLATFORM_NULL
+  // GLFW 3.4+ can run without any display server, with contexts from OSMesa
+  bool noDisplay = getenv("DISPLAY") == NULL && getenv("WAYLAND_DISPLAY") == NULL;
+  if (options.headless && noDisplay)
+    glfwInitHint(GLFW_PLATFORM, GLFW_PLATFORM_NULL);
+#endif
   glfwInit();
   glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
   glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
   glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
   glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+  if (options.headless)
+  {
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+#ifdef GLFW_PLATFORM_NULL
+    if (noDisplay)
+      glfwWindowHint(GLFW_CONTEXT_CREATION_API, GLFW_OSMESA_CONTEXT_API);
+#endif
+  }
 
   // Create GLFW window
-  GLFWwindow* window = glfwCreateWindow(800, 600, "LearnOpenGL", NULL, NULL);
+  GLFWwindow* window = glfwCreateWindow(options.width, options.height, "LearnOpenGL", NULL, NULL);
   if (window == NULL)
   {
     std::cout << "Failed to create GLFW window" << std::endl;
@@ -55,7 +569,7 @@ int main()
 
   // Tell OpenGL the size of the rendering window so OpenGL knows 
   // how we want to display the data and coordinates with respect to the window
-  glViewport(0, 0, 800, 600);
+  glViewport(0, 0, options.width, options.height);
 
   // Callback function if GLFW window is resized
   glfwSetWindowSizeCallback(window, framebuffer_size_callback);
@@ -64,8 +578,17 @@ int main()
   int numberOfVertexAttributes;
   glGetIntegerv(GL_MAX_VERTEX_ATTRIBS, &numberOfVertexAttributes);
   std::cout << "Maximum number of vertex attributes supported: " << numberOfVertexAttributes << std::endl;
-  
-  
+
+  int result = runScene(window, options);
+  glfwSetWindowUserPointer(window, NULL);
+
+  // Clean up GLFW resources
+  glfwTerminate();
+  return result;
+}
+
+int runScene(GLFWwindow* window, const Options& options)
+{
   //VVVVVVVVVVVVVVVVVVVVVVVVVVVVVVVVVVVVVVVVVV
   // Begin Shaders, Vertex Buffer Objects, Vertex Array Objects 
 
@@ -84,25 +607,29 @@ int main()
   };
 
   // VAO
-  unsigned int VAO;
-  glGenVertexArrays(1, &VAO);
+  GLVertexArray VAO = GLVertexArray::create();
   glBindVertexArray(VAO);
 
-  // Generate VBO 
-  unsigned int VBO;
-  glGenBuffers(1, &VBO);
+  // Generate the VBO and the EBO -- Element Array Buffer Object -- in one call
+  GLHandleArray<GLBufferTraits, 2> buffers = GLHandleArray<GLBufferTraits, 2>::create();
+  unsigned int VBO = buffers[0];
+  unsigned int EBO = buffers[1];
+
   glBindBuffer(GL_ARRAY_BUFFER, VBO);
   glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
 
-  // EBO -- Element Array Buffer Object
-  unsigned int EBO;
-  glGenBuffers(1, &EBO);
-
   glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
   glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
 
-  // Shader class 
-  Shader ourShader("../shaders/shader.vs", "../shaders/shader.fs");
+  // Shader class, linked programs are cached on disk between runs.
+  // The batch starts compiling now and is collected after the texture
+  // decodes are queued.
+  ProgramCache programCache("../cache");
+  ShaderBatch shaderBatch(&programCache);
+  ShaderFuture quadShader = shaderBatch.add("../shaders/shader.vs", "../shaders/shader.fs");
+  ShaderFuture instancedFuture = shaderBatch.add("../shaders/instanced.vs", "../shaders/shader.fs");
+  ShaderFuture spriteFuture = shaderBatch.add("../shaders/sprite.vs", "../shaders/sprite.fs");
+  shaderBatch.submit();
 
   // Linking Vertex Attributes
   // Position attributes 
@@ -176,98 +703,305 @@ int main()
   // TEXTURES &&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&
   // &&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&
 
-  unsigned int texture1; 
-  unsigned int texture2; 
-  glGenTextures(1, &texture1);
-  glBindTexture(GL_TEXTURE_2D, texture1);
-  // Set the texture wrapping / filtering options (on the currently bound texture) 
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-  // Load and generate the texture using the stb_image library 
-  int width, height, nrChannels;
-  std::string filePath = "../assets/container.jpg";
-  unsigned char *data = stbi_load(filePath.c_str(), &width, &height, &nrChannels, 0);
-
-  if (data)
-  {
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
-    glGenerateMipmap(GL_TEXTURE_2D);
-  }
-  else 
+  // Every per-frame state change goes through the cache so unchanged state
+  // never reaches the driver. The resize callback finds it through the
+  // window's user pointer, which main clears once the scene returns.
+  GLStateCache state;
+  glfwSetWindowUserPointer(window, &state);
+
+  // Scopes cost two clock reads each while profiling and nothing otherwise
+  Profiler profiler;
+  if (options.profile || options.trace)
   {
-    std::cout << "Failed to load texture" << std::endl;
+    Profiler::setEnabled(true);
+    profiler.setTracing(options.trace != NULL);
+    profiler.initGpu();
   }
-  // free the image memory
-  stbi_image_free(data);
 
-  glGenTextures(1, &texture2);
-  glBindTexture(GL_TEXTURE_2D, texture2);
-
-  // Set the texture wrapping / filtering options (on the currently bound texture) 
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-  filePath = "../assets/awesomeface.png";
-  stbi_set_flip_vertically_on_load(true);
-  data = stbi_load(filePath.c_str(), &width, &height, &nrChannels, 0);
-
-  if (data)
+  // Images decode on worker threads while the shaders compile. Both
+  // textures show a placeholder until the render loop uploads them, from
+  // pixel buffers the workers filled.
+  ThreadPool decodePool;
+  StbiParallelForScope parallelFor(decodePool);
+  std::unique_ptr<StagingRing> stagingRing;
+  if (options.staging)
+    stagingRing.reset(new StagingRing(state, 4 * 1024 * 1024, 4));
+  TextureLoader textureLoader(decodePool, state, stagingRing.get());
+  TextureParams textureParams;
+  textureParams.immutable = !options.driverMips;
+  textureParams.compress = options.compress;
+  textureParams.compressQuality = options.compressQuality;
+  // Baked containers already hold the flipped face and their own mip chain
+  unsigned int texture1, texture2;
+  if (options.stream && !options.baked)
   {
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
-    glGenerateMipmap(GL_TEXTURE_2D);
+    texture1 = textureLoader.loadStreamed("../assets/container.jpg", textureParams);
+    textureParams.flip = true;
+    texture2 = textureLoader.loadStreamed("../assets/awesomeface.png", textureParams);
   }
-  else 
+  else
   {
-    std::cout << "Failed to load texture" << std::endl;
+    texture1 = textureLoader.load(options.baked ? "../assets/container.htex" : "../assets/container.jpg", textureParams);
+    textureParams.flip = true;
+    texture2 = textureLoader.load(options.baked ? "../assets/awesomeface.htex" : "../assets/awesomeface.png", textureParams);
   }
-  // free the image memory
-  stbi_image_free(data);
 
   // Tell OpenGL which texture unit each shader sampler belongs to by setting each sampler using glUniform1i
   // Only have to set this once so we can do it before entering the render loop 
+  Shader ourShader = quadShader.get();
   ourShader.use();
   glUniform1i(glGetUniformLocation(ourShader.ID, "texture1"), 0);  // do it manually with gl
   ourShader.setInt("texture2", 1); // or with our shader class function 
 
-  // GLFW Render Loop!
-  while(!glfwWindowShouldClose(window))
+  // Per-object constants live in a uniform block fed from a ring buffer
+  const GLuint OBJECT_BINDING = 0;
+  ourShader.bindUniformBlock(fnv1a32("Object"), OBJECT_BINDING);
+
+  Shader instancedShader = instancedFuture.get();
+  instancedShader.use();
+  instancedShader.setInt("texture1", 0);
+  instancedShader.setInt("texture2", 1);
+
+  // Instanced quads reuse the quad's vertex and index buffers and add a
+  // per-instance x, y, angle, scale stream at location 3
+  GLVertexArray instanceVAO = GLVertexArray::create();
+  GLBuffer instanceVBO = GLBuffer::create();
+  glBindVertexArray(instanceVAO);
+  glBindBuffer(GL_ARRAY_BUFFER, VBO);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)0);
+  glEnableVertexAttribArray(0);
+  glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(3*sizeof(float)));
+  glEnableVertexAttribArray(1);
+  glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(6*sizeof(float)));
+  glEnableVertexAttribArray(2);
+  glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+  glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, InstanceArray::STRIDE * sizeof(float), (void*)0);
+  glEnableVertexAttribArray(3);
+  glVertexAttribDivisor(3, 1);
+  glBindVertexArray(0);
+
+  // Sprites are instanced quads too, each also reading an atlas region and
+  // layer at locations 4 and 5, so every image goes out in the same draw
+  const int ATLAS_UNIT = 2;
+  TextureAtlas atlas(state, 1024, 8);
+  Shader spriteShader = spriteFuture.get();
+  spriteShader.use();
+  spriteShader.setInt("atlas", ATLAS_UNIT);
+  GLVertexArray spriteVAO;
+  GLBuffer spriteRegionVBO;
+  if (options.sprites > 0)
+  {
+    int images = addSpriteImages(atlas);
+    if (images == 0 || !atlas.build())
+      return -1;
+    printf("Sprite atlas: %d images in %d layer(s) of 1024x1024 with %d mip levels, %.1f%% packed\n",
+           images, atlas.layers(), atlas.levels(), atlas.efficiency() * 100.0);
+    printf("%d sprites in 1 draw call, instead of %d texture binds and %d draws with a texture per image\n",
+           options.sprites, std::min(images, options.sprites), std::min(images, options.sprites));
+
+    spriteVAO = GLVertexArray::create();
+    spriteRegionVBO = GLBuffer::create();
+    glBindVertexArray(spriteVAO);
+    glBindBuffer(GL_ARRAY_BUFFER, VBO);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)0);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(6*sizeof(float)));
+    glEnableVertexAttribArray(2);
+    glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+    glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, InstanceArray::STRIDE * sizeof(float), (void*)0);
+    glEnableVertexAttribArray(3);
+    glVertexAttribDivisor(3, 1);
+    glBindBuffer(GL_ARRAY_BUFFER, spriteRegionVBO);
+    glVertexAttribPointer(4, 4, GL_FLOAT, GL_FALSE, sizeof(AtlasRegion), (void*)0);
+    glEnableVertexAttribArray(4);
+    glVertexAttribDivisor(4, 1);
+    glVertexAttribPointer(5, 1, GL_FLOAT, GL_FALSE, sizeof(AtlasRegion), (void*)(4*sizeof(float)));
+    glEnableVertexAttribArray(5);
+    glVertexAttribDivisor(5, 1);
+    glBindVertexArray(0);
+  }
+  // Sprite i shows image i modulo the image count
+  auto fillSpriteRegions = [&](size_t count)
   {
-    // input
-    processInput(window);
+    std::vector<AtlasRegion> regions(count);
+    for (size_t i = 0; i < count; i++)
+      regions[i] = atlas.region((int)(i % atlas.images()));
+    state.bindBuffer(GL_ARRAY_BUFFER, spriteRegionVBO);
+    glBufferData(GL_ARRAY_BUFFER, count * sizeof(AtlasRegion), regions.data(), GL_STATIC_DRAW);
+  };
+
+  InstanceArray instances;
+  instances.resize(options.sprites > 0 ? options.sprites : options.instances);
+  if (options.sprites > 0)
+    fillSpriteRegions(instances.size());
 
-    // Rendering commands here
+  UniformRing uniformRing(state, 64 * 1024);
+
+  // Rendering commands for one frame
+  auto renderFrame = [&](float time, float dt)
+  {
+    PROFILE_SCOPE("render");
+    GpuProfileScope gpuFrame(profiler, "frame");
+    textureLoader.update();
     glClearColor(0.2f, 0.3f, 0.3f, 1.0f);
     glClear(GL_COLOR_BUFFER_BIT);
-    glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+    state.polygonMode(GL_FILL);
+    state.bindTexture(0, GL_TEXTURE_2D, texture1);
+    state.bindTexture(1, GL_TEXTURE_2D, texture2);
+
+    if (options.sprites > 0)
+    {
+      spriteShader.use(state);
+      state.bindTexture(ATLAS_UNIT, GL_TEXTURE_2D_ARRAY, atlas.texture());
+      state.bindVertexArray(spriteVAO);
+      drawInstances(state, instanceVBO, instances, dt);
+      return;
+    }
+    if (instances.size() > 0)
+    {
+      instancedShader.use(state);
+      state.bindVertexArray(instanceVAO);
+      drawInstances(state, instanceVBO, instances, dt);
+      return;
+    }
 
-    // Custom color for fragmentShader
+    // Use the program 
+    ourShader.use(state);
+
+    // Write this frame's per-object constants once, then unmap before drawing
+    uniformRing.beginFrame();
     glm::mat4 trans = glm::mat4(1.0f);
     trans = glm::translate(trans, glm::vec3(0.5f, -0.5f, 0.0f));
-    trans = glm::rotate(trans, (float)glfwGetTime(), glm::vec3(0.0f, 0.0f, 1.0f));
-    unsigned int transformLoc = glGetUniformLocation(ourShader.ID, "transform");
-    glUniformMatrix4fv(transformLoc, 1, GL_FALSE, glm::value_ptr(trans));
+    trans = glm::rotate(trans, time, glm::vec3(0.0f, 0.0f, 1.0f));
+    UniformRing::Allocation object = uniformRing.push(trans);
+    uniformRing.flush();
+    uniformRing.bind(OBJECT_BINDING, object);
 
-    // Use the program 
-    // glUseProgram(shaderProgram);
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, texture1);
-    glActiveTexture(GL_TEXTURE1);
-    glBindTexture(GL_TEXTURE_2D, texture2);
-    glBindVertexArray(VAO);
+    state.bindVertexArray(VAO);
     glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+    uniformRing.endFrame();
+  };
 
-    // Check and call events and swap the buffers
-    glfwSwapBuffers(window);
-    glfwPollEvents();
+  // Headless runs draw into an offscreen framebuffer; the window is never
+  // shown and its buffers are never swapped
+  GLFramebuffer offscreen;
+  GLRenderbuffer offscreenColor;
+  if (options.headless)
+  {
+    offscreen = GLFramebuffer::create();
+    offscreenColor = GLRenderbuffer::create();
+    glBindRenderbuffer(GL_RENDERBUFFER, offscreenColor);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, options.width, options.height);
+    glBindFramebuffer(GL_FRAMEBUFFER, offscreen);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, offscreenColor);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+    {
+      std::cout << "Failed to create the offscreen framebuffer" << std::endl;
+      return -1;
+    }
+    state.viewport(0, 0, options.width, options.height);
   }
+  auto presentFrame = [&]()
+  {
+    if (options.headless)
+      glFlush();
+    else
+      glfwSwapBuffers(window);
+  };
 
-  // Clean up GLFW resources
-  glfwTerminate();
+  if (options.benchmark)
+  {
+    // Double the instance count each step, timing a fixed number of frames
+    // without vsync. glFinish bounds each step so queued work is not missed.
+    glfwSwapInterval(0);
+    textureLoader.finish();
+    std::cout << "instances  avg frame ms  Minstances/s" << std::endl;
+    for (int count = 1024; count <= options.maxInstances; count *= 2)
+    {
+      instances.resize(count);
+      if (options.sprites > 0)
+        fillSpriteRegions(count);
+      for (int i = 0; i < 10; i++)
+      {
+        renderFrame(0.0f, 0.016f);
+        presentFrame();
+      }
+      glFinish();
+      double start = glfwGetTime();
+      for (int i = 0; i < options.benchFrames; i++)
+      {
+        renderFrame(0.0f, 0.016f);
+        presentFrame();
+        glfwPollEvents();
+        profiler.endFrame();
+      }
+      glFinish();
+      double ms = (glfwGetTime() - start) * 1000.0 / options.benchFrames;
+      printf("%9d  %12.3f  %12.2f\n", count, ms, count / ms / 1000.0);
+    }
+    reportProfile(profiler, options);
+    return 0;
+  }
+
+  // GLFW Render Loop!
+  std::vector<double> frameStarts;
+  double lastTime = glfwGetTime();
+  while(!glfwWindowShouldClose(window))
+  {
+    {
+      PROFILE_SCOPE("frame");
+
+      // input
+      processInput(window);
+
+      // Rendering commands here
+      double time = glfwGetTime();
+      frameStarts.push_back(time);
+      renderFrame((float)time, (float)(time - lastTime));
+      lastTime = time;
+
+      // Check and call events and swap the buffers
+      PROFILE_SCOPE("present");
+      presentFrame();
+      glfwPollEvents();
+    }
+    profiler.endFrame();
+
+    if (options.frames > 0 && (int)frameStarts.size() >= options.frames)
+      break;
+  }
+
+  // Frame times are the gaps between frame starts, the last one ends once
+  // the GPU has drained
+  if (options.frames > 0 && !frameStarts.empty())
+  {
+    glFinish();
+    frameStarts.push_back(glfwGetTime());
+    std::vector<double> frameMs;
+    for (size_t i = 1; i < frameStarts.size(); i++)
+      frameMs.push_back((frameStarts[i] - frameStarts[i - 1]) * 1000.0);
+    printFrameStats(frameMs);
+  }
+
+  std::cout << "GL state calls issued: " << state.issued << ", filtered: " << state.filtered << std::endl;
+  reportProfile(profiler, options);
   return 0;
+}
 
+void reportProfile(Profiler& profiler, const Options& options)
+{
+  if (!Profiler::enabled())
+    return;
+  profiler.drain();
+  if (options.profile)
+    profiler.report(std::cout);
+  if (options.trace)
+  {
+    if (profiler.writeTrace(options.trace))
+      std::cout << "Wrote trace to " << options.trace << std::endl;
+    else
+      std::cout << "Failed to write trace " << options.trace << std::endl;
+  }
 }
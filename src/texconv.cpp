@@ -0,0 +1,111 @@
+// Bakes an image into a .htex container for TextureLoader, so the app maps
+// it at startup instead of decoding it.
+//
+//   texconv [--flip] [--mips] [--compress fast|high] input output
+#include "../include/BlockCompress.h"
+#include "../include/MipChain.h"
+#include "../include/TextureFile.h"
+#include "../include/stb_image.h"
+
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+int main(int argc, char **argv) {
+  bool flip = false;
+  bool mips = false;
+  bool compress = false;
+  BlockQuality quality = BLOCK_FAST;
+  const char *input = NULL;
+  const char *output = NULL;
+  bool valid = true;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--flip") == 0)
+      flip = true;
+    else if (strcmp(argv[i], "--mips") == 0)
+      mips = true;
+    else if (strcmp(argv[i], "--compress") == 0 && i + 1 < argc) {
+      compress = true;
+      const char *name = argv[++i];
+      if (strcmp(name, "high") == 0)
+        quality = BLOCK_HIGH;
+      else if (strcmp(name, "fast") == 0)
+        quality = BLOCK_FAST;
+      else
+        valid = false;
+    } else if (!input)
+      input = argv[i];
+    else if (!output)
+      output = argv[i];
+    else
+      input = NULL;
+  }
+  if (!valid || !input || !output) {
+    std::cout << "Usage: " << argv[0]
+              << " [--flip] [--mips] [--compress fast|high] input output"
+              << std::endl;
+    return 1;
+  }
+
+  int width, height, channels;
+  stbi_set_flip_vertically_on_load(flip);
+  unsigned char *pixels = stbi_load(input, &width, &height, &channels, 0);
+  if (!pixels) {
+    std::cout << "ERROR::TEXCONV::LOAD_FAILED " << input << ": "
+              << stbi_failure_reason() << std::endl;
+    return 1;
+  }
+
+  int levels = mips ? mipLevelCount(width, height) : 1;
+  std::vector<unsigned char> chain(
+      mipChainBytes(width, height, channels, levels));
+  memcpy(chain.data(), pixels, (size_t)width * height * channels);
+  stbi_image_free(pixels);
+  buildMipChain(chain.data(), width, height, channels, levels);
+
+  // Blocks need at least RGB, smaller images stay raw
+  compress = compress && channels >= 3;
+  BlockFormat format = blockFormatFor(channels);
+
+  TextureFileHeader header = {{'H', 'T', 'E', 'X'},
+                              TEXTURE_FILE_VERSION,
+                              (uint32_t)width,
+                              (uint32_t)height,
+                              (uint32_t)channels,
+                              TEXTURE_FILE_RAW,
+                              (uint32_t)levels,
+                              flip ? (uint32_t)TEXTURE_FILE_FLIPPED : 0u};
+  if (compress)
+    header.format = format == BLOCK_BC1 ? TEXTURE_FILE_BC1 : TEXTURE_FILE_BC3;
+
+  std::vector<TextureFileLevel> table(levels);
+  std::vector<unsigned char> payload;
+  uint64_t offset = sizeof(header) + sizeof(TextureFileLevel) * levels;
+  const unsigned char *level = chain.data();
+  for (int i = 0; i < levels; i++) {
+    int w = mipWidth(width, i), h = mipWidth(height, i);
+    size_t rawBytes = (size_t)w * h * channels;
+    size_t bytes = compress ? blockCompressedBytes(w, h, format) : rawBytes;
+    offset = (offset + TEXTURE_FILE_ALIGNMENT - 1) &
+             ~(uint64_t)(TEXTURE_FILE_ALIGNMENT - 1);
+    table[i] = TextureFileLevel{(uint32_t)w, (uint32_t)h, offset, bytes};
+
+    size_t at = payload.size();
+    payload.resize(at + bytes);
+    if (compress)
+      compressBlocks(level, w, h, channels, format, quality, &payload[at]);
+    else
+      memcpy(&payload[at], level, bytes);
+    level += rawBytes;
+    offset += bytes;
+  }
+
+  if (!writeTextureFile(output, header, table.data(), payload.data())) {
+    std::cout << "ERROR::TEXCONV::WRITE_FAILED " << output << std::endl;
+    return 1;
+  }
+  std::cout << output << ": " << width << "x" << height << "x" << channels
+            << ", " << levels << " levels, " << payload.size() << " bytes"
+            << std::endl;
+  return 0;
+}